@@ -0,0 +1,557 @@
+/***************************************************************************//**
+
+  @file         bench.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Benchmarks of the interpreter, on a set of standard workloads.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/*
+  Each run of a workload happens in a child process with a runtime of its own,
+  so that no run's memory use (or heap) is mistaken for another's.  The child
+  times the workload, and sends back what it measured through a pipe.
+ */
+typedef struct {
+  bool ok;
+  double seconds;
+  /**
+     @brief Values allocated while the workload was timed.
+   */
+  unsigned long allocs;
+  /**
+     @brief Peak resident memory of the child process, in kilobytes.
+   */
+  long max_rss;
+  char message[LISP_ERROR_SIZE];
+} bench_result;
+
+typedef struct bench_workload bench_workload;
+
+struct bench_workload {
+  const char *name;
+  /**
+     @brief Run the workload, timing only the work itself.
+     @returns false, with an error raised, if the workload failed.
+   */
+  bool (*run)(lisp_runtime *rt, const bench_workload *w, double *seconds);
+  /**
+     @brief Code evaluated before timing starts (to define functions).
+   */
+  const wchar_t *setup;
+  /**
+     @brief Code which is timed, evaluated iterations times.  Workloads which
+     generate their input use iterations as its size instead.
+   */
+  const wchar_t *code;
+  int iterations;
+  /**
+     @brief Operations (like function calls, or items of a list) that each
+     iteration performs.
+   */
+  unsigned long ops;
+};
+
+/**
+   @brief Workloads time out after this long, in case a change makes one loop.
+ */
+#define BENCH_TIMEOUT_MS (5 * 60 * 1000)
+
+static double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long bench_allocs(lisp_runtime *rt)
+{
+  unsigned long allocs = 0;
+  for (int i = 0; i < TP_COUNT; i++) {
+    allocs += rt->stats[i].allocs;
+  }
+  return allocs;
+}
+
+/**
+   @brief Parse the first expression of some code.
+   @returns NEW REFERENCE to the expression, or NULL with an error raised.
+ */
+static lisp_value *bench_parse_one(lisp_runtime *rt, const wchar_t *text)
+{
+  smb_ll *tokens = lisp_lex(rt, (wchar_t*)text);
+  smb_iter it = ll_get_iter(tokens);
+  lisp_value *code = lisp_parse(rt, &it);
+  ll_delete(tokens);
+  return code;
+}
+
+/**
+   @brief Evaluate a workload's code, after its setup.
+ */
+static bool bench_eval(lisp_runtime *rt, const bench_workload *w,
+                       double *seconds)
+{
+  lisp_scope *scope = lisp_create_globals(rt);
+  lisp_value *code, *rv = NULL;
+  double start;
+
+  lisp_set_timeout(rt, BENCH_TIMEOUT_MS);
+  rv = lisp_eval_string(rt, (wchar_t*)w->setup, scope);
+  lisp_decref(rt, rv);
+  code = bench_parse_one(rt, w->code);
+  if (rv == NULL || code == NULL) {
+    lisp_decref(rt, code);
+    lisp_scope_delete(rt, scope);
+    return false;
+  }
+
+  start = bench_now();
+  for (int i = 0; i < w->iterations && !rt->error; i++) {
+    rv = lisp_evaluate(rt, code, scope);
+    lisp_decref(rt, rv);
+  }
+  *seconds = bench_now() - start;
+
+  lisp_decref(rt, code);
+  lisp_scope_delete(rt, scope);
+  return !rt->error;
+}
+
+/*******************************************************************************
+                              Generated programs
+*******************************************************************************/
+
+typedef struct {
+  wchar_t *text;
+  size_t length;
+  size_t capacity;
+} bench_buffer;
+
+static void bench_append(bench_buffer *b, const wchar_t *format, ...)
+{
+  va_list va;
+  int n;
+
+  // There's no way to ask vswprintf() how long its output will be, so the
+  // buffer grows until the output fits.
+  for (;;) {
+    va_start(va, format);
+    n = vswprintf(b->text + b->length, b->capacity - b->length, format, va);
+    va_end(va);
+    if (n >= 0) {
+      b->length += n;
+      return;
+    }
+    b->capacity *= 2;
+    b->text = smb_renew(wchar_t, b->text, b->capacity);
+  }
+}
+
+/**
+   @brief Return a program of some number of forms, defining functions.
+ */
+static wchar_t *bench_program(int forms)
+{
+  bench_buffer b = {smb_new(wchar_t, 4096), 0, 4096};
+  for (int i = 0; i < forms; i++) {
+    bench_append(&b, L"(define f%d (lambda (a b)\n"
+                 L"  (if (< a b)\n"
+                 L"      (+ a %d (* b 2))\n"
+                 L"      (list \"item %d\" 'A b (- a 1) '(1 2 3)))))\n",
+                 i, i, i);
+  }
+  return b.text;
+}
+
+/**
+   @brief Return a session of some number of short forms, as typed at the REPL.
+ */
+static wchar_t *bench_session(int forms)
+{
+  bench_buffer b = {smb_new(wchar_t, 4096), 0, 4096};
+  for (int i = 0; i < forms; i++) {
+    switch (i % 3) {
+    case 0:
+      bench_append(&b, L"(define x%d %d)\n", i, i);
+      break;
+    case 1:
+      bench_append(&b, L"(+ x%d 1)\n", i - 1);
+      break;
+    default:
+      bench_append(&b, L"(length (list x%d \"two\" 3))\n", i - 2);
+      break;
+    }
+  }
+  // Like any script, the session ends by exiting, rather than with the end of
+  // its input.
+  bench_append(&b, L"(exit)\n");
+  return b.text;
+}
+
+/**
+   @brief Lex and parse a large generated program, without evaluating it.
+ */
+static bool bench_lex_parse(lisp_runtime *rt, const bench_workload *w,
+                            double *seconds)
+{
+  wchar_t *text = bench_program(w->iterations);
+  smb_ll *tokens;
+  smb_iter it;
+  double start;
+
+  start = bench_now();
+  tokens = lisp_lex(rt, text);
+  it = ll_get_iter(tokens);
+  while (it.has_next(&it)) {
+    lisp_decref(rt, lisp_parse(rt, &it));
+  }
+  *seconds = bench_now() - start;
+
+  ll_delete(tokens);
+  smb_free(text);
+  return !rt->error;
+}
+
+/**
+   @brief Feed a session through the REPL, from standard input to standard
+   output, just as it would be typed.
+ */
+static bool bench_repl(lisp_runtime *rt, const bench_workload *w,
+                       double *seconds)
+{
+  wchar_t *text = bench_session(w->iterations);
+  FILE *in = tmpfile();
+  int out = open("/dev/null", O_WRONLY);
+  double start;
+
+  if (in == NULL || out < 0 || fprintf(in, "%ls", text) < 0 ||
+      fflush(in) != 0) {
+    smb_free(text);
+    lisp_error(rt, "unable to create the session's input");
+    return false;
+  }
+  smb_free(text);
+  rewind(in);
+  dup2(fileno(in), STDIN_FILENO);
+  dup2(out, STDOUT_FILENO);
+
+  // The REPL reports errors on standard error and carries on, as it would
+  // for someone typing.
+  start = bench_now();
+  lisp_interact(rt, NULL, 0);
+  fflush(stdout);
+  *seconds = bench_now() - start;
+  return true;
+}
+
+/*******************************************************************************
+                                 The workloads
+*******************************************************************************/
+
+static const bench_workload bench_workloads[] = {
+  {
+    "fib", &bench_eval,
+    L"(define fib (lambda (n)"
+    L"  (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))",
+    L"(fib 24)",
+    1, 150049 // calls
+  },
+  {
+    "tak", &bench_eval,
+    L"(define tak (lambda (x y z)"
+    L"  (if (< y x)"
+    L"      (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))"
+    L"      z)))",
+    L"(tak 18 12 6)",
+    1, 63609 // calls
+  },
+  {
+    "ackermann", &bench_eval,
+    L"(define ack (lambda (m n)"
+    L"  (if (= m 0) (+ n 1)"
+    L"      (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1)))))))",
+    L"(ack 3 5)",
+    1, 42438 // calls
+  },
+  {
+    // Builds a list by consing, then walks it four times.
+    "list", &bench_eval,
+    L"(define build (lambda (n)"
+    L"  (fold (lambda (l x) (cons x l)) '() (lazy->list (lazy-range n)))))"
+    L"(define traverse (lambda (l)"
+    L"  (+ (length l) (fold + 0 (map (lambda (x) (+ x 1)) l))"
+    L"     (length (reverse l)))))",
+    L"(traverse (build 20000))",
+    10, 5 * 20000 // items visited
+  },
+  {
+    // Every call is live at the deepest point, so scopes are deep too.
+    "deep-recursion", &bench_eval,
+    L"(define count (lambda (n) (if (= n 0) 0 (+ 1 (count (- n 1))))))",
+    L"(count 3000)",
+    3, 3000 // calls
+  },
+  {
+    "lex-parse", &bench_lex_parse, NULL, NULL,
+    5000, 1 // forms
+  },
+  {
+    "repl", &bench_repl, NULL, NULL,
+    20000, 1 // forms
+  },
+};
+
+#define BENCH_COUNT (sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+/*******************************************************************************
+                                  The harness
+*******************************************************************************/
+
+static void bench_child(const bench_workload *w, int fd)
+{
+  lisp_runtime rt;
+  bench_result result;
+  struct rusage usage;
+  unsigned long allocs;
+
+  memset(&result, 0, sizeof(result));
+  lisp_runtime_init(&rt);
+  allocs = bench_allocs(&rt);
+  result.ok = w->run(&rt, w, &result.seconds);
+  result.allocs = bench_allocs(&rt) - allocs;
+  if (!result.ok) {
+    strncpy(result.message, rt.error ? rt.message : "unknown error",
+            LISP_ERROR_SIZE - 1);
+  }
+  lisp_runtime_destroy(&rt);
+  getrusage(RUSAGE_SELF, &usage);
+  result.max_rss = usage.ru_maxrss;
+  if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+    _exit(EXIT_FAILURE);
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+/**
+   @brief Run a workload once, in a child process.
+ */
+static bench_result bench_run(const bench_workload *w)
+{
+  bench_result result;
+  int fds[2], status;
+  pid_t pid;
+
+  memset(&result, 0, sizeof(result));
+  if (pipe(fds) != 0) {
+    strcpy(result.message, "unable to create a pipe");
+    return result;
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    bench_child(w, fds[1]);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    strcpy(result.message, "unable to fork");
+  } else if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+    result.ok = false;
+    strcpy(result.message, "the workload crashed");
+  }
+  close(fds[0]);
+  if (pid > 0) {
+    waitpid(pid, &status, 0);
+  }
+  return result;
+}
+
+typedef struct {
+  char name[64];
+  double seconds;
+} bench_baseline;
+
+/**
+   @brief Read the seconds of each workload from a file of earlier results.
+   @returns The number of workloads read, or -1 if the file can't be read.
+ */
+static int bench_read_baseline(const char *path, bench_baseline *base, int max)
+{
+  FILE *f = fopen(path, "r");
+  char line[256];
+  int n = 0;
+
+  if (f == NULL) {
+    return -1;
+  }
+  while (n < max && fgets(line, sizeof(line), f) != NULL) {
+    // The header's seconds aren't a number, so it's skipped.
+    if (sscanf(line, "%63s %lf", base[n].name, &base[n].seconds) == 2) {
+      n++;
+    }
+  }
+  fclose(f);
+  return n;
+}
+
+static const bench_workload *bench_find(const char *name)
+{
+  for (size_t i = 0; i < BENCH_COUNT; i++) {
+    if (strcmp(bench_workloads[i].name, name) == 0) {
+      return &bench_workloads[i];
+    }
+  }
+  return NULL;
+}
+
+static void usage(char *name)
+{
+  fprintf(stderr, "usage: %s [--repeat N] [--baseline FILE [--tolerance PCT]]"
+          "\n       [--save FILE] [WORKLOAD]...\n", name);
+  fprintf(stderr, "  --repeat N       run each workload N times, and keep the "
+          "fastest (default 3)\n");
+  fprintf(stderr, "  --baseline FILE  compare against results saved in FILE\n");
+  fprintf(stderr, "  --tolerance PCT  fail if a workload is more than PCT "
+          "percent slower\n");
+  fprintf(stderr, "  --save FILE      save the results to FILE, as a new "
+          "baseline\n");
+  fprintf(stderr, "workloads:");
+  for (size_t i = 0; i < BENCH_COUNT; i++) {
+    fprintf(stderr, " %s", bench_workloads[i].name);
+  }
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  bench_baseline base[BENCH_COUNT];
+  bench_result best, result;
+  const bench_workload *w;
+  char *baseline = NULL, *save = NULL, *end;
+  char **names = smb_new(char*, argc);
+  int nnames = 0, nbase = 0, repeat = 3, status = EXIT_SUCCESS;
+  double tolerance = -1, ops, change;
+  FILE *out = NULL;
+  bool selected;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || repeat <= 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+      baseline = argv[++i];
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = strtod(argv[++i], &end);
+      if (*end != '\0' || tolerance < 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+      save = argv[++i];
+    } else if (argv[i][0] != '-' && bench_find(argv[i]) != NULL) {
+      names[nnames++] = argv[i];
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  if (baseline != NULL) {
+    nbase = bench_read_baseline(baseline, base, BENCH_COUNT);
+    if (nbase < 0) {
+      fprintf(stderr, "error: unable to read baseline %s\n", baseline);
+      return EXIT_FAILURE;
+    }
+  }
+  if (save != NULL && (out = fopen(save, "w")) == NULL) {
+    fprintf(stderr, "error: unable to write %s\n", save);
+    return EXIT_FAILURE;
+  }
+
+  // Tab separated, with a header, so that results can be read by other
+  // programs (or a later run, as its baseline).
+  printf("workload\tseconds\tops\tops_per_sec\tmax_rss_kb\tallocs");
+  if (baseline != NULL) {
+    printf("\tbaseline_seconds\tchange");
+  }
+  printf("\n");
+  if (out != NULL) {
+    fprintf(out, "workload\tseconds\tops\tops_per_sec\tmax_rss_kb\tallocs\n");
+  }
+
+  for (size_t i = 0; i < BENCH_COUNT; i++) {
+    w = &bench_workloads[i];
+    selected = nnames == 0;
+    for (int j = 0; j < nnames; j++) {
+      selected = selected || strcmp(names[j], w->name) == 0;
+    }
+    if (!selected) {
+      continue;
+    }
+
+    best.ok = false;
+    for (int j = 0; j < repeat; j++) {
+      result = bench_run(w);
+      if (!result.ok) {
+        best = result;
+        break;
+      }
+      if (!best.ok || result.seconds < best.seconds) {
+        best = result;
+      }
+    }
+    if (!best.ok) {
+      fprintf(stderr, "error: %s: %s\n", w->name, best.message);
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    ops = (double)w->ops * w->iterations;
+    printf("%s\t%.4f\t%.0f\t%.0f\t%ld\t%lu", w->name, best.seconds, ops,
+           ops / best.seconds, best.max_rss, best.allocs);
+    if (out != NULL) {
+      fprintf(out, "%s\t%.4f\t%.0f\t%.0f\t%ld\t%lu\n", w->name, best.seconds,
+              ops, ops / best.seconds, best.max_rss, best.allocs);
+    }
+    for (int j = 0; j < nbase && baseline != NULL; j++) {
+      if (strcmp(base[j].name, w->name) == 0) {
+        change = 100 * (best.seconds / base[j].seconds - 1);
+        printf("\t%.4f\t%+.1f%%", base[j].seconds, change);
+        if (tolerance >= 0 && change > tolerance) {
+          status = EXIT_FAILURE;
+        }
+        break;
+      }
+    }
+    printf("\n");
+  }
+
+  if (out != NULL) {
+    fclose(out);
+  }
+  smb_free(names);
+  return status;
+}
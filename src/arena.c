@@ -0,0 +1,215 @@
+/***************************************************************************//**
+
+  @file         arena.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Bump allocation of short-lived values.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Size of the blocks the arena carves values out of.
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+/**
+   @brief Every value handed out by the arena is aligned to this many bytes.
+ */
+#define ARENA_ALIGN 16
+/**
+   @brief Largest allocation that is reused once it's freed.
+ */
+#define ARENA_REUSE_MAX (LISP_ARENA_CLASSES * ARENA_ALIGN)
+
+/**
+   @brief Epochs are numbered across all arenas, so they name an arena too.
+   They're kept in the bits of a value's flags above LISP_EPOCH_SHIFT.
+ */
+static unsigned int lisp_arena_epochs;
+#define ARENA_EPOCH_MASK ((1u << (32 - LISP_EPOCH_SHIFT)) - 1)
+
+static unsigned int lisp_arena_next_epoch(void)
+{
+  return __atomic_add_fetch(&lisp_arena_epochs, 1, __ATOMIC_RELAXED) &
+    ARENA_EPOCH_MASK;
+}
+
+struct lisp_arena_block {
+  struct lisp_arena_block *next;
+  size_t size;
+  size_t used;
+  char *data;
+};
+
+static lisp_arena_block *lisp_arena_block_create(size_t size)
+{
+  lisp_arena_block *block = smb_new(lisp_arena_block, 1);
+  // Over-allocate so that data can be aligned no matter what malloc gives us.
+  block->data = smb_new(char, size + ARENA_ALIGN);
+  block->size = size;
+  block->used = 0;
+  block->next = NULL;
+  return block;
+}
+
+static void lisp_arena_block_delete_all(lisp_arena_block *block)
+{
+  lisp_arena_block *next;
+  while (block) {
+    next = block->next;
+    smb_free(block->data);
+    smb_free(block);
+    block = next;
+  }
+}
+
+void lisp_arena_init(lisp_arena *arena, lisp_scope *scope)
+{
+  arena->blocks = lisp_arena_block_create(ARENA_BLOCK_SIZE);
+  arena->retired = NULL;
+  arena->live = 0;
+  arena->epoch = lisp_arena_next_epoch();
+  arena->scope = scope;
+  memset(arena->free, 0, sizeof(arena->free));
+}
+
+void lisp_arena_destroy(lisp_runtime *rt, lisp_arena *arena)
+{
+  if (rt->arena == arena) {
+    rt->arena = NULL;
+  }
+  lisp_arena_block_delete_all(arena->blocks);
+  lisp_arena_block_delete_all(arena->retired);
+}
+
+void *lisp_arena_alloc(lisp_arena *arena, size_t size)
+{
+  lisp_arena_block *block = arena->blocks;
+  uintptr_t base, start;
+  void *rv;
+  int c;
+
+  // Small sizes are rounded up to their class, so that whatever is freed can
+  // be handed out again for any size in that class.
+  if (size <= ARENA_REUSE_MAX) {
+    c = size == 0 ? 0 : (size - 1) / ARENA_ALIGN;
+    if (arena->free[c] != NULL) {
+      rv = arena->free[c];
+      arena->free[c] = *(void**)rv;
+      arena->live++;
+      return rv;
+    }
+    size = (c + 1) * ARENA_ALIGN;
+  }
+
+  base = (uintptr_t)(block->data + block->used);
+  start = (base + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+
+  if (start + size > (uintptr_t)(block->data + block->size)) {
+    // Oversized requests get a block all to themselves.
+    block = lisp_arena_block_create(size > ARENA_BLOCK_SIZE ?
+                                    size : ARENA_BLOCK_SIZE);
+    block->next = arena->blocks;
+    arena->blocks = block;
+    base = (uintptr_t)block->data;
+    start = (base + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+  }
+
+  block->used = (start - (uintptr_t)block->data) + size;
+  arena->live++;
+  return (void*)start;
+}
+
+bool lisp_arena_owns(lisp_arena *arena, lisp_value *lv)
+{
+  return lv->flags >> LISP_EPOCH_SHIFT == arena->epoch;
+}
+
+void lisp_arena_release(lisp_arena *arena, void *ptr, size_t size)
+{
+  int c;
+  arena->live--;
+  if (size <= ARENA_REUSE_MAX) {
+    c = size == 0 ? 0 : (size - 1) / ARENA_ALIGN;
+    *(void**)ptr = arena->free[c];
+    arena->free[c] = ptr;
+  }
+}
+
+void lisp_arena_begin(lisp_runtime *rt, lisp_arena *arena)
+{
+  rt->arena = arena;
+}
+
+void lisp_arena_end(lisp_runtime *rt, lisp_arena *arena)
+{
+  lisp_arena_block *block;
+
+  if (rt->arena == arena) {
+    rt->arena = NULL;
+  }
+  memset(arena->free, 0, sizeof(arena->free));
+  // Whatever is still alive belongs to an earlier evaluation from now on.
+  arena->epoch = lisp_arena_next_epoch();
+
+  if (arena->live != 0) {
+    // Something still points into the arena (a value escaped without being
+    // promoted).  It isn't safe to hand out this memory again, so keep it
+    // around until the arena is destroyed and start over with a fresh block.
+    block = arena->blocks;
+    while (block->next) {
+      block = block->next;
+    }
+    block->next = arena->retired;
+    arena->retired = arena->blocks;
+    arena->blocks = lisp_arena_block_create(ARENA_BLOCK_SIZE);
+    arena->live = 0;
+    return;
+  }
+
+  // Everything is dead, so all of the memory can be dropped at once.  Keep a
+  // single block to start the next evaluation with.
+  lisp_arena_block_delete_all(arena->blocks->next);
+  arena->blocks->next = NULL;
+  arena->blocks->used = 0;
+}
+
+lisp_value *lisp_promote(lisp_runtime *rt, lisp_value *lv)
+{
+  lisp_arena *saved;
+  lisp_value *rv;
+
+  if (lv == NULL) return NULL;
+  if (lisp_is_float(lv) || !(lv->flags & LISP_FLAG_ARENA)) {
+    lisp_incref(lv);
+    return lv;
+  }
+
+  // Copies must be allocated on the heap, not in the arena we're escaping.
+  saved = rt->arena;
+  rt->arena = NULL;
+  rv = lisp_copy(rt, lv, &lisp_promote);
+  rt->arena = saved;
+  return rv;
+}
+
+lisp_value *lisp_arena_escape(lisp_runtime *rt, lisp_scope *scope,
+                              lisp_value *lv)
+{
+  if (rt->arena != NULL && rt->arena->scope == scope) {
+    return lisp_promote(rt, lv);
+  }
+  lisp_incref(lv);
+  return lv;
+}
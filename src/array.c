@@ -0,0 +1,702 @@
+/***************************************************************************//**
+
+  @file         array.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Arrays of unboxed numbers, and SIMD kernels over them.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <string.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/*
+  On x86-64, kernels using AVX2 are compiled alongside the scalar ones, and used
+  whenever the CPU turns out to support them.  Building with -DLISP_NO_SIMD
+  leaves only the scalar kernels.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && __SIZEOF_LONG__ == 8 && \
+  !defined(LISP_NO_SIMD)
+#define LISP_AVX2 1
+#include <immintrin.h>
+#endif
+
+/*
+  Float arrays keep their doubles where the longs would go.
+ */
+typedef char lisp_array_needs_8_byte_longs[
+  sizeof(long) == sizeof(double) ? 1 : -1];
+
+/**
+   @brief The operations arrays are built on, in one implementation.
+
+   Integer arithmetic wraps around on overflow, as it does in SIMD registers.
+   Elementwise operations may write over either input.  The f versions are for
+   floats.
+ */
+typedef struct {
+  long (*sum)(const long *a, int n);
+  long (*dot)(const long *a, const long *b, int n);
+  long (*min)(const long *a, int n);
+  long (*max)(const long *a, int n);
+  void (*add)(long *out, const long *a, const long *b, int n);
+  void (*sub)(long *out, const long *a, const long *b, int n);
+  void (*mul)(long *out, const long *a, const long *b, int n);
+  double (*fsum)(const double *a, int n);
+  double (*fdot)(const double *a, const double *b, int n);
+  double (*fmin)(const double *a, int n);
+  double (*fmax)(const double *a, int n);
+  void (*fadd)(double *out, const double *a, const double *b, int n);
+  void (*fsub)(double *out, const double *a, const double *b, int n);
+  void (*fmul)(double *out, const double *a, const double *b, int n);
+} lisp_array_kernels;
+
+/*******************************************************************************
+                                Scalar kernels
+*******************************************************************************/
+
+// Arithmetic is done unsigned, where overflow is defined to wrap around.
+
+static long scalar_sum(const long *a, int n)
+{
+  unsigned long rv = 0;
+  for (int i = 0; i < n; i++) {
+    rv += (unsigned long)a[i];
+  }
+  return (long)rv;
+}
+
+static long scalar_dot(const long *a, const long *b, int n)
+{
+  unsigned long rv = 0;
+  for (int i = 0; i < n; i++) {
+    rv += (unsigned long)a[i] * (unsigned long)b[i];
+  }
+  return (long)rv;
+}
+
+static long scalar_min(const long *a, int n)
+{
+  long rv = a[0];
+  for (int i = 1; i < n; i++) {
+    rv = a[i] < rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static long scalar_max(const long *a, int n)
+{
+  long rv = a[0];
+  for (int i = 1; i < n; i++) {
+    rv = a[i] > rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static void scalar_add(long *out, const long *a, const long *b, int n)
+{
+  for (int i = 0; i < n; i++) {
+    out[i] = (long)((unsigned long)a[i] + (unsigned long)b[i]);
+  }
+}
+
+static void scalar_sub(long *out, const long *a, const long *b, int n)
+{
+  for (int i = 0; i < n; i++) {
+    out[i] = (long)((unsigned long)a[i] - (unsigned long)b[i]);
+  }
+}
+
+static void scalar_mul(long *out, const long *a, const long *b, int n)
+{
+  for (int i = 0; i < n; i++) {
+    out[i] = (long)((unsigned long)a[i] * (unsigned long)b[i]);
+  }
+}
+
+static double scalar_fsum(const double *a, int n)
+{
+  double rv = 0;
+  for (int i = 0; i < n; i++) {
+    rv += a[i];
+  }
+  return rv;
+}
+
+static double scalar_fdot(const double *a, const double *b, int n)
+{
+  double rv = 0;
+  for (int i = 0; i < n; i++) {
+    rv += a[i] * b[i];
+  }
+  return rv;
+}
+
+static double scalar_fmin(const double *a, int n)
+{
+  double rv = a[0];
+  for (int i = 1; i < n; i++) {
+    rv = a[i] < rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static double scalar_fmax(const double *a, int n)
+{
+  double rv = a[0];
+  for (int i = 1; i < n; i++) {
+    rv = a[i] > rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static void scalar_fadd(double *out, const double *a, const double *b, int n)
+{
+  for (int i = 0; i < n; i++) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+static void scalar_fsub(double *out, const double *a, const double *b, int n)
+{
+  for (int i = 0; i < n; i++) {
+    out[i] = a[i] - b[i];
+  }
+}
+
+static void scalar_fmul(double *out, const double *a, const double *b, int n)
+{
+  for (int i = 0; i < n; i++) {
+    out[i] = a[i] * b[i];
+  }
+}
+
+static const lisp_array_kernels scalar_kernels = {
+  .sum = &scalar_sum,
+  .dot = &scalar_dot,
+  .min = &scalar_min,
+  .max = &scalar_max,
+  .add = &scalar_add,
+  .sub = &scalar_sub,
+  .mul = &scalar_mul,
+  .fsum = &scalar_fsum,
+  .fdot = &scalar_fdot,
+  .fmin = &scalar_fmin,
+  .fmax = &scalar_fmax,
+  .fadd = &scalar_fadd,
+  .fsub = &scalar_fsub,
+  .fmul = &scalar_fmul
+};
+
+/*******************************************************************************
+                                 AVX2 kernels
+*******************************************************************************/
+
+#ifdef LISP_AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+#define LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define STORE(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+
+/**
+   @brief Multiply 64 bit lanes, keeping the low 64 bits of each product.
+
+   AVX2 only multiplies 32 bit halves, so the product is put together from the
+   low halves' product and the two cross products.  The high halves' product
+   only affects bits that are thrown away.
+ */
+static inline AVX2 __m256i avx2_mul64(__m256i a, __m256i b)
+{
+  __m256i lo = _mm256_mul_epu32(a, b);
+  __m256i cross = _mm256_add_epi64(
+    _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+    _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+static inline AVX2 unsigned long avx2_hsum(__m256i v)
+{
+  unsigned long lanes[4];
+  STORE(lanes, v);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static AVX2 long avx2_sum(const long *a, int n)
+{
+  // Two accumulators, so that each addition needn't wait on the last.
+  __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+  unsigned long rv;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_epi64(s0, LOAD(a + i));
+    s1 = _mm256_add_epi64(s1, LOAD(a + i + 4));
+  }
+  rv = avx2_hsum(_mm256_add_epi64(s0, s1));
+  for (; i < n; i++) {
+    rv += (unsigned long)a[i];
+  }
+  return (long)rv;
+}
+
+static AVX2 long avx2_dot(const long *a, const long *b, int n)
+{
+  __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+  unsigned long rv;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_epi64(s0, avx2_mul64(LOAD(a + i), LOAD(b + i)));
+    s1 = _mm256_add_epi64(s1, avx2_mul64(LOAD(a + i + 4), LOAD(b + i + 4)));
+  }
+  rv = avx2_hsum(_mm256_add_epi64(s0, s1));
+  for (; i < n; i++) {
+    rv += (unsigned long)a[i] * (unsigned long)b[i];
+  }
+  return (long)rv;
+}
+
+static AVX2 long avx2_min(const long *a, int n)
+{
+  __m256i m, x;
+  long lanes[4], rv;
+  int i;
+
+  if (n < 4) {
+    return scalar_min(a, n);
+  }
+  m = LOAD(a);
+  for (i = 4; i + 4 <= n; i += 4) {
+    x = LOAD(a + i);
+    m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(m, x));
+  }
+  STORE(lanes, m);
+  rv = scalar_min(lanes, 4);
+  for (; i < n; i++) {
+    rv = a[i] < rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static AVX2 long avx2_max(const long *a, int n)
+{
+  __m256i m, x;
+  long lanes[4], rv;
+  int i;
+
+  if (n < 4) {
+    return scalar_max(a, n);
+  }
+  m = LOAD(a);
+  for (i = 4; i + 4 <= n; i += 4) {
+    x = LOAD(a + i);
+    m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(x, m));
+  }
+  STORE(lanes, m);
+  rv = scalar_max(lanes, 4);
+  for (; i < n; i++) {
+    rv = a[i] > rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static AVX2 void avx2_add(long *out, const long *a, const long *b, int n)
+{
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    STORE(out + i, _mm256_add_epi64(LOAD(a + i), LOAD(b + i)));
+  }
+  scalar_add(out + i, a + i, b + i, n - i);
+}
+
+static AVX2 void avx2_sub(long *out, const long *a, const long *b, int n)
+{
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    STORE(out + i, _mm256_sub_epi64(LOAD(a + i), LOAD(b + i)));
+  }
+  scalar_sub(out + i, a + i, b + i, n - i);
+}
+
+static AVX2 void avx2_mul(long *out, const long *a, const long *b, int n)
+{
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    STORE(out + i, avx2_mul64(LOAD(a + i), LOAD(b + i)));
+  }
+  scalar_mul(out + i, a + i, b + i, n - i);
+}
+
+#define FLOAD(p) _mm256_loadu_pd(p)
+#define FSTORE(p, v) _mm256_storeu_pd((p), (v))
+
+static inline AVX2 double avx2_fhsum(__m256d v)
+{
+  double lanes[4];
+  FSTORE(lanes, v);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static AVX2 double avx2_fsum(const double *a, int n)
+{
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  double rv;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_pd(s0, FLOAD(a + i));
+    s1 = _mm256_add_pd(s1, FLOAD(a + i + 4));
+  }
+  rv = avx2_fhsum(_mm256_add_pd(s0, s1));
+  for (; i < n; i++) {
+    rv += a[i];
+  }
+  return rv;
+}
+
+static AVX2 double avx2_fdot(const double *a, const double *b, int n)
+{
+  // Multiplying and adding separately (rather than with FMA) rounds the same
+  // way the scalar kernel does for each product.
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  double rv;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(FLOAD(a + i), FLOAD(b + i)));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(FLOAD(a + i + 4), FLOAD(b + i + 4)));
+  }
+  rv = avx2_fhsum(_mm256_add_pd(s0, s1));
+  for (; i < n; i++) {
+    rv += a[i] * b[i];
+  }
+  return rv;
+}
+
+static AVX2 double avx2_fmin(const double *a, int n)
+{
+  __m256d m;
+  double lanes[4], rv;
+  int i;
+
+  if (n < 4) {
+    return scalar_fmin(a, n);
+  }
+  // With the new items first, min_pd keeps the old lane unless the new item
+  // is smaller, like the scalar kernel.
+  m = FLOAD(a);
+  for (i = 4; i + 4 <= n; i += 4) {
+    m = _mm256_min_pd(FLOAD(a + i), m);
+  }
+  FSTORE(lanes, m);
+  rv = scalar_fmin(lanes, 4);
+  for (; i < n; i++) {
+    rv = a[i] < rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static AVX2 double avx2_fmax(const double *a, int n)
+{
+  __m256d m;
+  double lanes[4], rv;
+  int i;
+
+  if (n < 4) {
+    return scalar_fmax(a, n);
+  }
+  m = FLOAD(a);
+  for (i = 4; i + 4 <= n; i += 4) {
+    m = _mm256_max_pd(FLOAD(a + i), m);
+  }
+  FSTORE(lanes, m);
+  rv = scalar_fmax(lanes, 4);
+  for (; i < n; i++) {
+    rv = a[i] > rv ? a[i] : rv;
+  }
+  return rv;
+}
+
+static AVX2 void avx2_fadd(double *out, const double *a, const double *b,
+                           int n)
+{
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    FSTORE(out + i, _mm256_add_pd(FLOAD(a + i), FLOAD(b + i)));
+  }
+  scalar_fadd(out + i, a + i, b + i, n - i);
+}
+
+static AVX2 void avx2_fsub(double *out, const double *a, const double *b,
+                           int n)
+{
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    FSTORE(out + i, _mm256_sub_pd(FLOAD(a + i), FLOAD(b + i)));
+  }
+  scalar_fsub(out + i, a + i, b + i, n - i);
+}
+
+static AVX2 void avx2_fmul(double *out, const double *a, const double *b,
+                           int n)
+{
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    FSTORE(out + i, _mm256_mul_pd(FLOAD(a + i), FLOAD(b + i)));
+  }
+  scalar_fmul(out + i, a + i, b + i, n - i);
+}
+
+static const lisp_array_kernels avx2_kernels = {
+  .sum = &avx2_sum,
+  .dot = &avx2_dot,
+  .min = &avx2_min,
+  .max = &avx2_max,
+  .add = &avx2_add,
+  .sub = &avx2_sub,
+  .mul = &avx2_mul,
+  .fsum = &avx2_fsum,
+  .fdot = &avx2_fdot,
+  .fmin = &avx2_fmin,
+  .fmax = &avx2_fmax,
+  .fadd = &avx2_fadd,
+  .fsub = &avx2_fsub,
+  .fmul = &avx2_fmul
+};
+
+#endif // LISP_AVX2
+
+/**
+   @brief Return the fastest kernels this CPU can run.
+ */
+static const lisp_array_kernels *kernels(void)
+{
+#ifdef LISP_AVX2
+  // This only reads what libgcc found out about the CPU at startup.
+  if (__builtin_cpu_supports("avx2")) {
+    return &avx2_kernels;
+  }
+#endif
+  return &scalar_kernels;
+}
+
+/*******************************************************************************
+                                  Arrays
+*******************************************************************************/
+
+lisp_array *lisp_array_create(lisp_runtime *rt, int length, bool is_float)
+{
+  lisp_array *rv = (lisp_array*)lisp_alloc(rt, &tp_array, sizeof(lisp_array) +
+                                           length * sizeof(long));
+  if (rv == NULL) return NULL;
+  rv->length = length;
+  rv->is_float = is_float;
+  return rv;
+}
+
+lisp_array *lisp_array_from_list(lisp_runtime *rt, lisp_value *list)
+{
+  lisp_array *rv;
+  lisp_list_iter it;
+  lisp_value *item;
+  double *floats;
+  bool is_float = false;
+  int i = 0;
+
+  // Check the items first, since a single float makes it an array of floats.
+  lisp_list_iter_init(&it, list);
+  while ((item = lisp_list_iter_next(&it)) != NULL) {
+    if (lisp_is_float(item)) {
+      is_float = true;
+    } else if (item->type != &tp_int) {
+      lisp_error(rt, "array: item %d: expected type int or float, got type %s",
+                 i, item->type->tp_name);
+      return NULL;
+    }
+    i++;
+  }
+
+  rv = lisp_array_create(rt, i, is_float);
+  if (rv == NULL) return NULL;
+  floats = lisp_array_floats(rv);
+  i = 0;
+  lisp_list_iter_init(&it, list);
+  while ((item = lisp_list_iter_next(&it)) != NULL) {
+    if (!is_float) {
+      rv->items[i] = ((lisp_int*)item)->value;
+    } else if (lisp_is_float(item)) {
+      floats[i] = lisp_float_value(item);
+    } else {
+      floats[i] = (double)((lisp_int*)item)->value;
+    }
+    i++;
+  }
+  return rv;
+}
+
+long lisp_array_sum(lisp_array *a)
+{
+  return kernels()->sum(a->items, a->length);
+}
+
+long lisp_array_dot(lisp_array *a, lisp_array *b)
+{
+  return kernels()->dot(a->items, b->items, a->length);
+}
+
+long lisp_array_min(lisp_array *a)
+{
+  return kernels()->min(a->items, a->length);
+}
+
+long lisp_array_max(lisp_array *a)
+{
+  return kernels()->max(a->items, a->length);
+}
+
+double lisp_array_fsum(lisp_array *a)
+{
+  return kernels()->fsum(lisp_array_floats(a), a->length);
+}
+
+double lisp_array_fdot(lisp_array *a, lisp_array *b)
+{
+  return kernels()->fdot(lisp_array_floats(a), lisp_array_floats(b),
+                         a->length);
+}
+
+double lisp_array_fmin(lisp_array *a)
+{
+  return kernels()->fmin(lisp_array_floats(a), a->length);
+}
+
+double lisp_array_fmax(lisp_array *a)
+{
+  return kernels()->fmax(lisp_array_floats(a), a->length);
+}
+
+/**
+   @brief Fill in the result of lisp_array_combine() for an array of floats.
+ */
+static void combine_floats(const lisp_array_kernels *k, char op,
+                           lisp_array *rv, lisp_array *a, lisp_value *b)
+{
+  double *out = lisp_array_floats(rv);
+  const double *other;
+  double x;
+
+  if (lisp_type_of(b) == &tp_array) {
+    other = lisp_array_floats((lisp_array*)b);
+  } else {
+    x = lisp_is_float(b) ? lisp_float_value(b) : (double)((lisp_int*)b)->value;
+    for (int i = 0; i < a->length; i++) {
+      out[i] = x;
+    }
+    other = out;
+  }
+
+  switch (op) {
+  case '+':
+    k->fadd(out, lisp_array_floats(a), other, a->length);
+    break;
+  case '-':
+    k->fsub(out, lisp_array_floats(a), other, a->length);
+    break;
+  default:
+    k->fmul(out, lisp_array_floats(a), other, a->length);
+    break;
+  }
+}
+
+lisp_array *lisp_array_combine(lisp_runtime *rt, char op, lisp_array *a,
+                               lisp_value *b)
+{
+  const lisp_array_kernels *k = kernels();
+  lisp_array *rv = lisp_array_create(rt, a->length, a->is_float);
+  const long *other;
+
+  if (rv == NULL) {
+    return NULL;
+  } else if (a->is_float) {
+    combine_floats(k, op, rv, a, b);
+    return rv;
+  } else if (b->type == &tp_array) {
+    other = ((lisp_array*)b)->items;
+  } else {
+    // Filling the result with the integer first lets the same kernels do the
+    // work, at the cost of one more pass over memory.
+    for (int i = 0; i < a->length; i++) {
+      rv->items[i] = ((lisp_int*)b)->value;
+    }
+    other = rv->items;
+  }
+
+  switch (op) {
+  case '+':
+    k->add(rv->items, a->items, other, a->length);
+    break;
+  case '-':
+    k->sub(rv->items, a->items, other, a->length);
+    break;
+  default:
+    k->mul(rv->items, a->items, other, a->length);
+    break;
+  }
+  return rv;
+}
+
+static lisp_value *lisp_array_alloc(lisp_runtime *rt)
+{
+  return (lisp_value*)lisp_array_create(rt, 0, false);
+}
+
+static void lisp_array_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_array *a = (lisp_array*)value;
+  lisp_free(rt, value, sizeof(lisp_array) + a->length * sizeof(long));
+}
+
+static void lisp_array_print(lisp_value *value, FILE *f, int indent)
+{
+  lisp_array *a = (lisp_array*)value;
+
+  fprintf(f, "#array(\n");
+  for (int i = 0; i < a->length; i++) {
+    if (a->is_float) {
+      fprintf(f, "%*s", indent + 1, "");
+      tp_float.tp_print(lisp_float(lisp_array_floats(a)[i]), f, indent + 1);
+    } else {
+      fprintf(f, "%*s%ld\n", indent + 1, "", a->items[i]);
+    }
+  }
+  fprintf(f, "%*s)\n", indent, "");
+}
+
+static lisp_value *lisp_array_copy(lisp_runtime *rt, lisp_value *value,
+                                   lisp_value *(*child)(lisp_runtime *,
+                                                        lisp_value *))
+{
+  (void)child; // unused
+  lisp_array *a = (lisp_array*)value;
+  lisp_array *rv = lisp_array_create(rt, a->length, a->is_float);
+  if (rv == NULL) return NULL;
+  memcpy(rv->items, a->items, a->length * sizeof(long));
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_array = {
+  .tp_name = "array",
+  .tp_index = TP_ARRAY,
+  .tp_alloc = &lisp_array_alloc,
+  .tp_dealloc = &lisp_array_dealloc,
+  .tp_print = &lisp_array_print,
+  .tp_copy = &lisp_array_copy
+};
@@ -0,0 +1,940 @@
+/***************************************************************************//**
+
+  @file         bignum.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Integers too big for a long, and arithmetic on them.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Length (in limbs) from which multiplication uses Karatsuba.
+ */
+#define KARATSUBA_THRESHOLD 32
+/**
+   @brief Length (in limbs) from which division uses a Newton reciprocal.
+ */
+#define NEWTON_THRESHOLD 64
+/**
+   @brief Length (in limbs) from which decimal conversion divides and conquers.
+ */
+#define DECIMAL_THRESHOLD 32
+
+#define BILLION 1000000000u
+#define LONG_LIMBS ((int)(sizeof(unsigned long) / sizeof(uint32_t)))
+
+/**
+   @brief An unsigned number (a magnitude), least significant limb first.
+
+   Limbs are 32 bits, so that a product of two fits in a uint64_t.  Normalized
+   numbers have no leading zero limbs, and zero has no limbs at all.
+ */
+typedef struct {
+  int length;
+  uint32_t *d;
+} nat;
+
+/*******************************************************************************
+                                 Limb arrays
+*******************************************************************************/
+
+/**
+   @brief r = a + b, where an >= bn.  r has room for an limbs.
+   @returns The carry out of the top limb.
+ */
+static uint32_t add_raw(uint32_t *r, const uint32_t *a, int an,
+                        const uint32_t *b, int bn)
+{
+  uint64_t t = 0;
+  int i;
+  for (i = 0; i < bn; i++) {
+    t += (uint64_t)a[i] + b[i];
+    r[i] = (uint32_t)t;
+    t >>= 32;
+  }
+  for (; i < an; i++) {
+    t += a[i];
+    r[i] = (uint32_t)t;
+    t >>= 32;
+  }
+  return (uint32_t)t;
+}
+
+/**
+   @brief r = a - b, where an >= bn.  r has room for an limbs.
+   @returns The borrow out of the top limb, which is 0 if a >= b.
+ */
+static uint32_t sub_raw(uint32_t *r, const uint32_t *a, int an,
+                        const uint32_t *b, int bn)
+{
+  uint32_t borrow = 0;
+  uint64_t t;
+  int i;
+  for (i = 0; i < bn; i++) {
+    t = (uint64_t)a[i] - b[i] - borrow;
+    r[i] = (uint32_t)t;
+    borrow = (uint32_t)(t >> 63);
+  }
+  for (; i < an; i++) {
+    t = (uint64_t)a[i] - borrow;
+    r[i] = (uint32_t)t;
+    borrow = (uint32_t)(t >> 63);
+  }
+  return borrow;
+}
+
+static void mul_basecase(uint32_t *r, const uint32_t *a, int an,
+                         const uint32_t *b, int bn)
+{
+  uint64_t carry;
+
+  memset(r, 0, (an + bn) * sizeof(uint32_t));
+  for (int i = 0; i < bn; i++) {
+    if (b[i] == 0) {
+      continue;
+    }
+    carry = 0;
+    for (int j = 0; j < an; j++) {
+      carry += (uint64_t)a[j] * b[i] + r[i + j];
+      r[i + j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    r[i + an] = (uint32_t)carry;
+  }
+}
+
+/**
+   @brief r = a * b, where an >= bn.  r has room for an + bn limbs.
+
+   Karatsuba multiplication splits each number in half, and gets by with three
+   half sized products instead of four: with a = a1 B^k + a0 and b = b1 B^k +
+   b0, the middle term a1 b0 + a0 b1 is (a0 + a1)(b0 + b1) - a0 b0 - a1 b1.
+ */
+static void mul_raw(uint32_t *r, const uint32_t *a, int an,
+                    const uint32_t *b, int bn)
+{
+  int k = (an + 1) / 2, a1n, b1n, zn, len;
+  uint32_t *sa, *sb, *z1, *t;
+
+  if (bn < KARATSUBA_THRESHOLD) {
+    mul_basecase(r, a, an, b, bn);
+    return;
+  }
+
+  if (bn <= k) {
+    // Too lopsided to split both in half, so multiply b by bn sized pieces of
+    // a instead.  No sum of pieces can carry past the top of the product.
+    t = smb_new(uint32_t, 2 * bn);
+    memset(r, 0, (an + bn) * sizeof(uint32_t));
+    for (int i = 0; i < an; i += bn) {
+      len = an - i < bn ? an - i : bn;
+      if (len == bn) {
+        mul_raw(t, a + i, len, b, bn);
+      } else {
+        mul_raw(t, b, bn, a + i, len);
+      }
+      add_raw(r + i, r + i, len + bn, t, len + bn);
+    }
+    smb_free(t);
+    return;
+  }
+
+  a1n = an - k;
+  b1n = bn - k;
+  sa = smb_new(uint32_t, k + 1);
+  sb = smb_new(uint32_t, k + 1);
+  z1 = smb_new(uint32_t, 2 * k + 2);
+  sa[k] = add_raw(sa, a, k, a + k, a1n);
+  sb[k] = add_raw(sb, b, k, b + k, b1n);
+  mul_raw(r, a, k, b, k);
+  mul_raw(r + 2 * k, a + k, a1n, b + k, b1n);
+  mul_raw(z1, sa, k + 1, sb, k + 1);
+  sub_raw(z1, z1, 2 * k + 2, r, 2 * k);
+  sub_raw(z1, z1, 2 * k + 2, r + 2 * k, a1n + b1n);
+  // The middle term's top limbs are zero, past where the product ends.
+  zn = 2 * k + 2;
+  while (zn > 0 && z1[zn - 1] == 0) {
+    zn--;
+  }
+  add_raw(r + k, r + k, an + bn - k, z1, zn);
+  smb_free(sa);
+  smb_free(sb);
+  smb_free(z1);
+}
+
+static int leading_zeros(uint32_t x)
+{
+  int n = 0;
+  while (!(x & 0x80000000u)) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+}
+
+/**
+   @brief q = a / b and r = a % b, where an >= bn >= 1 and b's top limb isn't
+   zero.  q has room for an - bn + 1 limbs, and r for bn.
+
+   This is Knuth's algorithm D, as written in Hacker's Delight.  Both numbers
+   are shifted so that b's top bit is set, which makes each guess at a
+   quotient limb (from the top two limbs of what's left) at most two too big.
+ */
+static void divmod_basecase(uint32_t *q, uint32_t *r, const uint32_t *a,
+                            int an, const uint32_t *b, int bn)
+{
+  const uint64_t base = (uint64_t)1 << 32;
+  uint64_t num, qhat, rhat, p;
+  int64_t t, k;
+  uint32_t *un, *vn;
+  int s;
+
+  if (bn == 1) {
+    num = 0;
+    for (int j = an - 1; j >= 0; j--) {
+      num = (num << 32) | a[j];
+      q[j] = (uint32_t)(num / b[0]);
+      num %= b[0];
+    }
+    r[0] = (uint32_t)num;
+    return;
+  }
+
+  s = leading_zeros(b[bn - 1]);
+  vn = smb_new(uint32_t, bn);
+  un = smb_new(uint32_t, an + 1);
+  for (int i = bn - 1; i > 0; i--) {
+    vn[i] = (b[i] << s) | (uint32_t)((uint64_t)b[i - 1] >> (32 - s));
+  }
+  vn[0] = b[0] << s;
+  un[an] = (uint32_t)((uint64_t)a[an - 1] >> (32 - s));
+  for (int i = an - 1; i > 0; i--) {
+    un[i] = (a[i] << s) | (uint32_t)((uint64_t)a[i - 1] >> (32 - s));
+  }
+  un[0] = a[0] << s;
+
+  for (int j = an - bn; j >= 0; j--) {
+    num = ((uint64_t)un[j + bn] << 32) + un[j + bn - 1];
+    qhat = num / vn[bn - 1];
+    rhat = num % vn[bn - 1];
+    while (qhat >= base ||
+           qhat * vn[bn - 2] > ((rhat << 32) + un[j + bn - 2])) {
+      qhat--;
+      rhat += vn[bn - 1];
+      if (rhat >= base) {
+        break;
+      }
+    }
+
+    // Subtract qhat times b, and add b back if that went negative.
+    k = 0;
+    for (int i = 0; i < bn; i++) {
+      p = qhat * vn[i];
+      t = (int64_t)un[i + j] - k - (int64_t)(p & 0xffffffffu);
+      un[i + j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j + bn] - k;
+    un[j + bn] = (uint32_t)t;
+    q[j] = (uint32_t)qhat;
+    if (t < 0) {
+      q[j]--;
+      p = 0;
+      for (int i = 0; i < bn; i++) {
+        p += (uint64_t)un[i + j] + vn[i];
+        un[i + j] = (uint32_t)p;
+        p >>= 32;
+      }
+      un[j + bn] += (uint32_t)p;
+    }
+  }
+
+  for (int i = 0; i < bn - 1; i++) {
+    r[i] = (un[i] >> s) | (uint32_t)((uint64_t)un[i + 1] << (32 - s));
+  }
+  r[bn - 1] = un[bn - 1] >> s;
+  smb_free(un);
+  smb_free(vn);
+}
+
+/*******************************************************************************
+                                 Magnitudes
+*******************************************************************************/
+
+static nat nat_alloc(int length)
+{
+  nat n;
+  n.length = length;
+  n.d = smb_new(uint32_t, length > 0 ? length : 1);
+  memset(n.d, 0, (length > 0 ? length : 1) * sizeof(uint32_t));
+  return n;
+}
+
+static void nat_trim(nat *n)
+{
+  while (n->length > 0 && n->d[n->length - 1] == 0) {
+    n->length--;
+  }
+}
+
+static nat nat_copy(const uint32_t *d, int length)
+{
+  nat n = nat_alloc(length);
+  memcpy(n.d, d, length * sizeof(uint32_t));
+  return n;
+}
+
+static nat nat_small(uint32_t x)
+{
+  nat n = nat_alloc(1);
+  n.d[0] = x;
+  nat_trim(&n);
+  return n;
+}
+
+/**
+   @brief Return B^s, where B = 2^32 is the base of a limb.
+ */
+static nat nat_power(int s)
+{
+  nat n = nat_alloc(s + 1);
+  n.d[s] = 1;
+  return n;
+}
+
+static int nat_cmp(nat a, nat b)
+{
+  if (a.length != b.length) {
+    return a.length < b.length ? -1 : 1;
+  }
+  for (int i = a.length - 1; i >= 0; i--) {
+    if (a.d[i] != b.d[i]) {
+      return a.d[i] < b.d[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+static nat nat_add(nat a, nat b)
+{
+  nat r, t;
+  if (a.length < b.length) {
+    t = a;
+    a = b;
+    b = t;
+  }
+  r = nat_alloc(a.length + 1);
+  r.d[a.length] = add_raw(r.d, a.d, a.length, b.d, b.length);
+  nat_trim(&r);
+  return r;
+}
+
+/**
+   @brief Return a - b, where a >= b.
+ */
+static nat nat_sub(nat a, nat b)
+{
+  nat r = nat_alloc(a.length);
+  sub_raw(r.d, a.d, a.length, b.d, b.length);
+  nat_trim(&r);
+  return r;
+}
+
+static nat nat_mul(nat a, nat b)
+{
+  nat r, t;
+  if (a.length == 0 || b.length == 0) {
+    return nat_alloc(0);
+  }
+  if (a.length < b.length) {
+    t = a;
+    a = b;
+    b = t;
+  }
+  r = nat_alloc(a.length + b.length);
+  mul_raw(r.d, a.d, a.length, b.d, b.length);
+  nat_trim(&r);
+  return r;
+}
+
+/**
+   @brief Return a / B^k, rounded down.
+ */
+static nat nat_shift_down(nat a, int k)
+{
+  return k >= a.length ? nat_alloc(0) : nat_copy(a.d + k, a.length - k);
+}
+
+/**
+   @brief Return a * B^k.
+ */
+static nat nat_shift_up(nat a, int k)
+{
+  nat r;
+  if (a.length == 0) {
+    return nat_alloc(0);
+  }
+  r = nat_alloc(a.length + k);
+  memcpy(r.d + k, a.d, a.length * sizeof(uint32_t));
+  return r;
+}
+
+/**
+   @brief Replace *n with *n + x or *n - x, freeing the old value.
+ */
+static void nat_step(nat *n, nat x, bool add)
+{
+  nat old = *n;
+  *n = add ? nat_add(old, x) : nat_sub(old, x);
+  smb_free(old.d);
+}
+
+/**
+   @brief Return roughly B^s / b, where b has n limbs and s >= n.  The result
+   is within a few units of the true (rounded down) value.
+
+   Newton's method improves an estimate x of B^s / b to
+   x + x (B^s - b x) / B^s, doubling the number of correct limbs.  So the
+   estimate comes from doing the same at half the precision, with only the
+   top limbs of b, and one step at full precision finishes the job.  All the
+   multiplications are Karatsuba ones, and their sizes halve at each level, so
+   the whole thing costs a few multiplications of the result's size.
+ */
+static nat nat_reciprocal(nat b, int s)
+{
+  int n = b.length, p = s - n, h, j;
+  nat q, r, bt, y, x, bx, power, e, t, d;
+
+  if (p < NEWTON_THRESHOLD) {
+    power = nat_power(s);
+    q = nat_alloc(p + 2);
+    r = nat_alloc(n);
+    divmod_basecase(q.d, r.d, power.d, s + 1, b.d, n);
+    nat_trim(&q);
+    smb_free(power.d);
+    smb_free(r.d);
+    return q;
+  }
+
+  // B^s / b is about B^(p - h) times B^(n' + h) / b', where b' is the top
+  // n' = h + 1 limbs of b.  That is correct to about h limbs.
+  h = p / 2 + 1;
+  j = n > h + 1 ? n - (h + 1) : 0;
+  bt = nat_shift_down(b, j);
+  y = nat_reciprocal(bt, bt.length + h);
+  x = nat_shift_up(y, p - h);
+  smb_free(bt.d);
+  smb_free(y.d);
+
+  // The estimate may be too big, in which case B^s - b x is negative, and
+  // the step is rounded away from zero to keep it on the small side.
+  bx = nat_mul(b, x);
+  power = nat_power(s);
+  if (nat_cmp(bx, power) <= 0) {
+    e = nat_sub(power, bx);
+    t = nat_mul(x, e);
+    d = nat_shift_down(t, s);
+    nat_step(&x, d, true);
+  } else {
+    e = nat_sub(bx, power);
+    t = nat_mul(x, e);
+    d = nat_shift_down(t, s);
+    r = nat_small(1);
+    nat_step(&d, r, true);
+    smb_free(r.d);
+    nat_step(&x, d, false);
+  }
+  smb_free(bx.d);
+  smb_free(power.d);
+  smb_free(e.d);
+  smb_free(t.d);
+  smb_free(d.d);
+  return x;
+}
+
+/**
+   @brief Set *q = a / b and *r = a % b, where b isn't zero.
+
+   Big divisions multiply a by the reciprocal of b instead, and then fix up
+   the quotient, which is at most a few too small or too big.
+ */
+static void nat_divmod(nat a, nat b, nat *q, nat *r)
+{
+  int m = a.length, n = b.length;
+  nat inverse, t, one;
+
+  if (nat_cmp(a, b) < 0) {
+    *q = nat_alloc(0);
+    *r = nat_copy(a.d, a.length);
+    return;
+  }
+  if (n < NEWTON_THRESHOLD || m - n < NEWTON_THRESHOLD) {
+    *q = nat_alloc(m - n + 1);
+    *r = nat_alloc(n);
+    divmod_basecase(q->d, r->d, a.d, m, b.d, n);
+    nat_trim(q);
+    nat_trim(r);
+    return;
+  }
+
+  inverse = nat_reciprocal(b, m);
+  t = nat_mul(a, inverse);
+  *q = nat_shift_down(t, m);
+  smb_free(t.d);
+  smb_free(inverse.d);
+
+  one = nat_small(1);
+  t = nat_mul(*q, b);
+  while (nat_cmp(t, a) > 0) {
+    nat_step(q, one, false);
+    nat_step(&t, b, false);
+  }
+  *r = nat_sub(a, t);
+  while (nat_cmp(*r, b) >= 0) {
+    nat_step(q, one, true);
+    nat_step(r, b, false);
+  }
+  smb_free(t.d);
+  smb_free(one.d);
+}
+
+/*******************************************************************************
+                              Decimal conversion
+*******************************************************************************/
+
+/**
+   @brief Powers of ten, 10^(9 * 2^i), for splitting numbers in half.
+ */
+typedef struct {
+  int count;
+  nat powers[32];
+} decimal_powers;
+
+/**
+   @brief Square up powers of ten until they're about half of some length.
+ */
+static void decimal_powers_init(decimal_powers *dp, int length)
+{
+  nat x = nat_small(BILLION);
+  dp->count = 0;
+  for (;;) {
+    dp->powers[dp->count++] = x;
+    if (x.length * 2 > length || dp->count == 32) {
+      break;
+    }
+    x = nat_mul(x, x);
+  }
+}
+
+static void decimal_powers_destroy(decimal_powers *dp)
+{
+  for (int i = 0; i < dp->count; i++) {
+    smb_free(dp->powers[i].d);
+  }
+}
+
+/**
+   @brief Write the digits of a number, padded with zeros to exactly width
+   digits if width isn't zero.
+   @returns Where the next digit goes.
+
+   Small numbers give up nine digits at a time to division by a billion.
+   Bigger ones are split in two by dividing by a power of ten about half their
+   size, and each half is written the same way, so with fast division this
+   takes less than quadratic time.
+ */
+static char *nat_digits(nat a, decimal_powers *dp, int width, char *out)
+{
+  int k, n = 0, low;
+  uint64_t rest;
+  char *digits;
+  nat x, q, r;
+
+  if (a.length < DECIMAL_THRESHOLD) {
+    // Digits come out least significant first, so they're reversed after.
+    x = nat_copy(a.d, a.length);
+    digits = smb_new(char, 10 * (a.length + 1));
+    while (x.length > 0) {
+      rest = 0;
+      for (int i = x.length - 1; i >= 0; i--) {
+        rest = (rest << 32) | x.d[i];
+        x.d[i] = (uint32_t)(rest / BILLION);
+        rest %= BILLION;
+      }
+      nat_trim(&x);
+      for (int i = 0; i < 9; i++) {
+        digits[n++] = (char)('0' + rest % 10);
+        rest /= 10;
+      }
+    }
+    while (n > 0 && digits[n - 1] == '0') {
+      n--;
+    }
+    for (int i = n; i < width; i++) {
+      *out++ = '0';
+    }
+    if (n == 0 && width == 0) {
+      *out++ = '0';
+    }
+    while (n > 0) {
+      *out++ = digits[--n];
+    }
+    smb_free(x.d);
+    smb_free(digits);
+    return out;
+  }
+
+  k = dp->count - 1;
+  while (k > 0 && dp->powers[k].length * 2 > a.length + 1) {
+    k--;
+  }
+  low = 9 << k;
+  nat_divmod(a, dp->powers[k], &q, &r);
+  out = nat_digits(q, dp, width > 0 ? width - low : 0, out);
+  out = nat_digits(r, dp, low, out);
+  smb_free(q.d);
+  smb_free(r.d);
+  return out;
+}
+
+/**
+   @brief Read a number from some decimal digits.
+
+   Like nat_digits(), long numbers are split in two, around a power of ten,
+   which only needs fast multiplication.
+ */
+static nat nat_parse(const wchar_t *text, int length, decimal_powers *dp)
+{
+  int k, low, chunk;
+  uint32_t scale, value;
+  uint64_t carry;
+  nat x, hi, lo, t;
+
+  if (length <= 9 * DECIMAL_THRESHOLD) {
+    x = nat_alloc(length / 9 + 2);
+    x.length = 0;
+    // Nine digits at a time, with the odd ones out first.
+    chunk = length % 9 == 0 ? 9 : length % 9;
+    for (int i = 0; i < length; i += chunk, chunk = 9) {
+      scale = 1;
+      value = 0;
+      for (int j = 0; j < chunk; j++) {
+        scale *= 10;
+        value = value * 10 + (uint32_t)(text[i + j] - L'0');
+      }
+      carry = value;
+      for (int j = 0; j < x.length; j++) {
+        carry += (uint64_t)x.d[j] * scale;
+        x.d[j] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      if (carry != 0) {
+        x.d[x.length++] = (uint32_t)carry;
+      }
+    }
+    return x;
+  }
+
+  k = 0;
+  while (k + 1 < dp->count && (9 << (k + 1)) < length) {
+    k++;
+  }
+  low = 9 << k;
+  hi = nat_parse(text, length - low, dp);
+  lo = nat_parse(text + length - low, low, dp);
+  t = nat_mul(hi, dp->powers[k]);
+  x = nat_add(t, lo);
+  smb_free(hi.d);
+  smb_free(lo.d);
+  smb_free(t.d);
+  return x;
+}
+
+/*******************************************************************************
+                                   Integers
+*******************************************************************************/
+
+/**
+   @brief Get the sign and magnitude of an integer of either kind.
+   @param small Room for LONG_LIMBS limbs, for the magnitude of a lisp_int.
+ */
+static void integer_view(lisp_value *v, int *sign, nat *mag, uint32_t *small)
+{
+  lisp_bignum *big;
+  unsigned long u;
+  long x;
+
+  if (v->type == &tp_bignum) {
+    big = (lisp_bignum*)v;
+    *sign = big->sign;
+    mag->length = big->length;
+    mag->d = big->digits;
+    return;
+  }
+  x = ((lisp_int*)v)->value;
+  u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+  *sign = (x > 0) - (x < 0);
+  mag->d = small;
+  mag->length = 0;
+  while (u != 0) {
+    small[mag->length++] = (uint32_t)u;
+    // Two steps, since shifting by the whole width of a long is undefined.
+    u = (u >> 16) >> 16;
+  }
+}
+
+/**
+   @brief Return an integer with a sign and magnitude, as a lisp_int if it
+   fits in one.  The magnitude is freed.
+ */
+static lisp_value *make_integer(lisp_runtime *rt, int sign, nat mag)
+{
+  lisp_bignum *rv;
+  lisp_int *i;
+  unsigned long u = 0;
+
+  nat_trim(&mag);
+  if (mag.length <= LONG_LIMBS) {
+    for (int j = mag.length - 1; j >= 0; j--) {
+      u = ((u << 16) << 16) | mag.d[j];
+    }
+    if (u <= (unsigned long)LONG_MAX ||
+        (sign < 0 && u == (unsigned long)LONG_MAX + 1)) {
+      i = (lisp_int*)tp_int.tp_alloc(rt);
+      if (i != NULL) {
+        i->value = sign < 0 ? -(long)(u - 1) - 1 : (long)u;
+      }
+      smb_free(mag.d);
+      return (lisp_value*)i;
+    }
+  }
+
+  rv = (lisp_bignum*)lisp_alloc(rt, &tp_bignum, sizeof(lisp_bignum) +
+                                mag.length * sizeof(uint32_t));
+  if (rv == NULL) {
+    smb_free(mag.d);
+    return NULL;
+  }
+  rv->sign = sign;
+  rv->length = mag.length;
+  memcpy(rv->digits, mag.d, mag.length * sizeof(uint32_t));
+  smb_free(mag.d);
+  return (lisp_value*)rv;
+}
+
+bool lisp_is_integer(lisp_value *v)
+{
+  return lisp_type_of(v) == &tp_int || lisp_type_of(v) == &tp_bignum;
+}
+
+static lisp_value *add_signed(lisp_runtime *rt, int sa, nat a, int sb, nat b)
+{
+  int c;
+  if (sa == 0) {
+    return make_integer(rt, sb, nat_copy(b.d, b.length));
+  } else if (sb == 0) {
+    return make_integer(rt, sa, nat_copy(a.d, a.length));
+  } else if (sa == sb) {
+    return make_integer(rt, sa, nat_add(a, b));
+  }
+  c = nat_cmp(a, b);
+  if (c == 0) {
+    return make_integer(rt, 0, nat_alloc(0));
+  } else if (c > 0) {
+    return make_integer(rt, sa, nat_sub(a, b));
+  } else {
+    return make_integer(rt, sb, nat_sub(b, a));
+  }
+}
+
+lisp_value *lisp_integer_add(lisp_runtime *rt, lisp_value *a, lisp_value *b)
+{
+  uint32_t la[LONG_LIMBS], lb[LONG_LIMBS];
+  int sa, sb;
+  nat ma, mb;
+  integer_view(a, &sa, &ma, la);
+  integer_view(b, &sb, &mb, lb);
+  return add_signed(rt, sa, ma, sb, mb);
+}
+
+lisp_value *lisp_integer_sub(lisp_runtime *rt, lisp_value *a, lisp_value *b)
+{
+  uint32_t la[LONG_LIMBS], lb[LONG_LIMBS];
+  int sa, sb;
+  nat ma, mb;
+  integer_view(a, &sa, &ma, la);
+  integer_view(b, &sb, &mb, lb);
+  return add_signed(rt, sa, ma, -sb, mb);
+}
+
+lisp_value *lisp_integer_mul(lisp_runtime *rt, lisp_value *a, lisp_value *b)
+{
+  uint32_t la[LONG_LIMBS], lb[LONG_LIMBS];
+  int sa, sb;
+  nat ma, mb;
+  integer_view(a, &sa, &ma, la);
+  integer_view(b, &sb, &mb, lb);
+  return make_integer(rt, sa * sb, nat_mul(ma, mb));
+}
+
+lisp_value *lisp_integer_divide(lisp_runtime *rt, lisp_value *a,
+                                lisp_value *b, char op)
+{
+  uint32_t la[LONG_LIMBS], lb[LONG_LIMBS];
+  int sa, sb;
+  nat ma, mb, q, r, t;
+
+  integer_view(a, &sa, &ma, la);
+  integer_view(b, &sb, &mb, lb);
+  nat_divmod(ma, mb, &q, &r);
+  if (op == '/') {
+    smb_free(r.d);
+    return make_integer(rt, sa * sb, q);
+  }
+  smb_free(q.d);
+  // A remainder takes the dividend's sign, and a modulus the divisor's.
+  if (op == 'm' && r.length > 0 && sa != sb) {
+    t = nat_sub(mb, r);
+    smb_free(r.d);
+    return make_integer(rt, sb, t);
+  }
+  return make_integer(rt, sa, r);
+}
+
+int lisp_integer_compare(lisp_value *a, lisp_value *b)
+{
+  uint32_t la[LONG_LIMBS], lb[LONG_LIMBS];
+  int sa, sb;
+  nat ma, mb;
+  integer_view(a, &sa, &ma, la);
+  integer_view(b, &sb, &mb, lb);
+  if (sa != sb) {
+    return sa < sb ? -1 : 1;
+  }
+  return sa * nat_cmp(ma, mb);
+}
+
+double lisp_integer_to_double(lisp_value *v)
+{
+  uint32_t small[LONG_LIMBS];
+  double d = 0;
+  int sign;
+  nat mag;
+
+  integer_view(v, &sign, &mag, small);
+  // The top three limbs hold more bits than a double does.
+  for (int i = mag.length - 1; i >= 0 && i >= mag.length - 3; i--) {
+    d = d * 4294967296.0 + mag.d[i];
+  }
+  if (mag.length > 3) {
+    d = ldexp(d, 32 * (mag.length - 3));
+  }
+  return sign * d;
+}
+
+lisp_value *lisp_integer_from_double(lisp_runtime *rt, double d)
+{
+  double m = fabs(trunc(d));
+  int e;
+  nat mag;
+
+  frexp(m, &e);
+  mag = nat_alloc(m < 1 ? 0 : (e + 31) / 32);
+  // Scaling by powers of two is exact, so each limb comes out exactly.
+  for (int i = 0; i < mag.length; i++) {
+    mag.d[i] = (uint32_t)fmod(ldexp(m, -32 * i), 4294967296.0);
+  }
+  return make_integer(rt, d < 0 ? -1 : 1, mag);
+}
+
+lisp_value *lisp_integer_parse(lisp_runtime *rt, const wchar_t *text)
+{
+  decimal_powers dp;
+  int sign = 1, length;
+  nat mag;
+
+  if (*text == L'-') {
+    sign = -1;
+    text++;
+  }
+  length = wcslen(text);
+  decimal_powers_init(&dp, length / 9 + 1);
+  mag = nat_parse(text, length, &dp);
+  decimal_powers_destroy(&dp);
+  return make_integer(rt, mag.length == 0 ? 0 : sign, mag);
+}
+
+/*******************************************************************************
+                            tp_bignum / lisp_bignum
+*******************************************************************************/
+
+static lisp_value *lisp_bignum_alloc(lisp_runtime *rt)
+{
+  lisp_bignum *rv = (lisp_bignum*)lisp_alloc(rt, &tp_bignum,
+                                             sizeof(lisp_bignum));
+  if (rv == NULL) return NULL;
+  rv->sign = 0;
+  rv->length = 0;
+  return (lisp_value*)rv;
+}
+
+static void lisp_bignum_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_bignum *big = (lisp_bignum*)value;
+  lisp_free(rt, value, sizeof(lisp_bignum) + big->length * sizeof(uint32_t));
+}
+
+static void lisp_bignum_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  lisp_bignum *big = (lisp_bignum*)value;
+  decimal_powers dp;
+  char *text, *end;
+  nat mag;
+
+  mag.length = big->length;
+  mag.d = big->digits;
+  // Each limb is fewer than ten digits.
+  text = smb_new(char, 10 * big->length + 2);
+  end = text;
+  if (big->sign < 0) {
+    *end++ = '-';
+  }
+  decimal_powers_init(&dp, mag.length);
+  end = nat_digits(mag, &dp, 0, end);
+  decimal_powers_destroy(&dp);
+  *end = '\0';
+  fprintf(f, "%s\n", text);
+  smb_free(text);
+}
+
+static lisp_value *lisp_bignum_copy(lisp_runtime *rt, lisp_value *value,
+                                    lisp_value *(*child)(lisp_runtime *,
+                                                         lisp_value *))
+{
+  (void)child; // unused
+  lisp_bignum *big = (lisp_bignum*)value;
+  return make_integer(rt, big->sign, nat_copy(big->digits, big->length));
+}
+
+lisp_type tp_bignum = {
+  .tp_name = "bignum",
+  .tp_index = TP_BIGNUM,
+  .tp_alloc = &lisp_bignum_alloc,
+  .tp_dealloc = &lisp_bignum_dealloc,
+  .tp_print = &lisp_bignum_print,
+  .tp_copy = &lisp_bignum_copy
+};
@@ -0,0 +1,360 @@
+/***************************************************************************//**
+
+  @file         channel.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Channels, which pass values between runtimes on other threads.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Bytes between the queue's two ends, so they sit on separate lines.
+ */
+#define CACHE_LINE 64
+
+/**
+   @brief A slot in a queue.
+
+   A slot's sequence number says whose turn it is.  It equals the position
+   being enqueued into it when it's free, and that position plus one once a
+   value is there to be dequeued.
+ */
+typedef struct {
+  size_t sequence;
+  lisp_value *value;
+} lisp_queue_cell;
+
+/**
+   @brief A bounded multi-producer, multi-consumer queue.
+
+   Sending and receiving only take the lock to sleep, when the queue is full or
+   empty: otherwise each claims a slot by bumping its end of the queue with a
+   compare and swap.  This is Dmitry Vyukov's bounded MPMC queue.
+ */
+struct lisp_queue {
+
+  /**
+     @brief Number of channel values sharing this queue.
+   */
+  unsigned int refcount;
+
+  size_t mask;
+  lisp_queue_cell *cells;
+
+  char pad0[CACHE_LINE];
+  size_t enqueue;
+  char pad1[CACHE_LINE - sizeof(size_t)];
+  size_t dequeue;
+  char pad2[CACHE_LINE - sizeof(size_t)];
+
+  /**
+     @brief Number of threads asleep (or about to be) waiting on the queue.
+   */
+  int waiting;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+
+};
+
+static bool lisp_queue_push(lisp_queue *q, lisp_value *value)
+{
+  size_t pos = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED);
+  lisp_queue_cell *cell;
+  long diff;
+
+  for (;;) {
+    cell = &q->cells[pos & q->mask];
+    diff = (long)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->enqueue, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; // full
+    } else {
+      pos = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->value = value;
+  __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static bool lisp_queue_pop(lisp_queue *q, lisp_value **value)
+{
+  size_t pos = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED);
+  lisp_queue_cell *cell;
+  long diff;
+
+  for (;;) {
+    cell = &q->cells[pos & q->mask];
+    diff = (long)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) -
+                  (pos + 1));
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->dequeue, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; // empty
+    } else {
+      pos = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED);
+    }
+  }
+
+  *value = cell->value;
+  __atomic_store_n(&cell->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+   @brief Wake anything waiting for the queue to change.
+
+   A waiter announces itself before its last attempt, and the fences make sure
+   that either it sees this change, or this sees it waiting.
+ */
+static void lisp_queue_wake(lisp_queue *q)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&q->waiting, __ATOMIC_RELAXED) > 0) {
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+  }
+}
+
+static lisp_queue *lisp_queue_create(int capacity)
+{
+  lisp_queue *q = smb_new(lisp_queue, 1);
+  pthread_condattr_t attr;
+  size_t size = 2;
+
+  // Slots are found by masking the position, so there's a power of two of
+  // them.  Each slot's sequence starts out as the first position it serves.
+  while (size < (size_t)capacity) {
+    size *= 2;
+  }
+  q->refcount = 1;
+  q->mask = size - 1;
+  q->cells = smb_new(lisp_queue_cell, size);
+  for (size_t i = 0; i < size; i++) {
+    q->cells[i].sequence = i;
+    q->cells[i].value = NULL;
+  }
+  q->enqueue = 0;
+  q->dequeue = 0;
+  q->waiting = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  // Deadlines are kept on the monotonic clock (see lisp_set_timeout()).
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&q->changed, &attr);
+  pthread_condattr_destroy(&attr);
+  return q;
+}
+
+/**
+   @brief Return how many bytes a queue's slots take up.
+ */
+static long lisp_queue_bytes(lisp_queue *q)
+{
+  return (q->mask + 1) * sizeof(lisp_queue_cell);
+}
+
+static void lisp_queue_release(lisp_runtime *rt, lisp_queue *q)
+{
+  lisp_value *value;
+  unsigned int left;
+
+  // Once the count drops, the queue may be freed by another thread at any
+  // moment, so waking whoever is left happens under the lock, along with the
+  // drop itself.
+  pthread_mutex_lock(&q->lock);
+  left = __atomic_sub_fetch(&q->refcount, 1, __ATOMIC_ACQ_REL);
+  if (left == 1) {
+    // They may be waiting on a channel nobody else can use now.
+    pthread_cond_broadcast(&q->changed);
+  }
+  pthread_mutex_unlock(&q->lock);
+  if (left > 0) {
+    return;
+  }
+  // Values still queued are frozen, so any runtime may drop them.
+  while (lisp_queue_pop(q, &value)) {
+    lisp_decref(rt, value);
+  }
+  pthread_cond_destroy(&q->changed);
+  pthread_mutex_destroy(&q->lock);
+  smb_free(q->cells);
+  smb_free(q);
+}
+
+/**
+   @brief Sleep until the queue changes, or the runtime's deadline passes.
+   @returns false, with an error raised, if there's no point waiting.
+   The caller holds the queue's lock.
+ */
+static bool lisp_queue_sleep(lisp_runtime *rt, lisp_queue *q, const char *op)
+{
+  struct timespec ts;
+
+  // With no other channel values, nobody can ever make room or send.
+  if (__atomic_load_n(&q->refcount, __ATOMIC_ACQUIRE) == 1) {
+    lisp_error(rt, "%s: nothing else can use this channel", op);
+    return false;
+  }
+  if (rt->deadline == 0) {
+    pthread_cond_wait(&q->changed, &q->lock);
+    return true;
+  }
+  ts.tv_sec = rt->deadline / 1000000000ULL;
+  ts.tv_nsec = rt->deadline % 1000000000ULL;
+  if (pthread_cond_timedwait(&q->changed, &q->lock, &ts) == ETIMEDOUT) {
+    lisp_error(rt, "evaluation timed out");
+    return false;
+  }
+  return true;
+}
+
+lisp_channel *lisp_channel_create(lisp_runtime *rt, int capacity)
+{
+  lisp_channel *ch = (lisp_channel*)tp_channel.tp_alloc(rt);
+  lisp_queue *q;
+
+  if (ch == NULL) return NULL;
+  q = lisp_queue_create(capacity);
+  if (!lisp_charge(rt, &ch->lv, lisp_queue_bytes(q))) {
+    lisp_queue_release(rt, q);
+    lisp_decref(rt, (lisp_value*)ch);
+    return NULL;
+  }
+  ch->queue = q;
+  return ch;
+}
+
+bool lisp_channel_send(lisp_runtime *rt, lisp_channel *ch, lisp_value *value)
+{
+  lisp_queue *q = ch->queue;
+  bool sent;
+
+  // The receiver is another runtime, so it gets a frozen version, which is
+  // the value itself if it's frozen already.
+  value = lisp_freeze(rt, value);
+  if (rt->error) {
+    lisp_decref(rt, value);
+    return false;
+  }
+
+  sent = lisp_queue_push(q, value);
+  if (!sent) {
+    pthread_mutex_lock(&q->lock);
+    __atomic_add_fetch(&q->waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!(sent = lisp_queue_push(q, value)) &&
+           lisp_queue_sleep(rt, q, "send")) {}
+    __atomic_sub_fetch(&q->waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  if (!sent) {
+    lisp_decref(rt, value);
+    return false;
+  }
+  lisp_queue_wake(q);
+  return true;
+}
+
+lisp_value *lisp_channel_receive(lisp_runtime *rt, lisp_channel *ch)
+{
+  lisp_queue *q = ch->queue;
+  lisp_value *value;
+  bool received;
+
+  received = lisp_queue_pop(q, &value);
+  if (!received) {
+    pthread_mutex_lock(&q->lock);
+    __atomic_add_fetch(&q->waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!(received = lisp_queue_pop(q, &value)) &&
+           lisp_queue_sleep(rt, q, "receive")) {}
+    __atomic_sub_fetch(&q->waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  if (!received) {
+    return NULL;
+  }
+  lisp_queue_wake(q);
+  return value;
+}
+
+static lisp_value *lisp_channel_alloc(lisp_runtime *rt)
+{
+  lisp_channel *rv = (lisp_channel*)lisp_alloc(rt, &tp_channel,
+                                               sizeof(lisp_channel));
+  if (rv == NULL) return NULL;
+  rv->queue = NULL;
+  return (lisp_value*)rv;
+}
+
+static void lisp_channel_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_channel *ch = (lisp_channel*)value;
+  if (ch->queue != NULL) {
+    lisp_charge(rt, value, -lisp_queue_bytes(ch->queue));
+    lisp_queue_release(rt, ch->queue);
+  }
+  lisp_free(rt, value, sizeof(lisp_channel));
+}
+
+static void lisp_channel_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)value; // unused
+  (void)indent; // unused
+  fprintf(f, "channel\n");
+}
+
+static lisp_value *lisp_channel_copy(lisp_runtime *rt, lisp_value *value,
+                                     lisp_value *(*child)(lisp_runtime *,
+                                                          lisp_value *))
+{
+  (void)child; // unused
+  lisp_channel *ch = (lisp_channel*)value;
+  lisp_channel *rv = (lisp_channel*)tp_channel.tp_alloc(rt);
+  if (rv == NULL) {
+    return NULL;
+  } else if (!lisp_charge(rt, &rv->lv, lisp_queue_bytes(ch->queue))) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  // Copies are the same channel, which is how other threads get hold of it.
+  __atomic_add_fetch(&ch->queue->refcount, 1, __ATOMIC_ACQ_REL);
+  rv->queue = ch->queue;
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_channel = {
+  .tp_name = "channel",
+  .tp_index = TP_CHANNEL,
+  .tp_alloc = &lisp_channel_alloc,
+  .tp_dealloc = &lisp_channel_dealloc,
+  .tp_print = &lisp_channel_print,
+  .tp_copy = &lisp_channel_copy
+};
@@ -0,0 +1,330 @@
+/***************************************************************************//**
+
+  @file         coroutine.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Coroutines, which let evaluation be suspended and resumed.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Address space reserved for each coroutine's stack.
+
+   Pages are only backed by memory once the coroutine touches them, so a
+   coroutine that never recurses deeply costs a few pages, however large this
+   is.  It's well over the usual 8 MiB main stack, so a coroutine can recurse
+   at least as deeply as anything else.  Calls stop with an error well before
+   the bottom (see lisp_check_stack()), and the lowest page is left
+   inaccessible, in case anything else gets that far.
+ */
+#define COROUTINE_STACK_SIZE (64 * 1024 * 1024)
+
+#define COROUTINE_NEW 0
+#define COROUTINE_SUSPENDED 1
+#define COROUTINE_RUNNING 2
+#define COROUTINE_DONE 3
+
+struct lisp_context {
+
+  int state;
+
+  /**
+     @brief Set when a suspended coroutine is deleted, so that it unwinds.
+   */
+  bool cancel;
+
+  ucontext_t context;
+  ucontext_t caller;
+  char *stack;
+
+  /**
+     @brief The function to call, and its arguments, until it is called.
+   */
+  lisp_value *function;
+  lisp_list *arguments;
+
+  /**
+     @brief Scope the function is called in.
+
+     Each resume points this at the resumer's scope, so names are looked up
+     wherever the coroutine is resumed from, as they would be for a call.
+   */
+  lisp_scope *scope;
+
+  /**
+     @brief The value being handed between the coroutine and its resumer.
+   */
+  lisp_value *transfer;
+
+  lisp_coroutine *resumer;
+  lisp_runtime *rt;
+
+};
+
+/**
+   @brief The first thing run on a coroutine's stack.
+
+   makecontext() only passes int arguments, so the coroutine's address is split
+   into two halves.
+ */
+static void lisp_coroutine_main(unsigned int hi, unsigned int lo)
+{
+  uintptr_t addr = ((uintptr_t)hi << 16 << 16) | (uintptr_t)lo;
+  lisp_coroutine *co = (lisp_coroutine*)addr;
+  lisp_context *ctx = co->context;
+  lisp_runtime *rt = ctx->rt;
+  lisp_value *rv;
+
+  // The value the coroutine was first resumed with has nowhere to go.
+  lisp_decref(rt, ctx->transfer);
+  rv = lisp_call(rt, ctx->function, ctx->arguments, ctx->scope);
+  // Like a yielded value, it may have come from the resumer's arena.
+  ctx->transfer = lisp_promote(rt, rv);
+  lisp_decref(rt, rv);
+  lisp_decref(rt, ctx->function);
+  lisp_decref(rt, (lisp_value*)ctx->arguments);
+  ctx->function = NULL;
+  ctx->arguments = NULL;
+  ctx->state = COROUTINE_DONE;
+  // Returning continues with uc_link, which is the resumer.
+}
+
+static bool lisp_coroutine_start(lisp_runtime *rt, lisp_coroutine *co)
+{
+  lisp_context *ctx = co->context;
+  long page = sysconf(_SC_PAGESIZE);
+  uintptr_t addr = (uintptr_t)co;
+
+  ctx->stack = mmap(NULL, COROUTINE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ctx->stack == MAP_FAILED) {
+    ctx->stack = NULL;
+    lisp_error(rt, "resume: unable to allocate a stack for the coroutine");
+    return false;
+  }
+  mprotect(ctx->stack, page, PROT_NONE);
+
+  getcontext(&ctx->context);
+  ctx->context.uc_stack.ss_sp = ctx->stack;
+  ctx->context.uc_stack.ss_size = COROUTINE_STACK_SIZE;
+  ctx->context.uc_link = &ctx->caller;
+  makecontext(&ctx->context, (void (*)(void))&lisp_coroutine_main, 2,
+              (unsigned int)(addr >> 16 >> 16), (unsigned int)addr);
+  return true;
+}
+
+/**
+   @brief Switch to a coroutine, and return what it hands back.
+ */
+static lisp_value *lisp_coroutine_switch(lisp_runtime *rt, lisp_coroutine *co,
+                                         lisp_value *value, lisp_scope *scope)
+{
+  lisp_context *ctx = co->context;
+  lisp_arena *arena = rt->arena;
+  uintptr_t stack_limit = rt->stack_limit;
+  lisp_value *rv;
+
+  if (ctx->state == COROUTINE_NEW && !lisp_coroutine_start(rt, co)) {
+    return NULL;
+  }
+
+  ctx->transfer = value;
+  ctx->scope->up = scope;
+  ctx->resumer = rt->coroutine;
+  ctx->state = COROUTINE_RUNNING;
+  rt->coroutine = co;
+  // A coroutine's values outlive the form that resumed it, so they can't be
+  // allocated from its arena.
+  rt->arena = NULL;
+  rt->stack_limit = (uintptr_t)ctx->stack + sysconf(_SC_PAGESIZE) +
+    LISP_STACK_RESERVE;
+
+  swapcontext(&ctx->caller, &ctx->context);
+
+  rt->arena = arena;
+  rt->stack_limit = stack_limit;
+  rt->coroutine = ctx->resumer;
+  ctx->resumer = NULL;
+  ctx->scope->up = NULL;
+
+  if (ctx->state == COROUTINE_DONE && ctx->stack != NULL) {
+    munmap(ctx->stack, COROUTINE_STACK_SIZE);
+    ctx->stack = NULL;
+  }
+  rv = ctx->transfer;
+  ctx->transfer = NULL;
+  return rv;
+}
+
+lisp_coroutine *lisp_coroutine_create(lisp_runtime *rt, lisp_value *func,
+                                      lisp_list *args)
+{
+  lisp_coroutine *co = (lisp_coroutine*)tp_coroutine.tp_alloc(rt);
+  lisp_context *ctx;
+
+  if (co == NULL) return NULL;
+  ctx = co->context;
+  // These are kept until the coroutine is first resumed, which may be long
+  // after the current arena is gone.
+  ctx->function = lisp_promote(rt, func);
+  ctx->arguments = (lisp_list*)lisp_promote(rt, (lisp_value*)args);
+  if (ctx->function == NULL || ctx->arguments == NULL) {
+    lisp_decref(rt, (lisp_value*)co);
+    return NULL;
+  }
+  return co;
+}
+
+lisp_value *lisp_coroutine_resume(lisp_runtime *rt, lisp_coroutine *co,
+                                  lisp_value *value, lisp_scope *scope)
+{
+  switch (co->context->state) {
+  case COROUTINE_RUNNING:
+    return lisp_error(rt, "resume: coroutine is already running");
+  case COROUTINE_DONE:
+    return lisp_error(rt, "resume: coroutine has finished");
+  }
+  // The coroutine runs without an arena, so nothing it does would promote the
+  // value, and it may keep it long after the current form's arena is gone.
+  value = lisp_promote(rt, value);
+  if (value == NULL) return NULL;
+  return lisp_coroutine_switch(rt, co, value, scope);
+}
+
+lisp_value *lisp_coroutine_yield(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_coroutine *co = rt->coroutine;
+  lisp_context *ctx;
+  lisp_value *rv;
+
+  if (co == NULL) {
+    return lisp_error(rt, "yield: not within a coroutine");
+  }
+  ctx = co->context;
+  if (ctx->cancel) {
+    return lisp_error(rt, "yield: coroutine was deleted");
+  }
+
+  // Names are looked up in the scope of whoever resumed the coroutine, so the
+  // value may be from the arena of a form that has finished since.
+  value = lisp_promote(rt, value);
+  if (value == NULL) return NULL;
+  ctx->transfer = value;
+  ctx->state = COROUTINE_SUSPENDED;
+  swapcontext(&ctx->context, &ctx->caller);
+
+  rv = ctx->transfer;
+  ctx->transfer = NULL;
+  if (ctx->cancel) {
+    return lisp_error(rt, "yield: coroutine was deleted");
+  }
+  return rv;
+}
+
+bool lisp_coroutine_done(lisp_coroutine *co)
+{
+  return co->context->state == COROUTINE_DONE;
+}
+
+static lisp_value *lisp_coroutine_alloc(lisp_runtime *rt)
+{
+  lisp_arena *arena = rt->arena;
+  lisp_coroutine *co;
+  lisp_context *ctx;
+
+  // Coroutines are never copied (see lisp_coroutine_copy()), so they can't be
+  // allocated from an arena, which would copy them when they escape.
+  rt->arena = NULL;
+  co = (lisp_coroutine*)lisp_alloc(rt, &tp_coroutine, sizeof(lisp_coroutine));
+  rt->arena = arena;
+  if (co == NULL) return NULL;
+
+  ctx = smb_new(lisp_context, 1);
+  ctx->state = COROUTINE_NEW;
+  ctx->cancel = false;
+  ctx->stack = NULL;
+  ctx->function = NULL;
+  ctx->arguments = NULL;
+  ctx->scope = lisp_scope_create();
+  ctx->transfer = NULL;
+  ctx->resumer = NULL;
+  ctx->rt = rt;
+  co->context = ctx;
+  return (lisp_value*)co;
+}
+
+static void lisp_coroutine_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_coroutine *co = (lisp_coroutine*)value;
+  lisp_context *ctx = co->context;
+  char message[LISP_ERROR_SIZE];
+  bool error = rt->error;
+
+  if (ctx->state == COROUTINE_SUSPENDED) {
+    // Everything on the coroutine's stack holds references, so rather than
+    // just dropping the stack, make its yield fail and let it unwind.  Any
+    // error already being raised must survive that.
+    memcpy(message, rt->message, LISP_ERROR_SIZE);
+    lisp_clear_error(rt);
+    ctx->cancel = true;
+    lisp_decref(rt, lisp_coroutine_switch(rt, co, NULL, NULL));
+    lisp_clear_error(rt);
+    if (error) {
+      lisp_error(rt, "%s", message);
+    }
+  }
+
+  lisp_decref(rt, ctx->function);
+  lisp_decref(rt, (lisp_value*)ctx->arguments);
+  lisp_scope_delete(rt, ctx->scope);
+  smb_free(ctx);
+  lisp_free(rt, value, sizeof(lisp_coroutine));
+}
+
+static void lisp_coroutine_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  lisp_coroutine *co = (lisp_coroutine*)value;
+  if (lisp_coroutine_done(co)) {
+    fprintf(f, "coroutine (done)\n");
+  } else {
+    fprintf(f, "coroutine\n");
+  }
+}
+
+static lisp_value *lisp_coroutine_copy(lisp_runtime *rt, lisp_value *value,
+                                       lisp_value *(*child)(lisp_runtime *,
+                                                            lisp_value *))
+{
+  (void)value; // unused
+  (void)child; // unused
+  // A stack can't be duplicated, and it can't be run by another runtime.
+  return lisp_error(rt, "a coroutine can't be copied or frozen");
+}
+
+lisp_type tp_coroutine = {
+  .tp_name = "coroutine",
+  .tp_index = TP_COROUTINE,
+  .tp_alloc = &lisp_coroutine_alloc,
+  .tp_dealloc = &lisp_coroutine_dealloc,
+  .tp_print = &lisp_coroutine_print,
+  .tp_copy = &lisp_coroutine_copy
+};
@@ -14,167 +14,350 @@
 *******************************************************************************/
 
 #include <assert.h>
+#include <stdlib.h>
 
 #include "libstephen/str.h"
 #include "libstephen/ht.h"
 #include "lex.h"
 #include "lisp.h"
 
-bool lisp_interactive_exit = false;
-
 // forward-declaration
-lisp_value *lisp_evaluate(lisp_value *expression, lisp_scope *scope);
-static lisp_list *lisp_evaluate_list(lisp_list *list, lisp_scope *scope);
+static lisp_list *lisp_evaluate_list(lisp_runtime *rt, lisp_list *list,
+                                     lisp_scope *scope);
 
-static void add_to_scope(lisp_list *names, lisp_list *values, lisp_scope *scope)
+static void add_to_scope(lisp_runtime *rt, lisp_list *names, lisp_list *values,
+                         lisp_scope *scope)
 {
   lisp_identifier *id;
   while (names->value != NULL && values->value != NULL) {
     id = (lisp_identifier*) names->value;
     lisp_incref(values->value);
-    ht_insert(&scope->table, PTR(id->value), PTR(values->value));
+    lisp_scope_bind(rt, scope, id->value, values->value);
     names = names->next; values = values->next;
   }
 }
 
-static lisp_value *lisp_evaluate_funccall(lisp_value *expression,
-                                          lisp_scope *scope)
+lisp_value *lisp_call(lisp_runtime *rt, lisp_value *func, lisp_list *args,
+                      lisp_scope *scope)
 {
-  lisp_builtin *bi;
   lisp_function *f;
-  lisp_funccall *call;
-  lisp_value *rv, *func;
-  lisp_list *args;
+  lisp_value *rv;
   lisp_scope *new_scope;
 
-  call = (lisp_funccall*) expression;
-  func = lisp_evaluate((lisp_value*)call->function, scope);
+  if (!lisp_check_deadline(rt) || !lisp_check_stack(rt)) {
+    return NULL;
+  }
 
-  if (func->type == &tp_builtin) {
+  if (lisp_type_of(func) == &tp_builtin) {
     // Calling builtin functions involves calling their function pointer.
-    bi = (lisp_builtin*) func;
-
-    // Builtins do things more powerful than normal functions, and thus they can
-    // request that their arguments not be evaluated.  This is important for
-    // implementing things like if, cond, etc.
-    if (bi->eval) {
-      // Evaluate arguments beforehand.
-      args = lisp_evaluate_list(call->arguments, scope);
-      rv = bi->function(args, scope);
-      lisp_decref((lisp_value*)args);
-    } else {
-      // Don't evaluate arguments.
-      args = call->arguments;
-      rv = bi->function(args, scope);
+    rv = ((lisp_builtin*)func)->function(rt, args, scope);
+  } else if (lisp_type_of(func) == &tp_function) {
+    f = (lisp_function*) func;
+    new_scope = lisp_scope_create();
+    new_scope->up = scope;
+    add_to_scope(rt, f->arglist, args, new_scope);
+    rv = lisp_evaluate(rt, (lisp_value*)f->code, new_scope);
+    lisp_scope_delete(rt, new_scope);
+  } else {
+    return lisp_error(rt, "value of type %s is not a function",
+                      lisp_type_of(func)->tp_name);
+  }
+
+  // A builtin may have returned a value despite an error raised by something
+  // it called and didn't check.
+  if (rt->error) {
+    lisp_decref(rt, rv);
+    return NULL;
+  }
+  return rv;
+}
+
+lisp_value *lisp_call_with(lisp_runtime *rt, lisp_value *func,
+                           lisp_value **args, int n, lisp_scope *scope)
+{
+  lisp_list *list, *names, *cell;
+  lisp_function *f;
+  lisp_scope *new_scope;
+  lisp_value *rv;
+
+  // A function only binds its arguments to names, so there's no need to build
+  // a list of them first.  This is the path the list library, lazy sequences
+  // and the parallel builtins call through, once per item.
+  if (lisp_type_of(func) == &tp_function) {
+    if (!lisp_check_deadline(rt) || !lisp_check_stack(rt)) {
+      return NULL;
     }
-  } else if(func->type == &tp_function) {
     f = (lisp_function*) func;
-    args = lisp_evaluate_list(call->arguments, scope);
     new_scope = lisp_scope_create();
     new_scope->up = scope;
-    add_to_scope(f->arglist, args, new_scope);
-    rv = lisp_evaluate((lisp_value*)f->code, new_scope);
-    lisp_scope_delete(new_scope);
-    lisp_decref((lisp_value*)args);
+    names = f->arglist;
+    for (int i = 0; i < n && names->value != NULL; i++) {
+      lisp_incref(args[i]);
+      lisp_scope_bind(rt, new_scope, ((lisp_identifier*)names->value)->value,
+                      args[i]);
+      names = names->next;
+    }
+    rv = lisp_evaluate(rt, f->code, new_scope);
+    lisp_scope_delete(rt, new_scope);
+    if (rt->error) {
+      lisp_decref(rt, rv);
+      return NULL;
+    }
+    return rv;
+  }
+
+  list = (lisp_list*)tp_list.tp_alloc(rt);
+  if (list == NULL) return NULL;
+  for (int i = n - 1; i >= 0; i--) {
+    cell = (lisp_list*)tp_list.tp_alloc(rt);
+    if (cell == NULL) {
+      lisp_decref(rt, (lisp_value*)list);
+      return NULL;
+    }
+    lisp_incref(args[i]);
+    cell->value = args[i];
+    cell->next = list;
+    list = cell;
+  }
+  rv = lisp_call(rt, func, list, scope);
+  lisp_decref(rt, (lisp_value*)list);
+  return rv;
+}
+
+static lisp_value *lisp_evaluate_funccall(lisp_runtime *rt,
+                                          lisp_value *expression,
+                                          lisp_scope *scope)
+{
+  lisp_funccall *call;
+  lisp_value *rv, *func;
+  lisp_list *args;
+
+  call = (lisp_funccall*) expression;
+  func = lisp_evaluate(rt, (lisp_value*)call->function, scope);
+  if (func == NULL) {
+    return NULL;
+  }
+
+  // Builtins do things more powerful than normal functions, and thus they can
+  // request that their arguments not be evaluated.  This is important for
+  // implementing things like if, cond, etc.
+  if (lisp_type_of(func) == &tp_builtin && !((lisp_builtin*)func)->eval) {
+    rv = lisp_call(rt, func, call->arguments, scope);
   } else {
-    printf("error in evaluation\n");
+    args = lisp_evaluate_list(rt, call->arguments, scope);
+    if (args == NULL) {
+      lisp_decref(rt, func);
+      return NULL;
+    }
+    rv = lisp_call(rt, func, args, scope);
+    lisp_decref(rt, (lisp_value*)args);
   }
-  lisp_decref(func);
+  lisp_decref(rt, func);
   return rv;
 }
 
 /**
    @brief Return a list containing each item in a list, evaluated.
+   @param rt The runtime to evaluate in.
    @param list List of items to evaluate.
    @param scope Scope to evaluate each list item within.
-   @returns A list of the evaluated items!
+   @returns A list of the evaluated items, or NULL on error!
  */
-static lisp_list *lisp_evaluate_list(lisp_list *list, lisp_scope *scope)
+static lisp_list *lisp_evaluate_list(lisp_runtime *rt, lisp_list *list,
+                                     lisp_scope *scope)
 {
   if (list->value == NULL) {
-    return (lisp_list*)tp_list.tp_alloc();
+    return (lisp_list*)tp_list.tp_alloc(rt);
+  }
+  lisp_list *l = (lisp_list*) tp_list.tp_alloc(rt);
+  if (l == NULL) return NULL;
+  l->value = lisp_evaluate(rt, list->value, scope);
+  if (l->value == NULL) {
+    lisp_decref(rt, (lisp_value*)l);
+    return NULL;
+  }
+  l->next = lisp_evaluate_list(rt, list->next, scope);
+  if (l->next == NULL) {
+    lisp_decref(rt, (lisp_value*)l);
+    return NULL;
   }
-  lisp_list *l = (lisp_list*) tp_list.tp_alloc();
-  l->value = lisp_evaluate(list->value, scope);
-  l->next = lisp_evaluate_list(list->next, scope);
   return l;
 }
 
 /**
    @brief Return the value of a piece of lisp code!
+   @param rt The runtime to evaluate in.
    @param expression The code to evaluate.
    @param scope The scope to evaluate the code within.
  */
-lisp_value *lisp_evaluate(lisp_value *expression, lisp_scope *scope)
+lisp_value *lisp_evaluate(lisp_runtime *rt, lisp_value *expression,
+                          lisp_scope *scope)
 {
-  smb_status st = SMB_SUCCESS;
   lisp_value *rv;
   lisp_identifier *id;
 
-  if (expression->type == &tp_int ||
+  if (lisp_is_float(expression) ||
+      expression->type == &tp_int ||
+      expression->type == &tp_bignum ||
       expression->type == &tp_atom ||
+      expression->type == &tp_string ||
+      expression->type == &tp_rope ||
       expression->type == &tp_list ||
+      expression->type == &tp_clist ||
+      expression->type == &tp_vector ||
+      expression->type == &tp_hash ||
+      expression->type == &tp_pvector ||
+      expression->type == &tp_phash ||
+      expression->type == &tp_array ||
       expression->type == &tp_builtin ||
       expression->type == &tp_function) {
     lisp_incref(expression);
     rv = expression;
   } else if (expression->type == &tp_funccall) {
-    rv = lisp_evaluate_funccall(expression, scope);
+    rv = lisp_evaluate_funccall(rt, expression, scope);
   } else {
     id = (lisp_identifier*)expression;
-    while (scope) {
-      rv = ht_get(&scope->table, PTR(id->value), &st).data_ptr;
-      if (st == SMB_SUCCESS) {
-        lisp_incref(rv); // we are returning a new reference not owned by scope
-        return rv;
-      }
-      st = SMB_SUCCESS;
-      scope = scope->up;
+    rv = lisp_scope_lookup(scope, id->value);
+    if (rv != NULL) {
+      lisp_incref(rv); // we are returning a new reference not owned by scope
+      return rv;
     }
-    fprintf(stderr, "lisp: definition of identifier \"%ls\" not found\n",
-            id->value);
-    exit(EXIT_FAILURE);
+    return lisp_error(rt, "definition of identifier \"%ls\" not found",
+                      id->value);
   }
   return rv;
 }
 
-lisp_value *lisp_run(wchar_t *str)
+lisp_value *lisp_run(lisp_runtime *rt, wchar_t *str)
 {
   // given string, return list of tokens (with strings if necessary)
-  smb_ll *tokens = lisp_lex(str);
+  smb_ll *tokens = lisp_lex(rt, str);
   // then, parse it to a (list of) lisp_value
   smb_iter it = ll_get_iter(tokens);
-  lisp_value *code = lisp_parse(&it);
+  lisp_value *code = lisp_parse(rt, &it);
   // then, evaluate that
-  lisp_scope *scope = lisp_create_globals();
-  lisp_value *res = lisp_evaluate(code, scope);
-  res->type->tp_print(res, stdout, 0);
-  lisp_decref(code);
-  lisp_scope_delete(scope);
+  lisp_scope *scope = lisp_create_globals(rt);
+  lisp_value *res = NULL;
+  if (code != NULL) {
+    res = lisp_evaluate(rt, code, scope);
+  }
+  if (res != NULL) {
+    lisp_type_of(res)->tp_print(res, stdout, 0);
+  }
+  lisp_decref(rt, code);
+  lisp_scope_delete(rt, scope);
   ll_delete(tokens);
   return res;
 }
 
-void lisp_interact(void)
+lisp_value *lisp_eval_string(lisp_runtime *rt, wchar_t *str,
+                             lisp_scope *scope)
+{
+  smb_ll *tokens = lisp_lex(rt, str);
+  smb_iter it = ll_get_iter(tokens);
+  lisp_value *code, *rv = tp_list.tp_alloc(rt);
+
+  // Parsing carries on after an error (lisp_parse() just discards what it
+  // parses), so that every token is consumed and freed.
+  while (it.has_next(&it)) {
+    code = lisp_parse(rt, &it);
+    if (code != NULL) {
+      lisp_decref(rt, rv);
+      rv = lisp_evaluate(rt, code, scope);
+      lisp_decref(rt, code);
+    }
+  }
+  ll_delete(tokens);
+
+  if (rt->error) {
+    lisp_decref(rt, rv);
+    return NULL;
+  }
+  return rv;
+}
+
+bool lisp_load_file(lisp_runtime *rt, const char *path, lisp_scope *scope)
+{
+  FILE *f = fopen(path, "rb");
+  char *text;
+  wchar_t *wtext;
+  long size;
+  size_t length;
+  lisp_value *rv;
+
+  if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+    if (f != NULL) fclose(f);
+    lisp_error(rt, "load: unable to read %s", path);
+    return false;
+  }
+  rewind(f);
+  text = smb_new(char, size + 1);
+  length = fread(text, 1, size, f);
+  text[length] = '\0';
+  fclose(f);
+
+  length = mbstowcs(NULL, text, 0);
+  if (length == (size_t)-1) {
+    smb_free(text);
+    lisp_error(rt, "load: invalid character in %s", path);
+    return false;
+  }
+  wtext = smb_new(wchar_t, length + 1);
+  mbstowcs(wtext, text, length + 1);
+  smb_free(text);
+
+  rv = lisp_eval_string(rt, wtext, scope);
+  smb_free(wtext);
+  lisp_decref(rt, rv);
+  return rv != NULL;
+}
+
+void lisp_interact(lisp_runtime *rt, char **load, int nload)
 {
   // Create an iterator of lisp tokens taken from stdin.
-  smb_iter token_iter = lisp_lex_file(stdin);
-  lisp_scope *scope = lisp_create_globals();
-  lisp_interactive_exit = false;
+  smb_iter token_iter = lisp_lex_file(rt, stdin);
+  lisp_scope *scope = lisp_create_globals(rt);
+  lisp_value *code, *res;
+  lisp_arena arena;
+  rt->quit = false;
+
+  for (int i = 0; i < nload; i++) {
+    if (!lisp_load_file(rt, load[i], scope)) {
+      fprintf(stderr, "error: %s\n", rt->message);
+      lisp_clear_error(rt);
+    }
+  }
+
+  // Each form is parsed and evaluated within the arena, so its temporaries
+  // are dropped all at once after the result is printed.
+  lisp_arena_init(&arena, scope);
 
   // While there are still tokens remaining...
-  while (token_iter.has_next(&token_iter) && !lisp_interactive_exit) {
+  while (token_iter.has_next(&token_iter) && !rt->quit) {
     printf("> ");
     fflush(stdout);
 
-    lisp_value *code = lisp_parse(&token_iter);
-    lisp_value *res = lisp_evaluate(code, scope);
-    res->type->tp_print(res, stdout, 0);
+    lisp_arena_begin(rt, &arena);
+    code = lisp_parse(rt, &token_iter);
+    res = NULL;
+    if (code != NULL) {
+      res = lisp_evaluate(rt, code, scope);
+    }
+
+    // Errors end the evaluation of a form, but not the session.
+    if (rt->error) {
+      fprintf(stderr, "error: %s\n", rt->message);
+      lisp_clear_error(rt);
+    } else {
+      lisp_type_of(res)->tp_print(res, stdout, 0);
+    }
 
-    lisp_decref(code);
-    lisp_decref(res);
+    lisp_decref(rt, code);
+    lisp_decref(rt, res);
+    lisp_arena_end(rt, &arena);
   }
 
   token_iter.destroy(&token_iter);
-  lisp_scope_delete(scope);
+  lisp_scope_delete(rt, scope);
+  lisp_arena_destroy(rt, &arena);
 }
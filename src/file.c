@@ -0,0 +1,248 @@
+/***************************************************************************//**
+
+  @file         file.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Files, for reading and writing data from lisp code.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Bytes of buffering for each file, so most reads and writes only copy
+   memory, and the system is called once per buffer.
+ */
+#define FILE_BUFFER (1 << 16)
+
+lisp_file *lisp_file_open(lisp_runtime *rt, const char *path,
+                          const char *mode)
+{
+  FILE *file = fopen(path, mode);
+  lisp_file *f;
+
+  if (file == NULL) {
+    lisp_error(rt, "unable to open %s", path);
+    return NULL;
+  }
+  setvbuf(file, NULL, _IOFBF, FILE_BUFFER);
+  f = (lisp_file*)tp_file.tp_alloc(rt);
+  if (f == NULL) {
+    fclose(file);
+    return NULL;
+  }
+  f->file = file;
+  f->output = mode[0] != 'r';
+  return f;
+}
+
+bool lisp_file_close(lisp_runtime *rt, lisp_file *f)
+{
+  bool ok = true;
+
+  if (f->file != NULL) {
+    ok = fclose(f->file) == 0;
+    f->file = NULL;
+  }
+  if (!ok) {
+    lisp_error(rt, "unable to finish writing file");
+  }
+  return ok;
+}
+
+/**
+   @brief Make sure a file is open, and open in the right direction.
+ */
+static bool lisp_file_check(lisp_runtime *rt, lisp_file *f, bool output)
+{
+  if (f->file == NULL) {
+    lisp_error(rt, "file is closed");
+    return false;
+  } else if (f->output != output) {
+    lisp_error(rt, "file isn't open for %s", output ? "writing" : "reading");
+    return false;
+  }
+  return true;
+}
+
+lisp_string *lisp_file_read_record(lisp_runtime *rt, lisp_file *f,
+                                   int delimiter)
+{
+  ssize_t length;
+
+  if (!lisp_file_check(rt, f, false)) {
+    return NULL;
+  }
+  length = getdelim(&f->line, &f->capacity, delimiter, f->file);
+  if (length < 0) {
+    if (ferror(f->file)) {
+      lisp_error(rt, "unable to read file");
+    }
+    return NULL;
+  }
+  if (length > 0 && f->line[length - 1] == delimiter) {
+    length--;
+  }
+  return lisp_string_new(rt, f->line, length);
+}
+
+static lisp_value *lisp_file_next_record(lisp_runtime *rt, lisp_value *source)
+{
+  lisp_file *f = (lisp_file*)source;
+  return (lisp_value*)lisp_file_read_record(rt, f, f->delimiter);
+}
+
+lisp_lazy *lisp_file_records(lisp_runtime *rt, lisp_file *f, int delimiter)
+{
+  f->delimiter = delimiter;
+  return lisp_lazy_source(rt, &lisp_file_next_record, (lisp_value*)f);
+}
+
+bool lisp_file_write(lisp_runtime *rt, lisp_file *f, lisp_value *text)
+{
+  lisp_string *str;
+  bool ok;
+
+  if (!lisp_file_check(rt, f, true)) {
+    return false;
+  }
+  if (lisp_type_of(text) == &tp_rope) {
+    ok = lisp_rope_write((lisp_rope*)text, f->file);
+  } else {
+    str = (lisp_string*)text;
+    ok = fwrite(str->data, 1, str->length, f->file) == str->length;
+  }
+  if (!ok) {
+    lisp_error(rt, "unable to write file");
+  }
+  return ok;
+}
+
+static void lisp_file_unmap(char *data, size_t length)
+{
+  munmap(data, length);
+}
+
+lisp_string *lisp_file_read_all(lisp_runtime *rt, const char *path)
+{
+  struct stat sb;
+  lisp_string *rv;
+  char *data, *map;
+  size_t length = 0, capacity = FILE_BUFFER;
+  ssize_t count;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &sb) != 0) {
+    if (fd >= 0) close(fd);
+    lisp_error(rt, "unable to read %s", path);
+    return NULL;
+  }
+
+  // Short strings keep their bytes inline anyway, so only longer files are
+  // worth mapping.
+  if (S_ISREG(sb.st_mode) && sb.st_size > LISP_STRING_SMALL) {
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      lisp_error(rt, "unable to map %s", path);
+      return NULL;
+    }
+    return lisp_string_external(rt, map, sb.st_size, &lisp_file_unmap);
+  }
+
+  // Anything else (like a pipe) may not say how long it is, so it's read
+  // until it ends.
+  data = smb_new(char, capacity);
+  while ((count = read(fd, data + length, capacity - length)) > 0) {
+    length += count;
+    if (length == capacity) {
+      capacity *= 2;
+      data = smb_renew(char, data, capacity);
+    }
+  }
+  close(fd);
+  if (count < 0) {
+    smb_free(data);
+    lisp_error(rt, "unable to read %s", path);
+    return NULL;
+  }
+  rv = lisp_string_new(rt, data, length);
+  smb_free(data);
+  return rv;
+}
+
+/*******************************************************************************
+                              tp_file / lisp_file
+*******************************************************************************/
+
+static lisp_value *lisp_file_alloc(lisp_runtime *rt)
+{
+  lisp_arena *arena = rt->arena;
+  lisp_file *f;
+
+  // Files are never copied (see lisp_file_copy()), so they can't be allocated
+  // from an arena, which would copy them when they escape.
+  rt->arena = NULL;
+  f = (lisp_file*)lisp_alloc(rt, &tp_file, sizeof(lisp_file));
+  rt->arena = arena;
+  if (f == NULL) return NULL;
+  f->file = NULL;
+  f->output = false;
+  f->delimiter = '\n';
+  f->line = NULL;
+  f->capacity = 0;
+  return (lisp_value*)f;
+}
+
+static void lisp_file_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_file *f = (lisp_file*)value;
+  if (f->file != NULL) {
+    fclose(f->file);
+  }
+  free(f->line); // allocated by getdelim()
+  lisp_free(rt, value, sizeof(lisp_file));
+}
+
+static void lisp_file_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)value; // unused
+  (void)indent; // unused
+  fprintf(f, "file\n");
+}
+
+static lisp_value *lisp_file_copy(lisp_runtime *rt, lisp_value *value,
+                                  lisp_value *(*child)(lisp_runtime *,
+                                                       lisp_value *))
+{
+  (void)value; // unused
+  (void)child; // unused
+  // Two copies would both close the file, and other threads can't share its
+  // position.
+  return lisp_error(rt, "a file can't be copied or frozen");
+}
+
+lisp_type tp_file = {
+  .tp_name = "file",
+  .tp_index = TP_FILE,
+  .tp_alloc = &lisp_file_alloc,
+  .tp_dealloc = &lisp_file_dealloc,
+  .tp_print = &lisp_file_print,
+  .tp_copy = &lisp_file_copy
+};
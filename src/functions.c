@@ -13,15 +13,18 @@
 
 *******************************************************************************/
 
+#include <limits.h>
+#include <math.h>
 #include <stdarg.h>
 #include <string.h>
 
+#include "libstephen/al.h"
 #include "libstephen/ht.h"
 #include "lisp.h"
 
 bool lisp_truthy(lisp_value *expr)
 {
-  return (expr->type == &tp_int) && (((lisp_int*)expr)->value != 0);
+  return (lisp_type_of(expr) == &tp_int) && (((lisp_int*)expr)->value != 0);
 }
 
 static lisp_type *get_type(char code) {
@@ -38,6 +41,30 @@ static lisp_type *get_type(char code) {
     return &tp_builtin;
   case 'c':
     return &tp_funccall;
+  case 's':
+    return &tp_string;
+  case 'f':
+    return &tp_future;
+  case 'o':
+    return &tp_coroutine;
+  case 'h':
+    return &tp_channel;
+  case 'v':
+    return &tp_vector;
+  case 'm':
+    return &tp_hash;
+  case 'r':
+    return &tp_array;
+  case 'z':
+    return &tp_lazy;
+  case 'p':
+    return &tp_rope;
+  case 'e':
+    return &tp_file;
+  case 'V':
+    return &tp_pvector;
+  case 'M':
+    return &tp_phash;
   default:
     return NULL;
   }
@@ -54,9 +81,11 @@ static lisp_type *get_type(char code) {
    and extract it into a correctly typed variable, this function simplifies it
    for you.  You pass a format string where character i codes for the type of
    argument i.  This function ensures the correct type and number of arguments,
-   and puts them into the variables you specify.
+   and puts them into the variables you specify.  If the arguments don't match,
+   an error is raised and false is returned.
  */
-static void get_args(char *fname, lisp_list *args, char *format, ...)
+static bool get_args(lisp_runtime *rt, char *fname, lisp_list *args,
+                     char *format, ...)
 {
   va_list va;
   int nargs;
@@ -65,59 +94,220 @@ static void get_args(char *fname, lisp_list *args, char *format, ...)
   lisp_type *expected_type;
   va_start(va, format);
 
-  nargs = lisp_list_length(args);
+  nargs = lisp_list_length((lisp_value*)args);
   nexp = strlen(format);
   if (nargs != nexp) {
-    fprintf(stderr, "%s: wrong number of args (expected %d, got %d)\n",
-            fname, nexp, nargs);
-    exit(EXIT_FAILURE);
+    va_end(va);
+    lisp_error(rt, "%s: wrong number of args (expected %d, got %d)",
+               fname, nexp, nargs);
+    return false;
   }
 
   for (int i = 0; i < nargs; i++) {
     v = va_arg(va, lisp_value**);
     expected_type = get_type(format[i]);
-    if (expected_type != NULL && expected_type != args->value->type) {
-      fprintf(stderr, "%s: argument %d: expected type %s, got type %s\n",
-              fname, i, expected_type->tp_name, args->value->type->tp_name);
-      exit(EXIT_FAILURE);
+    // Lists may be in either representation.
+    if (expected_type == &tp_list && lisp_is_list(args->value)) {
+      expected_type = lisp_type_of(args->value);
+    }
+    if (expected_type != NULL && expected_type != lisp_type_of(args->value)) {
+      va_end(va);
+      lisp_error(rt, "%s: argument %d: expected type %s, got type %s",
+                 fname, i, expected_type->tp_name,
+                 lisp_type_of(args->value)->tp_name);
+      return false;
     }
     *v = args->value;
     args = args->next;
   }
 
   va_end(va);
+  return true;
+}
+
+static lisp_value *make_int(lisp_runtime *rt, long int value)
+{
+  lisp_int *rv = (lisp_int*)tp_int.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->value = value;
+  return (lisp_value*)rv;
 }
 
 /**
-   @brief Add any number of values.
+   @brief A number argument, which may be an integer or a float.
+ */
+typedef struct {
+  bool is_float;
+  long i;
+  double f;
+  /**
+     @brief The argument itself, if it's a bignum (and then i is unused).
+   */
+  lisp_value *big;
+} lisp_number;
+
+/**
+   @brief Read a number argument.
+   @returns false, with an error raised, if the value isn't a number.
  */
-static lisp_value *lisp_add(lisp_list *params, lisp_scope *scope)
+static bool get_number(lisp_runtime *rt, char *fname, int index,
+                       lisp_value *v, lisp_number *n)
 {
-  (void)scope; //unused
-  lisp_int *rv = (lisp_int*)tp_int.tp_alloc();
-  while (params->value) {
-    if (params->value->type != &tp_int) {
-      fprintf(stderr, "lisp_add(): type error\n");
-      exit(EXIT_FAILURE);
-    }
-    rv->value += ((lisp_int*)params->value)->value;
+  n->big = NULL;
+  if (lisp_is_float(v)) {
+    n->is_float = true;
+    n->f = lisp_float_value(v);
+    return true;
+  } else if (v->type == &tp_int) {
+    n->is_float = false;
+    n->i = ((lisp_int*)v)->value;
+    n->f = (double)n->i;
+    return true;
+  } else if (v->type == &tp_bignum) {
+    n->is_float = false;
+    n->i = 0;
+    n->f = lisp_integer_to_double(v);
+    n->big = v;
+    return true;
+  }
+  lisp_error(rt, "%s: argument %d: expected a number, got type %s", fname,
+             index, v->type->tp_name);
+  return false;
+}
+
+/**
+   @brief Combine two integers of either kind, with +, -, * or /.
+   @param b Not zero, if op is '/'.
+   @returns NEW REFERENCE to the result.
+ */
+static lisp_value *arith_big(lisp_runtime *rt, lisp_value *a, lisp_value *b,
+                             char op)
+{
+  switch (op) {
+  case '+': return lisp_integer_add(rt, a, b);
+  case '-': return lisp_integer_sub(rt, a, b);
+  case '*': return lisp_integer_mul(rt, a, b);
+  default: return lisp_integer_divide(rt, a, b, '/');
+  }
+}
+
+/**
+   @brief Combine numbers with +, -, * or /, from left to right.
+
+   The result is an integer until a float turns up, and a float from then on.
+   Integers stay longs until a result overflows, and are bignums from then on
+   (until a result fits in a long again).  Integer division truncates.  Given a
+   single argument, - negates it and / takes its reciprocal.
+ */
+static lisp_value *arith(lisp_runtime *rt, lisp_list *params, char *fname,
+                         char op)
+{
+  int len = lisp_list_length((lisp_value*)params), index = 0;
+  lisp_value *x, *y, *r;
+  lisp_number acc, n;
+  bool overflow;
+  long i;
+
+  acc.is_float = false;
+  acc.big = NULL;
+  acc.i = (op == '+' || op == '-') ? 0 : 1;
+  if ((op == '-' || op == '/') && len == 0) {
+    return lisp_error(rt, "%s: too few arguments", fname);
+  } else if ((op == '-' || op == '/') && len > 1) {
+    if (!get_number(rt, fname, index++, params->value, &acc)) return NULL;
+    lisp_incref(acc.big);
     params = params->next;
   }
-  return (lisp_value *)rv;
+
+  // The accumulator holds a reference to its bignum, if it has one.
+  for (; params->value != NULL; params = params->next) {
+    if (!get_number(rt, fname, index++, params->value, &n)) {
+      lisp_decref(rt, acc.big);
+      return NULL;
+    }
+    if (n.is_float && !acc.is_float) {
+      acc.is_float = true;
+      acc.f = acc.big != NULL ? lisp_integer_to_double(acc.big) :
+        (double)acc.i;
+      lisp_decref(rt, acc.big);
+      acc.big = NULL;
+    }
+    if (acc.is_float) {
+      switch (op) {
+      case '+': acc.f += n.f; break;
+      case '-': acc.f -= n.f; break;
+      case '*': acc.f *= n.f; break;
+      default: acc.f /= n.f; break;
+      }
+      continue;
+    }
+    if (op == '/' && n.big == NULL && n.i == 0) {
+      lisp_decref(rt, acc.big);
+      return lisp_error(rt, "%s: division by zero", fname);
+    }
+    if (acc.big == NULL && n.big == NULL) {
+      switch (op) {
+      case '+': overflow = __builtin_add_overflow(acc.i, n.i, &i); break;
+      case '-': overflow = __builtin_sub_overflow(acc.i, n.i, &i); break;
+      case '*': overflow = __builtin_mul_overflow(acc.i, n.i, &i); break;
+      default:
+        // Dividing the smallest long by -1 is the only quotient that overflows.
+        overflow = acc.i == LONG_MIN && n.i == -1;
+        i = overflow ? 0 : acc.i / n.i;
+        break;
+      }
+      if (!overflow) {
+        acc.i = i;
+        continue;
+      }
+    }
+    x = acc.big != NULL ? acc.big : make_int(rt, acc.i);
+    y = n.big != NULL ? n.big : make_int(rt, n.i);
+    r = x == NULL || y == NULL ? NULL : arith_big(rt, x, y, op);
+    lisp_decref(rt, x);
+    if (n.big == NULL) {
+      lisp_decref(rt, y);
+    }
+    acc.big = NULL;
+    if (r == NULL) {
+      return NULL;
+    } else if (r->type == &tp_int) {
+      acc.i = ((lisp_int*)r)->value;
+      lisp_decref(rt, r);
+    } else {
+      acc.big = r;
+    }
+  }
+  if (acc.is_float) {
+    return lisp_float(acc.f);
+  }
+  return acc.big != NULL ? acc.big : make_int(rt, acc.i);
+}
+
+/**
+   @brief Add any number of values.
+ */
+static lisp_value *lisp_add(lisp_runtime *rt, lisp_list *params,
+                            lisp_scope *scope)
+{
+  (void)scope; //unused
+  return arith(rt, params, "+", '+');
 }
 
 /**
    @brief Return the length of a list.
  */
-static lisp_value *lisp_length(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_length(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
 {
   (void)scope; //unused
-  lisp_list *l;
+  lisp_value *l;
   lisp_int *i;
 
-  get_args("length", params, "l", &l);
+  if (!get_args(rt, "length", params, "l", &l)) return NULL;
 
-  i = (lisp_int*)tp_int.tp_alloc();
+  i = (lisp_int*)tp_int.tp_alloc(rt);
+  if (i == NULL) return NULL;
   i->value = lisp_list_length(l);
   return (lisp_value*)i;
 }
@@ -125,135 +315,318 @@ static lisp_value *lisp_length(lisp_list *params, lisp_scope *scope)
 /**
    @brief Subtract some number of values form the first one.
  */
-static lisp_value *lisp_subtract(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_subtract(lisp_runtime *rt, lisp_list *params,
+                                 lisp_scope *scope)
 {
   (void)scope; //unused
-  lisp_int *rv;
-  int len = lisp_list_length(params);
-
-  if (len == 0) {
-    fprintf(stderr, "lisp_subtract(): too few arguments\n");
-    exit(EXIT_FAILURE);
-  } else if (len == 1) {
-    // negate the argument
-    if (params->value->type != &tp_int) {
-      fprintf(stderr, "lisp_subtract(): wrong type argument\n");
-      exit(EXIT_FAILURE);
-    }
-    rv = (lisp_int*)tp_int.tp_alloc();
-    rv->value = -((lisp_int*)params->value)->value;
-  } else {
-    if (params->value->type != &tp_int) {
-      fprintf(stderr, "lisp_subtract(): wrong type argument\n");
-      exit(EXIT_FAILURE);
+  return arith(rt, params, "-", '-');
+}
+
+/**
+   @brief Multiply any number of values.
+ */
+static lisp_value *lisp_multiply(lisp_runtime *rt, lisp_list *params,
+                                 lisp_scope *scope)
+{
+  (void)scope; //unused
+  return arith(rt, params, "*", '*');
+}
+
+/**
+   @brief Divide the first value by the rest.
+ */
+static lisp_value *lisp_divide(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
+{
+  (void)scope; //unused
+  return arith(rt, params, "/", '/');
+}
+
+/**
+   @brief Convert a number to a float.
+ */
+static lisp_value *lisp_float_builtin(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; //unused
+  lisp_value *v;
+  lisp_number n;
+  if (!get_args(rt, "float", params, "?", &v)) return NULL;
+  if (!get_number(rt, "float", 0, v, &n)) return NULL;
+  return lisp_float(n.f);
+}
+
+/**
+   @brief Convert a number to an integer, rounding toward zero.
+ */
+static lisp_value *lisp_truncate(lisp_runtime *rt, lisp_list *params,
+                                 lisp_scope *scope)
+{
+  (void)scope; //unused
+  lisp_value *v;
+  lisp_number n;
+
+  if (!get_args(rt, "truncate", params, "?", &v)) return NULL;
+  if (!get_number(rt, "truncate", 0, v, &n)) return NULL;
+  if (!n.is_float) {
+    lisp_incref(v);
+    return v;
+  }
+  // LONG_MAX rounds up to a power of two as a double.
+  if (n.f >= (double)LONG_MIN && n.f < (double)LONG_MAX) {
+    return make_int(rt, (long)n.f);
+  } else if (n.f - n.f != 0) {
+    // Only infinities and NaN aren't zero when subtracted from themselves.
+    return lisp_error(rt, "truncate: %g has no integer value", n.f);
+  }
+  return lisp_integer_from_double(rt, n.f);
+}
+
+/**
+   @brief Read two integer arguments.
+   @returns false, with an error raised, if they aren't two integers.
+ */
+static bool get_integers(lisp_runtime *rt, char *fname, lisp_list *params,
+                         lisp_value **a, lisp_value **b)
+{
+  if (!get_args(rt, fname, params, "??", a, b)) return false;
+  for (int i = 0; i < 2; i++) {
+    lisp_value *v = i == 0 ? *a : *b;
+    if (!lisp_is_integer(v)) {
+      lisp_error(rt, "%s: argument %d: expected an integer, got type %s",
+                 fname, i, lisp_type_of(v)->tp_name);
+      return false;
     }
-    rv = (lisp_int*)tp_int.tp_alloc();
-    rv->value = ((lisp_int*)params->value)->value;
+  }
+  return true;
+}
 
-    params = params->next;
-    while (params) {
-      if (params->value->type != &tp_int) {
-        fprintf(stderr, "lisp_subtract(): wrong type argument\n");
-        exit(EXIT_FAILURE);
-      }
-      rv->value -= ((lisp_int*)params->value)->value;
-      params = params->next;
+/**
+   @brief Return the remainder ('r') or modulus ('m') of two integers.
+ */
+static lisp_value *integer_mod(lisp_runtime *rt, lisp_list *params,
+                               char *fname, char op)
+{
+  lisp_value *a, *b;
+  long x, y, r;
+
+  if (!get_integers(rt, fname, params, &a, &b)) return NULL;
+  if (b->type == &tp_int && ((lisp_int*)b)->value == 0) {
+    return lisp_error(rt, "%s: division by zero", fname);
+  }
+  if (a->type == &tp_int && b->type == &tp_int) {
+    x = ((lisp_int*)a)->value;
+    y = ((lisp_int*)b)->value;
+    // The smallest long % -1 overflows, though the answer is plainly 0.
+    r = y == -1 ? 0 : x % y;
+    if (op == 'm' && r != 0 && (r < 0) != (y < 0)) {
+      r += y;
     }
+    return make_int(rt, r);
   }
+  return lisp_integer_divide(rt, a, b, op);
+}
 
-  return (lisp_value*)rv;
+/**
+   @brief Return the remainder of dividing two integers, with the sign of the
+   first.
+ */
+static lisp_value *lisp_remainder(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; //unused
+  return integer_mod(rt, params, "remainder", 'r');
 }
 
-static lisp_value *lisp_car(lisp_list *params, lisp_scope *scope)
+/**
+   @brief Return the first integer modulo the second, with the sign of the
+   second.
+ */
+static lisp_value *lisp_modulo(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
 {
   (void)scope; //unused
-  lisp_list *l;
-  get_args("car", params, "l", &l);
+  return integer_mod(rt, params, "modulo", 'm');
+}
+
+/**
+   @brief Raise a number to a power.
+
+   An integer raised to a non-negative integer power is exact, by repeated
+   squaring.  Anything else is a float.
+ */
+static lisp_value *lisp_expt(lisp_runtime *rt, lisp_list *params,
+                             lisp_scope *scope)
+{
+  (void)scope; //unused
+  lisp_value *vb, *ve, *x, *t, *rv;
+  lisp_number b, e;
+  long power;
+
+  if (!get_args(rt, "expt", params, "??", &vb, &ve) ||
+      !get_number(rt, "expt", 0, vb, &b) ||
+      !get_number(rt, "expt", 1, ve, &e)) {
+    return NULL;
+  }
+  if (b.is_float || e.is_float || e.i < 0) {
+    return lisp_float(pow(b.f, e.f));
+  } else if (e.big != NULL) {
+    return lisp_error(rt, "expt: exponent is too big");
+  }
+
+  power = e.i;
+  rv = make_int(rt, 1);
+  x = vb;
+  lisp_incref(x);
+  while (power > 0 && rv != NULL && x != NULL) {
+    if (power & 1) {
+      t = lisp_integer_mul(rt, rv, x);
+      lisp_decref(rt, rv);
+      rv = t;
+    }
+    power >>= 1;
+    if (power > 0) {
+      t = lisp_integer_mul(rt, x, x);
+      lisp_decref(rt, x);
+      x = t;
+    }
+  }
+  if (x == NULL) {
+    lisp_decref(rt, rv);
+    return NULL;
+  }
+  lisp_decref(rt, x);
+  return rv;
+}
+
+static lisp_value *lisp_car(lisp_runtime *rt, lisp_list *params,
+                            lisp_scope *scope)
+{
+  (void)scope; //unused
+  lisp_value *l, *first;
+  if (!get_args(rt, "car", params, "l", &l)) return NULL;
 
-  if (l->value == NULL) {
-    fprintf(stderr, "lisp_car(): car of empty list\n");
-    exit(EXIT_FAILURE);
+  first = lisp_list_first(l);
+  if (first == NULL) {
+    return lisp_error(rt, "car: car of empty list");
   }
 
-  lisp_incref(l->value);
-  return l->value;
+  lisp_incref(first);
+  return first;
 }
 
-static lisp_value *lisp_cdr(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_cdr(lisp_runtime *rt, lisp_list *params,
+                            lisp_scope *scope)
 {
   (void)scope; //unused
-  lisp_list *l;
-  get_args("cdr", params, "l", &l);
+  lisp_value *l;
+  if (!get_args(rt, "cdr", params, "l", &l)) return NULL;
 
-  if (l == NULL) {
-    return NULL;
-  } else {
-    lisp_incref((lisp_value*)l->next);
-    return (lisp_value*)l->next;
+  if (lisp_list_first(l) == NULL) {
+    return lisp_error(rt, "cdr: cdr of empty list");
   }
+
+  return lisp_list_rest(rt, l);
 }
 
-static lisp_value *lisp_cons(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_cons(lisp_runtime *rt, lisp_list *params,
+                             lisp_scope *scope)
 {
   (void)scope; //unused
   lisp_value *v;
-  lisp_list *old_list;
-  lisp_list *new_list;
+  lisp_value *old_list;
+
+  if (!get_args(rt, "cons", params, "?l", &v, &old_list)) return NULL;
+  return lisp_list_cons(rt, v, old_list);
+}
 
-  get_args("cons", params, "?l", &v, &old_list);
+/**
+   @brief Return a list of the arguments.
+ */
+static lisp_value *lisp_list_builtin(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; //unused
+  lisp_list_iter it;
+  lisp_value **items;
+  lisp_value *rv;
+  int n = lisp_list_length((lisp_value*)params);
 
-  new_list = (lisp_list*)tp_list.tp_alloc();
-  new_list->value = v;
-  new_list->next = old_list;
-  lisp_incref(v);
-  lisp_incref((lisp_value*)old_list);
-  return (lisp_value*)new_list;
+  items = smb_new(lisp_value*, n);
+  lisp_list_iter_init(&it, (lisp_value*)params);
+  for (int i = 0; i < n; i++) {
+    items[i] = lisp_list_iter_next(&it);
+  }
+  rv = lisp_list_from_array(rt, items, n);
+  smb_free(items);
+  return rv;
 }
 
-static lisp_value *lisp_exit(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_exit(lisp_runtime *rt, lisp_list *params,
+                             lisp_scope *scope)
 {
   (void)scope; //unused
   (void)params; // unused
   lisp_value *rv;
-  lisp_interactive_exit = true;
+  rt->quit = true;
   if (params->value != NULL) {
     rv = params->value;
     lisp_incref(rv);
   } else {
-    rv = (lisp_value*)tp_int.tp_alloc();
+    rv = (lisp_value*)tp_int.tp_alloc(rt);
   }
   return rv;
 }
 
-static lisp_value *lisp_if(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_if(lisp_runtime *rt, lisp_list *params,
+                           lisp_scope *scope)
 {
   lisp_value *condition, *if_true, *if_false;
-  get_args("if", params, "???", &condition, &if_true, &if_false);
+  if (!get_args(rt, "if", params, "???", &condition, &if_true, &if_false)) {
+    return NULL;
+  }
 
-  condition = lisp_evaluate(condition, scope);
-  if (lisp_truthy(condition)) {
-    return lisp_evaluate(if_true, scope);
+  condition = lisp_evaluate(rt, condition, scope);
+  if (condition == NULL) {
+    return NULL;
+  } else if (lisp_truthy(condition)) {
+    lisp_decref(rt, condition);
+    return lisp_evaluate(rt, if_true, scope);
   } else {
-    return lisp_evaluate(if_false, scope);
+    lisp_decref(rt, condition);
+    return lisp_evaluate(rt, if_false, scope);
   }
 }
 
-static lisp_value *lisp_lambda(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_lambda(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
 {
   (void)scope; //unused (for now)
   lisp_value *arglist;
   lisp_value *expression;
   lisp_list *list;
-  lisp_function *function = (lisp_function*)tp_function.tp_alloc();
-  get_args("lambda", params, "??", &arglist, &expression);
+  lisp_function *function;
+  if (!get_args(rt, "lambda", params, "??", &arglist, &expression)) return NULL;
+  function = (lisp_function*)tp_function.tp_alloc(rt);
+  if (function == NULL) return NULL;
 
   // The argument list will show up as a func call when there are any arguments,
   // but it will be an empty list if there aren't.
-  if (arglist->type == &tp_list) {
+  if (lisp_type_of(arglist) == &tp_list) {
     lisp_incref(arglist);
     function->arglist = (lisp_list*) arglist;
-  } else if (arglist->type == &tp_funccall) {
-    list = (lisp_list*)tp_list.tp_alloc();
+  } else if (lisp_type_of(arglist) == &tp_clist) {
+    function->arglist = lisp_list_cells(rt, arglist);
+    if (function->arglist == NULL) {
+      lisp_decref(rt, (lisp_value*)function);
+      return NULL;
+    }
+  } else if (lisp_type_of(arglist) == &tp_funccall) {
+    list = (lisp_list*)tp_list.tp_alloc(rt);
+    if (list == NULL) {
+      lisp_decref(rt, (lisp_value*)function);
+      return NULL;
+    }
     list->value = ((lisp_funccall*)arglist)->function;
     list->next = ((lisp_funccall*)arglist)->arguments;
     lisp_incref(list->value);
@@ -265,80 +638,174 @@ static lisp_value *lisp_lambda(lisp_list *params, lisp_scope *scope)
   return (lisp_value*)function;
 }
 
-static lisp_value *lisp_define(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_define(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
 {
   lisp_identifier *name;
-  lisp_value *value;
-  get_args("define", params, "i?", &name, &value);
-  value = lisp_evaluate(value, scope);
-  lisp_incref(value); // one reference belongs to the table
-  lisp_incref((lisp_value*)name); // one reference belongs to the table (but never leaves...)
-  ht_insert(&scope->table, PTR(name->value), PTR(value));
+  lisp_value *expr, *result, *value;
+  if (!get_args(rt, "define", params, "i?", &name, &expr)) return NULL;
+  result = lisp_evaluate(rt, expr, scope);
+  if (result == NULL) {
+    return NULL;
+  }
+  // If the scope outlives the current arena, these are copied out of it.
+  value = lisp_arena_escape(rt, scope, result); // one reference belongs to the table
+  lisp_decref(rt, result);
+  // The binding borrows the identifier's name, so the scope keeps it.
+  name = (lisp_identifier*)lisp_arena_escape(rt, scope, (lisp_value*)name);
+  // Either copy may have run out of heap, and nothing half-copied is bound.
+  if (rt->error) {
+    lisp_decref(rt, value);
+    lisp_decref(rt, (lisp_value*)name);
+    return NULL;
+  }
+  lisp_scope_bind(rt, scope, name->value, value);
+  lisp_scope_keep(scope, (lisp_value*)name);
+  lisp_incref(value);
   return value;
 }
 
-static lisp_value *lisp_numeq(lisp_list *params, lisp_scope *scope)
+/**
+   @brief Compare an integer with a float exactly.  Rounding the integer to a
+   double would make integers past 2^53, and bignums, compare wrongly.
+   @param vx The integer.
+   @param x The integer, as read by get_number().
+   @param[out] cmp As for compare().
+   @returns false, with an error raised, if out of memory.
+ */
+static bool compare_float(lisp_runtime *rt, lisp_value *vx, lisp_number *x,
+                          double f, int *cmp)
+{
+  lisp_value *vt;
+  double t = trunc(f);
+  long ti;
+
+  if (isnan(f)) {
+    *cmp = 2;
+    return true;
+  } else if (isinf(f)) {
+    *cmp = f > 0 ? -1 : 1;
+    return true;
+  }
+
+  // Compare with the integer part of the float, and if that's equal, the
+  // fraction decides it.
+  if (x->big == NULL && t >= (double)LONG_MIN && t < -(double)LONG_MIN) {
+    ti = (long)t;
+    *cmp = (x->i > ti) - (x->i < ti);
+  } else {
+    vt = lisp_integer_from_double(rt, t);
+    if (vt == NULL) {
+      return false;
+    }
+    *cmp = lisp_integer_compare(vx, vt);
+    lisp_decref(rt, vt);
+  }
+  if (*cmp == 0) {
+    *cmp = (f < t) - (f > t);
+  }
+  return true;
+}
+
+/**
+   @brief Compare two numbers exactly: as floats only if both are floats.
+   @param[out] cmp -1, 0 or 1 if the first is less than, equal to or greater
+   than the second, or 2 if either is NaN, so that every comparison fails.
+   @returns false, with an error raised, if the arguments aren't two numbers.
+ */
+static bool compare(lisp_runtime *rt, lisp_list *params, char *fname,
+                    int *cmp)
+{
+  lisp_value *va, *vb;
+  lisp_number a, b;
+
+  if (!get_args(rt, fname, params, "??", &va, &vb) ||
+      !get_number(rt, fname, 0, va, &a) ||
+      !get_number(rt, fname, 1, vb, &b)) {
+    return false;
+  }
+  if (!a.is_float && !b.is_float && a.big == NULL && b.big == NULL) {
+    *cmp = (a.i > b.i) - (a.i < b.i);
+  } else if (!a.is_float && !b.is_float) {
+    *cmp = lisp_integer_compare(va, vb);
+  } else if (!a.is_float) {
+    return compare_float(rt, va, &a, b.f, cmp);
+  } else if (!b.is_float) {
+    if (!compare_float(rt, vb, &b, a.f, cmp)) {
+      return false;
+    }
+    if (*cmp != 2) {
+      *cmp = -*cmp;
+    }
+  } else if (a.f == b.f) {
+    *cmp = 0;
+  } else if (a.f < b.f) {
+    *cmp = -1;
+  } else if (a.f > b.f) {
+    *cmp = 1;
+  } else {
+    *cmp = 2;
+  }
+  return true;
+}
+
+static lisp_value *lisp_numeq(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
 {
   (void)scope; // unused
-  lisp_int *a, *b, *retval;
-  get_args("=", params, "dd", &a, &b);
-  retval = (lisp_int *)tp_int.tp_alloc();
-  retval->value = (a->value == b->value);
-  return (lisp_value *)retval;
+  int cmp;
+  if (!compare(rt, params, "=", &cmp)) return NULL;
+  return make_int(rt, cmp == 0);
 }
 
-static lisp_value *lisp_numlt(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_numlt(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
 {
   (void)scope; // unused
-  lisp_int *a, *b, *retval;
-  get_args("=", params, "dd", &a, &b);
-  retval = (lisp_int *)tp_int.tp_alloc();
-  retval->value = (a->value < b->value);
-  return (lisp_value *)retval;
+  int cmp;
+  if (!compare(rt, params, "<", &cmp)) return NULL;
+  return make_int(rt, cmp == -1);
 }
 
-static lisp_value *lisp_numgt(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_numgt(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
 {
   (void)scope; // unused
-  lisp_int *a, *b, *retval;
-  get_args("=", params, "dd", &a, &b);
-  retval = (lisp_int *)tp_int.tp_alloc();
-  retval->value = (a->value > b->value);
-  return (lisp_value *)retval;
+  int cmp;
+  if (!compare(rt, params, ">", &cmp)) return NULL;
+  return make_int(rt, cmp == 1);
 }
 
-static lisp_value *lisp_numle(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_numle(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
 {
   (void)scope; // unused
-  lisp_int *a, *b, *retval;
-  get_args("=", params, "dd", &a, &b);
-  retval = (lisp_int *)tp_int.tp_alloc();
-  retval->value = (a->value <= b->value);
-  return (lisp_value *)retval;
+  int cmp;
+  if (!compare(rt, params, "<=", &cmp)) return NULL;
+  return make_int(rt, cmp == -1 || cmp == 0);
 }
 
-static lisp_value *lisp_numge(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_numge(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
 {
   (void)scope; // unused
-  lisp_int *a, *b, *retval;
-  get_args("=", params, "dd", &a, &b);
-  retval = (lisp_int *)tp_int.tp_alloc();
-  retval->value = (a->value >= b->value);
-  return (lisp_value *)retval;
+  int cmp;
+  if (!compare(rt, params, ">=", &cmp)) return NULL;
+  return make_int(rt, cmp == 0 || cmp == 1);
 }
 
-static lisp_value *lisp_null_p(lisp_list *params, lisp_scope *scope)
+static lisp_value *lisp_null_p(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
 {
   (void)scope; // unused
   lisp_value *v;
-  lisp_list *l;
   lisp_int *retval;
-  get_args("null?", params, "?", &v);
-  retval = (lisp_int*) tp_int.tp_alloc();
+  if (!get_args(rt, "null?", params, "?", &v)) return NULL;
+  retval = (lisp_int*) tp_int.tp_alloc(rt);
+  if (retval == NULL) return NULL;
 
-  if (v->type == &tp_list) {
-    l = (lisp_list *) v;
-    retval->value = (l->value == NULL);
+  if (lisp_is_list(v)) {
+    retval->value = (lisp_list_first(v) == NULL);
   } else {
     retval->value = 0;
   }
@@ -346,79 +813,1918 @@ static lisp_value *lisp_null_p(lisp_list *params, lisp_scope *scope)
 }
 
 /**
-   @brief Return a scope containing the top-level variables for our lisp.
+   @brief Return the length of a string, in bytes.
  */
-lisp_scope *lisp_create_globals(void)
+static lisp_value *lisp_string_length(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
 {
-  lisp_scope *scope = lisp_scope_create();
-  lisp_builtin *bi;
+  (void)scope; // unused
+  lisp_string *str;
+  if (!get_args(rt, "string-length", params, "s", &str)) return NULL;
+  return make_int(rt, str->length);
+}
+
+/**
+   @brief Return the part of a string from start (inclusive) to end (exclusive).
+
+   The end is optional, and defaults to the length of the string.
+ */
+static lisp_value *lisp_substring(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_string *str;
+  lisp_int *start, *end;
+  long int e;
+
+  if (lisp_list_length((lisp_value*)params) == 2) {
+    if (!get_args(rt, "substring", params, "sd", &str, &start)) return NULL;
+    e = str->length;
+  } else {
+    if (!get_args(rt, "substring", params, "sdd", &str, &start, &end)) {
+      return NULL;
+    }
+    e = end->value;
+  }
+
+  if (start->value < 0 || start->value > e || e > (long int)str->length) {
+    return lisp_error(rt, "substring: range %ld to %ld out of bounds for "
+                      "length %zu", start->value, e, str->length);
+  }
+
+  return (lisp_value*)lisp_string_substring(rt, str, start->value, e);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_add;
-  ht_insert(&scope->table, PTR(L"+"), PTR(bi));
+/**
+   @brief Concatenate any number of strings.
+ */
+static lisp_value *lisp_string_append(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_list *l;
+  lisp_string *str, *rv;
+  size_t length = 0, offset = 0;
+  int nonempty = 0;
+
+  for (l = params; l->value != NULL; l = l->next) {
+    if (lisp_type_of(l->value) != &tp_string) {
+      return lisp_error(rt, "string-append: expected type string, got type %s",
+                        lisp_type_of(l->value)->tp_name);
+    }
+    str = (lisp_string*)l->value;
+    if (str->length > 0) {
+      nonempty++;
+      rv = str;
+    }
+    length += str->length;
+  }
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_subtract;
-  ht_insert(&scope->table, PTR(L"-"), PTR(bi));
+  // Appending empty strings to one string doesn't need a copy at all.
+  if (nonempty == 1) {
+    lisp_incref((lisp_value*)rv);
+    return (lisp_value*)rv;
+  }
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_length;
-  ht_insert(&scope->table, PTR(L"length"), PTR(bi));
+  rv = lisp_string_create(rt, length);
+  if (rv == NULL) return NULL;
+  for (l = params; l->value != NULL; l = l->next) {
+    str = (lisp_string*)l->value;
+    memcpy((char*)rv->data + offset, str->data, str->length);
+    offset += str->length;
+  }
+  return (lisp_value*)rv;
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_car;
-  ht_insert(&scope->table, PTR(L"car"), PTR(bi));
+static lisp_value *lisp_string_eq(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_string *a, *b;
+  if (!get_args(rt, "string=?", params, "ss", &a, &b)) return NULL;
+  return make_int(rt, a->length == b->length &&
+                  (a->data == b->data || lisp_string_compare(a, b) == 0));
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_cdr;
-  ht_insert(&scope->table, PTR(L"cdr"), PTR(bi));
+static lisp_value *lisp_string_lt(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_string *a, *b;
+  if (!get_args(rt, "string<?", params, "ss", &a, &b)) return NULL;
+  return make_int(rt, lisp_string_compare(a, b) < 0);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_cons;
-  ht_insert(&scope->table, PTR(L"cons"), PTR(bi));
+/**
+   @brief Apply a function to each item of a list on the worker threads.
+ */
+static lisp_value *lisp_pmap(lisp_runtime *rt, lisp_list *params,
+                             lisp_scope *scope)
+{
+  lisp_value *f, *l;
+  if (!get_args(rt, "pmap", params, "?l", &f, &l)) return NULL;
+  return lisp_par_map(rt, f, l, scope);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_exit;
-  ht_insert(&scope->table, PTR(L"exit"), PTR(bi));
+/**
+   @brief Combine a list with an associative function on the worker threads.
+ */
+static lisp_value *lisp_preduce(lisp_runtime *rt, lisp_list *params,
+                                lisp_scope *scope)
+{
+  lisp_value *f, *init, *l;
+  if (!get_args(rt, "preduce", params, "??l", &f, &init, &l)) return NULL;
+  return lisp_par_reduce(rt, f, init, l, scope);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_numeq;
-  ht_insert(&scope->table, PTR(L"="), PTR(bi));
+static lisp_value *lisp_pfor_each(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  lisp_value *f, *l;
+  if (!get_args(rt, "pfor-each", params, "?l", &f, &l)) return NULL;
+  if (!lisp_par_for_each(rt, f, l, scope)) return NULL;
+  return tp_list.tp_alloc(rt);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_numlt;
-  ht_insert(&scope->table, PTR(L"<"), PTR(bi));
+/**
+   @brief Return an immutable copy of a value, which may be shared with other
+   runtimes.
+ */
+static lisp_value *lisp_freeze_builtin(lisp_runtime *rt, lisp_list *params,
+                                       lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *v;
+  if (!get_args(rt, "freeze", params, "?", &v)) return NULL;
+  return lisp_freeze(rt, v);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_numgt;
-  ht_insert(&scope->table, PTR(L">"), PTR(bi));
+static lisp_value *lisp_frozen_p(lisp_runtime *rt, lisp_list *params,
+                                 lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *v;
+  if (!get_args(rt, "frozen?", params, "?", &v)) return NULL;
+  return make_int(rt, lisp_is_float(v) || (v->flags & LISP_FLAG_FROZEN));
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_numle;
-  ht_insert(&scope->table, PTR(L"<="), PTR(bi));
+/**
+   @brief Start evaluating an expression on a worker thread.
+ */
+static lisp_value *lisp_future_builtin(lisp_runtime *rt, lisp_list *params,
+                                       lisp_scope *scope)
+{
+  lisp_value *expr;
+  if (!get_args(rt, "future", params, "?", &expr)) return NULL;
+  return (lisp_value*)lisp_future_create(rt, expr, scope);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_numge;
-  ht_insert(&scope->table, PTR(L">="), PTR(bi));
+/**
+   @brief Wait for the result of a future.
+ */
+static lisp_value *lisp_touch(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_future *future;
+  if (!get_args(rt, "touch", params, "f", &future)) return NULL;
+  return lisp_future_touch(rt, future);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_null_p;
-  ht_insert(&scope->table, PTR(L"null?"), PTR(bi));
+/**
+   @brief Create a coroutine which calls a function with the remaining args.
+ */
+static lisp_value *lisp_spawn(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
+{
+  (void)scope; // unused
+  if (params->value == NULL) {
+    return lisp_error(rt, "spawn: wrong number of args (expected at least 1, "
+                      "got 0)");
+  }
+  return (lisp_value*)lisp_coroutine_create(rt, params->value, params->next);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_if;
-  bi->eval = false;
-  ht_insert(&scope->table, PTR(L"if"), PTR(bi));
+/**
+   @brief Run a coroutine until it yields, passing it an optional value.
+ */
+static lisp_value *lisp_resume(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
+{
+  lisp_coroutine *co;
+  lisp_value *value, *rv;
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_lambda;
-  bi->eval = false;
-  ht_insert(&scope->table, PTR(L"lambda"), PTR(bi));
+  if (lisp_list_length((lisp_value*)params) == 1) {
+    if (!get_args(rt, "resume", params, "o", &co)) return NULL;
+    value = tp_list.tp_alloc(rt);
+    if (value == NULL) return NULL;
+    rv = lisp_coroutine_resume(rt, co, value, scope);
+    lisp_decref(rt, value);
+    return rv;
+  }
+  if (!get_args(rt, "resume", params, "o?", &co, &value)) return NULL;
+  return lisp_coroutine_resume(rt, co, value, scope);
+}
 
-  bi = (lisp_builtin*)tp_builtin.tp_alloc();
-  bi->function = &lisp_define;
-  bi->eval = false;
-  ht_insert(&scope->table, PTR(L"define"), PTR(bi));
+/**
+   @brief Suspend the current coroutine, returning a value from its resume.
+ */
+static lisp_value *lisp_yield(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *value;
+  if (!get_args(rt, "yield", params, "?", &value)) return NULL;
+  return lisp_coroutine_yield(rt, value);
+}
+
+static lisp_value *lisp_done_p(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_coroutine *co;
+  if (!get_args(rt, "done?", params, "o", &co)) return NULL;
+  return make_int(rt, lisp_coroutine_done(co));
+}
+
+/**
+   @brief Create a channel holding up to the given number of values.
+ */
+static lisp_value *lisp_channel_builtin(lisp_runtime *rt, lisp_list *params,
+                                        lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_int *capacity;
+  if (!get_args(rt, "channel", params, "d", &capacity)) return NULL;
+  if (capacity->value < 1 || capacity->value > LISP_CHANNEL_MAX) {
+    return lisp_error(rt, "channel: capacity must be from 1 to %d",
+                      LISP_CHANNEL_MAX);
+  }
+  return (lisp_value*)lisp_channel_create(rt, capacity->value);
+}
+
+/**
+   @brief Send a value on a channel, and return it.
+ */
+static lisp_value *lisp_send(lisp_runtime *rt, lisp_list *params,
+                             lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_channel *ch;
+  lisp_value *value;
+  if (!get_args(rt, "send", params, "h?", &ch, &value)) return NULL;
+  if (!lisp_channel_send(rt, ch, value)) return NULL;
+  lisp_incref(value);
+  return value;
+}
+
+static lisp_value *lisp_receive(lisp_runtime *rt, lisp_list *params,
+                                lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_channel *ch;
+  if (!get_args(rt, "receive", params, "h", &ch)) return NULL;
+  return lisp_channel_receive(rt, ch);
+}
+
+/**
+   @brief Return a vector of the arguments.
+ */
+static lisp_value *lisp_vector_builtin(lisp_runtime *rt, lisp_list *params,
+                                       lisp_scope *scope)
+{
+  (void)scope; // unused
+  return (lisp_value*)lisp_vector_from_list(rt, (lisp_value*)params);
+}
+
+/**
+   @brief Return a vector of n copies of a value.
+ */
+static lisp_value *lisp_make_vector(lisp_runtime *rt, lisp_list *params,
+                                    lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_int *n;
+  lisp_value *fill;
+  lisp_vector *vec;
+
+  if (!get_args(rt, "make-vector", params, "d?", &n, &fill)) return NULL;
+  if (n->value < 0 || n->value > INT_MAX) {
+    return lisp_error(rt, "make-vector: invalid length %ld", n->value);
+  }
+  vec = lisp_vector_create(rt, n->value);
+  if (vec == NULL) return NULL;
+  while (vec->length < n->value) {
+    lisp_incref(fill);
+    vec->items[vec->length++] = fill;
+  }
+  return (lisp_value*)vec;
+}
+
+static lisp_value *lisp_vector_length(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_vector *vec;
+  if (!get_args(rt, "vector-length", params, "v", &vec)) return NULL;
+  return make_int(rt, vec->length);
+}
+
+static lisp_value *lisp_vector_ref(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_vector *vec;
+  lisp_int *index;
+
+  if (!get_args(rt, "vector-ref", params, "vd", &vec, &index)) return NULL;
+  if (index->value < 0 || index->value >= vec->length) {
+    return lisp_error(rt, "vector-ref: index %ld out of range for vector of "
+                      "length %d", index->value, vec->length);
+  }
+  lisp_incref(vec->items[index->value]);
+  return vec->items[index->value];
+}
+
+/**
+   @brief Replace an item of a vector, and return the new item.
+ */
+static lisp_value *lisp_vector_set_builtin(lisp_runtime *rt, lisp_list *params,
+                                           lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_vector *vec;
+  lisp_int *index;
+  lisp_value *value;
+
+  if (!get_args(rt, "vector-set!", params, "vd?", &vec, &index, &value)) {
+    return NULL;
+  }
+  if (index->value < INT_MIN || index->value > INT_MAX) {
+    return lisp_error(rt, "vector-set!: index %ld out of range for vector of "
+                      "length %d", index->value, vec->length);
+  }
+  if (!lisp_vector_set(rt, vec, index->value, value)) return NULL;
+  lisp_incref(value);
+  return value;
+}
+
+/**
+   @brief Add an item to the end of a vector, and return the item.
+ */
+static lisp_value *lisp_vector_push_builtin(lisp_runtime *rt,
+                                            lisp_list *params,
+                                            lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_vector *vec;
+  lisp_value *value;
+
+  if (!get_args(rt, "vector-push!", params, "v?", &vec, &value)) return NULL;
+  if (!lisp_vector_push(rt, vec, value)) return NULL;
+  lisp_incref(value);
+  return value;
+}
+
+static lisp_value *lisp_vector_to_list(lisp_runtime *rt, lisp_list *params,
+                                       lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_vector *vec;
+  if (!get_args(rt, "vector->list", params, "v", &vec)) return NULL;
+  return lisp_list_from_array(rt, vec->items, vec->length);
+}
+
+static lisp_value *lisp_list_to_vector(lisp_runtime *rt, lisp_list *params,
+                                       lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *list;
+  if (!get_args(rt, "list->vector", params, "l", &list)) return NULL;
+  return (lisp_value*)lisp_vector_from_list(rt, list);
+}
+
+/**
+   @brief Return a hash map of the arguments, which alternate keys and values.
+ */
+static lisp_value *lisp_hash_builtin(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; // unused
+  int n = lisp_list_length((lisp_value*)params);
+  lisp_hash *h;
+
+  if (n % 2 != 0) {
+    return lisp_error(rt, "hash: expected keys and values in pairs, got %d "
+                      "args", n);
+  }
+  h = lisp_hash_create(rt, n / 2);
+  if (h == NULL) return NULL;
+  for (int i = 0; i < n; i += 2, params = params->next->next) {
+    if (!lisp_hash_set(rt, h, params->value, params->next->value)) {
+      lisp_decref(rt, (lisp_value*)h);
+      return NULL;
+    }
+  }
+  return (lisp_value*)h;
+}
+
+static lisp_value *lisp_make_hash(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  if (!get_args(rt, "make-hash", params, "")) return NULL;
+  return (lisp_value*)lisp_hash_create(rt, 0);
+}
+
+/**
+   @brief Return the value of a key, or the default if there is one and the key
+   isn't there.
+ */
+static lisp_value *lisp_hash_ref(lisp_runtime *rt, lisp_list *params,
+                                 lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_hash *h;
+  lisp_value *key, *fallback = NULL, *value;
+
+  if (lisp_list_length((lisp_value*)params) == 3) {
+    if (!get_args(rt, "hash-ref", params, "m??", &h, &key, &fallback)) {
+      return NULL;
+    }
+  } else if (!get_args(rt, "hash-ref", params, "m?", &h, &key)) {
+    return NULL;
+  }
+  value = lisp_hash_get(rt, h, key);
+  if (value == NULL) {
+    if (rt->error) return NULL;
+    if (fallback == NULL) return lisp_error(rt, "hash-ref: key not found");
+    value = fallback;
+  }
+  lisp_incref(value);
+  return value;
+}
+
+/**
+   @brief Set the value of a key, and return the value.
+ */
+static lisp_value *lisp_hash_set_builtin(lisp_runtime *rt, lisp_list *params,
+                                         lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_hash *h;
+  lisp_value *key, *value;
+
+  if (!get_args(rt, "hash-set!", params, "m??", &h, &key, &value)) {
+    return NULL;
+  }
+  if (!lisp_hash_set(rt, h, key, value)) return NULL;
+  lisp_incref(value);
+  return value;
+}
+
+/**
+   @brief Remove a key, and return whether it was there.
+ */
+static lisp_value *lisp_hash_remove_builtin(lisp_runtime *rt,
+                                            lisp_list *params,
+                                            lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_hash *h;
+  lisp_value *key;
+  bool removed;
+
+  if (!get_args(rt, "hash-remove!", params, "m?", &h, &key)) return NULL;
+  removed = lisp_hash_remove(rt, h, key);
+  if (rt->error) return NULL;
+  return make_int(rt, removed);
+}
+
+static lisp_value *lisp_hash_count(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_hash *h;
+  if (!get_args(rt, "hash-count", params, "m", &h)) return NULL;
+  return make_int(rt, h->count);
+}
+
+/**
+   @brief Return a list of a hash map's keys, values, or (key value) pairs.
+ */
+static lisp_value *hash_entries(lisp_runtime *rt, lisp_list *params,
+                                char *fname, bool keys, bool values)
+{
+  lisp_hash *h;
+  lisp_value **items, *pair[2];
+  lisp_hash_entry *e;
+  lisp_value *rv;
+  int n = 0;
+
+  if (!get_args(rt, fname, params, "m", &h)) return NULL;
+  items = smb_new(lisp_value*, h->count > 0 ? h->count : 1);
+  for (int i = 0; i < h->capacity; i++) {
+    e = &h->entries[i];
+    if (e->key == NULL) {
+      continue;
+    }
+    if (keys && values) {
+      pair[0] = e->key;
+      pair[1] = e->value;
+      items[n] = lisp_list_from_array(rt, pair, 2);
+      if (items[n] == NULL) break;
+      n++;
+    } else {
+      items[n] = keys ? e->key : e->value;
+      lisp_incref(items[n++]);
+    }
+  }
+  rv = rt->error ? NULL : lisp_list_from_array(rt, items, n);
+  for (int i = 0; i < n; i++) {
+    lisp_decref(rt, items[i]);
+  }
+  smb_free(items);
+  return rv;
+}
+
+static lisp_value *lisp_hash_keys(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  return hash_entries(rt, params, "hash-keys", true, false);
+}
+
+static lisp_value *lisp_hash_values(lisp_runtime *rt, lisp_list *params,
+                                    lisp_scope *scope)
+{
+  (void)scope; // unused
+  return hash_entries(rt, params, "hash-values", false, true);
+}
+
+static lisp_value *lisp_hash_to_list(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; // unused
+  return hash_entries(rt, params, "hash->list", true, true);
+}
+
+/**
+   @brief Return an array of the arguments, which must be numbers.  It holds
+   floats if any of them is a float, or else integers.
+ */
+static lisp_value *lisp_array_builtin(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; // unused
+  return (lisp_value*)lisp_array_from_list(rt, (lisp_value*)params);
+}
+
+/**
+   @brief Return an array of n copies of an integer or a float.
+ */
+static lisp_value *lisp_make_array(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_int *n;
+  lisp_value *fill;
+  lisp_array *a;
+
+  if (!get_args(rt, "make-array", params, "d?", &n, &fill)) return NULL;
+  if (n->value < 0 || n->value > INT_MAX / (long)sizeof(long)) {
+    return lisp_error(rt, "make-array: invalid length %ld", n->value);
+  }
+  if (!lisp_is_float(fill) && fill->type != &tp_int) {
+    return lisp_error(rt, "make-array: argument 1: expected type int or "
+                      "float, got type %s", fill->type->tp_name);
+  }
+  a = lisp_array_create(rt, n->value, lisp_is_float(fill));
+  if (a == NULL) return NULL;
+  for (int i = 0; i < a->length; i++) {
+    if (a->is_float) {
+      lisp_array_floats(a)[i] = lisp_float_value(fill);
+    } else {
+      a->items[i] = ((lisp_int*)fill)->value;
+    }
+  }
+  return (lisp_value*)a;
+}
+
+/**
+   @brief Return an item of an array as an int or a float.
+   @returns NEW REFERENCE to the item.
+ */
+static lisp_value *array_item(lisp_runtime *rt, lisp_array *a, int i)
+{
+  return a->is_float ? lisp_float(lisp_array_floats(a)[i]) :
+    make_int(rt, a->items[i]);
+}
+
+static lisp_value *lisp_list_to_array(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *list;
+  if (!get_args(rt, "list->array", params, "l", &list)) return NULL;
+  return (lisp_value*)lisp_array_from_list(rt, list);
+}
+
+static lisp_value *lisp_array_to_list(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_array *a;
+  lisp_value **items;
+  lisp_value *rv;
+
+  if (!get_args(rt, "array->list", params, "r", &a)) return NULL;
+  items = smb_new(lisp_value*, a->length > 0 ? a->length : 1);
+  for (int i = 0; i < a->length; i++) {
+    items[i] = array_item(rt, a, i);
+  }
+  rv = rt->error ? NULL : lisp_list_from_array(rt, items, a->length);
+  for (int i = 0; i < a->length; i++) {
+    lisp_decref(rt, items[i]);
+  }
+  smb_free(items);
+  return rv;
+}
+
+static lisp_value *lisp_array_length(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_array *a;
+  if (!get_args(rt, "array-length", params, "r", &a)) return NULL;
+  return make_int(rt, a->length);
+}
+
+static lisp_value *lisp_array_ref(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_array *a;
+  lisp_int *index;
+
+  if (!get_args(rt, "array-ref", params, "rd", &a, &index)) return NULL;
+  if (index->value < 0 || index->value >= a->length) {
+    return lisp_error(rt, "array-ref: index %ld out of range for array of "
+                      "length %d", index->value, a->length);
+  }
+  return array_item(rt, a, index->value);
+}
+
+static lisp_value *lisp_array_sum_builtin(lisp_runtime *rt, lisp_list *params,
+                                          lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_array *a;
+  if (!get_args(rt, "array-sum", params, "r", &a)) return NULL;
+  if (a->is_float) {
+    return lisp_float(lisp_array_fsum(a));
+  }
+  return make_int(rt, lisp_array_sum(a));
+}
+
+static lisp_value *lisp_array_dot_builtin(lisp_runtime *rt, lisp_list *params,
+                                          lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_array *a, *b;
+
+  if (!get_args(rt, "array-dot", params, "rr", &a, &b)) return NULL;
+  if (a->length != b->length) {
+    return lisp_error(rt, "array-dot: arrays have different lengths (%d and "
+                      "%d)", a->length, b->length);
+  } else if (a->is_float != b->is_float) {
+    return lisp_error(rt, "array-dot: can't mix arrays of ints and floats");
+  } else if (a->is_float) {
+    return lisp_float(lisp_array_fdot(a, b));
+  }
+  return make_int(rt, lisp_array_dot(a, b));
+}
+
+/**
+   @brief Return the smallest or largest item of a non-empty array.
+ */
+static lisp_value *array_extreme(lisp_runtime *rt, lisp_list *params,
+                                 char *fname, bool max)
+{
+  lisp_array *a;
+
+  if (!get_args(rt, fname, params, "r", &a)) return NULL;
+  if (a->length == 0) {
+    return lisp_error(rt, "%s: array is empty", fname);
+  } else if (a->is_float) {
+    return lisp_float(max ? lisp_array_fmax(a) : lisp_array_fmin(a));
+  }
+  return make_int(rt, max ? lisp_array_max(a) : lisp_array_min(a));
+}
+
+static lisp_value *lisp_array_min_builtin(lisp_runtime *rt, lisp_list *params,
+                                          lisp_scope *scope)
+{
+  (void)scope; // unused
+  return array_extreme(rt, params, "array-min", false);
+}
+
+static lisp_value *lisp_array_max_builtin(lisp_runtime *rt, lisp_list *params,
+                                          lisp_scope *scope)
+{
+  (void)scope; // unused
+  return array_extreme(rt, params, "array-max", true);
+}
+
+/**
+   @brief Combine an array's items with an array of the same length and kind,
+   or with a number.  Only an array of floats may be combined with a float.
+ */
+static lisp_value *array_arith(lisp_runtime *rt, lisp_list *params,
+                               char *fname, char op)
+{
+  lisp_array *a;
+  lisp_value *b;
+
+  if (!get_args(rt, fname, params, "r?", &a, &b)) return NULL;
+  if (lisp_type_of(b) == &tp_array) {
+    if (((lisp_array*)b)->length != a->length) {
+      return lisp_error(rt, "%s: arrays have different lengths (%d and %d)",
+                        fname, a->length, ((lisp_array*)b)->length);
+    } else if (((lisp_array*)b)->is_float != a->is_float) {
+      return lisp_error(rt, "%s: can't mix arrays of ints and floats", fname);
+    }
+  } else if (lisp_type_of(b) != &tp_int &&
+             !(a->is_float && lisp_type_of(b) == &tp_float)) {
+    return lisp_error(rt, "%s: argument 1: expected type array or %s, got "
+                      "type %s", fname, a->is_float ? "number" : "int",
+                      lisp_type_of(b)->tp_name);
+  }
+  return (lisp_value*)lisp_array_combine(rt, op, a, b);
+}
+
+static lisp_value *lisp_array_add(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  return array_arith(rt, params, "array+", '+');
+}
+
+static lisp_value *lisp_array_sub(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  return array_arith(rt, params, "array-", '-');
+}
+
+static lisp_value *lisp_array_mul(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  return array_arith(rt, params, "array*", '*');
+}
+
+/**
+   @brief Return a list of (type live bytes allocs) for each type.
+ */
+static lisp_value *lisp_heap_stats(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_type **tp;
+  lisp_atom *name;
+  lisp_value *stats[4], *entry, *rv;
+  smb_al entries;
+  smb_status st = SMB_SUCCESS;
+  size_t len;
+  int n;
+
+  if (!get_args(rt, "heap-stats", params, "")) return NULL;
+
+  al_init(&entries);
+  for (tp = lisp_types; *tp != NULL; tp++) {
+    len = strlen((*tp)->tp_name);
+    name = (lisp_atom*)tp_atom.tp_alloc(rt);
+    if (name != NULL) {
+      name->value = smb_new(wchar_t, len + 1);
+      mbstowcs(name->value, (*tp)->tp_name, len + 1);
+    }
+    stats[0] = (lisp_value*)name;
+    stats[1] = make_int(rt, rt->stats[(*tp)->tp_index].live);
+    stats[2] = make_int(rt, rt->stats[(*tp)->tp_index].bytes);
+    stats[3] = make_int(rt, rt->stats[(*tp)->tp_index].allocs);
+    entry = rt->error ? NULL : lisp_list_from_array(rt, stats, 4);
+    for (int i = 0; i < 4; i++) {
+      lisp_decref(rt, stats[i]);
+    }
+    if (entry == NULL) break;
+    al_append(&entries, PTR(entry));
+  }
+
+  n = al_length(&entries);
+  lisp_value **items = smb_new(lisp_value*, n > 0 ? n : 1);
+  for (int i = 0; i < n; i++) {
+    items[i] = al_get(&entries, i, &st).data_ptr;
+  }
+  rv = rt->error ? NULL : lisp_list_from_array(rt, items, n);
+  for (int i = 0; i < n; i++) {
+    lisp_decref(rt, items[i]);
+  }
+  smb_free(items);
+  al_destroy(&entries);
+  return rv;
+}
+
+/**
+   @brief Return a copy of a string with a terminating NUL, for the C library.
+   @returns A string the caller must smb_free().
+ */
+static char *c_string(lisp_string *str)
+{
+  char *rv = smb_new(char, str->length + 1);
+  memcpy(rv, str->data, str->length);
+  rv[str->length] = '\0';
+  return rv;
+}
+
+/**
+   @brief Write the global scope to an image file.
+ */
+static lisp_value *lisp_dump_image(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  lisp_string *path;
+  char *cpath;
+  long count;
+
+  if (!get_args(rt, "dump-image", params, "s", &path)) return NULL;
+  while (scope->up != NULL) {
+    scope = scope->up;
+  }
+  cpath = c_string(path);
+  count = lisp_image_dump(rt, scope, cpath);
+  smb_free(cpath);
+  return count < 0 ? NULL : make_int(rt, count);
+}
+
+/**
+   @brief Return a lazy sequence of integers, from (lazy-range end),
+   (lazy-range start end) or (lazy-range start end step).
+ */
+static lisp_value *lisp_lazy_range_builtin(lisp_runtime *rt,
+                                           lisp_list *params,
+                                           lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_int *start, *end, *step;
+
+  switch (lisp_list_length((lisp_value*)params)) {
+  case 1:
+    if (!get_args(rt, "lazy-range", params, "d", &end)) return NULL;
+    return (lisp_value*)lisp_lazy_range(rt, 0, end->value, 1);
+  case 2:
+    if (!get_args(rt, "lazy-range", params, "dd", &start, &end)) return NULL;
+    return (lisp_value*)lisp_lazy_range(rt, start->value, end->value, 1);
+  default:
+    if (!get_args(rt, "lazy-range", params, "ddd", &start, &end, &step)) {
+      return NULL;
+    }
+    if (step->value == 0) {
+      return lisp_error(rt, "lazy-range: step must not be zero");
+    }
+    return (lisp_value*)lisp_lazy_range(rt, start->value, end->value,
+                                        step->value);
+  }
+}
+
+static lisp_value *lisp_lazy_iterate_builtin(lisp_runtime *rt,
+                                             lisp_list *params,
+                                             lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *f, *x;
+  if (!get_args(rt, "lazy-iterate", params, "??", &f, &x)) return NULL;
+  return (lisp_value*)lisp_lazy_iterate(rt, f, x);
+}
+
+static lisp_value *lisp_lazy_unfold_builtin(lisp_runtime *rt,
+                                            lisp_list *params,
+                                            lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *f, *seed;
+  if (!get_args(rt, "lazy-unfold", params, "??", &f, &seed)) return NULL;
+  return (lisp_value*)lisp_lazy_unfold(rt, f, seed);
+}
+
+static lisp_value *lisp_list_to_lazy(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *list;
+  if (!get_args(rt, "list->lazy", params, "l", &list)) return NULL;
+  return (lisp_value*)lisp_lazy_from_list(rt, list);
+}
+
+static lisp_value *lisp_lazy_to_list_builtin(lisp_runtime *rt,
+                                             lisp_list *params,
+                                             lisp_scope *scope)
+{
+  lisp_lazy *s;
+  if (!get_args(rt, "lazy->list", params, "z", &s)) return NULL;
+  return lisp_lazy_to_list(rt, s, scope);
+}
+
+/**
+   @brief Force a sequence for lazy-first and lazy-rest, which need an item.
+ */
+static bool force_item(lisp_runtime *rt, char *fname, lisp_list *params,
+                       lisp_scope *scope, lisp_lazy **s)
+{
+  if (!get_args(rt, fname, params, "z", s)) return false;
+  if (!lisp_lazy_force(rt, *s, scope)) return false;
+  if ((*s)->first == NULL) {
+    lisp_error(rt, "%s: sequence is empty", fname);
+    return false;
+  }
+  return true;
+}
+
+static lisp_value *lisp_lazy_first(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  lisp_lazy *s;
+  if (!force_item(rt, "lazy-first", params, scope, &s)) return NULL;
+  lisp_incref(s->first);
+  return s->first;
+}
+
+static lisp_value *lisp_lazy_rest(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  lisp_lazy *s;
+  if (!force_item(rt, "lazy-rest", params, scope, &s)) return NULL;
+  lisp_incref((lisp_value*)s->rest);
+  return (lisp_value*)s->rest;
+}
+
+static lisp_value *lisp_lazy_emptyp(lisp_runtime *rt, lisp_list *params,
+                                    lisp_scope *scope)
+{
+  lisp_lazy *s;
+  if (!get_args(rt, "lazy-empty?", params, "z", &s)) return NULL;
+  if (!lisp_lazy_force(rt, s, scope)) return NULL;
+  return make_int(rt, s->first == NULL);
+}
+
+static lisp_value *lisp_lazy_map_builtin(lisp_runtime *rt, lisp_list *params,
+                                         lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *f;
+  lisp_lazy *s;
+  if (!get_args(rt, "lazy-map", params, "?z", &f, &s)) return NULL;
+  return (lisp_value*)lisp_lazy_map(rt, f, s);
+}
+
+static lisp_value *lisp_lazy_filter_builtin(lisp_runtime *rt,
+                                            lisp_list *params,
+                                            lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *f;
+  lisp_lazy *s;
+  if (!get_args(rt, "lazy-filter", params, "?z", &f, &s)) return NULL;
+  return (lisp_value*)lisp_lazy_filter(rt, f, s);
+}
+
+static lisp_value *lisp_lazy_take_builtin(lisp_runtime *rt, lisp_list *params,
+                                          lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_int *n;
+  lisp_lazy *s;
+  if (!get_args(rt, "lazy-take", params, "dz", &n, &s)) return NULL;
+  return (lisp_value*)lisp_lazy_take(rt, n->value, s);
+}
+
+static lisp_value *lisp_lazy_fold_builtin(lisp_runtime *rt, lisp_list *params,
+                                          lisp_scope *scope)
+{
+  lisp_value *f, *init;
+  lisp_lazy *s;
+  if (!get_args(rt, "lazy-fold", params, "??z", &f, &init, &s)) return NULL;
+  // Only the argument list refers to a sequence passed straight in, and it
+  // has no further use for it, so the fold may use it up (see
+  // lisp_lazy_fold()).
+  return lisp_lazy_fold(rt, f, init, s, scope);
+}
+
+/**
+   @brief Return a list of collected items, and drop the references to them.
+   @param items The items, which are NEW REFERENCES (the array is freed too).
+   @param n How many items were collected.
+   @returns NEW REFERENCE to the list, or NULL if an error was raised while
+   collecting them.
+ */
+static lisp_value *collected_list(lisp_runtime *rt, lisp_value **items, int n)
+{
+  lisp_value *rv = NULL;
+  if (!rt->error) {
+    rv = lisp_list_from_array(rt, items, n);
+  }
+  for (int i = 0; i < n; i++) {
+    lisp_decref(rt, items[i]);
+  }
+  smb_free(items);
+  return rv;
+}
+
+/**
+   @brief Apply a function to each item of one or more lists, returning a list
+   of the results.  With several lists, the function takes an item from each,
+   and it stops at the end of the shortest.
+ */
+static lisp_value *lisp_map(lisp_runtime *rt, lisp_list *params,
+                            lisp_scope *scope)
+{
+  int nlists = lisp_list_length((lisp_value*)params) - 1;
+  lisp_list_iter *iters;
+  lisp_value **args, **items;
+  lisp_value *f;
+  lisp_list *l;
+  int n = INT_MAX, length, i;
+
+  if (nlists < 1) {
+    return lisp_error(rt, "map: wrong number of args (expected at least 2, "
+                      "got %d)", nlists + 1);
+  }
+  f = params->value;
+  for (l = params->next, i = 1; l->value != NULL; l = l->next, i++) {
+    if (!lisp_is_list(l->value)) {
+      return lisp_error(rt, "map: argument %d: expected type list, got type "
+                        "%s", i, lisp_type_of(l->value)->tp_name);
+    }
+    length = lisp_list_length(l->value);
+    n = length < n ? length : n;
+  }
+
+  iters = smb_new(lisp_list_iter, nlists);
+  args = smb_new(lisp_value*, nlists);
+  for (l = params->next, i = 0; l->value != NULL; l = l->next, i++) {
+    lisp_list_iter_init(&iters[i], l->value);
+  }
+  items = smb_new(lisp_value*, n > 0 ? n : 1);
+  for (i = 0; i < n; i++) {
+    for (int j = 0; j < nlists; j++) {
+      args[j] = lisp_list_iter_next(&iters[j]);
+    }
+    items[i] = lisp_call_with(rt, f, args, nlists, scope);
+    if (items[i] == NULL) {
+      break;
+    }
+  }
+  smb_free(iters);
+  smb_free(args);
+  return collected_list(rt, items, i);
+}
+
+/**
+   @brief Return a list of the items for which a function returns true.
+ */
+static lisp_value *lisp_filter(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
+{
+  lisp_value *f, *list, *item, *keep, **items;
+  lisp_list_iter it;
+  int n = 0;
+
+  if (!get_args(rt, "filter", params, "?l", &f, &list)) return NULL;
+  items = smb_new(lisp_value*, lisp_list_length(list) + 1);
+  lisp_list_iter_init(&it, list);
+  while ((item = lisp_list_iter_next(&it)) != NULL) {
+    keep = lisp_call_with(rt, f, &item, 1, scope);
+    if (keep == NULL) {
+      break;
+    }
+    if (lisp_truthy(keep)) {
+      lisp_incref(item);
+      items[n++] = item;
+    }
+    lisp_decref(rt, keep);
+  }
+  return collected_list(rt, items, n);
+}
+
+/**
+   @brief Combine the items of a list from left to right, calling (f acc x).
+ */
+static lisp_value *lisp_fold(lisp_runtime *rt, lisp_list *params,
+                             lisp_scope *scope)
+{
+  lisp_value *f, *acc, *list, *args[2];
+  lisp_list_iter it;
+
+  if (!get_args(rt, "fold", params, "??l", &f, &acc, &list)) return NULL;
+  lisp_incref(acc);
+  lisp_list_iter_init(&it, list);
+  while ((args[1] = lisp_list_iter_next(&it)) != NULL) {
+    args[0] = acc;
+    acc = lisp_call_with(rt, f, args, 2, scope);
+    lisp_decref(rt, args[0]);
+    if (acc == NULL) {
+      return NULL;
+    }
+  }
+  return acc;
+}
+
+/**
+   @brief Return a list of the items of each list in turn.  The last list isn't
+   copied: the result ends with it.
+ */
+static lisp_value *lisp_append(lisp_runtime *rt, lisp_list *params,
+                               lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value **items, *item, *last = NULL, *rv;
+  lisp_list_iter it;
+  lisp_list *l;
+  int n = 0, nargs, i;
+
+  if (params->value == NULL) {
+    return tp_list.tp_alloc(rt);
+  }
+  for (l = params, nargs = 0; l->value != NULL; l = l->next, nargs++) {
+    if (!lisp_is_list(l->value)) {
+      return lisp_error(rt, "append: argument %d: expected type list, got "
+                        "type %s", nargs, lisp_type_of(l->value)->tp_name);
+    }
+    if (last != NULL) {
+      n += lisp_list_length(last);
+    }
+    last = l->value;
+  }
+
+  // The items are only borrowed, since lisp_list_prepend() takes its own
+  // references to them.  The same list may be passed more than once, so the
+  // arguments before the last are counted off rather than compared with it.
+  items = smb_new(lisp_value*, n > 0 ? n : 1);
+  n = 0;
+  for (l = params, i = 0; i < nargs - 1; l = l->next, i++) {
+    lisp_list_iter_init(&it, l->value);
+    while ((item = lisp_list_iter_next(&it)) != NULL) {
+      items[n++] = item;
+    }
+  }
+  rv = lisp_list_prepend(rt, items, n, last);
+  smb_free(items);
+  return rv;
+}
+
+static lisp_value *lisp_reverse(lisp_runtime *rt, lisp_list *params,
+                                lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value **items, *list, *rv;
+  lisp_list_iter it;
+  int n;
+
+  if (!get_args(rt, "reverse", params, "l", &list)) return NULL;
+  n = lisp_list_length(list);
+  items = smb_new(lisp_value*, n > 0 ? n : 1);
+  lisp_list_iter_init(&it, list);
+  for (int i = n - 1; i >= 0; i--) {
+    items[i] = lisp_list_iter_next(&it);
+  }
+  rv = lisp_list_from_array(rt, items, n);
+  smb_free(items);
+  return rv;
+}
+
+/**
+   @brief Return the first list in an association list that starts with a key,
+   or the empty list if there isn't one.  Keys are compared like hash keys.
+ */
+static lisp_value *lisp_assoc(lisp_runtime *rt, lisp_list *params,
+                              lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *key, *alist, *item;
+  lisp_list_iter it;
+  int i = 0;
+
+  if (!get_args(rt, "assoc", params, "?l", &key, &alist)) return NULL;
+  lisp_list_iter_init(&it, alist);
+  while ((item = lisp_list_iter_next(&it)) != NULL) {
+    if (!lisp_is_list(item) || lisp_list_first(item) == NULL) {
+      return lisp_error(rt, "assoc: item %d is not a non-empty list", i);
+    }
+    if (lisp_eqv(lisp_list_first(item), key)) {
+      lisp_incref(item);
+      return item;
+    }
+    i++;
+  }
+  return tp_list.tp_alloc(rt);
+}
+
+/**
+   @brief Return a rope of the arguments, which may be strings or ropes.
+ */
+static lisp_value *lisp_rope_builtin(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_rope *rv = (lisp_rope*)tp_rope.tp_alloc(rt), *piece, *next;
+  lisp_list *l;
+  int i = 0;
+
+  for (l = params; l->value != NULL && rv != NULL; l = l->next, i++) {
+    if (lisp_type_of(l->value) == &tp_string) {
+      piece = lisp_rope_from_string(rt, (lisp_string*)l->value);
+      if (piece == NULL) {
+        lisp_decref(rt, (lisp_value*)rv);
+        return NULL;
+      }
+    } else if (lisp_type_of(l->value) == &tp_rope) {
+      piece = (lisp_rope*)l->value;
+      lisp_incref((lisp_value*)piece);
+    } else {
+      lisp_decref(rt, (lisp_value*)rv);
+      return lisp_error(rt, "rope: argument %d: expected a string or rope, "
+                        "got type %s", i, lisp_type_of(l->value)->tp_name);
+    }
+    next = lisp_rope_concat(rt, rv, piece);
+    lisp_decref(rt, (lisp_value*)rv);
+    lisp_decref(rt, (lisp_value*)piece);
+    rv = next;
+  }
+  return (lisp_value*)rv;
+}
+
+static lisp_value *lisp_rope_length(lisp_runtime *rt, lisp_list *params,
+                                    lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_rope *r;
+  if (!get_args(rt, "rope-length", params, "p", &r)) return NULL;
+  return make_int(rt, r->length);
+}
+
+/**
+   @brief Return part of a rope, with the same arguments as substring.
+ */
+static lisp_value *lisp_rope_slice_builtin(lisp_runtime *rt,
+                                           lisp_list *params,
+                                           lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_rope *r;
+  lisp_int *start, *end;
+  long int e;
+
+  if (lisp_list_length((lisp_value*)params) == 2) {
+    if (!get_args(rt, "rope-slice", params, "pd", &r, &start)) return NULL;
+    e = r->length;
+  } else {
+    if (!get_args(rt, "rope-slice", params, "pdd", &r, &start, &end)) {
+      return NULL;
+    }
+    e = end->value;
+  }
+
+  if (start->value < 0 || start->value > e || e > (long int)r->length) {
+    return lisp_error(rt, "rope-slice: range %ld to %ld out of bounds for "
+                      "length %zu", start->value, e, r->length);
+  }
+  return (lisp_value*)lisp_rope_slice(rt, r, start->value, e);
+}
+
+static lisp_value *lisp_rope_to_string(lisp_runtime *rt, lisp_list *params,
+                                       lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_rope *r;
+  if (!get_args(rt, "rope->string", params, "p", &r)) return NULL;
+  return (lisp_value*)lisp_rope_flatten(rt, r);
+}
+
+/**
+   @brief Write a rope to a file, replacing its contents, and return the number
+   of bytes written.  The rope is never flattened into one string.
+ */
+static lisp_value *lisp_rope_write_builtin(lisp_runtime *rt,
+                                           lisp_list *params,
+                                           lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_rope *r;
+  lisp_string *path;
+  char *cpath;
+  FILE *f;
+  bool ok;
+
+  if (!get_args(rt, "rope-write", params, "ps", &r, &path)) return NULL;
+  cpath = c_string(path);
+  f = fopen(cpath, "wb");
+  ok = f != NULL && lisp_rope_write(r, f);
+  if (f != NULL && fclose(f) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    lisp_error(rt, "rope-write: unable to write %s", cpath);
+  }
+  smb_free(cpath);
+  return ok ? make_int(rt, r->length) : NULL;
+}
+
+/**
+   @brief Get the optional delimiter argument of a builtin that reads records.
+   @param arg A string of one byte, or NULL for the default of a newline.
+ */
+static bool get_delimiter(lisp_runtime *rt, char *fname, lisp_value *arg,
+                          int *delimiter)
+{
+  *delimiter = '\n';
+  if (arg == NULL) {
+    return true;
+  }
+  if (lisp_type_of(arg) != &tp_string || ((lisp_string*)arg)->length != 1) {
+    lisp_error(rt, "%s: delimiter must be a string of one byte", fname);
+    return false;
+  }
+  *delimiter = (unsigned char)((lisp_string*)arg)->data[0];
+  return true;
+}
+
+static lisp_value *lisp_open_input_file(lisp_runtime *rt, lisp_list *params,
+                                        lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_string *path;
+  lisp_file *f;
+  char *cpath;
+
+  if (!get_args(rt, "open-input-file", params, "s", &path)) return NULL;
+  cpath = c_string(path);
+  f = lisp_file_open(rt, cpath, "rb");
+  smb_free(cpath);
+  return (lisp_value*)f;
+}
+
+/**
+   @brief Open a file for writing, replacing it, or appending to it if the
+   optional second argument is true.
+ */
+static lisp_value *lisp_open_output_file(lisp_runtime *rt, lisp_list *params,
+                                         lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_string *path;
+  lisp_value *append = NULL;
+  lisp_file *f;
+  char *cpath;
+
+  if (lisp_list_length((lisp_value*)params) == 2) {
+    if (!get_args(rt, "open-output-file", params, "s?", &path, &append)) {
+      return NULL;
+    }
+  } else if (!get_args(rt, "open-output-file", params, "s", &path)) {
+    return NULL;
+  }
+  cpath = c_string(path);
+  f = lisp_file_open(rt, cpath, append && lisp_truthy(append) ? "ab" : "wb");
+  smb_free(cpath);
+  return (lisp_value*)f;
+}
+
+static lisp_value *lisp_close_file(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_file *f;
+  if (!get_args(rt, "close-file", params, "e", &f)) return NULL;
+  if (!lisp_file_close(rt, f)) return NULL;
+  return make_int(rt, 1);
+}
+
+/**
+   @brief Read the next line of a file (or record, given a delimiter), and
+   return it without its delimiter, or return '() at the end of the file.
+ */
+static lisp_value *lisp_read_line(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_file *f;
+  lisp_value *delim = NULL, *rv;
+  int delimiter;
+
+  if (lisp_list_length((lisp_value*)params) == 2) {
+    if (!get_args(rt, "read-line", params, "e?", &f, &delim)) return NULL;
+  } else if (!get_args(rt, "read-line", params, "e", &f)) {
+    return NULL;
+  }
+  if (!get_delimiter(rt, "read-line", delim, &delimiter)) return NULL;
+  rv = (lisp_value*)lisp_file_read_record(rt, f, delimiter);
+  if (rv == NULL && !rt->error) {
+    rv = tp_list.tp_alloc(rt);
+  }
+  return rv;
+}
+
+/**
+   @brief Return a lazy sequence of the lines (or records) of a file, given
+   either its path or an input file.
+ */
+static lisp_value *lisp_file_lines(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *source, *delim = NULL, *rv;
+  lisp_file *f;
+  char *cpath;
+  int delimiter;
+
+  if (lisp_list_length((lisp_value*)params) == 2) {
+    if (!get_args(rt, "file-lines", params, "??", &source, &delim)) {
+      return NULL;
+    }
+  } else if (!get_args(rt, "file-lines", params, "?", &source)) {
+    return NULL;
+  }
+  if (!get_delimiter(rt, "file-lines", delim, &delimiter)) return NULL;
+
+  if (lisp_type_of(source) == &tp_file) {
+    f = (lisp_file*)source;
+    lisp_incref(source);
+  } else if (lisp_type_of(source) == &tp_string) {
+    cpath = c_string((lisp_string*)source);
+    f = lisp_file_open(rt, cpath, "rb");
+    smb_free(cpath);
+    if (f == NULL) return NULL;
+  } else {
+    return lisp_error(rt, "file-lines: expected a path or a file, got type %s",
+                      lisp_type_of(source)->tp_name);
+  }
+  if (f->output) {
+    lisp_decref(rt, (lisp_value*)f);
+    return lisp_error(rt, "file-lines: file isn't open for reading");
+  }
+  rv = (lisp_value*)lisp_file_records(rt, f, delimiter);
+  lisp_decref(rt, (lisp_value*)f);
+  return rv;
+}
+
+static lisp_value *lisp_read_file(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_string *path, *rv;
+  char *cpath;
+
+  if (!get_args(rt, "read-file", params, "s", &path)) return NULL;
+  cpath = c_string(path);
+  rv = lisp_file_read_all(rt, cpath);
+  smb_free(cpath);
+  return (lisp_value*)rv;
+}
+
+/**
+   @brief Write a string or rope to a file, and return how many bytes that was.
+ */
+static lisp_value *lisp_write_string(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *text;
+  lisp_file *f;
+
+  if (!get_args(rt, "write-string", params, "?e", &text, &f)) return NULL;
+  if (lisp_type_of(text) != &tp_string && lisp_type_of(text) != &tp_rope) {
+    return lisp_error(rt, "write-string: expected a string or rope, got type "
+                      "%s", lisp_type_of(text)->tp_name);
+  }
+  if (!lisp_file_write(rt, f, text)) return NULL;
+  return make_int(rt, lisp_type_of(text) == &tp_rope ?
+                  ((lisp_rope*)text)->length : ((lisp_string*)text)->length);
+}
+
+static lisp_value *pvector_from_list(lisp_runtime *rt, lisp_value *list)
+{
+  int n = lisp_list_length(list);
+  lisp_value **items = smb_new(lisp_value*, n > 0 ? n : 1);
+  lisp_list_iter it;
+  lisp_value *rv;
+
+  lisp_list_iter_init(&it, list);
+  for (int i = 0; i < n; i++) {
+    items[i] = lisp_list_iter_next(&it);
+  }
+  rv = (lisp_value*)lisp_pvector_from_array(rt, items, n);
+  smb_free(items);
+  return rv;
+}
+
+/**
+   @brief Return a persistent vector of the arguments.
+ */
+static lisp_value *lisp_pvector_builtin(lisp_runtime *rt, lisp_list *params,
+                                        lisp_scope *scope)
+{
+  (void)scope; // unused
+  return pvector_from_list(rt, (lisp_value*)params);
+}
+
+static lisp_value *lisp_list_to_pvector(lisp_runtime *rt, lisp_list *params,
+                                        lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_value *list;
+  if (!get_args(rt, "list->pvector", params, "l", &list)) return NULL;
+  return pvector_from_list(rt, list);
+}
+
+static lisp_value *lisp_pvector_to_list_builtin(lisp_runtime *rt,
+                                                lisp_list *params,
+                                                lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_pvector *v;
+  if (!get_args(rt, "pvector->list", params, "V", &v)) return NULL;
+  return lisp_pvector_to_list(rt, v);
+}
+
+static lisp_value *lisp_pvector_length(lisp_runtime *rt, lisp_list *params,
+                                       lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_pvector *v;
+  if (!get_args(rt, "pvector-length", params, "V", &v)) return NULL;
+  return make_int(rt, v->length);
+}
+
+static lisp_value *lisp_pvector_ref_builtin(lisp_runtime *rt,
+                                            lisp_list *params,
+                                            lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_pvector *v;
+  lisp_int *index;
+  lisp_value *item;
+
+  if (!get_args(rt, "pvector-ref", params, "Vd", &v, &index)) return NULL;
+  if (index->value < 0 || index->value >= v->length) {
+    return lisp_error(rt, "pvector-ref: index %ld out of range for vector of "
+                      "length %d", index->value, v->length);
+  }
+  item = lisp_pvector_ref(v, index->value);
+  lisp_incref(item);
+  return item;
+}
+
+/**
+   @brief Return a persistent vector with one item replaced.
+ */
+static lisp_value *lisp_pvector_set_builtin(lisp_runtime *rt,
+                                            lisp_list *params,
+                                            lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_pvector *v;
+  lisp_int *index;
+  lisp_value *value;
+
+  if (!get_args(rt, "pvector-set", params, "Vd?", &v, &index, &value)) {
+    return NULL;
+  }
+  if (index->value < 0 || index->value >= v->length) {
+    return lisp_error(rt, "pvector-set: index %ld out of range for vector of "
+                      "length %d", index->value, v->length);
+  }
+  return (lisp_value*)lisp_pvector_set(rt, v, index->value, value);
+}
+
+/**
+   @brief Return a persistent vector with an item added to the end.
+ */
+static lisp_value *lisp_pvector_push_builtin(lisp_runtime *rt,
+                                             lisp_list *params,
+                                             lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_pvector *v;
+  lisp_value *value;
+
+  if (!get_args(rt, "pvector-push", params, "V?", &v, &value)) return NULL;
+  if (v->length == INT_MAX) {
+    return lisp_error(rt, "pvector-push: vector is too long");
+  }
+  return (lisp_value*)lisp_pvector_push(rt, v, value);
+}
+
+/**
+   @brief Return a persistent hash map of the arguments, which alternate keys
+   and values.
+ */
+static lisp_value *lisp_phash_builtin(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; // unused
+  int n = lisp_list_length((lisp_value*)params);
+  lisp_phash *h, *next;
+
+  if (n % 2 != 0) {
+    return lisp_error(rt, "phash: expected keys and values in pairs, got %d "
+                      "args", n);
+  }
+  h = (lisp_phash*)tp_phash.tp_alloc(rt);
+  if (h == NULL) return NULL;
+  for (int i = 0; i < n; i += 2, params = params->next->next) {
+    next = lisp_phash_set(rt, h, params->value, params->next->value);
+    lisp_decref(rt, (lisp_value*)h);
+    if (next == NULL) {
+      return NULL;
+    }
+    h = next;
+  }
+  return (lisp_value*)h;
+}
+
+/**
+   @brief Return the value of a key, or the default if there is one and the key
+   isn't there.
+ */
+static lisp_value *lisp_phash_ref(lisp_runtime *rt, lisp_list *params,
+                                  lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_phash *h;
+  lisp_value *key, *fallback = NULL, *value;
+
+  if (lisp_list_length((lisp_value*)params) == 3) {
+    if (!get_args(rt, "phash-ref", params, "M??", &h, &key, &fallback)) {
+      return NULL;
+    }
+  } else if (!get_args(rt, "phash-ref", params, "M?", &h, &key)) {
+    return NULL;
+  }
+  value = lisp_phash_get(rt, h, key);
+  if (value == NULL) {
+    if (rt->error) return NULL;
+    if (fallback == NULL) return lisp_error(rt, "phash-ref: key not found");
+    value = fallback;
+  }
+  lisp_incref(value);
+  return value;
+}
+
+/**
+   @brief Return a persistent hash map with a key set to a value.
+ */
+static lisp_value *lisp_phash_set_builtin(lisp_runtime *rt, lisp_list *params,
+                                          lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_phash *h;
+  lisp_value *key, *value;
+
+  if (!get_args(rt, "phash-set", params, "M??", &h, &key, &value)) {
+    return NULL;
+  }
+  return (lisp_value*)lisp_phash_set(rt, h, key, value);
+}
+
+/**
+   @brief Return a persistent hash map without a key.
+ */
+static lisp_value *lisp_phash_remove_builtin(lisp_runtime *rt,
+                                             lisp_list *params,
+                                             lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_phash *h;
+  lisp_value *key;
+
+  if (!get_args(rt, "phash-remove", params, "M?", &h, &key)) return NULL;
+  return (lisp_value*)lisp_phash_remove(rt, h, key);
+}
+
+static lisp_value *lisp_phash_count(lisp_runtime *rt, lisp_list *params,
+                                    lisp_scope *scope)
+{
+  (void)scope; // unused
+  lisp_phash *h;
+  if (!get_args(rt, "phash-count", params, "M", &h)) return NULL;
+  return make_int(rt, h->count);
+}
+
+/**
+   @brief Return a list of a persistent hash map's keys, values, or (key value)
+   pairs.
+ */
+static lisp_value *phash_entries(lisp_runtime *rt, lisp_list *params,
+                                 char *fname, bool keys, bool values)
+{
+  lisp_phash *h;
+  lisp_value **items, *pair[2];
+  lisp_value *rv;
+
+  if (!get_args(rt, fname, params, "M", &h)) return NULL;
+  items = smb_new(lisp_value*, h->count > 0 ? 2 * h->count : 1);
+  lisp_phash_items(h, items, items + h->count);
+  if (keys && values) {
+    for (int i = 0; i < h->count; i++) {
+      pair[0] = items[i];
+      pair[1] = items[h->count + i];
+      items[i] = lisp_list_from_array(rt, pair, 2);
+    }
+    rv = rt->error ? NULL : lisp_list_from_array(rt, items, h->count);
+    for (int i = 0; i < h->count; i++) {
+      lisp_decref(rt, items[i]);
+    }
+  } else {
+    rv = lisp_list_from_array(rt, keys ? items : items + h->count, h->count);
+  }
+  smb_free(items);
+  return rv;
+}
+
+static lisp_value *lisp_phash_keys(lisp_runtime *rt, lisp_list *params,
+                                   lisp_scope *scope)
+{
+  (void)scope; // unused
+  return phash_entries(rt, params, "phash-keys", true, false);
+}
+
+static lisp_value *lisp_phash_values(lisp_runtime *rt, lisp_list *params,
+                                     lisp_scope *scope)
+{
+  (void)scope; // unused
+  return phash_entries(rt, params, "phash-values", false, true);
+}
+
+static lisp_value *lisp_phash_to_list(lisp_runtime *rt, lisp_list *params,
+                                      lisp_scope *scope)
+{
+  (void)scope; // unused
+  return phash_entries(rt, params, "phash->list", true, true);
+}
+
+/**
+   @brief Every builtin, along with the name it is bound to in the globals.
+
+   A builtin's index in this table is its ID, which is how images refer to it
+   (see image.c).  IDs must stay stable, so new builtins go at the end.
+ */
+lisp_builtin_entry lisp_builtins[] = {
+  {L"+", &lisp_add, true},
+  {L"-", &lisp_subtract, true},
+  {L"length", &lisp_length, true},
+  {L"car", &lisp_car, true},
+  {L"cdr", &lisp_cdr, true},
+  {L"cons", &lisp_cons, true},
+  {L"list", &lisp_list_builtin, true},
+  {L"exit", &lisp_exit, true},
+  {L"=", &lisp_numeq, true},
+  {L"<", &lisp_numlt, true},
+  {L">", &lisp_numgt, true},
+  {L"<=", &lisp_numle, true},
+  {L">=", &lisp_numge, true},
+  {L"null?", &lisp_null_p, true},
+  {L"string-length", &lisp_string_length, true},
+  {L"substring", &lisp_substring, true},
+  {L"string-append", &lisp_string_append, true},
+  {L"string=?", &lisp_string_eq, true},
+  {L"string<?", &lisp_string_lt, true},
+  {L"heap-stats", &lisp_heap_stats, true},
+  {L"freeze", &lisp_freeze_builtin, true},
+  {L"frozen?", &lisp_frozen_p, true},
+  {L"pmap", &lisp_pmap, true},
+  {L"preduce", &lisp_preduce, true},
+  {L"pfor-each", &lisp_pfor_each, true},
+  {L"touch", &lisp_touch, true},
+  {L"spawn", &lisp_spawn, true},
+  {L"resume", &lisp_resume, true},
+  {L"yield", &lisp_yield, true},
+  {L"done?", &lisp_done_p, true},
+  {L"if", &lisp_if, false},
+  {L"lambda", &lisp_lambda, false},
+  {L"define", &lisp_define, false},
+  {L"future", &lisp_future_builtin, false},
+  {L"dump-image", &lisp_dump_image, true},
+  {L"channel", &lisp_channel_builtin, true},
+  {L"send", &lisp_send, true},
+  {L"receive", &lisp_receive, true},
+  {L"vector", &lisp_vector_builtin, true},
+  {L"make-vector", &lisp_make_vector, true},
+  {L"vector-length", &lisp_vector_length, true},
+  {L"vector-ref", &lisp_vector_ref, true},
+  {L"vector-set!", &lisp_vector_set_builtin, true},
+  {L"vector-push!", &lisp_vector_push_builtin, true},
+  {L"vector->list", &lisp_vector_to_list, true},
+  {L"list->vector", &lisp_list_to_vector, true},
+  {L"hash", &lisp_hash_builtin, true},
+  {L"make-hash", &lisp_make_hash, true},
+  {L"hash-ref", &lisp_hash_ref, true},
+  {L"hash-set!", &lisp_hash_set_builtin, true},
+  {L"hash-remove!", &lisp_hash_remove_builtin, true},
+  {L"hash-count", &lisp_hash_count, true},
+  {L"hash-keys", &lisp_hash_keys, true},
+  {L"hash-values", &lisp_hash_values, true},
+  {L"hash->list", &lisp_hash_to_list, true},
+  {L"array", &lisp_array_builtin, true},
+  {L"make-array", &lisp_make_array, true},
+  {L"list->array", &lisp_list_to_array, true},
+  {L"array->list", &lisp_array_to_list, true},
+  {L"array-length", &lisp_array_length, true},
+  {L"array-ref", &lisp_array_ref, true},
+  {L"array-sum", &lisp_array_sum_builtin, true},
+  {L"array-dot", &lisp_array_dot_builtin, true},
+  {L"array-min", &lisp_array_min_builtin, true},
+  {L"array-max", &lisp_array_max_builtin, true},
+  {L"array+", &lisp_array_add, true},
+  {L"array-", &lisp_array_sub, true},
+  {L"array*", &lisp_array_mul, true},
+  {L"*", &lisp_multiply, true},
+  {L"/", &lisp_divide, true},
+  {L"float", &lisp_float_builtin, true},
+  {L"truncate", &lisp_truncate, true},
+  {L"remainder", &lisp_remainder, true},
+  {L"modulo", &lisp_modulo, true},
+  {L"expt", &lisp_expt, true},
+  {L"lazy-range", &lisp_lazy_range_builtin, true},
+  {L"lazy-iterate", &lisp_lazy_iterate_builtin, true},
+  {L"lazy-unfold", &lisp_lazy_unfold_builtin, true},
+  {L"list->lazy", &lisp_list_to_lazy, true},
+  {L"lazy->list", &lisp_lazy_to_list_builtin, true},
+  {L"lazy-first", &lisp_lazy_first, true},
+  {L"lazy-rest", &lisp_lazy_rest, true},
+  {L"lazy-empty?", &lisp_lazy_emptyp, true},
+  {L"lazy-map", &lisp_lazy_map_builtin, true},
+  {L"lazy-filter", &lisp_lazy_filter_builtin, true},
+  {L"lazy-take", &lisp_lazy_take_builtin, true},
+  {L"lazy-fold", &lisp_lazy_fold_builtin, true},
+  {L"map", &lisp_map, true},
+  {L"filter", &lisp_filter, true},
+  {L"fold", &lisp_fold, true},
+  {L"append", &lisp_append, true},
+  {L"reverse", &lisp_reverse, true},
+  {L"assoc", &lisp_assoc, true},
+  {L"rope", &lisp_rope_builtin, true},
+  {L"rope-length", &lisp_rope_length, true},
+  {L"rope-slice", &lisp_rope_slice_builtin, true},
+  {L"rope->string", &lisp_rope_to_string, true},
+  {L"rope-write", &lisp_rope_write_builtin, true},
+  {L"open-input-file", &lisp_open_input_file, true},
+  {L"open-output-file", &lisp_open_output_file, true},
+  {L"close-file", &lisp_close_file, true},
+  {L"read-line", &lisp_read_line, true},
+  {L"file-lines", &lisp_file_lines, true},
+  {L"read-file", &lisp_read_file, true},
+  {L"write-string", &lisp_write_string, true},
+  {L"pvector", &lisp_pvector_builtin, true},
+  {L"list->pvector", &lisp_list_to_pvector, true},
+  {L"pvector->list", &lisp_pvector_to_list_builtin, true},
+  {L"pvector-length", &lisp_pvector_length, true},
+  {L"pvector-ref", &lisp_pvector_ref_builtin, true},
+  {L"pvector-set", &lisp_pvector_set_builtin, true},
+  {L"pvector-push", &lisp_pvector_push_builtin, true},
+  {L"phash", &lisp_phash_builtin, true},
+  {L"phash-ref", &lisp_phash_ref, true},
+  {L"phash-set", &lisp_phash_set_builtin, true},
+  {L"phash-remove", &lisp_phash_remove_builtin, true},
+  {L"phash-count", &lisp_phash_count, true},
+  {L"phash-keys", &lisp_phash_keys, true},
+  {L"phash-values", &lisp_phash_values, true},
+  {L"phash->list", &lisp_phash_to_list, true},
+  {NULL, NULL, false}
+};
+
+/**
+   @brief Return a scope containing the top-level variables for our lisp.
+ */
+lisp_scope *lisp_create_globals(lisp_runtime *rt)
+{
+  lisp_scope *scope = lisp_scope_create();
+  lisp_builtin *bi;
+
+  for (lisp_builtin_entry *e = lisp_builtins; e->name != NULL; e++) {
+    bi = (lisp_builtin*)tp_builtin.tp_alloc(rt);
+    if (bi == NULL) {
+      // The heap limit doesn't even leave room for the builtins.
+      return scope;
+    }
+    bi->function = e->function;
+    bi->eval = e->eval;
+    lisp_scope_bind(rt, scope, e->name, (lisp_value*)bi);
+  }
+
+  // Anything restored from an image is bound over the builtins.
+  if (rt->image != NULL) {
+    lisp_image_bind(rt, rt->image, scope);
+  }
 
   return scope;
 }
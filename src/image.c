@@ -0,0 +1,688 @@
+/***************************************************************************//**
+
+  @file         image.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Dumping a scope to an image file, and mapping it back in.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "libstephen/al.h"
+#include "libstephen/base.h"
+#include "libstephen/ht.h"
+#include "lisp.h"
+
+/*
+  An image file is laid out like this:
+
+    lisp_image_header
+    padding, up to IMAGE_DATA
+    data:     values, in memory layout, each aligned to IMAGE_ALIGN
+    bindings: nbindings pairs of (name, value) offsets into data
+    relocs:   nrelocs offsets of pointers within data
+    objects:  nobjects offsets of values within data
+
+  Pointers within data are stored as offsets from the start of data (0 is
+  never the offset of anything, so it stays NULL).  Each value's type pointer
+  holds its tp_index, and each builtin's function pointer holds its ID.  When
+  an image is mapped, each of these is patched back into a real pointer.
+ */
+
+#define IMAGE_MAGIC "LISPIMG"
+/**
+   @brief Bumped whenever the layout of an image or any value changes.
+ */
+#define IMAGE_VERSION 3
+#define IMAGE_DATA 64
+#define IMAGE_ALIGN 16
+
+typedef struct {
+
+  char magic[8];
+  uint32_t version;
+  uint32_t word;
+  uint64_t size;
+  uint64_t nbindings;
+  uint64_t nrelocs;
+  uint64_t nobjects;
+
+} lisp_image_header;
+
+struct lisp_image {
+
+  char *map;
+  size_t length;
+  char *data;
+  uint64_t size;
+  uint64_t nbindings;
+  uint64_t *bindings;
+
+};
+
+/*******************************************************************************
+                                  Dumping
+*******************************************************************************/
+
+typedef struct {
+
+  lisp_runtime *rt;
+  char *data;
+  size_t size;
+  size_t capacity;
+
+  /**
+     @brief Offset each value already dumped was written to.
+   */
+  smb_ht offsets;
+
+  smb_al relocs;
+  smb_al objects;
+
+} lisp_dumper;
+
+/**
+   @brief Reserve space in the image.
+   @returns Offset of the space, which is zeroed.
+ */
+static size_t image_alloc(lisp_dumper *d, size_t size)
+{
+  size_t off = (d->size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+
+  if (off + size > d->capacity) {
+    while (off + size > d->capacity) {
+      d->capacity *= 2;
+    }
+    d->data = smb_renew(char, d->data, d->capacity);
+  }
+  memset(d->data + d->size, 0, off + size - d->size);
+  d->size = off + size;
+  return off;
+}
+
+/**
+   @brief Point a pointer within the image at the value at an offset.
+
+   The target may also be a float (see dump_value()), which is stored as it is.
+ */
+static void image_set(lisp_dumper *d, size_t slot, size_t target)
+{
+  uintptr_t value = target;
+  memcpy(d->data + slot, &value, sizeof(value));
+  if (target != 0 && !lisp_is_float((lisp_value*)value)) {
+    al_append(&d->relocs, LLINT(slot));
+  }
+}
+
+/**
+   @brief Copy a value into the image, before its pointers are fixed up.
+
+   The caller must set every pointer in the copy with image_set().
+ */
+static size_t dump_object(lisp_dumper *d, lisp_value *lv, size_t size)
+{
+  size_t off = image_alloc(d, size);
+  lisp_value *copy;
+
+  memcpy(d->data + off, lv, size);
+  copy = (lisp_value*)(d->data + off);
+  copy->type = (lisp_type*)(uintptr_t)lv->type->tp_index;
+  copy->refcount = 1;
+  copy->flags = 0;
+
+  ht_insert(&d->offsets, PTR(lv), LLINT(off));
+  al_append(&d->objects, LLINT(off));
+  return off;
+}
+
+static size_t dump_wstring(lisp_dumper *d, wchar_t *str)
+{
+  size_t size = (wcslen(str) + 1) * sizeof(wchar_t);
+  size_t off = image_alloc(d, size);
+  memcpy(d->data + off, str, size);
+  return off;
+}
+
+static size_t dump_value(lisp_dumper *d, lisp_value *lv);
+
+/**
+   @brief Dump a chain of list cells, without recursing down the chain.
+ */
+static size_t dump_list(lisp_dumper *d, lisp_list *list)
+{
+  smb_status st = SMB_SUCCESS;
+  size_t first = 0, prev = 0, off;
+
+  while (list != NULL && list->lv.type == &tp_list) {
+    st = SMB_SUCCESS;
+    ht_get(&d->offsets, PTR(list), &st);
+    if (st == SMB_SUCCESS) {
+      break;
+    }
+    off = dump_object(d, (lisp_value*)list, sizeof(lisp_list));
+    image_set(d, off + offsetof(lisp_list, value), dump_value(d, list->value));
+    if (prev == 0) {
+      first = off;
+    } else {
+      image_set(d, prev + offsetof(lisp_list, next), off);
+    }
+    prev = off;
+    list = list->next;
+  }
+
+  off = dump_value(d, (lisp_value*)list);
+  if (prev == 0) {
+    return off;
+  }
+  image_set(d, prev + offsetof(lisp_list, next), off);
+  return first;
+}
+
+static size_t dump_value(lisp_dumper *d, lisp_value *lv)
+{
+  smb_status st = SMB_SUCCESS;
+  DATA found;
+  size_t off, size;
+  lisp_builtin_entry *e;
+  lisp_chunk *chunk;
+  lisp_strbuf *buf;
+  lisp_string *str;
+  lisp_vector *vec;
+  uintptr_t bytes;
+  lisp_hash *h;
+  lisp_trie *trie;
+
+  if (lv == NULL || d->rt->error) {
+    return 0;
+  }
+  // Floats aren't stored anywhere, so they stand for themselves.  They can't
+  // be mistaken for offsets, which never get anywhere near 2^48.
+  if (lisp_is_float(lv)) {
+    return (uintptr_t)lv;
+  }
+  found = ht_get(&d->offsets, PTR(lv), &st);
+  if (st == SMB_SUCCESS) {
+    return found.data_llint;
+  }
+
+  switch (lv->type->tp_index) {
+  case TP_INT:
+    return dump_object(d, lv, sizeof(lisp_int));
+
+  case TP_ATOM:
+  case TP_IDENTIFIER:
+    off = dump_object(d, lv, sizeof(lisp_atom));
+    image_set(d, off + offsetof(lisp_atom, value),
+              dump_wstring(d, ((lisp_atom*)lv)->value));
+    return off;
+
+  case TP_LIST:
+    return dump_list(d, (lisp_list*)lv);
+
+  case TP_BUILTIN:
+    for (e = lisp_builtins; e->name != NULL; e++) {
+      if (e->function == ((lisp_builtin*)lv)->function) {
+        break;
+      }
+    }
+    if (e->name == NULL) {
+      lisp_error(d->rt, "dump-image: builtin has no ID");
+      return 0;
+    }
+    off = dump_object(d, lv, sizeof(lisp_builtin));
+    ((lisp_builtin*)(d->data + off))->function =
+      (lisp_value *(*)(lisp_runtime*, lisp_list*, lisp_scope*))
+      (uintptr_t)(e - lisp_builtins);
+    return off;
+
+  case TP_FUNCTION:
+    off = dump_object(d, lv, sizeof(lisp_function));
+    image_set(d, off + offsetof(lisp_function, arglist),
+              dump_value(d, (lisp_value*)((lisp_function*)lv)->arglist));
+    image_set(d, off + offsetof(lisp_function, code),
+              dump_value(d, ((lisp_function*)lv)->code));
+    return off;
+
+  case TP_FUNCCALL:
+    off = dump_object(d, lv, sizeof(lisp_funccall));
+    image_set(d, off + offsetof(lisp_funccall, function),
+              dump_value(d, ((lisp_funccall*)lv)->function));
+    image_set(d, off + offsetof(lisp_funccall, arguments),
+              dump_value(d, (lisp_value*)((lisp_funccall*)lv)->arguments));
+    return off;
+
+  case TP_CHUNK:
+    chunk = (lisp_chunk*)lv;
+    off = dump_object(d, lv, sizeof(lisp_chunk) +
+                      chunk->capacity * sizeof(lisp_value*));
+    for (int i = 0; i < chunk->capacity; i++) {
+      image_set(d, off + offsetof(lisp_chunk, items) + i * sizeof(lisp_value*),
+                i < chunk->first ? 0 : dump_value(d, chunk->items[i]));
+    }
+    image_set(d, off + offsetof(lisp_chunk, tail),
+              dump_value(d, chunk->tail));
+    return off;
+
+  case TP_CLIST:
+    off = dump_object(d, lv, sizeof(lisp_clist));
+    image_set(d, off + offsetof(lisp_clist, chunk),
+              dump_value(d, (lisp_value*)((lisp_clist*)lv)->chunk));
+    return off;
+
+  case TP_STRBUF:
+    // The bytes go right after the buffer, wherever they were kept before.
+    buf = (lisp_strbuf*)lv;
+    off = dump_object(d, lv, sizeof(lisp_strbuf));
+    size = image_alloc(d, buf->length + 1);
+    memcpy(d->data + size, buf->data, buf->length);
+    ((lisp_strbuf*)(d->data + off))->release = NULL;
+    image_set(d, off + offsetof(lisp_strbuf, data), size);
+    return off;
+
+  case TP_STRING:
+    str = (lisp_string*)lv;
+    if (str->buf == NULL) {
+      off = dump_object(d, lv, sizeof(lisp_string) + str->length + 1);
+      image_set(d, off + offsetof(lisp_string, data),
+                off + offsetof(lisp_string, small));
+      return off;
+    }
+    off = dump_object(d, lv, sizeof(lisp_string));
+    size = dump_value(d, (lisp_value*)str->buf);
+    image_set(d, off + offsetof(lisp_string, buf), size);
+    memcpy(&bytes, d->data + size + offsetof(lisp_strbuf, data),
+           sizeof(bytes));
+    image_set(d, off + offsetof(lisp_string, data),
+              bytes + (str->data - str->buf->data));
+    return off;
+
+  case TP_VECTOR:
+    vec = (lisp_vector*)lv;
+    off = dump_object(d, lv, sizeof(lisp_vector));
+    ((lisp_vector*)(d->data + off))->capacity = vec->length;
+    size = vec->length == 0 ? 0 :
+      image_alloc(d, vec->length * sizeof(lisp_value*));
+    image_set(d, off + offsetof(lisp_vector, items), size);
+    for (int i = 0; i < vec->length; i++) {
+      image_set(d, size + i * sizeof(lisp_value*),
+                dump_value(d, vec->items[i]));
+    }
+    return off;
+
+  case TP_HASH:
+    h = (lisp_hash*)lv;
+    off = dump_object(d, lv, sizeof(lisp_hash));
+    // Keys hash the same in any process, so entries keep their places.
+    size = image_alloc(d, h->capacity * sizeof(lisp_hash_entry));
+    image_set(d, off + offsetof(lisp_hash, entries), size);
+    for (int i = 0; i < h->capacity; i++) {
+      if (h->entries[i].key == NULL) {
+        continue;
+      }
+      ((lisp_hash_entry*)(d->data + size))[i].hash = h->entries[i].hash;
+      image_set(d, size + i * sizeof(lisp_hash_entry) +
+                offsetof(lisp_hash_entry, key),
+                dump_value(d, h->entries[i].key));
+      image_set(d, size + i * sizeof(lisp_hash_entry) +
+                offsetof(lisp_hash_entry, value),
+                dump_value(d, h->entries[i].value));
+    }
+    return off;
+
+  case TP_ARRAY:
+    return dump_object(d, lv, sizeof(lisp_array) +
+                       ((lisp_array*)lv)->length * sizeof(long));
+
+  case TP_BIGNUM:
+    return dump_object(d, lv, sizeof(lisp_bignum) +
+                       ((lisp_bignum*)lv)->length * sizeof(uint32_t));
+
+  case TP_ROPE:
+    off = dump_object(d, lv, sizeof(lisp_rope));
+    image_set(d, off + offsetof(lisp_rope, leaf),
+              dump_value(d, (lisp_value*)((lisp_rope*)lv)->leaf));
+    image_set(d, off + offsetof(lisp_rope, left),
+              dump_value(d, (lisp_value*)((lisp_rope*)lv)->left));
+    image_set(d, off + offsetof(lisp_rope, right),
+              dump_value(d, (lisp_value*)((lisp_rope*)lv)->right));
+    return off;
+
+  case TP_TRIE:
+    trie = (lisp_trie*)lv;
+    off = dump_object(d, lv, sizeof(lisp_trie) +
+                      trie->count * sizeof(lisp_value*));
+    for (int i = 0; i < trie->count; i++) {
+      image_set(d, off + offsetof(lisp_trie, items) + i * sizeof(lisp_value*),
+                dump_value(d, trie->items[i]));
+    }
+    return off;
+
+  case TP_PVECTOR:
+    off = dump_object(d, lv, sizeof(lisp_pvector));
+    image_set(d, off + offsetof(lisp_pvector, root),
+              dump_value(d, (lisp_value*)((lisp_pvector*)lv)->root));
+    return off;
+
+  case TP_PHASH:
+    // As with hash maps, keys hash the same in any process.
+    off = dump_object(d, lv, sizeof(lisp_phash));
+    image_set(d, off + offsetof(lisp_phash, root),
+              dump_value(d, (lisp_value*)((lisp_phash*)lv)->root));
+    return off;
+
+  default:
+    lisp_error(d->rt, "dump-image: can't dump a value of type %s",
+               lv->type->tp_name);
+    return 0;
+  }
+}
+
+static void dump_binding(lisp_dumper *d, smb_al *bindings, wchar_t *name,
+                         lisp_value *value)
+{
+  al_append(bindings, LLINT(dump_wstring(d, name)));
+  al_append(bindings, LLINT(dump_value(d, value)));
+}
+
+static bool write_offsets(FILE *f, smb_al *al)
+{
+  smb_status st = SMB_SUCCESS;
+  uint64_t off;
+  for (int i = 0; i < al_length(al); i++) {
+    off = al_get(al, i, &st).data_llint;
+    if (fwrite(&off, sizeof(off), 1, f) != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+long lisp_image_dump(lisp_runtime *rt, lisp_scope *scope, const char *path)
+{
+  lisp_dumper d;
+  lisp_image_header header;
+  smb_al bindings;
+  smb_ht_bckt *bucket;
+  char padding[IMAGE_DATA] = {0};
+  FILE *f;
+  bool ok;
+  long rv;
+
+  d.rt = rt;
+  d.capacity = 4096;
+  d.data = smb_new(char, d.capacity);
+  // Nothing is written at offset 0, so that it can stand for NULL.
+  d.size = IMAGE_ALIGN;
+  memset(d.data, 0, d.size);
+  ht_init(&d.offsets, &lisp_pointer_hash, &lisp_pointer_compare);
+  al_init(&d.relocs);
+  al_init(&d.objects);
+  al_init(&bindings);
+
+  if (scope->nsmall >= 0) {
+    for (int i = 0; i < scope->nsmall; i++) {
+      dump_binding(&d, &bindings, scope->names[i], scope->values[i]);
+    }
+  } else {
+    for (int i = 0; i < scope->table.allocated; i++) {
+      for (bucket = scope->table.table[i]; bucket; bucket = bucket->next) {
+        dump_binding(&d, &bindings, bucket->key.data_ptr,
+                     bucket->value.data_ptr);
+      }
+    }
+  }
+  image_alloc(&d, 0);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  header.word = sizeof(void*);
+  header.size = d.size;
+  header.nbindings = al_length(&bindings) / 2;
+  header.nrelocs = al_length(&d.relocs);
+  header.nobjects = al_length(&d.objects);
+  rv = header.nobjects;
+
+  if (!rt->error) {
+    f = fopen(path, "wb");
+    ok = f != NULL &&
+      fwrite(&header, sizeof(header), 1, f) == 1 &&
+      fwrite(padding, IMAGE_DATA - sizeof(header), 1, f) == 1 &&
+      fwrite(d.data, d.size, 1, f) == 1 &&
+      write_offsets(f, &bindings) &&
+      write_offsets(f, &d.relocs) &&
+      write_offsets(f, &d.objects);
+    if (f != NULL && fclose(f) != 0) {
+      ok = false;
+    }
+    if (!ok) {
+      lisp_error(rt, "dump-image: unable to write %s", path);
+    }
+  }
+
+  al_destroy(&bindings);
+  al_destroy(&d.objects);
+  al_destroy(&d.relocs);
+  ht_destroy(&d.offsets);
+  smb_free(d.data);
+  return rt->error ? -1 : rv;
+}
+
+/*******************************************************************************
+                                  Mapping
+*******************************************************************************/
+
+/**
+   @brief Return true if a value of some size fits in an image at an offset.
+ */
+static bool image_fits(lisp_image_header *h, uint64_t off, uint64_t size)
+{
+  return off % sizeof(uintptr_t) == 0 && off <= h->size &&
+    size <= h->size - off;
+}
+
+/**
+   @brief Return true if a binding's value is a float rather than an offset.
+ */
+static bool image_float(uint64_t off)
+{
+  return lisp_is_float((lisp_value*)(uintptr_t)off);
+}
+
+/**
+   @brief Return a binding's name, or NULL if it doesn't end within data.
+ */
+static wchar_t *image_name(char *data, uint64_t size, uint64_t off)
+{
+  wchar_t *name;
+
+  if (off % sizeof(wchar_t) != 0 || off >= size) {
+    return NULL;
+  }
+  name = (wchar_t*)(data + off);
+  if (wmemchr(name, L'\0', (size - off) / sizeof(wchar_t)) == NULL) {
+    return NULL;
+  }
+  return name;
+}
+
+/**
+   @brief Check that the rest of the file holds exactly the tables the header
+   describes.  Each count is checked against what's left of the file before
+   anything is added up, so none of it can overflow.
+ */
+static bool image_tables_fit(lisp_image_header *h, uint64_t length)
+{
+  uint64_t rest, words;
+
+  if (h->size > length - IMAGE_DATA) {
+    return false;
+  }
+  rest = length - IMAGE_DATA - h->size;
+  words = rest / sizeof(uint64_t);
+  if (rest % sizeof(uint64_t) != 0 || h->nbindings > words / 2 ||
+      h->nrelocs > words || h->nobjects > words) {
+    return false;
+  }
+  return 2 * h->nbindings + h->nrelocs + h->nobjects == words;
+}
+
+/**
+   @brief Patch pointers, types, and builtins.
+   @returns false if the image is malformed.
+ */
+static bool image_patch(lisp_image *image, lisp_image_header *h)
+{
+  uint64_t *relocs = image->bindings + 2 * h->nbindings;
+  uint64_t *objects = relocs + h->nrelocs;
+  uintptr_t *slot;
+  lisp_value *lv;
+  lisp_builtin *bi;
+  uintptr_t index, nbuiltins = 0;
+
+  while (lisp_builtins[nbuiltins].name != NULL) {
+    nbuiltins++;
+  }
+
+  for (uint64_t i = 0; i < h->nrelocs; i++) {
+    if (!image_fits(h, relocs[i], sizeof(uintptr_t))) {
+      return false;
+    }
+    slot = (uintptr_t*)(image->data + relocs[i]);
+    if (*slot >= h->size) {
+      return false;
+    }
+    *slot += (uintptr_t)image->data;
+  }
+
+  for (uint64_t i = 0; i < h->nobjects; i++) {
+    if (!image_fits(h, objects[i], sizeof(lisp_value))) {
+      return false;
+    }
+    lv = (lisp_value*)(image->data + objects[i]);
+    index = (uintptr_t)lv->type;
+    if (index >= TP_COUNT) {
+      return false;
+    }
+    lv->type = lisp_types[index];
+    lv->flags = LISP_FLAG_IMMORTAL | LISP_FLAG_FROZEN;
+    if (lv->type == &tp_builtin) {
+      bi = (lisp_builtin*)lv;
+      index = (uintptr_t)bi->function;
+      if (!image_fits(h, objects[i], sizeof(lisp_builtin)) ||
+          index >= nbuiltins) {
+        return false;
+      }
+      bi->function = lisp_builtins[index].function;
+    }
+  }
+
+  for (uint64_t i = 0; i < 2 * h->nbindings; i++) {
+    if (i % 2 == 0) {
+      if (image_name(image->data, h->size, image->bindings[i]) == NULL) {
+        return false;
+      }
+    } else if (!image_float(image->bindings[i]) &&
+               !image_fits(h, image->bindings[i], 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+lisp_image *lisp_image_open(lisp_runtime *rt, const char *path)
+{
+  lisp_image_header *h;
+  lisp_image *image;
+  struct stat sb;
+  char *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &sb) != 0) {
+    if (fd >= 0) close(fd);
+    lisp_error(rt, "unable to read image %s", path);
+    return NULL;
+  }
+  if ((size_t)sb.st_size < IMAGE_DATA) {
+    close(fd);
+    lisp_error(rt, "%s is not an image", path);
+    return NULL;
+  }
+  // Private, so that patching pointers doesn't change the file.  Only the
+  // pages that need patching are copied.
+  map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    lisp_error(rt, "unable to map image %s", path);
+    return NULL;
+  }
+
+  h = (lisp_image_header*)map;
+  if (memcmp(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+      h->version != IMAGE_VERSION || h->word != sizeof(void*) ||
+      h->size % IMAGE_ALIGN != 0 || !image_tables_fit(h, sb.st_size)) {
+    munmap(map, sb.st_size);
+    lisp_error(rt, "%s is not an image from this version", path);
+    return NULL;
+  }
+
+  image = smb_new(lisp_image, 1);
+  image->map = map;
+  image->length = sb.st_size;
+  image->data = map + IMAGE_DATA;
+  image->size = h->size;
+  image->nbindings = h->nbindings;
+  image->bindings = (uint64_t*)(image->data + h->size);
+
+  if (!image_patch(image, h)) {
+    lisp_image_close(image);
+    lisp_error(rt, "image %s is corrupt", path);
+    return NULL;
+  }
+  return image;
+}
+
+void lisp_image_bind(lisp_runtime *rt, lisp_image *image, lisp_scope *scope)
+{
+  wchar_t *name;
+  lisp_value *value;
+
+  for (uint64_t i = 0; i < image->nbindings; i++) {
+    // lisp_image_open() checked the names already, but a bad one here would
+    // be read past the end of the map.
+    name = image_name(image->data, image->size, image->bindings[2 * i]);
+    if (name == NULL) {
+      lisp_error(rt, "image has a malformed binding name");
+      return;
+    }
+    if (image_float(image->bindings[2 * i + 1])) {
+      value = (lisp_value*)(uintptr_t)image->bindings[2 * i + 1];
+    } else {
+      value = (lisp_value*)(image->data + image->bindings[2 * i + 1]);
+    }
+    lisp_scope_bind(rt, scope, name, value);
+  }
+}
+
+void lisp_image_close(lisp_image *image)
+{
+  munmap(image->map, image->length);
+  smb_free(image);
+}
@@ -0,0 +1,486 @@
+/***************************************************************************//**
+
+  @file         lazy.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Lazy sequences, whose items are computed as they're used.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Create a node holding on to a function and a source (either nullable).
+ */
+static lisp_lazy *lisp_lazy_create(lisp_runtime *rt, lisp_lazy_kind kind,
+                                   lisp_value *function, lisp_value *source)
+{
+  lisp_lazy *s = (lisp_lazy*)tp_lazy.tp_alloc(rt);
+  if (s == NULL) return NULL;
+  s->kind = kind;
+  s->function = lisp_keep(rt, &s->lv, function);
+  s->source = lisp_keep(rt, &s->lv, source);
+  if ((function != NULL && s->function == NULL) ||
+      (source != NULL && s->source == NULL)) {
+    lisp_decref(rt, (lisp_value*)s);
+    return NULL;
+  }
+  return s;
+}
+
+/**
+   @brief Take a reference to a value for a node to hold on to.
+   @param value NEW REFERENCE, which is given up (nullable).
+ */
+static lisp_value *lisp_lazy_keep(lisp_runtime *rt, lisp_lazy *s,
+                                  lisp_value *value)
+{
+  lisp_value *rv = lisp_keep(rt, &s->lv, value);
+  lisp_decref(rt, value);
+  return rv;
+}
+
+lisp_lazy *lisp_lazy_empty(lisp_runtime *rt)
+{
+  return lisp_lazy_create(rt, LISP_LAZY_FORCED, NULL, NULL);
+}
+
+lisp_lazy *lisp_lazy_range(lisp_runtime *rt, long start, long end, long step)
+{
+  lisp_lazy *s = lisp_lazy_create(rt, LISP_LAZY_RANGE, NULL, NULL);
+  if (s == NULL) return NULL;
+  s->start = start;
+  s->end = end;
+  s->step = step;
+  return s;
+}
+
+lisp_lazy *lisp_lazy_from_list(lisp_runtime *rt, lisp_value *list)
+{
+  return lisp_lazy_create(rt, LISP_LAZY_LIST, NULL, list);
+}
+
+lisp_lazy *lisp_lazy_iterate(lisp_runtime *rt, lisp_value *f, lisp_value *x)
+{
+  return lisp_lazy_create(rt, LISP_LAZY_ITERATE, f, x);
+}
+
+lisp_lazy *lisp_lazy_unfold(lisp_runtime *rt, lisp_value *f, lisp_value *seed)
+{
+  return lisp_lazy_create(rt, LISP_LAZY_UNFOLD, f, seed);
+}
+
+lisp_lazy *lisp_lazy_map(lisp_runtime *rt, lisp_value *f, lisp_lazy *seq)
+{
+  return lisp_lazy_create(rt, LISP_LAZY_MAP, f, (lisp_value*)seq);
+}
+
+lisp_lazy *lisp_lazy_filter(lisp_runtime *rt, lisp_value *f, lisp_lazy *seq)
+{
+  return lisp_lazy_create(rt, LISP_LAZY_FILTER, f, (lisp_value*)seq);
+}
+
+lisp_lazy *lisp_lazy_take(lisp_runtime *rt, long n, lisp_lazy *seq)
+{
+  lisp_lazy *s;
+  // Taking nothing mustn't keep the rest of the sequence alive.
+  if (n <= 0) {
+    return lisp_lazy_empty(rt);
+  }
+  s = lisp_lazy_create(rt, LISP_LAZY_TAKE, NULL, (lisp_value*)seq);
+  if (s == NULL) return NULL;
+  s->start = n;
+  return s;
+}
+
+lisp_lazy *lisp_lazy_source(lisp_runtime *rt, lisp_lazy_next next,
+                            lisp_value *source)
+{
+  lisp_lazy *s = lisp_lazy_create(rt, LISP_LAZY_SOURCE, NULL, source);
+  if (s == NULL) return NULL;
+  s->next = next;
+  return s;
+}
+
+/**
+   @brief Replace a node's recipe with its first item and the rest.
+   @param first NEW REFERENCE to the first item, or NULL for the end.
+   @param rest NEW REFERENCE to the rest, or NULL for the end.
+   @returns false, leaving the node as it was, if the rest is missing after an
+   item (since it couldn't be made) or the node can't hold on to them.
+ */
+static bool lisp_lazy_settle(lisp_runtime *rt, lisp_lazy *s,
+                             lisp_value *first, lisp_lazy *rest)
+{
+  lisp_value *kept_first;
+  lisp_lazy *kept_rest;
+
+  if (first != NULL && rest == NULL) {
+    lisp_decref(rt, first);
+    return false;
+  }
+  kept_first = lisp_lazy_keep(rt, s, first);
+  kept_rest = (lisp_lazy*)lisp_lazy_keep(rt, s, (lisp_value*)rest);
+  if (first != NULL && (kept_first == NULL || kept_rest == NULL)) {
+    lisp_decref(rt, kept_first);
+    lisp_decref(rt, (lisp_value*)kept_rest);
+    return false;
+  }
+  lisp_decref(rt, s->function);
+  lisp_decref(rt, s->source);
+  s->function = NULL;
+  s->source = NULL;
+  s->kind = LISP_LAZY_FORCED;
+  s->first = kept_first;
+  s->rest = kept_rest;
+  return true;
+}
+
+static lisp_value *lisp_lazy_call(lisp_runtime *rt, lisp_value *f,
+                                  lisp_value *x, lisp_scope *scope)
+{
+  return lisp_call_with(rt, f, &x, 1, scope);
+}
+
+static bool lisp_lazy_step(lisp_runtime *rt, lisp_lazy *s, lisp_scope *scope)
+{
+  lisp_lazy *src, *rest;
+  lisp_value *item, *r;
+  lisp_list_iter it;
+  bool keep;
+  long next;
+
+  switch (s->kind) {
+  case LISP_LAZY_FORCED:
+    return true;
+
+  case LISP_LAZY_RANGE:
+    if (s->step > 0 ? s->start >= s->end : s->start <= s->end) {
+      return lisp_lazy_settle(rt, s, NULL, NULL);
+    }
+    item = tp_int.tp_alloc(rt);
+    if (item == NULL) return false;
+    ((lisp_int*)item)->value = s->start;
+    if (__builtin_add_overflow(s->start, s->step, &next)) {
+      next = s->end;
+    }
+    return lisp_lazy_settle(rt, s, item,
+                            lisp_lazy_range(rt, next, s->end, s->step));
+
+  case LISP_LAZY_LIST:
+    lisp_list_iter_init(&it, s->source);
+    item = lisp_list_iter_next(&it);
+    if (item == NULL) {
+      return lisp_lazy_settle(rt, s, NULL, NULL);
+    }
+    lisp_incref(item);
+    r = lisp_list_rest(rt, s->source);
+    rest = r == NULL ? NULL : lisp_lazy_from_list(rt, r);
+    lisp_decref(rt, r);
+    return lisp_lazy_settle(rt, s, item, rest);
+
+  case LISP_LAZY_ITERATE:
+    // The first node's item is the starting value itself, and after that,
+    // each is the function of the one before.
+    if (s->start) {
+      item = lisp_lazy_call(rt, s->function, s->source, scope);
+      if (item == NULL) return false;
+    } else {
+      item = s->source;
+      lisp_incref(item);
+    }
+    rest = lisp_lazy_iterate(rt, s->function, item);
+    if (rest != NULL) {
+      rest->start = 1;
+    }
+    return lisp_lazy_settle(rt, s, item, rest);
+
+  case LISP_LAZY_UNFOLD:
+    r = lisp_lazy_call(rt, s->function, s->source, scope);
+    if (r == NULL) return false;
+    if (lisp_is_list(r) && lisp_list_length(r) == 0) {
+      lisp_decref(rt, r);
+      return lisp_lazy_settle(rt, s, NULL, NULL);
+    } else if (!lisp_is_list(r) || lisp_list_length(r) != 2) {
+      lisp_decref(rt, r);
+      lisp_error(rt, "lazy-unfold: function must return '() or a list of an "
+                 "item and the next seed");
+      return false;
+    }
+    lisp_list_iter_init(&it, r);
+    item = lisp_list_iter_next(&it);
+    lisp_incref(item);
+    rest = lisp_lazy_unfold(rt, s->function, lisp_list_iter_next(&it));
+    lisp_decref(rt, r);
+    return lisp_lazy_settle(rt, s, item, rest);
+
+  case LISP_LAZY_MAP:
+    src = (lisp_lazy*)s->source;
+    if (!lisp_lazy_force(rt, src, scope)) return false;
+    if (src->first == NULL) {
+      return lisp_lazy_settle(rt, s, NULL, NULL);
+    }
+    item = lisp_lazy_call(rt, s->function, src->first, scope);
+    if (item == NULL) return false;
+    return lisp_lazy_settle(rt, s, item,
+                            lisp_lazy_map(rt, s->function, src->rest));
+
+  case LISP_LAZY_FILTER:
+    for (;;) {
+      src = (lisp_lazy*)s->source;
+      if (!lisp_lazy_force(rt, src, scope)) return false;
+      if (src->first == NULL) {
+        return lisp_lazy_settle(rt, s, NULL, NULL);
+      }
+      r = lisp_lazy_call(rt, s->function, src->first, scope);
+      if (r == NULL) return false;
+      keep = lisp_truthy(r);
+      lisp_decref(rt, r);
+      if (keep) {
+        lisp_incref(src->first);
+        return lisp_lazy_settle(rt, s, src->first,
+                                lisp_lazy_filter(rt, s->function, src->rest));
+      }
+      // Move the source along, so that rejected items can be freed even
+      // while a long run of them is skipped.
+      r = lisp_keep(rt, &s->lv, (lisp_value*)src->rest);
+      if (r == NULL) return false;
+      lisp_decref(rt, s->source);
+      s->source = r;
+    }
+
+  case LISP_LAZY_TAKE:
+    src = (lisp_lazy*)s->source;
+    if (!lisp_lazy_force(rt, src, scope)) return false;
+    if (src->first == NULL) {
+      return lisp_lazy_settle(rt, s, NULL, NULL);
+    }
+    lisp_incref(src->first);
+    return lisp_lazy_settle(rt, s, src->first,
+                            lisp_lazy_take(rt, s->start - 1, src->rest));
+
+  case LISP_LAZY_SOURCE:
+    item = s->next(rt, s->source);
+    if (item == NULL) {
+      if (rt->error) return false;
+      return lisp_lazy_settle(rt, s, NULL, NULL);
+    }
+    return lisp_lazy_settle(rt, s, item,
+                            lisp_lazy_source(rt, s->next, s->source));
+  }
+  return false;
+}
+
+bool lisp_lazy_force(lisp_runtime *rt, lisp_lazy *s, lisp_scope *scope)
+{
+  bool rv;
+  if (s->kind == LISP_LAZY_FORCED) {
+    return true;
+  }
+  // A function that reads the very sequence it's computing would otherwise
+  // compute the same item twice, or recurse forever.
+  if (s->forcing) {
+    lisp_error(rt, "lazy sequence depends on its own items");
+    return false;
+  }
+  s->forcing = true;
+  rv = lisp_lazy_step(rt, s, scope);
+  s->forcing = false;
+  return rv;
+}
+
+/**
+   @brief Turn a node into the rest of its sequence, dropping its first item.
+ */
+static void lisp_lazy_advance(lisp_runtime *rt, lisp_lazy *s)
+{
+  lisp_lazy *next = s->rest;
+
+  lisp_decref(rt, s->first);
+  s->kind = next->kind;
+  s->function = next->function;
+  s->source = next->source;
+  s->first = next->first;
+  s->rest = next->rest;
+  s->start = next->start;
+  s->end = next->end;
+  s->step = next->step;
+  s->next = next->next;
+  lisp_incref(s->function);
+  lisp_incref(s->source);
+  lisp_incref(s->first);
+  lisp_incref((lisp_value*)s->rest);
+  lisp_decref(rt, (lisp_value*)next);
+}
+
+lisp_value *lisp_lazy_fold(lisp_runtime *rt, lisp_value *f, lisp_value *init,
+                           lisp_lazy *s, lisp_scope *scope)
+{
+  bool in_place = s->lv.refcount == 1 &&
+    !(s->lv.flags & LISP_FLAG_IMMORTAL);
+  lisp_value *acc = init, *args[2];
+  lisp_lazy *next;
+
+  lisp_incref(acc);
+  if (!in_place) {
+    lisp_incref((lisp_value*)s);
+  }
+  for (;;) {
+    if (!lisp_lazy_force(rt, s, scope)) {
+      lisp_decref(rt, acc);
+      acc = NULL;
+      break;
+    }
+    if (s->first == NULL) {
+      break;
+    }
+    args[0] = acc;
+    args[1] = s->first;
+    args[0] = lisp_call_with(rt, f, args, 2, scope);
+    lisp_decref(rt, acc);
+    acc = args[0];
+    if (acc == NULL) {
+      break;
+    }
+    if (in_place) {
+      lisp_lazy_advance(rt, s);
+    } else {
+      next = s->rest;
+      lisp_incref((lisp_value*)next);
+      lisp_decref(rt, (lisp_value*)s);
+      s = next;
+    }
+  }
+  if (!in_place) {
+    lisp_decref(rt, (lisp_value*)s);
+  }
+  return acc;
+}
+
+lisp_value *lisp_lazy_to_list(lisp_runtime *rt, lisp_lazy *s,
+                              lisp_scope *scope)
+{
+  int n = 0, capacity = 16;
+  lisp_value **items = smb_new(lisp_value*, capacity);
+  lisp_value *rv = NULL;
+
+  for (; lisp_lazy_force(rt, s, scope); s = s->rest) {
+    if (s->first == NULL) {
+      rv = lisp_list_from_array(rt, items, n);
+      break;
+    }
+    if (n == capacity) {
+      capacity *= 2;
+      items = smb_renew(lisp_value*, items, capacity);
+    }
+    items[n++] = s->first;
+  }
+  smb_free(items);
+  return rv;
+}
+
+/*******************************************************************************
+                              tp_lazy / lisp_lazy
+*******************************************************************************/
+
+static lisp_value *lisp_lazy_alloc(lisp_runtime *rt)
+{
+  lisp_lazy *s = (lisp_lazy*)lisp_alloc(rt, &tp_lazy, sizeof(lisp_lazy));
+  if (s == NULL) return NULL;
+  s->kind = LISP_LAZY_FORCED;
+  s->forcing = false;
+  s->function = NULL;
+  s->source = NULL;
+  s->first = NULL;
+  s->rest = NULL;
+  s->start = 0;
+  s->end = 0;
+  s->step = 0;
+  s->next = NULL;
+  return (lisp_value*)s;
+}
+
+static void lisp_lazy_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_lazy *s = (lisp_lazy*)value, *next;
+
+  // A forced sequence may be millions of nodes long, so each node that dies
+  // with its predecessor is freed by this loop, instead of by recursion.
+  while (s != NULL) {
+    lisp_decref(rt, s->function);
+    lisp_decref(rt, s->source);
+    lisp_decref(rt, s->first);
+    next = s->rest;
+    lisp_free(rt, (lisp_value*)s, sizeof(lisp_lazy));
+    s = NULL;
+    if (next == NULL) {
+      break;
+    } else if (next->lv.flags & (LISP_FLAG_FROZEN | LISP_FLAG_IMMORTAL)) {
+      lisp_decref(rt, (lisp_value*)next);
+    } else if (--next->lv.refcount == 0) {
+      s = next;
+    }
+  }
+}
+
+static void lisp_lazy_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)value; // unused
+  (void)indent; // unused
+  fprintf(f, "lazy-seq\n");
+}
+
+static lisp_value *lisp_lazy_copy(lisp_runtime *rt, lisp_value *value,
+                                  lisp_value *(*child)(lisp_runtime *,
+                                                       lisp_value *))
+{
+  lisp_lazy *s = (lisp_lazy*)value, *rv;
+
+  // Forcing a sequence changes it, so it can't be shared between threads.
+  // Promoting it out of an arena is fine, though.
+  if (rt->freezing) {
+    return lisp_error(rt, "a lazy sequence can't be frozen");
+  }
+  rv = (lisp_lazy*)tp_lazy.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->kind = s->kind;
+  // Each child is nullable, but a copy that failed stops this one at once.
+  if ((rv->function = child(rt, s->function)) == NULL && s->function != NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  if ((rv->source = child(rt, s->source)) == NULL && s->source != NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  if ((rv->first = child(rt, s->first)) == NULL && s->first != NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  rv->rest = (lisp_lazy*)child(rt, (lisp_value*)s->rest);
+  if (rv->rest == NULL && s->rest != NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  rv->start = s->start;
+  rv->end = s->end;
+  rv->step = s->step;
+  rv->next = s->next;
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_lazy = {
+  .tp_name = "lazy-seq",
+  .tp_index = TP_LAZY,
+  .tp_alloc = &lisp_lazy_alloc,
+  .tp_dealloc = &lisp_lazy_dealloc,
+  .tp_print = &lisp_lazy_print,
+  .tp_copy = &lisp_lazy_copy
+};
@@ -19,7 +19,7 @@
 #include <stdbool.h>
 #include "libstephen/al.h"
 
-typedef struct {
+typedef struct smb_lex {
 
   smb_al patterns;
   smb_al tokens;
@@ -16,13 +16,15 @@
 #ifndef CKY_LISP_H
 #define CKY_LISP_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #include "libstephen/ht.h"
 #include "libstephen/ll.h"
+#include "libstephen/log.h"
 
 /*
-  Basic types in lisp.
+  Basic types in lisp.  These index each type's statistics in a runtime.
  */
 #define TP_INT  0
 #define TP_ATOM 1
@@ -31,9 +33,54 @@
 #define TP_FUNCTION 4
 #define TP_FUNCCALL 5
 #define TP_IDENTIFIER 6
+#define TP_CHUNK 7
+#define TP_CLIST 8
+#define TP_STRBUF 9
+#define TP_STRING 10
+#define TP_FUTURE 11
+#define TP_COROUTINE 12
+#define TP_CHANNEL 13
+#define TP_VECTOR 14
+#define TP_HASH 15
+#define TP_ARRAY 16
+#define TP_FLOAT 17
+#define TP_BIGNUM 18
+#define TP_LAZY 19
+#define TP_ROPE 20
+#define TP_FILE 21
+#define TP_TRIE 22
+#define TP_PVECTOR 23
+#define TP_PHASH 24
+#define TP_COUNT 25
+
+/*
+  Flags stored in each lisp_value.
+ */
+#define LISP_FLAG_ARENA 0x1
+/*
+  A frozen value (and everything it refers to) is immutable, and may be shared
+  between runtimes on different threads.  Its refcount is updated atomically.
+ */
+#define LISP_FLAG_FROZEN 0x2
+/*
+  An immortal value is never freed, and its refcount is never touched, so the
+  memory it lives in is never written to.  Values mapped from an image are
+  immortal (and frozen).
+ */
+#define LISP_FLAG_IMMORTAL 0x4
+/*
+  The bits above the flags of an arena value hold the epoch of the evaluation
+  that allocated it (see lisp_arena).
+ */
+#define LISP_EPOCH_SHIFT 8
 
 struct lisp_value;
 typedef struct lisp_value lisp_value;
+struct lisp_runtime;
+typedef struct lisp_runtime lisp_runtime;
+struct smb_lex;
+struct lisp_image;
+typedef struct lisp_image lisp_image;
 
 /**
    @brief Type objects define how values of some type should behave.
@@ -45,17 +92,31 @@ typedef struct {
    */
   const char *tp_name;
   /**
-     @brief Memory allocator for this type.
+     @brief Index of this type (one of the TP_* values).
+   */
+  int tp_index;
+  /**
+     @brief Memory allocator for this type.  Returns NULL, with an error raised,
+     if the runtime's heap limit is reached.
    */
-  lisp_value* (*tp_alloc)(void);
+  lisp_value* (*tp_alloc)(lisp_runtime*);
   /**
      @brief Memory deallocator for this type.
    */
-  void (*tp_dealloc)(lisp_value*);
+  void (*tp_dealloc)(lisp_runtime*, lisp_value*);
   /**
      @brief Output function.
    */
   void (*tp_print)(lisp_value*, FILE *, int);
+  /**
+     @brief Copy a value onto the heap.
+
+     The copy gets a reference to each child of the original, obtained by
+     calling the second argument on it.  Returns a new reference, or NULL (with
+     an error raised) if the copy or any child couldn't be made.
+   */
+  lisp_value* (*tp_copy)(lisp_runtime*, lisp_value*,
+                         lisp_value* (*)(lisp_runtime*, lisp_value*));
 
 } lisp_type;
 
@@ -74,15 +135,45 @@ struct lisp_value {
    */
   unsigned int refcount;
 
+  /**
+     @brief Bitwise OR of LISP_FLAG_* values.
+   */
+  unsigned int flags;
+
 };
 
+/**
+   @brief Number of bindings a scope holds before it switches to a hash table.
+ */
+#define LISP_SCOPE_SMALL 4
+
 /**
    @brief A struct to represent one level of scope.
+
+   Most scopes belong to a function call and hold only a handful of arguments.
+   Those live in small inline arrays that are searched linearly.  Once a scope
+   grows past LISP_SCOPE_SMALL bindings (like the global scope does), they are
+   moved into a hash table.
  */
 typedef struct lisp_scope {
 
   /**
-     @brief Hash table containing variables!
+     @brief Number of bindings in the inline arrays, or -1 if using the table.
+   */
+  int nsmall;
+
+  /**
+     @brief Names of the inline bindings.
+   */
+  wchar_t *names[LISP_SCOPE_SMALL];
+
+  /**
+     @brief Values of the inline bindings.
+   */
+  lisp_value *values[LISP_SCOPE_SMALL];
+
+  /**
+     @brief Hash table containing variables, once there are too many.
    */
   smb_ht table;
 
@@ -91,8 +182,225 @@ typedef struct lisp_scope {
    */
   struct lisp_scope *up;
 
+  /**
+     @brief Values kept alive for as long as the scope, or NULL.
+
+     Bindings borrow their names.  When define binds a name, the identifier it
+     came from is kept here.
+   */
+  smb_ll *owned;
+
 } lisp_scope;
 
+/**
+   @brief A region that short-lived values are bump allocated from.
+
+   While an arena is current, every value allocated is carved out of its blocks
+   instead of being malloc'd individually.  Freeing such a value costs nothing,
+   and once an evaluation is finished, all of its memory is dropped at once.
+   Values that need to outlive the evaluation (those bound into the arena's
+   scope) are copied to the heap by lisp_promote().  Small values freed during
+   the evaluation go on a free list for their size, and are reused, so a long
+   running evaluation only takes as much memory as it has live at once.
+ */
+typedef struct lisp_arena_block lisp_arena_block;
+#define LISP_ARENA_CLASSES 16
+typedef struct {
+
+  /**
+     @brief Blocks values are allocated from, most recent first.
+   */
+  lisp_arena_block *blocks;
+
+  /**
+     @brief Blocks that could not be reused, freed when the arena is destroyed.
+   */
+  lisp_arena_block *retired;
+
+  /**
+     @brief Number of values allocated from the arena and not yet freed.
+   */
+  unsigned long live;
+
+  /**
+     @brief Identifies the current evaluation.  Every evaluation gets a new
+     one, so values left over from earlier evaluations can be told apart, and
+     aren't counted in live or reused when they're freed.
+   */
+  unsigned int epoch;
+
+  /**
+     @brief Freed memory to reuse, by size in multiples of 16 bytes.
+   */
+  void *free[LISP_ARENA_CLASSES];
+
+  /**
+     @brief The long-lived scope.  Values bound here must be promoted.
+   */
+  lisp_scope *scope;
+
+} lisp_arena;
+
+/**
+   @brief A pool of worker threads, each with its own runtime.
+ */
+typedef struct lisp_pool lisp_pool;
+
+/**
+   @brief A unit of work for a lisp_pool.
+
+   Embed this at the top of a struct holding whatever the task needs.
+ */
+typedef struct lisp_task lisp_task;
+struct lisp_task {
+
+  /**
+     @brief Do the work, within a worker's runtime and global scope.
+   */
+  void (*run)(lisp_runtime *rt, lisp_scope *globals, lisp_task *task);
+
+};
+
+/**
+   @brief A cooperative task, with its own stack, within a runtime.
+ */
+typedef struct lisp_coroutine lisp_coroutine;
+
+/**
+   @brief Allocation statistics for one type.
+ */
+typedef struct {
+
+  /**
+     @brief Number of values of this type currently allocated.
+   */
+  unsigned long live;
+  /**
+     @brief Number of bytes currently allocated to values of this type.
+   */
+  unsigned long bytes;
+  /**
+     @brief Number of values of this type allocated, ever.
+   */
+  unsigned long allocs;
+
+} lisp_type_stats;
+
+/**
+   @brief Size of the buffer for a runtime's error message.
+ */
+#define LISP_ERROR_SIZE 256
+
+/**
+   @brief Stack space left free by lisp_check_stack(), for the builtins (and
+   whatever else) that run between one call and the next.
+ */
+#define LISP_STACK_RESERVE (256 * 1024)
+
+/**
+   @brief All of the state belonging to one interpreter.
+
+   Nothing in the interpreter is global, so any number of runtimes may be used
+   at once, each on its own thread.  Values must not be shared between them.
+ */
+struct lisp_runtime {
+
+  /**
+     @brief The arena values are currently allocated from, or NULL.
+   */
+  lisp_arena *arena;
+
+  /**
+     @brief Allocation statistics, indexed by each type's tp_index.
+   */
+  lisp_type_stats stats[TP_COUNT];
+
+  /**
+     @brief Number of bytes currently allocated to values of all types.
+   */
+  unsigned long heap_bytes;
+
+  /**
+     @brief Maximum for heap_bytes, or 0 for no limit.
+   */
+  unsigned long heap_limit;
+
+  /**
+     @brief True when an error has been raised and not yet handled.
+   */
+  bool error;
+
+  /**
+     @brief Description of the current error.
+   */
+  char message[LISP_ERROR_SIZE];
+
+  /**
+     @brief True while lisp_freeze() is allocating frozen copies.
+   */
+  bool freezing;
+
+  /**
+     @brief The copy in progress (its child function, &lisp_promote or
+     &lisp_freeze), or NULL.
+   */
+  lisp_value *(*copying)(lisp_runtime *, lisp_value *);
+
+  /**
+     @brief Copies the copy in progress has made of values it may reach again,
+     by the address of each original, or NULL.
+   */
+  smb_ht *copies;
+
+  /**
+     @brief Worker threads for parallel builtins, or NULL to run sequentially.
+   */
+  lisp_pool *pool;
+
+  /**
+     @brief The coroutine currently running, or NULL.
+   */
+  lisp_coroutine *coroutine;
+
+  /**
+     @brief Image whose bindings lisp_create_globals() adds, or NULL.
+   */
+  struct lisp_image *image;
+
+  /**
+     @brief Lexer for lisp tokens, created the first time it's needed.
+   */
+  struct smb_lex *lexer;
+
+  /**
+     @brief CLOCK_MONOTONIC time (in nanoseconds) at which evaluation should be
+     abandoned, or 0 for no limit.
+   */
+  unsigned long long deadline;
+
+  /**
+     @brief Function calls since the deadline was last checked.
+   */
+  unsigned int ticks;
+
+  /**
+     @brief Lowest address the stack evaluation is running on may grow down to,
+     or 0 if it isn't known.
+   */
+  uintptr_t stack_limit;
+
+  /**
+     @brief True once the interactive session should stop.
+   */
+  bool quit;
+
+  /**
+     @brief A logger for when I want to see debug output.
+   */
+  smb_logger log;
+
+};
+
 /*******************************************************************************
                           "Child" types of lisp_value
 *******************************************************************************/
@@ -100,131 +408,1480 @@ typedef struct {
   lisp_value lv;
   long int value;
 } lisp_int;
-lisp_type tp_int;
+extern lisp_type tp_int;
+
+/*
+  Floats are never allocated or reference counted: a float is kept in the
+  lisp_value pointer itself, as the bits of the double plus 2^49 (the way
+  JavaScriptCore does it).  Real pointers have their top 16 bits clear on 64 bit
+  platforms, while every encoded double has some of them set, so the two can be
+  told apart.  NaNs are all stored as the same quiet NaN, since only negative
+  NaNs would wrap around to look like pointers.  Anything that might be handed
+  a float must use lisp_type_of() instead of reading lv->type.
+ */
+extern lisp_type tp_float;
+
+#define LISP_FLOAT_OFFSET ((uint64_t)1 << 49)
+
+static inline bool lisp_is_float(const lisp_value *lv)
+{
+  return ((uintptr_t)lv >> 48) != 0;
+}
+
+static inline lisp_value *lisp_float(double d)
+{
+  union { double d; uint64_t u; } bits;
+  bits.d = d;
+  if (d != d) {
+    bits.u = 0x7ff8000000000000ULL;
+  }
+  return (lisp_value*)(uintptr_t)(bits.u + LISP_FLOAT_OFFSET);
+}
+
+static inline double lisp_float_value(const lisp_value *lv)
+{
+  union { double d; uint64_t u; } bits;
+  bits.u = (uint64_t)(uintptr_t)lv - LISP_FLOAT_OFFSET;
+  return bits.d;
+}
+
+static inline lisp_type *lisp_type_of(const lisp_value *lv)
+{
+  return lisp_is_float(lv) ? &tp_float : lv->type;
+}
 
 typedef struct {
   lisp_value lv;
   wchar_t *value;
 } lisp_atom;
-lisp_type tp_atom;
+extern lisp_type tp_atom;
 
 typedef struct {
   lisp_value lv;
   wchar_t *value;
 } lisp_identifier;
-lisp_type tp_identifier;
+extern lisp_type tp_identifier;
+
+/*
+  Strings are immutable sequences of bytes (UTF-8 text).  Short strings keep
+  their bytes inline, in the same allocation as the string.  Longer ones refer
+  to a shared, refcounted lisp_strbuf, so that copies and substrings of them
+  don't need to copy any bytes.  A buffer usually keeps its bytes inline too,
+  but it may instead refer to bytes from elsewhere (like a file mapped into
+  memory), which it gives back with its release function.
+ */
+#define LISP_STRING_SMALL 23
+
+typedef struct {
+  lisp_value lv;
+  size_t length;
+  char *data;
+  void (*release)(char *data, size_t length);
+  char bytes[];
+} lisp_strbuf;
+extern lisp_type tp_strbuf;
+
+typedef struct {
+  lisp_value lv;
+  size_t length;
+  const char *data;
+  lisp_strbuf *buf;
+  char small[];
+} lisp_string;
+extern lisp_type tp_string;
 
 typedef struct lisp_list {
   lisp_value lv;
   lisp_value *value;
   struct lisp_list *next;
 } lisp_list;
-lisp_type tp_list;
+extern lisp_type tp_list;
+
+/*
+  Compact lists store their elements contiguously in chunks, rather than one
+  per cell.  Chunks are filled from the back, so that consing onto the front of
+  a list can usually just claim the next free slot.  A lisp_clist is a view of
+  a chunk starting at some index.  Once the chunk runs out, the list continues
+  with the chunk's tail, which may be a list of either kind.
+ */
+typedef struct lisp_chunk {
+  lisp_value lv;
+  int capacity;
+  int first;
+  lisp_value *tail;
+  lisp_value *items[];
+} lisp_chunk;
+extern lisp_type tp_chunk;
+
+typedef struct {
+  lisp_value lv;
+  lisp_chunk *chunk;
+  int index;
+} lisp_clist;
+extern lisp_type tp_clist;
+
+/*
+  Vectors store their items contiguously, in an array that doubles in size as
+  it fills up.  Unlike other values, they can be changed in place (unless they
+  are frozen).
+ */
+typedef struct {
+  lisp_value lv;
+  int length;
+  int capacity;
+  lisp_value **items;
+} lisp_vector;
+extern lisp_type tp_vector;
+
+/*
+  Hash maps keep their entries in a single array, using open addressing with
+  linear probing, so a lookup usually reads one or two neighbouring entries.
+  Each entry keeps its key's hash, so most mismatches are found without looking
+  at the key.  An entry with a NULL key is empty.  Keys may be integers, atoms
+  or strings, which are compared by value.  Like vectors, hash maps can be
+  changed in place unless they are frozen.
+ */
+typedef struct {
+  unsigned int hash;
+  lisp_value *key;
+  lisp_value *value;
+} lisp_hash_entry;
+
+typedef struct {
+  lisp_value lv;
+  int count;
+  int capacity;
+  lisp_hash_entry *entries;
+} lisp_hash;
+extern lisp_type tp_hash;
+
+/*
+  Arrays hold a fixed number of integers or floats, unboxed and side by side, so
+  that arithmetic over them can run through SIMD kernels (see array.c) instead
+  of chasing pointers.  Like strings, they are immutable.
+ */
+typedef struct {
+  lisp_value lv;
+  int length;
+  /**
+     @brief Whether the items are doubles, read through lisp_array_floats(),
+     rather than longs.  Either takes up the same space.
+   */
+  bool is_float;
+  long items[];
+} lisp_array;
+extern lisp_type tp_array;
+
+static inline double *lisp_array_floats(lisp_array *a)
+{
+  return (double*)a->items;
+}
+
+/*
+  Integers too big for a lisp_int are bignums: a sign, and a magnitude in 32 bit
+  limbs, least significant first (see bignum.c).  Arithmetic only returns a
+  bignum when the result doesn't fit in a lisp_int, so each integer has just
+  one representation, and the two kinds never compare equal.
+ */
+typedef struct {
+  lisp_value lv;
+  int sign;
+  int length;
+  uint32_t digits[];
+} lisp_bignum;
+extern lisp_type tp_bignum;
 
 typedef struct {
   lisp_value lv;
   lisp_value *function;
   lisp_list *arguments;
 } lisp_funccall;
-lisp_type tp_funccall;
+extern lisp_type tp_funccall;
 
 typedef struct {
   lisp_value lv;
-  lisp_value * (*function) (lisp_list *, lisp_scope *);
+  lisp_value * (*function) (lisp_runtime *, lisp_list *, lisp_scope *);
   bool eval;
 } lisp_builtin;
-lisp_type tp_builtin;
+extern lisp_type tp_builtin;
 
 typedef struct {
   lisp_value lv;
   lisp_list *arglist;
   lisp_value *code;
 } lisp_function;
-lisp_type tp_function;
-
-/*******************************************************************************
-                    Some useful utility functions on lists.
-*******************************************************************************/
-int lisp_list_length(lisp_list *l);
-
-/**
-   @brief Tokenize a string.
+extern lisp_type tp_function;
 
-   The input string is not modified.  All returned tokens are newly allocated,
-   so the input string does not need to be "kept around" while the tokens are
-   used.  On the flip side, you must free all the tokens when you are done with
-   them.
-
-   @param str The string to tokenize.
-   @returns A `smb_ll` containing `lisp_token` structs.
- */
-smb_ll *lisp_lex(wchar_t *str);
-
-/**
-   @brief Tokenize a file incrementally.
+/*
+  The state of a future, shared between its copies and the worker computing it.
  */
-smb_iter lisp_lex_file(FILE *f);
+typedef struct lisp_promise lisp_promise;
 
-/**
-   @brief Parse a token stream and return the first expression.
-   @param it Pointer to the iterator over the stream.
-   @returns NEW REFERENCE to code
- */
-lisp_value *lisp_parse(smb_iter *it);
+typedef struct {
+  lisp_value lv;
+  lisp_promise *promise;
+} lisp_future;
+extern lisp_type tp_future;
 
-/**
-   @brief Evaluate an expression within a scope.
-   @param expr Reference to expression.
-   @param scope The scope to run in.
-   @returns NEW REFERENCE to the return value
+/*
+  The stack and saved registers of a coroutine, along with what it is running.
  */
-lisp_value *lisp_evaluate(lisp_value *expr, lisp_scope *scope);
+typedef struct lisp_context lisp_context;
 
-/**
-   @brief Run a piece of lisp code.
-   @param str Code to run.
-   @returns The value of the last expression.
- */
-lisp_value *lisp_run(wchar_t *str);
+struct lisp_coroutine {
+  lisp_value lv;
+  lisp_context *context;
+};
+extern lisp_type tp_coroutine;
 
-/**
-   @brief Run an interactive lisp session on stdin.
+/*
+  The queue behind a channel, shared between its copies.
  */
-void lisp_interact(void);
+typedef struct lisp_queue lisp_queue;
 
 /**
-   @brief Increment the reference count of an object.
-   @param lv Object to incref (nullable)
+   @brief Most values a channel can hold at once.
  */
-void lisp_incref(lisp_value *lv);
+#define LISP_CHANNEL_MAX (1 << 20)
 
-/**
-   @brief Decrement the reference count of an object.
-   @param lv Object to decref (nullable)
+typedef struct {
+  lisp_value lv;
+  lisp_queue *queue;
+} lisp_channel;
+extern lisp_type tp_channel;
 
-   When an object goes down to 0 references, it is deallocated.
+/*
+  A lazy sequence is made of nodes that are computed as they're used (see
+  lazy.c).  Until it's forced, a node holds a recipe for its first item and the
+  rest of the sequence.  Forcing it replaces the recipe with the result, so each
+  item is only computed once, and each node only refers to the one after it, so
+  that once nothing refers to the front of a sequence any more, it is freed.
  */
-void lisp_decref(lisp_value *lv);
+typedef enum {
+  LISP_LAZY_FORCED,
+  LISP_LAZY_RANGE,
+  LISP_LAZY_LIST,
+  LISP_LAZY_ITERATE,
+  LISP_LAZY_UNFOLD,
+  LISP_LAZY_MAP,
+  LISP_LAZY_FILTER,
+  LISP_LAZY_TAKE,
+  LISP_LAZY_SOURCE
+} lisp_lazy_kind;
 
 /**
-   @brief Create and return a lisp_scope containing all global name definitions.
+   @brief Produce the next item of a source, for lisp_lazy_source().
+   @returns NEW REFERENCE to the item, or NULL at the end (or with an error
+   raised).
  */
-lisp_scope *lisp_create_globals(void);
-/**
-   @brief Create an empty scope!
+typedef lisp_value *(*lisp_lazy_next)(lisp_runtime *rt, lisp_value *source);
 
-   Anything you put in a new scope should be incref'd, because the scope "owns"
-   a reference to everything in it.
+typedef struct lisp_lazy {
+  lisp_value lv;
+  lisp_lazy_kind kind;
+  bool forcing;
+  /**
+     @brief The function that computes items (map, filter, iterate, unfold).
+   */
+  lisp_value *function;
+  /**
+     @brief Where items come from: a sequence, list, value, seed or source.
+   */
+  lisp_value *source;
+  /**
+     @brief Once forced, the first item, or NULL if the sequence is empty.
+   */
+  lisp_value *first;
+  /**
+     @brief Once forced, the rest of the sequence (NULL if it's empty).
+   */
+  struct lisp_lazy *rest;
+  /**
+     @brief The next number, last one and step of a range.  Take keeps its
+     count in start, and iterate whether to apply the function yet.
+   */
+  long start, end, step;
+  lisp_lazy_next next;
+} lisp_lazy;
+extern lisp_type tp_lazy;
+
+/*
+  A rope is an immutable string kept as a balanced tree (see rope.c).  Its
+  leaves are strings, and each node holds its left and right halves, so that
+  ropes can be concatenated and sliced in logarithmic time, sharing the pieces
+  they're made of instead of copying them.  Depth is 0 for a leaf.
+ */
+typedef struct lisp_rope {
+  lisp_value lv;
+  size_t length;
+  int depth;
+  lisp_string *leaf;
+  struct lisp_rope *left, *right;
+} lisp_rope;
+extern lisp_type tp_rope;
+
+/*
+  An open file, read or written through a large buffer.  Like a coroutine, a
+  file belongs to the runtime that opened it, so it can't be copied or frozen.
+  It is closed once nothing refers to it, if it wasn't closed before.
+ */
+typedef struct {
+  lisp_value lv;
+  FILE *file;
+  bool output;
+  /**
+     @brief The byte that ends each record of the file's lazy sequence.
+   */
+  int delimiter;
+  /**
+     @brief Buffer that records are read into, reused for each one.
+   */
+  char *line;
+  size_t capacity;
+} lisp_file;
+extern lisp_type tp_file;
+
+/*
+  Persistent vectors and hash maps never change: setting an item returns a new
+  version instead, which shares most of its trie with the old one (see
+  persistent.c).  A node of either trie is a lisp_trie.  A vector's nodes hold
+  count children (or, at the bottom, items), and a hash map's nodes hold a pair
+  of slots for each bit of their bitmap.
+ */
+typedef struct {
+  lisp_value lv;
+  uint32_t bitmap;
+  int count;
+  lisp_value *items[];
+} lisp_trie;
+extern lisp_type tp_trie;
+
+typedef struct {
+  lisp_value lv;
+  int length;
+  /**
+     @brief How many bits of an index are below the root (a multiple of 5).
+   */
+  int shift;
+  lisp_trie *root;
+} lisp_pvector;
+extern lisp_type tp_pvector;
+
+typedef struct {
+  lisp_value lv;
+  int count;
+  lisp_trie *root;
+} lisp_phash;
+extern lisp_type tp_phash;
+
+/*******************************************************************************
+                    Some useful utility functions on lists.
+*******************************************************************************/
+
+/**
+   @brief Iteration state over a list of either representation.
+ */
+typedef struct {
+  lisp_list *cell;
+  lisp_chunk *chunk;
+  int index;
+} lisp_list_iter;
+
+/**
+   @brief Return true if a value is a list (of either representation).
+ */
+bool lisp_is_list(lisp_value *lv);
+/**
+   @brief Begin iterating over a list.
+   @param it Iterator to initialize.
+   @param list List to iterate over (lisp_list or lisp_clist).
+ */
+void lisp_list_iter_init(lisp_list_iter *it, lisp_value *list);
+/**
+   @brief Return the next item of a list, or NULL at the end.
+   @returns BORROWED REFERENCE to the item.
+ */
+lisp_value *lisp_list_iter_next(lisp_list_iter *it);
+/**
+   @brief Return the number of items in a list of either representation.
+ */
+int lisp_list_length(lisp_value *l);
+/**
+   @brief Return the first item of a non-empty list.
+   @returns BORROWED REFERENCE to the item.
+ */
+lisp_value *lisp_list_first(lisp_value *l);
+/**
+   @brief Return a non-empty list without its first item.
+   @returns NEW REFERENCE to the rest of the list.
+ */
+lisp_value *lisp_list_rest(lisp_runtime *rt, lisp_value *l);
+/**
+   @brief Return a compact list with an item added to the front.
+   @param value Item to add.  A new reference is taken.
+   @param list List to add to (of either representation).
+   @returns NEW REFERENCE to the new list.
+ */
+lisp_value *lisp_list_cons(lisp_runtime *rt, lisp_value *value,
+                           lisp_value *list);
+/**
+   @brief Return a compact list containing the given items.
+   @param items Array of items.  A new reference is taken to each one.
+   @param n Number of items.
+   @returns NEW REFERENCE to a compact list (or an empty list if n is 0).
+ */
+lisp_value *lisp_list_from_array(lisp_runtime *rt, lisp_value **items, int n);
+/**
+   @brief Return a compact list of the given items, followed by another list.
+   @param items Array of items.  A new reference is taken to each one.
+   @param n Number of items.
+   @param tail List that follows them, which is shared rather than copied.
+   @returns NEW REFERENCE to the new list (tail itself if n is 0).
+ */
+lisp_value *lisp_list_prepend(lisp_runtime *rt, lisp_value **items, int n,
+                              lisp_value *tail);
+/**
+   @brief Return a list made of lisp_list cells with the same items as a list.
+   @param list List of either representation.
+   @returns NEW REFERENCE to a lisp_list.
+ */
+lisp_list *lisp_list_cells(lisp_runtime *rt, lisp_value *list);
+/**
+   @brief Return whether two values are the same, as hash keys and assoc compare
+   them.  Numbers, atoms and strings are compared by value, and anything else
+   only matches itself.
+ */
+bool lisp_eqv(lisp_value *a, lisp_value *b);
+
+/*******************************************************************************
+                              Vector functions.
+*******************************************************************************/
+
+/**
+   @brief Create an empty vector with room for some number of items.
+   @returns NEW REFERENCE to the vector.
+ */
+lisp_vector *lisp_vector_create(lisp_runtime *rt, int capacity);
+/**
+   @brief Return a vector with the same items as a list.
+   @param list List of either representation.
+   @returns NEW REFERENCE to the vector.
+ */
+lisp_vector *lisp_vector_from_list(lisp_runtime *rt, lisp_value *list);
+/**
+   @brief Replace the item at an index of a vector.
+   @param value New item.  A new reference is taken.
+   @returns false, with an error raised, if the index is out of range or the
+   vector is frozen.
+ */
+bool lisp_vector_set(lisp_runtime *rt, lisp_vector *vec, int index,
+                     lisp_value *value);
+/**
+   @brief Add an item to the end of a vector, in amortized constant time.
+   @param value Item to add.  A new reference is taken.
+   @returns false, with an error raised, if the vector is frozen.
+ */
+bool lisp_vector_push(lisp_runtime *rt, lisp_vector *vec, lisp_value *value);
+
+/*******************************************************************************
+                             Hash map functions.
+*******************************************************************************/
+
+/**
+   @brief Create an empty hash map with room for some number of entries.
+   @returns NEW REFERENCE to the hash map.
+ */
+lisp_hash *lisp_hash_create(lisp_runtime *rt, int count);
+/**
+   @brief Look up a key in a hash map.
+   @returns BORROWED REFERENCE to the key's value, or NULL if it isn't there.
+   NULL is also returned, with an error raised, if the key can't be hashed.
+ */
+lisp_value *lisp_hash_get(lisp_runtime *rt, lisp_hash *h, lisp_value *key);
+/**
+   @brief Set the value of a key in a hash map, adding the key if needed.
+   @param key Key.  A new reference is taken.
+   @param value Value.  A new reference is taken.
+   @returns false, with an error raised, if the key can't be hashed or the hash
+   map is frozen.
+ */
+bool lisp_hash_set(lisp_runtime *rt, lisp_hash *h, lisp_value *key,
+                   lisp_value *value);
+/**
+   @brief Remove a key (and its value) from a hash map.
+   @returns Whether the key was there.  False is also returned, with an error
+   raised, if the key can't be hashed or the hash map is frozen.
+ */
+bool lisp_hash_remove(lisp_runtime *rt, lisp_hash *h, lisp_value *key);
+/**
+   @brief Hash a key, which must be an integer, atom or string.
+   @param op Name of the operation, for the error message.
+   @returns false, with an error raised, if the key is of any other type.
+ */
+bool lisp_hash_key(lisp_runtime *rt, lisp_value *key, const char *op,
+                   unsigned int *hash);
+
+/*******************************************************************************
+                               Array functions.
+*******************************************************************************/
+
+/**
+   @brief Create an array of some length.
+   @param is_float Whether it holds floats rather than integers.
+   @returns NEW REFERENCE to an array, whose items the caller must fill in.
+ */
+lisp_array *lisp_array_create(lisp_runtime *rt, int length, bool is_float);
+/**
+   @brief Return an array with the same items as a list.  It holds floats if
+   any item is a float (the integers are converted), or else integers.
+   @param list List of either representation.
+   @returns NEW REFERENCE to the array, or NULL, with an error raised, if an
+   item isn't an int or a float.
+ */
+lisp_array *lisp_array_from_list(lisp_runtime *rt, lisp_value *list);
+/**
+   @brief Return the sum of an array's items, wrapping around on overflow.
+ */
+long lisp_array_sum(lisp_array *a);
+/**
+   @brief Return the dot product of two arrays of the same length.
+ */
+long lisp_array_dot(lisp_array *a, lisp_array *b);
+/**
+   @brief Return the smallest item of an array, which mustn't be empty.
+ */
+long lisp_array_min(lisp_array *a);
+/**
+   @brief Return the largest item of an array, which mustn't be empty.
+ */
+long lisp_array_max(lisp_array *a);
+/*
+  The same, for arrays of floats.  Sums may be added up in any order, so they
+  can round differently depending on the CPU.  If there are NaNs, the smallest
+  or largest item may or may not be one.
+ */
+double lisp_array_fsum(lisp_array *a);
+double lisp_array_fdot(lisp_array *a, lisp_array *b);
+double lisp_array_fmin(lisp_array *a);
+double lisp_array_fmax(lisp_array *a);
+/**
+   @brief Add, subtract or multiply an array's items by another's.
+   @param op One of '+', '-' or '*'.
+   @param b An array of the same length and kind, or a number to combine with
+   each item: an int for an array of integers, or an int or float for an array
+   of floats.
+   @returns NEW REFERENCE to an array of the results.
+ */
+lisp_array *lisp_array_combine(lisp_runtime *rt, char op, lisp_array *a,
+                               lisp_value *b);
+
+/*******************************************************************************
+                              Integer functions.
+*******************************************************************************/
+
+/*
+  These take integers of either kind (lisp_int or lisp_bignum), and return a
+  lisp_int whenever the result fits in one.  They are the slow path: callers
+  should do what they can with plain longs first.
+ */
+
+/**
+   @brief Return whether a value is an integer of either kind.
+ */
+bool lisp_is_integer(lisp_value *v);
+/**
+   @returns NEW REFERENCE to a + b.
+ */
+lisp_value *lisp_integer_add(lisp_runtime *rt, lisp_value *a, lisp_value *b);
+/**
+   @returns NEW REFERENCE to a - b.
+ */
+lisp_value *lisp_integer_sub(lisp_runtime *rt, lisp_value *a, lisp_value *b);
+/**
+   @returns NEW REFERENCE to a * b.
+ */
+lisp_value *lisp_integer_mul(lisp_runtime *rt, lisp_value *a, lisp_value *b);
+/**
+   @brief Divide two integers, where b isn't zero.
+   @param op '/' for the quotient (truncated), 'r' for the remainder (with the
+   sign of a) or 'm' for the modulus (with the sign of b).
+   @returns NEW REFERENCE to the result.
+ */
+lisp_value *lisp_integer_divide(lisp_runtime *rt, lisp_value *a,
+                                lisp_value *b, char op);
+/**
+   @brief Return -1, 0 or 1 as a is less than, equal to, or greater than b.
+ */
+int lisp_integer_compare(lisp_value *a, lisp_value *b);
+/**
+   @brief Return the closest double to an integer (or infinity).
+ */
+double lisp_integer_to_double(lisp_value *v);
+/**
+   @brief Return a finite double, truncated to an integer.
+   @returns NEW REFERENCE to the integer.
+ */
+lisp_value *lisp_integer_from_double(lisp_runtime *rt, double d);
+/**
+   @brief Read an integer from decimal digits, with an optional '-'.
+   @returns NEW REFERENCE to the integer.
+ */
+lisp_value *lisp_integer_parse(lisp_runtime *rt, const wchar_t *text);
+
+/*******************************************************************************
+                              String functions.
+*******************************************************************************/
+
+/**
+   @brief Create a string with room for some number of bytes.
+   @param length Length of the string.
+   @returns NEW REFERENCE to a string, whose data the caller must fill in.
+ */
+lisp_string *lisp_string_create(lisp_runtime *rt, size_t length);
+/**
+   @brief Create a string containing a copy of some bytes.
+   @returns NEW REFERENCE to the string.
+ */
+lisp_string *lisp_string_new(lisp_runtime *rt, const char *data,
+                             size_t length);
+/**
+   @brief Return part of a string.
+   @param str String to take part of.
+   @param start Index of the first byte.
+   @param end Index after the last byte.
+   @returns NEW REFERENCE to a string, sharing the buffer of str if it has one.
+ */
+lisp_string *lisp_string_substring(lisp_runtime *rt, lisp_string *str,
+                                   size_t start, size_t end);
+/**
+   @brief Compare two strings, like memcmp().
+ */
+int lisp_string_compare(lisp_string *a, lisp_string *b);
+/**
+   @brief Create a string of bytes that are stored elsewhere.
+   @param data The bytes, which must not change while the string exists.
+   @param length Number of bytes.
+   @param release Called to give the bytes back once nothing refers to them.
+   @returns NEW REFERENCE to the string.
+
+   The buffer behind the string is frozen from the start, so that freezing or
+   promoting the string never copies the bytes.
+ */
+lisp_string *lisp_string_external(lisp_runtime *rt, char *data, size_t length,
+                                  void (*release)(char *data, size_t length));
+
+/*******************************************************************************
+                                The runtime.
+*******************************************************************************/
+
+/**
+   @brief Initialize a runtime, to be used on the calling thread.
+ */
+void lisp_runtime_init(lisp_runtime *rt);
+/**
+   @brief Let a runtime know it's now being used on the calling thread, whose
+   stack it must stay within.
+ */
+void lisp_runtime_set_stack(lisp_runtime *rt);
+/**
+   @brief Free everything owned by a runtime.
+ */
+void lisp_runtime_destroy(lisp_runtime *rt);
+/**
+   @brief Raise an error within a runtime.
+   @param rt Runtime to raise the error in.
+   @param format Format string for the error message (printf style).
+   @returns NULL, so that builtins may simply return the result.
+
+   Once an error is raised, evaluation unwinds: every function that evaluates
+   code returns NULL as soon as it sees the error, until something handles it
+   with lisp_clear_error().  Only the first error raised is recorded.
+ */
+lisp_value *lisp_error(lisp_runtime *rt, const char *format, ...);
+/**
+   @brief Mark the current error as handled.
+ */
+void lisp_clear_error(lisp_runtime *rt);
+/**
+   @brief Limit how long evaluation may take from now on.
+   @param ms Milliseconds from now, or 0 to remove the limit.
+ */
+void lisp_set_timeout(lisp_runtime *rt, unsigned long ms);
+/**
+   @brief Raise an error if the runtime's deadline has passed.
+   @returns false if the deadline has passed.
+
+   The clock is only read every so often, so this is cheap enough to call on
+   every function call.
+ */
+bool lisp_check_deadline(lisp_runtime *rt);
+/**
+   @brief Raise an error if the stack is nearly out of room.
+   @returns false if there's no room for another call.
+ */
+bool lisp_check_stack(lisp_runtime *rt);
+
+/**
+   @brief Tokenize a string.
+
+   The input string is not modified.  All returned tokens are newly allocated,
+   so the input string does not need to be "kept around" while the tokens are
+   used.  On the flip side, you must free all the tokens when you are done with
+   them.
+
+   @param str The string to tokenize.
+   @returns A `smb_ll` containing `lisp_token` structs.
+ */
+smb_ll *lisp_lex(lisp_runtime *rt, wchar_t *str);
+
+/**
+   @brief Tokenize a file incrementally.
+ */
+smb_iter lisp_lex_file(lisp_runtime *rt, FILE *f);
+
+/**
+   @brief Parse a token stream and return the first expression.
+   @param it Pointer to the iterator over the stream.
+   @returns NEW REFERENCE to code
+ */
+lisp_value *lisp_parse(lisp_runtime *rt, smb_iter *it);
+
+/**
+   @brief Evaluate an expression within a scope.
+   @param rt The runtime to evaluate in.
+   @param expr Reference to expression.
+   @param scope The scope to run in.
+   @returns NEW REFERENCE to the return value, or NULL on error
+ */
+lisp_value *lisp_evaluate(lisp_runtime *rt, lisp_value *expr,
+                          lisp_scope *scope);
+/**
+   @brief Call a function with arguments that have already been evaluated.
+   @param rt The runtime to evaluate in.
+   @param func The function or builtin to call.
+   @param args The arguments.
+   @param scope The scope to call it from.
+   @returns NEW REFERENCE to the return value, or NULL on error
+ */
+lisp_value *lisp_call(lisp_runtime *rt, lisp_value *func, lisp_list *args,
+                      lisp_scope *scope);
+/**
+   @brief Call a function with an array of arguments.
+   @param args The arguments (borrowed).
+   @param n How many arguments there are.
+   @returns NEW REFERENCE to the return value, or NULL on error
+ */
+lisp_value *lisp_call_with(lisp_runtime *rt, lisp_value *func,
+                           lisp_value **args, int n, lisp_scope *scope);
+/**
+   @brief Return whether a value counts as true (a nonzero integer).
+ */
+bool lisp_truthy(lisp_value *expr);
+
+/**
+   @brief Run a piece of lisp code.
+   @param rt The runtime to run in.
+   @param str Code to run.
+   @returns The value of the last expression, or NULL on error.
+ */
+lisp_value *lisp_run(lisp_runtime *rt, wchar_t *str);
+
+/**
+   @brief Evaluate each expression in a string, in order.
+   @param rt The runtime to evaluate in.
+   @param str Code to run.
+   @param scope The scope to run in.
+   @returns NEW REFERENCE to the value of the last expression (or the empty
+   list if there are none), or NULL on error.
+ */
+lisp_value *lisp_eval_string(lisp_runtime *rt, wchar_t *str,
+                             lisp_scope *scope);
+/**
+   @brief Evaluate each expression in a file, in order.
+   @returns false (with an error raised) on error.
+ */
+bool lisp_load_file(lisp_runtime *rt, const char *path, lisp_scope *scope);
+
+/**
+   @brief Run an interactive lisp session on stdin.
+   @param rt The runtime to run in.
+   @param load Files to load before reading from stdin.
+   @param nload Number of files to load.
+ */
+void lisp_interact(lisp_runtime *rt, char **load, int nload);
+
+/**
+   @brief Increment the reference count of an object.
+   @param lv Object to incref (nullable)
+ */
+void lisp_incref(lisp_value *lv);
+
+/**
+   @brief Decrement the reference count of an object.
+   @param rt Runtime that owns the object.
+   @param lv Object to decref (nullable)
+
+   When an object goes down to 0 references, it is deallocated.
+ */
+void lisp_decref(lisp_runtime *rt, lisp_value *lv);
+
+/**
+   @brief Allocate a value of the given type.
+   @param rt Runtime to allocate in.
+   @param type Type of the new value.
+   @param size Size of the struct to allocate.
+   @returns A value with its type set and a refcount of 1, or NULL with an error
+   raised if it would take the runtime past its heap limit.
+
+   If an arena is current, the value comes from the arena.  Every function that
+   allocates a value passes a NULL on, so that evaluation unwinds and drops
+   whatever it built so far.  Frozen copies belong to no runtime, so they're
+   never limited.
+ */
+lisp_value *lisp_alloc(lisp_runtime *rt, lisp_type *type, size_t size);
+/**
+   @brief Free memory allocated by lisp_alloc().
+   @param rt Runtime the value belongs to.
+   @param lv Value to free.
+   @param size Size the value was allocated with.
+ */
+void lisp_free(lisp_runtime *rt, lisp_value *lv, size_t size);
+/**
+   @brief Count memory a value owns besides itself, such as a vector's items.
+   @param rt Runtime the value belongs to.
+   @param lv Value the memory belongs to.
+   @param size Bytes about to be allocated, or (if negative) just freed.
+   @returns false, with an error raised, if allocating that much would take
+   the runtime past its heap limit.  Nothing is counted then, and the caller
+   mustn't allocate.
+
+   The bytes count towards the value's type in the heap stats, as if they were
+   part of the value.
+ */
+bool lisp_charge(lisp_runtime *rt, lisp_value *lv, long size);
+
+/**
+   @brief Every type object, in order of tp_index, terminated by NULL.
+ */
+extern lisp_type *lisp_types[];
+/**
+   @brief Allocation statistics of frozen values, indexed by tp_index.
+
+   Frozen values don't belong to any one runtime, so they're counted here
+   instead.  These are updated atomically.
+ */
+extern lisp_type_stats lisp_frozen_stats[TP_COUNT];
+/**
+   @brief Print the allocation statistics of each type.
+ */
+void lisp_print_heap_stats(lisp_runtime *rt, FILE *f);
+
+/**
+   @brief Return a frozen version of a value.
+   @param rt Runtime the value belongs to.
+   @param lv Value to freeze (nullable).
+   @returns NEW REFERENCE to lv itself if it is already frozen, otherwise to a
+   frozen copy of it.
+
+   Values are copied rather than frozen in place, since the runtime that owns
+   the original may still hold references that it expects to be able to mutate
+   (or that live in an arena).  Frozen values within lv are shared rather than
+   copied, so freezing something built out of frozen parts is cheap.  Values
+   that lv refers to more than once are copied once, and shared by the copy in
+   the same way (see lisp_copy()).
+ */
+lisp_value *lisp_freeze(lisp_runtime *rt, lisp_value *lv);
+/**
+   @brief Copy a value with its type's tp_copy, for lisp_freeze() or
+   lisp_promote().
+   @param child The function copying the value, which is used for its children.
+   @returns NEW REFERENCE to the copy.
+
+   Within the outermost copy, a value reached more than once (the same vector
+   in every slot of another, say) is only copied the first time, and every
+   place it's reached from shares that copy, just as they shared the original.
+ */
+lisp_value *lisp_copy(lisp_runtime *rt, lisp_value *lv,
+                      lisp_value *(*child)(lisp_runtime *, lisp_value *));
+/**
+   @brief Hash function for tables keyed by the address of a value.
+ */
+unsigned int lisp_pointer_hash(DATA data);
+/**
+   @brief Comparison function for tables keyed by the address of a value.
+ */
+int lisp_pointer_compare(DATA d1, DATA d2);
+/**
+   @brief Make a value, and everything it refers to, immortal (and frozen).
+   @param lv Value to mark (nullable).
+
+   Unlike lisp_freeze(), this marks values in place, and they are never freed
+   afterward.  It's meant for values that live as long as the process anyway,
+   such as the globals of a fork server, whose children then never write to the
+   memory those values live in.  Nothing else may be mutating them meanwhile.
+ */
+void lisp_immortalize(lisp_value *lv);
+
+/**
+   @brief Initialize an arena.
+   @param arena Arena to initialize.
+   @param scope Scope which outlives each evaluation in the arena.
+ */
+void lisp_arena_init(lisp_arena *arena, lisp_scope *scope);
+/**
+   @brief Free all memory held by an arena.
+ */
+void lisp_arena_destroy(lisp_runtime *rt, lisp_arena *arena);
+/**
+   @brief Allocate memory from an arena.
+ */
+void *lisp_arena_alloc(lisp_arena *arena, size_t size);
+/**
+   @brief Return whether a value was allocated by an arena's current evaluation.
+ */
+bool lisp_arena_owns(lisp_arena *arena, lisp_value *lv);
+/**
+   @brief Give back memory from an arena, to be reused if it's small.
+ */
+void lisp_arena_release(lisp_arena *arena, void *ptr, size_t size);
+/**
+   @brief Make an arena current, so that new values are allocated from it.
+ */
+void lisp_arena_begin(lisp_runtime *rt, lisp_arena *arena);
+/**
+   @brief Stop allocating from an arena, and drop all of its values.
+
+   Every value allocated from the arena must have been freed already.
+ */
+void lisp_arena_end(lisp_runtime *rt, lisp_arena *arena);
+/**
+   @brief Return a version of a value that does not live in any arena.
+   @param lv Value to promote (nullable).
+   @returns NEW REFERENCE to lv itself, or a heap copy of it, which shares
+   whatever the original shared (see lisp_copy()).
+ */
+lisp_value *lisp_promote(lisp_runtime *rt, lisp_value *lv);
+/**
+   @brief Return a reference to a value that a container may hold on to.
+   @param container The vector, hash map or other value that will hold it.
+   @returns NEW REFERENCE to the value, promoted if the container isn't in the
+   current arena.
+ */
+lisp_value *lisp_keep(lisp_runtime *rt, lisp_value *container,
+                      lisp_value *value);
+/**
+   @brief Return a version of a value that may be stored in a scope.
+   @param scope Scope the value will be stored in.
+   @param lv Value to store.
+   @returns NEW REFERENCE, promoted if the scope outlives the current arena.
+ */
+lisp_value *lisp_arena_escape(lisp_runtime *rt, lisp_scope *scope,
+                              lisp_value *lv);
+
+/**
+   @brief Create and return a lisp_scope containing all global name definitions.
+ */
+lisp_scope *lisp_create_globals(lisp_runtime *rt);
+
+/**
+   @brief A builtin function, and the name it's bound to in the globals.
+ */
+typedef struct {
+  wchar_t *name;
+  lisp_value * (*function) (lisp_runtime *, lisp_list *, lisp_scope *);
+  bool eval;
+} lisp_builtin_entry;
+/**
+   @brief Every builtin, in order of ID, terminated by a NULL name.
+ */
+extern lisp_builtin_entry lisp_builtins[];
+
+/*******************************************************************************
+                                   Images
+*******************************************************************************/
+
+/**
+   @brief Write everything bound in a scope, and all it refers to, to a file.
+   @param rt Runtime to raise errors in.
+   @param scope Scope whose bindings are written (not its parents').
+   @param path File to write.
+   @returns Number of values written, or -1 (with an error raised) on failure.
+
+   Pointers are written as offsets, and builtins by ID, so the image may be
+   mapped anywhere by another process running the same build.
+ */
+long lisp_image_dump(lisp_runtime *rt, lisp_scope *scope, const char *path);
+/**
+   @brief Map an image into memory, ready to bind.
+   @returns The image, or NULL (with an error raised) on failure.
+
+   The values in an image are immortal and frozen, so they may be shared by
+   every runtime in the process.
+ */
+lisp_image *lisp_image_open(lisp_runtime *rt, const char *path);
+/**
+   @brief Bind everything in an image into a scope.
+ */
+void lisp_image_bind(lisp_runtime *rt, lisp_image *image, lisp_scope *scope);
+/**
+   @brief Unmap an image.  Nothing may refer to its values any more.
+ */
+void lisp_image_close(lisp_image *image);
+
+/*******************************************************************************
+                                 Parallelism
+*******************************************************************************/
+
+/**
+   @brief Create a pool of worker threads.
+
+   The threads aren't started until the first task is submitted.
+ */
+lisp_pool *lisp_pool_create(int nworkers);
+/**
+   @brief Wait for all submitted tasks to finish, and free a pool.
+ */
+void lisp_pool_delete(lisp_pool *pool);
+/**
+   @brief Return the number of worker threads in a pool.
+ */
+int lisp_pool_size(lisp_pool *pool);
+/**
+   @brief Queue a task to be run by one of the workers.
+ */
+void lisp_pool_submit(lisp_pool *pool, lisp_task *task);
+
+/**
+   @brief Apply a function to each item of a list, in parallel.
+   @param rt Runtime to call from.
+   @param func Function to apply.  It should have no side effects.
+   @param list List of arguments.
+   @param scope Scope to call the function from.
+   @returns NEW REFERENCE to a list of the results, in order, or NULL on error.
+
+   Short lists, and calls without a pool, are handled sequentially.  Otherwise,
+   the function, the list, and any values the function refers to by name are
+   frozen so that the workers can share them, and the results are frozen too.
+ */
+lisp_value *lisp_par_map(lisp_runtime *rt, lisp_value *func, lisp_value *list,
+                         lisp_scope *scope);
+/**
+   @brief Combine the items of a list with a function, in parallel.
+   @param rt Runtime to call from.
+   @param func Function taking two arguments.  It must be associative.
+   @param init Value to start from.
+   @param list List of values to combine.
+   @param scope Scope to call the function from.
+   @returns NEW REFERENCE to the result, or NULL on error.
+ */
+lisp_value *lisp_par_reduce(lisp_runtime *rt, lisp_value *func,
+                            lisp_value *init, lisp_value *list,
+                            lisp_scope *scope);
+/**
+   @brief Apply a function to each item of a list in parallel, for effect.
+   @returns true, or false on error.
+ */
+bool lisp_par_for_each(lisp_runtime *rt, lisp_value *func, lisp_value *list,
+                       lisp_scope *scope);
+/**
+   @brief Start evaluating an expression on a worker thread.
+   @param rt Runtime to start from.
+   @param expr Expression to evaluate.
+   @param scope Scope to evaluate it in.
+   @returns NEW REFERENCE to a future for the result.
+
+   As with lisp_par_map(), the expression and whatever it refers to by name are
+   frozen for the worker, and the result will be frozen.  Without a pool, the
+   expression is evaluated right away.
+ */
+lisp_future *lisp_future_create(lisp_runtime *rt, lisp_value *expr,
+                                lisp_scope *scope);
+/**
+   @brief Wait for a future's result.
+   @returns NEW REFERENCE to the result, or NULL if evaluating it raised an
+   error, which is raised again here.
+ */
+lisp_value *lisp_future_touch(lisp_runtime *rt, lisp_future *future);
+
+/*******************************************************************************
+                                   Server
+*******************************************************************************/
+
+/**
+   @brief Settings for lisp_serve().
+ */
+typedef struct {
+
+  /**
+     @brief Path of the Unix domain socket to listen on.
+   */
+  const char *path;
+
+  /**
+     @brief Number of interpreters, and so of requests handled at once.
+
+     With fork set, this is the number of child processes at once instead.
+   */
+  int workers;
+
+  /**
+     @brief Fork a child process for each request, rather than keeping threads.
+
+     The globals are loaded once, made immortal, and shared copy-on-write by
+     every child, so a request can't affect the server or any other request.
+   */
+  bool fork;
+
+  /**
+     @brief Milliseconds a request may take, or 0 for no limit.
+   */
+  unsigned long timeout;
+
+  /**
+     @brief Files each interpreter loads before taking requests.
+   */
+  char **load;
+  int nload;
+
+  /**
+     @brief Image each interpreter's globals are restored from, or NULL.
+   */
+  lisp_image *image;
+
+  /**
+     @brief Heap limit for each interpreter, or 0 for none.
+   */
+  unsigned long heap_limit;
+
+  /**
+     @brief Worker threads for parallel builtins, shared by every interpreter.
+   */
+  lisp_pool *pool;
+
+} lisp_server_config;
+
+/**
+   @brief Evaluate requests from a Unix domain socket, forever.
+   @returns Only on failure to set up the socket, with an exit status.
+
+   Each connection is one request.  The client sends code and shuts down its
+   side of the connection, and the server replies with the printed value of
+   the last expression (or "error: " and a message) and closes the connection.
+   Requests are evaluated in a scope of their own, so definitions don't carry
+   over between them.
+ */
+int lisp_serve(lisp_server_config *config);
+
+/*******************************************************************************
+                                 Coroutines
+*******************************************************************************/
+
+/**
+   @brief Create a coroutine which will call a function.
+   @param rt Runtime the coroutine belongs to.
+   @param func Function to call once the coroutine is first resumed.
+   @param args Arguments to call it with.
+   @returns NEW REFERENCE to the coroutine.
+ */
+lisp_coroutine *lisp_coroutine_create(lisp_runtime *rt, lisp_value *func,
+                                      lisp_list *args);
+/**
+   @brief Run a coroutine until it yields or returns.
+   @param rt Runtime the coroutine belongs to.
+   @param co Coroutine to resume.
+   @param value Value for the coroutine's pending yield to return.
+   @param scope Scope to look up names in, for as long as the coroutine runs.
+   @returns NEW REFERENCE to the value yielded or returned, or NULL on error.
+ */
+lisp_value *lisp_coroutine_resume(lisp_runtime *rt, lisp_coroutine *co,
+                                  lisp_value *value, lisp_scope *scope);
+/**
+   @brief Suspend the current coroutine, handing a value to its resumer.
+   @returns NEW REFERENCE to the value it is next resumed with, or NULL on
+   error.
+ */
+lisp_value *lisp_coroutine_yield(lisp_runtime *rt, lisp_value *value);
+/**
+   @brief Return true if a coroutine has returned (or raised an error).
+ */
+bool lisp_coroutine_done(lisp_coroutine *co);
+
+/*******************************************************************************
+                                  Channels
+*******************************************************************************/
+
+/**
+   @brief Create a channel, which holds up to capacity values at once.
+   @returns NEW REFERENCE to the channel.
+
+   The capacity is rounded up to a power of two (and at least two), and may be
+   at most LISP_CHANNEL_MAX.  Copies of a channel, such as the frozen ones given
+   to futures and pmap, are the same channel, so that is how other threads get
+   hold of it.  Each copy counts the queue's slots towards its runtime's heap,
+   since any of them may be the last to hold it.
+ */
+lisp_channel *lisp_channel_create(lisp_runtime *rt, int capacity);
+/**
+   @brief Send a frozen version of a value, waiting while the channel is full.
+   @returns false, with an error raised, if it couldn't be sent.
+ */
+bool lisp_channel_send(lisp_runtime *rt, lisp_channel *ch, lisp_value *value);
+/**
+   @brief Receive a value, waiting while the channel is empty.
+   @returns NEW REFERENCE to the (frozen) value, or NULL on error.
+
+   Waiting is abandoned with an error once the runtime's deadline passes, or
+   if there are no other copies of the channel left to send with.
+ */
+lisp_value *lisp_channel_receive(lisp_runtime *rt, lisp_channel *ch);
+
+/*******************************************************************************
+                               Lazy sequences
+*******************************************************************************/
+
+/*
+  Each of these returns a NEW REFERENCE to an unforced sequence.  Functions are
+  called from the scope the sequence is forced in, since lambdas don't capture
+  the scope they were created in.
+ */
+
+/**
+   @brief Return a sequence with no items.
+ */
+lisp_lazy *lisp_lazy_empty(lisp_runtime *rt);
+/**
+   @brief Return start, start + step, and so on, while they're before end.
+ */
+lisp_lazy *lisp_lazy_range(lisp_runtime *rt, long start, long end, long step);
+/**
+   @brief Return the items of a list, of either representation.
+ */
+lisp_lazy *lisp_lazy_from_list(lisp_runtime *rt, lisp_value *list);
+/**
+   @brief Return x, (f x), (f (f x)) and so on, forever.
+ */
+lisp_lazy *lisp_lazy_iterate(lisp_runtime *rt, lisp_value *f, lisp_value *x);
+/**
+   @brief Return items made by calling f on a seed.
+
+   f returns either '() to end the sequence, or a list of the next item and
+   the seed to call it with next.
+ */
+lisp_lazy *lisp_lazy_unfold(lisp_runtime *rt, lisp_value *f, lisp_value *seed);
+/**
+   @brief Return f of each item of a sequence.
+ */
+lisp_lazy *lisp_lazy_map(lisp_runtime *rt, lisp_value *f, lisp_lazy *seq);
+/**
+   @brief Return the items of a sequence for which f returns true.
+ */
+lisp_lazy *lisp_lazy_filter(lisp_runtime *rt, lisp_value *f, lisp_lazy *seq);
+/**
+   @brief Return the first n items of a sequence.
+ */
+lisp_lazy *lisp_lazy_take(lisp_runtime *rt, long n, lisp_lazy *seq);
+/**
+   @brief Return the items produced by calling next on source until it ends.
+
+   Items are asked for in order, and each only once, so the source may be
+   something like a file that is read as the sequence is used.
+ */
+lisp_lazy *lisp_lazy_source(lisp_runtime *rt, lisp_lazy_next next,
+                            lisp_value *source);
+/**
+   @brief Compute the first item and rest of a sequence, if not done already.
+   @returns false, with an error raised, if computing it failed.
+ */
+bool lisp_lazy_force(lisp_runtime *rt, lisp_lazy *s, lisp_scope *scope);
+/**
+   @brief Combine each item of a sequence into an accumulator, with (f acc x).
+   @returns NEW REFERENCE to the result, or NULL on error.
+
+   If the caller's reference to s is the only one, s is used up in place as the
+   fold goes, so that items are freed once they are used, and memory use stays
+   constant however long the sequence is.
+ */
+lisp_value *lisp_lazy_fold(lisp_runtime *rt, lisp_value *f, lisp_value *init,
+                           lisp_lazy *s, lisp_scope *scope);
+/**
+   @brief Return a list of all of a sequence's items.
+   @returns NEW REFERENCE to the list, or NULL on error.
+ */
+lisp_value *lisp_lazy_to_list(lisp_runtime *rt, lisp_lazy *s,
+                              lisp_scope *scope);
+
+/*******************************************************************************
+                                    Ropes
+*******************************************************************************/
+
+/**
+   @brief Return a rope containing a string.
+   @returns NEW REFERENCE to the rope.
+ */
+lisp_rope *lisp_rope_from_string(lisp_runtime *rt, lisp_string *str);
+/**
+   @brief Return a rope of one rope followed by another, in O(log n) time.
+   @returns NEW REFERENCE to the rope, which shares most of a and b.
+ */
+lisp_rope *lisp_rope_concat(lisp_runtime *rt, lisp_rope *a, lisp_rope *b);
+/**
+   @brief Return the bytes of a rope from start to end, in O(log n) time.
+   @returns NEW REFERENCE to the rope, which shares most of r.
+ */
+lisp_rope *lisp_rope_slice(lisp_runtime *rt, lisp_rope *r, size_t start,
+                           size_t end);
+/**
+   @brief Return the contents of a rope as a single string.
+   @returns NEW REFERENCE to the string.
+ */
+lisp_string *lisp_rope_flatten(lisp_runtime *rt, lisp_rope *r);
+/**
+   @brief Write the contents of a rope to a file, leaf by leaf.
+   @returns false if writing failed.
+ */
+bool lisp_rope_write(lisp_rope *r, FILE *f);
+
+/*******************************************************************************
+                                    Files
+*******************************************************************************/
+
+/**
+   @brief Open a file, with a mode as for fopen().
+   @returns NEW REFERENCE to the file, or NULL with an error raised.
+ */
+lisp_file *lisp_file_open(lisp_runtime *rt, const char *path,
+                          const char *mode);
+/**
+   @brief Close a file, if it isn't closed already.
+   @returns false, with an error raised, if its output couldn't be written.
+ */
+bool lisp_file_close(lisp_runtime *rt, lisp_file *f);
+/**
+   @brief Read the next record of a file, up to a delimiter such as '\n'.
+   @returns NEW REFERENCE to the record, without its delimiter, or NULL at the
+   end of the file (or with an error raised).
+ */
+lisp_string *lisp_file_read_record(lisp_runtime *rt, lisp_file *f,
+                                   int delimiter);
+/**
+   @brief Return a lazy sequence of the records left in a file.
+   @returns NEW REFERENCE to the sequence, which reads the file as it's used.
+ */
+lisp_lazy *lisp_file_records(lisp_runtime *rt, lisp_file *f, int delimiter);
+/**
+   @brief Write a string or rope to a file.
+   @returns false, with an error raised, if it couldn't be written.
+ */
+bool lisp_file_write(lisp_runtime *rt, lisp_file *f, lisp_value *text);
+/**
+   @brief Return the contents of a file as a string.
+
+   Regular files are mapped into memory rather than read, so the string costs
+   no copying, and pages are only read once they're used.  The file must not
+   be changed while the string (or any part of it) is still in use.
+   @returns NEW REFERENCE to the string, or NULL with an error raised.
+ */
+lisp_string *lisp_file_read_all(lisp_runtime *rt, const char *path);
+
+/*******************************************************************************
+                      Persistent vectors and hash maps
+*******************************************************************************/
+
+/**
+   @brief Return a persistent vector of some items.
+   @returns NEW REFERENCE to the vector.
+ */
+lisp_pvector *lisp_pvector_from_array(lisp_runtime *rt, lisp_value **items,
+                                      int n);
+/**
+   @brief Return an item of a persistent vector.  The index must be in range.
+   @returns BORROWED REFERENCE to the item.
+ */
+lisp_value *lisp_pvector_ref(lisp_pvector *v, int index);
+/**
+   @brief Return a vector like v, but with one item replaced, in O(log32 n)
+   time.  The index must be in range.
+   @returns NEW REFERENCE to the vector, which shares most of v.
+ */
+lisp_pvector *lisp_pvector_set(lisp_runtime *rt, lisp_pvector *v, int index,
+                               lisp_value *value);
+/**
+   @brief Return a vector like v, with an item added to the end.
+   @returns NEW REFERENCE to the vector, which shares most of v.
+ */
+lisp_pvector *lisp_pvector_push(lisp_runtime *rt, lisp_pvector *v,
+                                lisp_value *value);
+/**
+   @brief Return a list of a persistent vector's items.
+   @returns NEW REFERENCE to the list.
+ */
+lisp_value *lisp_pvector_to_list(lisp_runtime *rt, lisp_pvector *v);
+/**
+   @brief Look up a key in a persistent hash map.
+   @returns BORROWED REFERENCE to the key's value, or NULL if it isn't there.
+   NULL is also returned, with an error raised, if the key can't be hashed.
+ */
+lisp_value *lisp_phash_get(lisp_runtime *rt, lisp_phash *h, lisp_value *key);
+/**
+   @brief Return a hash map like h, but with a key set to a value, in
+   O(log32 n) time.
+   @returns NEW REFERENCE to the hash map, which shares most of h, or NULL with
+   an error raised if the key can't be hashed.
+ */
+lisp_phash *lisp_phash_set(lisp_runtime *rt, lisp_phash *h, lisp_value *key,
+                           lisp_value *value);
+/**
+   @brief Return a hash map like h, but without a key.
+   @returns NEW REFERENCE to the hash map (h itself, if the key isn't there),
+   or NULL with an error raised if the key can't be hashed.
+ */
+lisp_phash *lisp_phash_remove(lisp_runtime *rt, lisp_phash *h,
+                              lisp_value *key);
+/**
+   @brief Fill two arrays, each with room for h->count values, with the keys of
+   a persistent hash map and their values.  Each reference is BORROWED.
+ */
+void lisp_phash_items(lisp_phash *h, lisp_value **keys, lisp_value **values);
+/**
+   @brief Create an empty scope!
+
+   Anything you put in a new scope should be incref'd, because the scope "owns"
+   a reference to everything in it.
  */
 lisp_scope *lisp_scope_create(void);
+/**
+   @brief Bind a name to a value within a scope.
+   @param scope Scope to bind in.
+   @param name Name to bind.  Must remain valid as long as the scope does.
+   @param value Value to bind.  The scope steals this reference.
+
+   If the name was already bound in this scope, the old value is decref'd.
+ */
+void lisp_scope_bind(lisp_runtime *rt, lisp_scope *scope, wchar_t *name,
+                     lisp_value *value);
+/**
+   @brief Look up a name in a scope and each of its parents.
+   @param scope Innermost scope to look in.
+   @param name Name to look up.
+   @returns BORROWED REFERENCE to the value, or NULL if not found.
+ */
+lisp_value *lisp_scope_lookup(lisp_scope *scope, wchar_t *name);
+/**
+   @brief Keep a value alive until a scope is deleted.
+   @param scope Scope to keep it in.
+   @param value Value to keep.  The scope steals this reference.
+ */
+void lisp_scope_keep(lisp_scope *scope, lisp_value *value);
+/**
+   @brief Make everything a scope refers to immortal (see lisp_immortalize()).
+ */
+void lisp_scope_immortalize(lisp_scope *scope);
 /**
    @brief Delete the given scope (not any of its parents though).
    @param scope Scope to delete.
 
    When you delete a scope, everything in it gets decref'd.
  */
-void lisp_scope_delete(lisp_scope *scope);
-
-bool lisp_interactive_exit;
+void lisp_scope_delete(lisp_runtime *rt, lisp_scope *scope);
 
 #endif // CKY_LISP_H
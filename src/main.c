@@ -13,13 +13,131 @@
 
 *******************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libstephen/base.h"
 #include "lisp.h"
 
-int main(int argc, char *argv[])
+/*
+  The runtime is static so that print_stats() can still find it at exit.
+ */
+static lisp_runtime rt;
+
+static void print_stats(void)
+{
+  lisp_print_heap_stats(&rt, stderr);
+}
+
+static void usage(char *name)
 {
-  (void)argc; // unused
-  (void)argv; // unused
-  lisp_interact();
-  return 0;
+  fprintf(stderr, "usage: %s [--stats] [--heap-limit BYTES] [--threads N]\n"
+          "       [--image FILE] [--load FILE]...\n"
+          "       [--serve PATH [--workers N] [--timeout MS] [--fork]]\n", name);
+  fprintf(stderr, "  --stats             print allocation statistics at exit\n");
+  fprintf(stderr, "  --heap-limit BYTES  fail allocations beyond BYTES\n");
+  fprintf(stderr, "  --threads N         use N worker threads (default: one "
+          "per CPU, 0 for none)\n");
+  fprintf(stderr, "  --image FILE        start with the globals saved by "
+          "dump-image in FILE\n");
+  fprintf(stderr, "  --load FILE         evaluate FILE before anything else\n");
+  fprintf(stderr, "  --serve PATH        evaluate requests from a Unix socket "
+          "at PATH\n");
+  fprintf(stderr, "  --workers N         interpreters serving requests "
+          "(default: one per CPU)\n");
+  fprintf(stderr, "  --timeout MS        abandon requests after MS "
+          "milliseconds\n");
+  fprintf(stderr, "  --fork              serve each request from a child "
+          "process\n");
+  exit(EXIT_FAILURE);
 }
 
+int main(int argc, char *argv[])
+{
+  char *end;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  long threads = ncpu, workers = ncpu;
+  char *serve = NULL, *image = NULL;
+  unsigned long timeout = 0;
+  char **load = smb_new(char*, argc);
+  int nload = 0, status = EXIT_SUCCESS;
+  bool forking = false;
+  lisp_server_config config;
+
+  lisp_runtime_init(&rt);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      // Registered with atexit() so they are printed however we exit.
+      atexit(&print_stats);
+    } else if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc) {
+      rt.heap_limit = strtoul(argv[++i], &end, 10);
+      if (*end != '\0' || rt.heap_limit == 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || threads < 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+      image = argv[++i];
+    } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+      load[nload++] = argv[++i];
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      serve = argv[++i];
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      workers = strtol(argv[++i], &end, 10);
+      if (*end != '\0' || workers <= 0) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+      timeout = strtoul(argv[++i], &end, 10);
+      if (*end != '\0') {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--fork") == 0) {
+      forking = true;
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  if (image != NULL) {
+    rt.image = lisp_image_open(&rt, image);
+    if (rt.image == NULL) {
+      fprintf(stderr, "error: %s\n", rt.message);
+      smb_free(load);
+      return EXIT_FAILURE;
+    }
+  }
+  if (threads > 0) {
+    rt.pool = lisp_pool_create(threads);
+  }
+  if (serve != NULL) {
+    config.path = serve;
+    config.workers = workers;
+    config.timeout = timeout;
+    config.fork = forking;
+    config.load = load;
+    config.nload = nload;
+    config.image = rt.image;
+    config.heap_limit = rt.heap_limit;
+    config.pool = rt.pool;
+    status = lisp_serve(&config);
+  } else {
+    lisp_interact(&rt, load, nload);
+  }
+  if (rt.pool != NULL) {
+    lisp_pool_delete(rt.pool);
+  }
+  lisp_runtime_destroy(&rt);
+  if (rt.image != NULL) {
+    lisp_image_close(rt.image);
+  }
+  smb_free(load);
+  return status;
+}
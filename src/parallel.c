@@ -0,0 +1,669 @@
+/***************************************************************************//**
+
+  @file         parallel.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Parallel map, reduce, and for-each over lists, and futures.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "libstephen/al.h"
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Lists shorter than this are handled sequentially.
+ */
+#define PAR_MIN_ITEMS 32
+/**
+   @brief Number of tasks a list is split into, per worker.
+
+   More tasks than workers leaves something to steal when some items take
+   longer than others.
+ */
+#define PAR_TASKS_PER_WORKER 4
+
+#define PAR_MAP 0
+#define PAR_REDUCE 1
+#define PAR_FOR_EACH 2
+
+/**
+   @brief Frozen copies of the values a function refers to by name.
+
+   Functions don't carry their environment with them; names are looked up in
+   whatever scope they are called from.  Workers can't look at the caller's
+   scope, so each name the function (or any function it refers to) uses is
+   looked up ahead of time and bound in the worker's scope instead.
+ */
+typedef struct {
+
+  smb_al names;
+  smb_al values;
+
+} lisp_capture;
+
+/**
+   @brief A map, reduce, or for-each, split into tasks.
+ */
+typedef struct {
+
+  int op;
+  lisp_value *func;
+  lisp_capture capture;
+
+  /**
+     @brief The items of the (frozen) list.
+   */
+  lisp_value **items;
+
+  /**
+     @brief One frozen result per item for a map, or per task for a reduce.
+   */
+  lisp_value **results;
+  int nresults;
+
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  int remaining;
+  bool error;
+  char message[LISP_ERROR_SIZE];
+
+} lisp_par_job;
+
+typedef struct {
+
+  lisp_task task;
+  lisp_par_job *job;
+  int index;
+  int start;
+  int end;
+
+} lisp_par_task;
+
+#define PROMISE_PENDING 0
+#define PROMISE_RUNNING 1
+#define PROMISE_DONE 2
+
+/**
+   @brief The computation behind a future.
+
+   A promise is shared by the future it was created for, any frozen copies of
+   that future, and the task queued to compute it, so it is reference counted
+   separately from them.
+ */
+struct lisp_promise {
+
+  lisp_task task;
+  int refcount;
+
+  /**
+     @brief PROMISE_PENDING until someone claims the promise to compute it.
+
+     Usually that's a worker, but whoever touches a pending promise computes it
+     themselves instead of waiting for it to be reached in a queue.
+   */
+  int state;
+
+  lisp_value *expr;
+  lisp_capture capture;
+
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  lisp_value *value;
+  bool error;
+  char message[LISP_ERROR_SIZE];
+
+};
+
+/*******************************************************************************
+                                  Captures
+*******************************************************************************/
+
+static void capture_function(lisp_runtime *rt, lisp_capture *cap,
+                             lisp_value *func, lisp_scope *scope);
+
+static bool is_argument(lisp_list *arglist, wchar_t *name)
+{
+  if (arglist == NULL) {
+    return false;
+  }
+  for (; arglist->value != NULL; arglist = arglist->next) {
+    if (wcscmp(((lisp_identifier*)arglist->value)->value, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void capture_name(lisp_runtime *rt, lisp_capture *cap, wchar_t *name,
+                         lisp_scope *scope)
+{
+  smb_status st = SMB_SUCCESS;
+  lisp_value *value;
+  wchar_t *copy;
+
+  for (int i = 0; i < al_length(&cap->names); i++) {
+    if (wcscmp(al_get(&cap->names, i, &st).data_ptr, name) == 0) {
+      return;
+    }
+  }
+
+  // Names that aren't defined yet may be defined by the function itself.
+  value = lisp_scope_lookup(scope, name);
+  if (value == NULL) {
+    return;
+  }
+
+  value = lisp_freeze(rt, value);
+  if (value == NULL) {
+    return;
+  }
+  copy = smb_new(wchar_t, wcslen(name) + 1);
+  wcscpy(copy, name);
+  al_append(&cap->names, PTR(copy));
+  al_append(&cap->values, PTR(value));
+  capture_function(rt, cap, value, scope);
+}
+
+static void capture_code(lisp_runtime *rt, lisp_capture *cap, lisp_value *code,
+                         lisp_list *arglist, lisp_scope *scope)
+{
+  lisp_funccall *call;
+  lisp_list *l;
+  wchar_t *name;
+
+  if (lisp_type_of(code) == &tp_identifier) {
+    name = ((lisp_identifier*)code)->value;
+    if (!is_argument(arglist, name)) {
+      capture_name(rt, cap, name, scope);
+    }
+  } else if (lisp_type_of(code) == &tp_funccall) {
+    call = (lisp_funccall*)code;
+    capture_code(rt, cap, call->function, arglist, scope);
+    for (l = call->arguments; l->value != NULL; l = l->next) {
+      capture_code(rt, cap, l->value, arglist, scope);
+    }
+  }
+}
+
+static void capture_function(lisp_runtime *rt, lisp_capture *cap,
+                             lisp_value *func, lisp_scope *scope)
+{
+  lisp_function *f;
+  if (lisp_type_of(func) == &tp_function) {
+    f = (lisp_function*)func;
+    capture_code(rt, cap, f->code, f->arglist, scope);
+  }
+}
+
+/**
+   @brief Create a scope binding everything in a capture.
+ */
+static lisp_scope *capture_scope(lisp_runtime *rt, lisp_capture *cap,
+                                 lisp_scope *up)
+{
+  smb_status st = SMB_SUCCESS;
+  lisp_scope *scope = lisp_scope_create();
+  lisp_value *value;
+
+  scope->up = up;
+  for (int i = 0; i < al_length(&cap->names); i++) {
+    value = al_get(&cap->values, i, &st).data_ptr;
+    lisp_incref(value);
+    lisp_scope_bind(rt, scope, al_get(&cap->names, i, &st).data_ptr, value);
+  }
+  return scope;
+}
+
+static void capture_destroy(lisp_runtime *rt, lisp_capture *cap)
+{
+  smb_status st = SMB_SUCCESS;
+  for (int i = 0; i < al_length(&cap->names); i++) {
+    smb_free(al_get(&cap->names, i, &st).data_ptr);
+    lisp_decref(rt, al_get(&cap->values, i, &st).data_ptr);
+  }
+  al_destroy(&cap->names);
+  al_destroy(&cap->values);
+}
+
+/*******************************************************************************
+                                    Jobs
+*******************************************************************************/
+
+/**
+   @brief Run one task of a job, within a worker.
+ */
+static void lisp_par_run(lisp_runtime *rt, lisp_scope *globals,
+                         lisp_task *task)
+{
+  lisp_par_task *pt = (lisp_par_task*)task;
+  lisp_par_job *job = pt->job;
+  lisp_scope *scope = capture_scope(rt, &job->capture, globals);
+  lisp_value *acc = NULL, *rv, *args[2];
+  int i = pt->start;
+
+  if (job->op == PAR_REDUCE) {
+    acc = job->items[i++];
+    lisp_incref(acc);
+  }
+
+  for (; i < pt->end; i++) {
+    if (job->op == PAR_REDUCE) {
+      args[0] = acc;
+      args[1] = job->items[i];
+      rv = lisp_call_with(rt, job->func, args, 2, scope);
+      lisp_decref(rt, acc);
+      acc = rv;
+    } else {
+      rv = lisp_call_with(rt, job->func, &job->items[i], 1, scope);
+    }
+    if (rv == NULL) {
+      break;
+    }
+    if (job->op == PAR_MAP) {
+      // Results are handed back to another runtime, so they must be frozen.
+      job->results[i] = lisp_freeze(rt, rv);
+      lisp_decref(rt, rv);
+    } else if (job->op == PAR_FOR_EACH) {
+      lisp_decref(rt, rv);
+    }
+  }
+
+  if (acc != NULL) {
+    job->results[pt->index] = lisp_freeze(rt, acc);
+    lisp_decref(rt, acc);
+  }
+  lisp_scope_delete(rt, scope);
+
+  pthread_mutex_lock(&job->lock);
+  if (rt->error && !job->error) {
+    job->error = true;
+    memcpy(job->message, rt->message, LISP_ERROR_SIZE);
+  }
+  lisp_clear_error(rt);
+  if (--job->remaining == 0) {
+    pthread_cond_signal(&job->done);
+  }
+  pthread_mutex_unlock(&job->lock);
+}
+
+/**
+   @brief Run a job on the pool, and wait for it to finish.
+   @returns false (with an error raised) if any task failed.
+
+   On success, job->results holds the frozen results.  The caller must decref
+   them and free the array.
+ */
+static bool lisp_par_job_run(lisp_runtime *rt, lisp_par_job *job,
+                             lisp_value *func, lisp_value *list, int n,
+                             lisp_scope *scope)
+{
+  lisp_list_iter it;
+  lisp_par_task *tasks;
+  lisp_value *frozen;
+  int ntasks, size;
+
+  ntasks = lisp_pool_size(rt->pool) * PAR_TASKS_PER_WORKER;
+  size = (n + ntasks - 1) / ntasks;
+  ntasks = (n + size - 1) / size;
+
+  // Everything the workers touch must be frozen.
+  frozen = lisp_freeze(rt, list);
+  job->func = lisp_freeze(rt, func);
+  if (frozen == NULL || job->func == NULL) {
+    lisp_decref(rt, frozen);
+    lisp_decref(rt, job->func);
+    return false;
+  }
+  al_init(&job->capture.names);
+  al_init(&job->capture.values);
+  capture_function(rt, &job->capture, job->func, scope);
+
+  job->items = smb_new(lisp_value*, n);
+  lisp_list_iter_init(&it, frozen);
+  for (int i = 0; i < n; i++) {
+    job->items[i] = lisp_list_iter_next(&it);
+  }
+  job->nresults = job->op == PAR_REDUCE ? ntasks : n;
+  job->results = smb_new(lisp_value*, job->nresults);
+  for (int i = 0; i < job->nresults; i++) {
+    job->results[i] = NULL;
+  }
+
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->done, NULL);
+  job->remaining = ntasks;
+  job->error = false;
+
+  tasks = smb_new(lisp_par_task, ntasks);
+  for (int i = 0; i < ntasks; i++) {
+    tasks[i].task.run = &lisp_par_run;
+    tasks[i].job = job;
+    tasks[i].index = i;
+    tasks[i].start = i * size;
+    tasks[i].end = (i + 1) * size < n ? (i + 1) * size : n;
+    lisp_pool_submit(rt->pool, &tasks[i].task);
+  }
+
+  pthread_mutex_lock(&job->lock);
+  while (job->remaining > 0) {
+    pthread_cond_wait(&job->done, &job->lock);
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  smb_free(tasks);
+  pthread_cond_destroy(&job->done);
+  pthread_mutex_destroy(&job->lock);
+  capture_destroy(rt, &job->capture);
+  lisp_decref(rt, job->func);
+  smb_free(job->items);
+  lisp_decref(rt, frozen);
+
+  if (job->error) {
+    for (int i = 0; i < job->nresults; i++) {
+      lisp_decref(rt, job->results[i]);
+    }
+    smb_free(job->results);
+    lisp_error(rt, "%s", job->message);
+    return false;
+  }
+  return true;
+}
+
+static bool lisp_par_sequential(lisp_runtime *rt, int n)
+{
+  return rt->pool == NULL || n < PAR_MIN_ITEMS;
+}
+
+lisp_value *lisp_par_map(lisp_runtime *rt, lisp_value *func, lisp_value *list,
+                         lisp_scope *scope)
+{
+  int n = lisp_list_length(list);
+  lisp_par_job job = {.op = PAR_MAP};
+  lisp_list_iter it;
+  lisp_value *item, *rv = NULL;
+
+  if (lisp_par_sequential(rt, n)) {
+    job.results = smb_new(lisp_value*, n);
+    job.nresults = 0;
+    lisp_list_iter_init(&it, list);
+    while ((item = lisp_list_iter_next(&it)) != NULL) {
+      job.results[job.nresults] = lisp_call_with(rt, func, &item, 1, scope);
+      if (job.results[job.nresults] == NULL) {
+        break;
+      }
+      job.nresults++;
+    }
+  } else if (!lisp_par_job_run(rt, &job, func, list, n, scope)) {
+    return NULL;
+  }
+
+  if (job.nresults == n) {
+    rv = lisp_list_from_array(rt, job.results, n);
+  }
+  for (int i = 0; i < job.nresults; i++) {
+    lisp_decref(rt, job.results[i]);
+  }
+  smb_free(job.results);
+  return rv;
+}
+
+lisp_value *lisp_par_reduce(lisp_runtime *rt, lisp_value *func,
+                            lisp_value *init, lisp_value *list,
+                            lisp_scope *scope)
+{
+  int n = lisp_list_length(list);
+  lisp_par_job job = {.op = PAR_REDUCE};
+  lisp_list_iter it;
+  lisp_value *acc, *args[2];
+
+  lisp_incref(init);
+  acc = init;
+
+  if (lisp_par_sequential(rt, n)) {
+    lisp_list_iter_init(&it, list);
+    while (acc != NULL && (args[1] = lisp_list_iter_next(&it)) != NULL) {
+      args[0] = acc;
+      acc = lisp_call_with(rt, func, args, 2, scope);
+      lisp_decref(rt, args[0]);
+    }
+    return acc;
+  }
+
+  if (!lisp_par_job_run(rt, &job, func, list, n, scope)) {
+    lisp_decref(rt, acc);
+    return NULL;
+  }
+
+  // Combine each task's result, in order.
+  for (int i = 0; i < job.nresults; i++) {
+    if (acc != NULL) {
+      args[0] = acc;
+      args[1] = job.results[i];
+      acc = lisp_call_with(rt, func, args, 2, scope);
+      lisp_decref(rt, args[0]);
+    }
+    lisp_decref(rt, job.results[i]);
+  }
+  smb_free(job.results);
+  return acc;
+}
+
+bool lisp_par_for_each(lisp_runtime *rt, lisp_value *func, lisp_value *list,
+                       lisp_scope *scope)
+{
+  int n = lisp_list_length(list);
+  lisp_par_job job = {.op = PAR_FOR_EACH};
+  lisp_list_iter it;
+  lisp_value *item, *rv;
+
+  if (lisp_par_sequential(rt, n)) {
+    lisp_list_iter_init(&it, list);
+    while ((item = lisp_list_iter_next(&it)) != NULL) {
+      rv = lisp_call_with(rt, func, &item, 1, scope);
+      if (rv == NULL) {
+        return false;
+      }
+      lisp_decref(rt, rv);
+    }
+    return true;
+  }
+
+  if (!lisp_par_job_run(rt, &job, func, list, n, scope)) {
+    return false;
+  }
+  smb_free(job.results);
+  return true;
+}
+
+/*******************************************************************************
+                                  Futures
+*******************************************************************************/
+
+static void lisp_promise_release(lisp_runtime *rt, lisp_promise *p)
+{
+  if (__atomic_sub_fetch(&p->refcount, 1, __ATOMIC_ACQ_REL) > 0) {
+    return;
+  }
+  // The queued task holds a reference until it runs, so the last reference is
+  // only dropped once the promise is done.
+  lisp_decref(rt, p->value);
+  pthread_cond_destroy(&p->done);
+  pthread_mutex_destroy(&p->lock);
+  smb_free(p);
+}
+
+/**
+   @brief Evaluate a promise's expression, and publish its result.
+   @param rt Runtime to evaluate in.
+   @param p Promise, which the caller has claimed.
+   @param up Scope to look up names which weren't captured in.
+ */
+static void lisp_promise_compute(lisp_runtime *rt, lisp_promise *p,
+                                 lisp_scope *up)
+{
+  lisp_scope *scope = capture_scope(rt, &p->capture, up);
+  lisp_coroutine *co = rt->coroutine;
+  lisp_value *rv, *frozen;
+
+  // Others may be waiting on the promise, so it can't be left half computed
+  // by yielding from it.
+  rt->coroutine = NULL;
+  rv = lisp_evaluate(rt, p->expr, scope);
+  rt->coroutine = co;
+  frozen = lisp_freeze(rt, rv);
+
+  lisp_decref(rt, rv);
+  lisp_scope_delete(rt, scope);
+  capture_destroy(rt, &p->capture);
+  lisp_decref(rt, p->expr);
+  p->expr = NULL;
+
+  pthread_mutex_lock(&p->lock);
+  p->value = frozen;
+  if (rt->error) {
+    p->error = true;
+    memcpy(p->message, rt->message, LISP_ERROR_SIZE);
+  }
+  __atomic_store_n(&p->state, PROMISE_DONE, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&p->done);
+  pthread_mutex_unlock(&p->lock);
+  lisp_clear_error(rt);
+}
+
+static bool lisp_promise_claim(lisp_promise *p)
+{
+  int expected = PROMISE_PENDING;
+  return __atomic_compare_exchange_n(&p->state, &expected, PROMISE_RUNNING,
+                                     false, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE);
+}
+
+static void lisp_promise_run(lisp_runtime *rt, lisp_scope *globals,
+                             lisp_task *task)
+{
+  lisp_promise *p = (lisp_promise*)task;
+  if (lisp_promise_claim(p)) {
+    lisp_promise_compute(rt, p, globals);
+  }
+  lisp_promise_release(rt, p);
+}
+
+lisp_future *lisp_future_create(lisp_runtime *rt, lisp_value *expr,
+                                lisp_scope *scope)
+{
+  lisp_future *future = (lisp_future*)tp_future.tp_alloc(rt);
+  lisp_promise *p;
+
+  if (future == NULL) return NULL;
+  p = smb_new(lisp_promise, 1);
+  p->task.run = &lisp_promise_run;
+  p->refcount = 1;
+  p->state = PROMISE_PENDING;
+  p->expr = lisp_freeze(rt, expr);
+  al_init(&p->capture.names);
+  al_init(&p->capture.values);
+  capture_code(rt, &p->capture, p->expr, NULL, scope);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->value = NULL;
+  p->error = false;
+  future->promise = p;
+
+  if (rt->pool == NULL) {
+    lisp_promise_claim(p);
+    lisp_promise_compute(rt, p, scope);
+  } else {
+    p->refcount++; // for the task
+    lisp_pool_submit(rt->pool, &p->task);
+  }
+  return future;
+}
+
+lisp_value *lisp_future_touch(lisp_runtime *rt, lisp_future *future)
+{
+  lisp_promise *p = future->promise;
+
+  // A toucher may itself be a worker (or all of them may be busy), so rather
+  // than wait for a pending promise to be reached, compute it here.
+  if (lisp_promise_claim(p)) {
+    lisp_promise_compute(rt, p, NULL);
+  }
+
+  pthread_mutex_lock(&p->lock);
+  while (__atomic_load_n(&p->state, __ATOMIC_ACQUIRE) != PROMISE_DONE) {
+    pthread_cond_wait(&p->done, &p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  if (p->error) {
+    return lisp_error(rt, "%s", p->message);
+  }
+  lisp_incref(p->value);
+  return p->value;
+}
+
+static lisp_value *lisp_future_alloc(lisp_runtime *rt)
+{
+  lisp_future *rv = (lisp_future*)lisp_alloc(rt, &tp_future,
+                                             sizeof(lisp_future));
+  if (rv == NULL) return NULL;
+  rv->promise = NULL;
+  return (lisp_value*)rv;
+}
+
+static void lisp_future_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_future *future = (lisp_future*)value;
+  if (future->promise != NULL) {
+    lisp_promise_release(rt, future->promise);
+  }
+  lisp_free(rt, value, sizeof(lisp_future));
+}
+
+static void lisp_future_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  lisp_future *future = (lisp_future*)value;
+  if (__atomic_load_n(&future->promise->state, __ATOMIC_ACQUIRE) ==
+      PROMISE_DONE) {
+    fprintf(f, "future (done)\n");
+  } else {
+    fprintf(f, "future\n");
+  }
+}
+
+static lisp_value *lisp_future_copy(lisp_runtime *rt, lisp_value *value,
+                                    lisp_value *(*child)(lisp_runtime *,
+                                                         lisp_value *))
+{
+  (void)child; // unused
+  lisp_future *future = (lisp_future*)value;
+  lisp_future *rv = (lisp_future*)tp_future.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  // Copies share the computation, rather than starting it again.
+  __atomic_add_fetch(&future->promise->refcount, 1, __ATOMIC_ACQ_REL);
+  rv->promise = future->promise;
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_future = {
+  .tp_name = "future",
+  .tp_index = TP_FUTURE,
+  .tp_alloc = &lisp_future_alloc,
+  .tp_dealloc = &lisp_future_dealloc,
+  .tp_print = &lisp_future_print,
+  .tp_copy = &lisp_future_copy
+};
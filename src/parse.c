@@ -15,18 +15,11 @@
 
 #include <wchar.h>
 
+#include "libstephen/al.h"
 #include "libstephen/log.h"
 #include "lex.h"
 #include "lisp.h"
 
-/*
-  A logger for when I want to see debug output.
- */
-smb_logger lisp_log = {
-  .format = SMB_DEFAULT_LOGFORMAT,
-  .num = 0,
-};
-
 /**
    @brief Token for whitespace.
 
@@ -58,6 +51,18 @@ smb_logger lisp_log = {
    @brief Token for the beginning of a list literal, '(
  */
 #define OPEN_LIST   6
+/**
+   @brief Token for a string literal.
+ */
+#define STRING      7
+/**
+   @brief Token for the beginning of a vector literal, #(
+ */
+#define OPEN_VECTOR 8
+/**
+   @brief Token for a floating point number.
+ */
+#define FLOAT       9
 
 /**
    @brief A struct to represent the tokens of a lisp program.
@@ -94,21 +99,39 @@ static smb_lex *lisp_create_lexer(void)
   lex_add_token(lexer, L"'[0-9IDCHAR]+", LLINT(ATOM));
   lex_add_token(lexer, L"\\d+", LLINT(INTEGER));
   lex_add_token(lexer, L"'\\(", LLINT(OPEN_LIST));
+  lex_add_token(lexer, L"\"[^\"]*\"", LLINT(STRING));
+  lex_add_token(lexer, L"#\\(", LLINT(OPEN_VECTOR));
+  lex_add_token(lexer, L"\\d+\\.\\d+", LLINT(FLOAT));
+  lex_add_token(lexer, L"\\d+\\.\\d+[eE][+-]?\\d+", LLINT(FLOAT));
+  lex_add_token(lexer, L"\\d+[eE][+-]?\\d+", LLINT(FLOAT));
   return lexer;
 }
 
-smb_ll *lisp_lex(wchar_t *str)
+/**
+   @brief Return the runtime's lexer, creating it if necessary.
+
+   Building the lexer compiles all of its patterns, so it's only done once.
+ */
+static smb_lex *lisp_lexer(lisp_runtime *rt)
+{
+  if (rt->lexer == NULL) {
+    rt->lexer = lisp_create_lexer();
+  }
+  return rt->lexer;
+}
+
+smb_ll *lisp_lex(lisp_runtime *rt, wchar_t *str)
 {
   smb_ll *tokens = ll_create();
-  smb_lex *lex = lisp_create_lexer();
+  smb_lex *lex = lisp_lexer(rt);
   smb_status status = SMB_SUCCESS;
 
   while (*str != L'\0') {
-    LDEBUG(&lisp_log, "lisp_lex(): remaining text: \"%ls\"\n", str);
+    LDEBUG(&rt->log, "lisp_lex(): remaining text: \"%ls\"\n", str);
     lisp_token *lt = smb_new(lisp_token, 1);
     int length;
     lex_yylex(lex, str, &lt->token, &length, &status);
-    LDEBUG(&lisp_log, "lisp_lex(): match length %d\n", length);
+    LDEBUG(&rt->log, "lisp_lex(): match length %d\n", length);
     switch (lt->token.data_llint) {
     case WHITESPACE:
       smb_free(lt);
@@ -117,8 +140,19 @@ smb_ll *lisp_lex(wchar_t *str)
     case ATOM:
       str += 1;   // we ignore the quote - atoms are stored sans quote
       length -= 1;
+      lt->text = smb_new(wchar_t, length + 1);
+      wcsncpy(lt->text, str, length);
+      lt->text[length] = L'\0';
+      break;
+    case STRING:
+      // strings are stored without their quotes
+      lt->text = smb_new(wchar_t, length - 1);
+      wcsncpy(lt->text, str + 1, length - 2);
+      lt->text[length - 2] = L'\0';
+      break;
     case IDENTIFIER:
     case INTEGER:
+    case FLOAT:
       lt->text = smb_new(wchar_t, length + 1);
       wcsncpy(lt->text, str, length);
       lt->text[length] = L'\0';
@@ -132,7 +166,6 @@ smb_ll *lisp_lex(wchar_t *str)
     str += length;
   }
 
-  lex_delete(lex, false);
   return tokens;
 }
 
@@ -157,8 +190,16 @@ static DATA lisp_lex_file_next(smb_iter *it, smb_status *st) {
     smb_free(lt->text);
     lt->text = cpy;
     break;
+  case STRING:
+    cpy = smb_new(wchar_t, length - 1);
+    wcsncpy(cpy, lt->text+1, length - 2);
+    cpy[length - 2] = L'\0';
+    smb_free(lt->text);
+    lt->text = cpy;
+    break;
   case IDENTIFIER:
   case INTEGER:
+  case FLOAT:
     break;
   default:
     smb_free(lt->text);
@@ -175,7 +216,7 @@ static bool lisp_lex_file_has_next(smb_iter *it)
 
 static void lisp_lex_file_destroy(smb_iter *it)
 {
-  lex_delete((smb_lex*)it->ds, false);
+  (void)it; // the lexer belongs to the runtime
 }
 
 static void lisp_lex_file_delete(smb_iter *it)
@@ -184,9 +225,9 @@ static void lisp_lex_file_delete(smb_iter *it)
   smb_free(it);
 }
 
-smb_iter lisp_lex_file(FILE *f)
+smb_iter lisp_lex_file(lisp_runtime *rt, FILE *f)
 {
-  smb_lex *lex = lisp_create_lexer();
+  smb_lex *lex = lisp_lexer(rt);
   smb_iter it = {
     .ds = lex,
     .state = PTR(f),
@@ -198,11 +239,32 @@ smb_iter lisp_lex_file(FILE *f)
   return it;
 }
 
+/**
+   @brief Convert the text of a string literal into a lisp_string.
+ */
+static lisp_string *lisp_parse_string(lisp_runtime *rt, const wchar_t *text)
+{
+  lisp_string *str;
+  size_t length = wcstombs(NULL, text, 0);
+
+  if (length == (size_t)-1) {
+    // Parse an empty string instead, so that the parser can carry on to the end
+    // of the form before the error is reported.
+    lisp_error(rt, "invalid character in string literal");
+    return lisp_string_create(rt, 0);
+  }
+
+  str = lisp_string_create(rt, length);
+  if (str == NULL) return NULL;
+  wcstombs((char*)str->data, text, length + 1);
+  return str;
+}
+
 /*
   Forward declaration breaks dependency cycle between lisp_parse_rec and
   lisp_parse_list.
  */
-static lisp_value *lisp_parse_rec(smb_iter *, bool);
+static lisp_value *lisp_parse_rec(lisp_runtime *, smb_iter *, bool);
 
 /**
    @brief Parse a lisp list.
@@ -211,27 +273,86 @@ static lisp_value *lisp_parse_rec(smb_iter *, bool);
    may be a list literal, or a list of arguments.  This difference is specified
    by the within_list parameter.
 
+   @param rt Runtime to allocate the code in.
    @param it Pointer to the token iterator.
    @param within_list True if this literal is within a list literal.
    @returns A lisp list containing parsed code.
  */
-static lisp_list *lisp_parse_list(smb_iter *it, bool within_list) {
+static lisp_list *lisp_parse_list(lisp_runtime *rt, smb_iter *it,
+                                  bool within_list) {
   lisp_list *curr = NULL, *orig = NULL;
   lisp_value *value;
 
-  orig = (lisp_list*)tp_list.tp_alloc();
+  orig = (lisp_list*)tp_list.tp_alloc(rt);
   curr = orig;
 
   do {
-    value = lisp_parse_rec(it, within_list);
+    value = lisp_parse_rec(rt, it, within_list);
+    if (curr == NULL) {
+      // Out of heap, so the rest of the list is only parsed to be discarded.
+      lisp_decref(rt, value);
+      continue;
+    }
     curr->value = value;
-    curr->next = (lisp_list*)tp_list.tp_alloc();
+    curr->next = (lisp_list*)tp_list.tp_alloc(rt);
     curr = curr->next;
   } while (value != NULL);
 
   return orig;
 }
 
+/**
+   @brief Parse the contents of a list literal into a compact list.
+   @param rt Runtime to allocate the code in.
+   @param it Pointer to the token iterator.
+   @returns A lisp_clist, or an empty lisp_list.
+ */
+static lisp_value *lisp_parse_literal(lisp_runtime *rt, smb_iter *it) {
+  smb_status st = SMB_SUCCESS;
+  smb_al items;
+  lisp_value *value, *rv;
+  int n;
+
+  al_init(&items);
+  while ((value = lisp_parse_rec(rt, it, true)) != NULL) {
+    al_append(&items, PTR(value));
+  }
+
+  n = al_length(&items);
+  lisp_value **array = smb_new(lisp_value*, n);
+  for (int i = 0; i < n; i++) {
+    array[i] = al_get(&items, i, &st).data_ptr;
+  }
+  rv = lisp_list_from_array(rt, array, n);
+  for (int i = 0; i < n; i++) {
+    lisp_decref(rt, array[i]);
+  }
+  smb_free(array);
+  al_destroy(&items);
+  return rv;
+}
+
+/**
+   @brief Parse the contents of a vector literal.
+   @param rt Runtime to allocate the code in.
+   @param it Pointer to the token iterator.
+   @returns A frozen lisp_vector.
+
+   Like a list literal, the contents aren't evaluated.  The vector is part of
+   the code, so it's frozen: changing it would change the code for next time.
+ */
+static lisp_value *lisp_parse_vector(lisp_runtime *rt, smb_iter *it) {
+  lisp_value *list = lisp_parse_literal(rt, it);
+  lisp_value *vec, *rv;
+
+  if (list == NULL) return NULL;
+  vec = (lisp_value*)lisp_vector_from_list(rt, list);
+  rv = lisp_freeze(rt, vec);
+  lisp_decref(rt, list);
+  lisp_decref(rt, vec);
+  return rv;
+}
+
 /**
    @brief Parse a single piece of lisp code.
 
@@ -239,68 +360,118 @@ static lisp_list *lisp_parse_list(smb_iter *it, bool within_list) {
    that look like identifiers are just atoms.  This is the only difference in
    parsing.
 
+   @param rt Runtime to allocate the code in.
    @param it Pointer to an iterator of tokens.
    @param within_list Are we within a list literal?
    @return Parsed code as a lisp_value*.
  */
-lisp_value *lisp_parse_rec(smb_iter *it, bool within_list)
+lisp_value *lisp_parse_rec(lisp_runtime *rt, smb_iter *it, bool within_list)
 {
   smb_status st = SMB_SUCCESS;
-  lisp_value *lv;
+  lisp_value *lv = NULL;
   lisp_atom *atom;
   lisp_identifier *id;
-  lisp_int *int_;
   lisp_funccall *funccall;
-  lisp_token *lt = it->next(it, &st).data_ptr;
+  lisp_value *function;
+  lisp_list *arguments;
+  lisp_token *lt;
+
+  if (!it->has_next(it)) {
+    return lisp_error(rt, "unexpected end of input");
+  }
+  lt = it->next(it, &st).data_ptr;
 
   switch (lt->token.data_llint) {
   case ATOM:
-    lv = tp_atom.tp_alloc();
+    lv = tp_atom.tp_alloc(rt);
     atom = (lisp_atom*)lv;
-    atom->value = lt->text;
+    if (atom == NULL) {
+      smb_free(lt->text);
+    } else {
+      atom->value = lt->text;
+    }
     break;
   case IDENTIFIER:
     if (within_list) {
-      lv = tp_atom.tp_alloc();
+      lv = tp_atom.tp_alloc(rt);
       atom = (lisp_atom*)lv;
-      atom->value = lt->text;
+      if (atom == NULL) {
+        smb_free(lt->text);
+      } else {
+        atom->value = lt->text;
+      }
     } else {
-      lv = tp_identifier.tp_alloc();
+      lv = tp_identifier.tp_alloc(rt);
       id = (lisp_identifier*)lv;
-      id->value = lt->text;
+      if (id == NULL) {
+        smb_free(lt->text);
+      } else {
+        id->value = lt->text;
+      }
     }
     break;
   case INTEGER:
-    lv = tp_int.tp_alloc();
-    int_ = (lisp_int*)lv;
-    swscanf(lt->text, L"%ld", &int_->value);
+    // Too many digits for a long makes a bignum.
+    lv = lisp_integer_parse(rt, lt->text);
+    smb_free(lt->text);
+    break;
+  case FLOAT:
+    lv = lisp_float(wcstod(lt->text, NULL));
     smb_free(lt->text);
     break;
   case OPEN_PAREN:
     if (within_list) {
-      lv = (lisp_value*)lisp_parse_list(it, within_list);
+      lv = lisp_parse_literal(rt, it);
     } else {
-      lv = tp_funccall.tp_alloc();
+      lv = tp_funccall.tp_alloc(rt);
       funccall = (lisp_funccall*)lv;
-      funccall->function = lisp_parse_rec(it, within_list);
-      funccall->arguments = lisp_parse_list(it, within_list);
+      function = lisp_parse_rec(rt, it, within_list);
+      arguments = lisp_parse_list(rt, it, within_list);
+      if (funccall == NULL) {
+        lisp_decref(rt, function);
+        lisp_decref(rt, (lisp_value*)arguments);
+      } else {
+        funccall->function = function;
+        funccall->arguments = arguments;
+      }
     }
     break;
   case OPEN_LIST:
-    lv = (lisp_value*)lisp_parse_list(it, true);
+    lv = lisp_parse_literal(rt, it);
+    break;
+  case OPEN_VECTOR:
+    lv = lisp_parse_vector(rt, it);
+    break;
+  case STRING:
+    lv = (lisp_value*)lisp_parse_string(rt, lt->text);
+    smb_free(lt->text);
     break;
   case CLOSE_PAREN:
     lv = NULL;
     break;
   }
 
+  // Running out of heap mustn't look like a close paren, so a float (which
+  // needs no allocation) stands in for whatever couldn't be made, and the
+  // parser still reaches the end of the form.  lisp_parse() discards it all.
+  if (lv == NULL && lt->token.data_llint != CLOSE_PAREN) {
+    lv = lisp_float(0);
+  }
+
   // The token is no longer needed.  The text may exist, but if it does, it will
   // be handled by the garbage collector from now on.
   smb_free(lt);
   return lv;
 }
 
-lisp_value *lisp_parse(smb_iter *it)
+lisp_value *lisp_parse(lisp_runtime *rt, smb_iter *it)
 {
-  return lisp_parse_rec(it, false);
+  lisp_value *rv = lisp_parse_rec(rt, it, false);
+  if (rv == NULL) {
+    return lisp_error(rt, "unexpected close paren");
+  } else if (rt->error) {
+    lisp_decref(rt, rv);
+    return NULL;
+  }
+  return rv;
 }
@@ -0,0 +1,830 @@
+/***************************************************************************//**
+
+  @file         persistent.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Persistent vectors and hash maps, which share structure between
+                their versions.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <stdint.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/*
+  Both kinds of collection are tries with 32 ways at each level, indexed by 5
+  bits at a time.  A change never touches an existing node: it copies the nodes
+  on the path to the change, and the copies share every other node with the
+  version they were made from.  So a change costs O(log32 n) memory and time,
+  and an old version stays valid (and unchanged) for as long as it's used.
+ */
+#define TRIE_BITS 5
+#define TRIE_WIDTH (1 << TRIE_BITS)
+#define TRIE_MASK (TRIE_WIDTH - 1)
+
+/**
+   @brief Hashes have 32 bits, so a map's nodes this deep are collision nodes.
+ */
+#define TRIE_HASH_BITS 32
+
+static lisp_trie *lisp_trie_create(lisp_runtime *rt, int count)
+{
+  lisp_trie *t = (lisp_trie*)lisp_alloc(
+    rt, &tp_trie, sizeof(lisp_trie) + count * sizeof(lisp_value*));
+  if (t == NULL) return NULL;
+  t->bitmap = 0;
+  t->count = count;
+  // Slots start empty, so a node abandoned half-filled can still be freed.
+  for (int i = 0; i < count; i++) {
+    t->items[i] = NULL;
+  }
+  return t;
+}
+
+/**
+   @brief Put an item in a new node's slot, returning false if it won't fit.
+
+   Slots may hold NULL, so only a non-NULL item that couldn't be kept fails.
+ */
+static bool lisp_trie_keep(lisp_runtime *rt, lisp_trie *t, int slot,
+                           lisp_value *item)
+{
+  t->items[slot] = lisp_keep(rt, &t->lv, item);
+  return t->items[slot] != NULL || item == NULL;
+}
+
+/**
+   @brief Return a copy of a node, with one slot replaced by an item.
+
+   If the slot is the node's count, the item is added at the end instead.
+ */
+static lisp_trie *lisp_trie_replace(lisp_runtime *rt, lisp_trie *t, int slot,
+                                    lisp_value *item)
+{
+  lisp_trie *rv = lisp_trie_create(rt, slot < t->count ? t->count : slot + 1);
+  if (rv == NULL) return NULL;
+  rv->bitmap = t->bitmap;
+  for (int i = 0; i < rv->count; i++) {
+    if (!lisp_trie_keep(rt, rv, i, i == slot ? item : t->items[i])) {
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+  }
+  return rv;
+}
+
+/**
+   @brief Return a copy of a node with a pair of slots inserted at some slot.
+ */
+static lisp_trie *lisp_trie_insert(lisp_runtime *rt, lisp_trie *t, int slot,
+                                   lisp_value *a, lisp_value *b)
+{
+  lisp_trie *rv = lisp_trie_create(rt, t->count + 2);
+  lisp_value *item;
+
+  if (rv == NULL) return NULL;
+  rv->bitmap = t->bitmap;
+  for (int i = 0; i < rv->count; i++) {
+    if (i < slot) {
+      item = t->items[i];
+    } else if (i == slot) {
+      item = a;
+    } else if (i == slot + 1) {
+      item = b;
+    } else {
+      item = t->items[i - 2];
+    }
+    if (!lisp_trie_keep(rt, rv, i, item)) {
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+  }
+  return rv;
+}
+
+/**
+   @brief Return a copy of a node without the pair of slots at some slot.
+ */
+static lisp_trie *lisp_trie_delete(lisp_runtime *rt, lisp_trie *t, int slot)
+{
+  lisp_trie *rv = lisp_trie_create(rt, t->count - 2);
+  if (rv == NULL) return NULL;
+  rv->bitmap = t->bitmap;
+  for (int i = 0, j = 0; i < t->count; i++) {
+    if (i != slot && i != slot + 1 &&
+        !lisp_trie_keep(rt, rv, j++, t->items[i])) {
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+  }
+  return rv;
+}
+
+/*******************************************************************************
+                              Persistent vectors
+*******************************************************************************/
+
+/*
+  A vector's items are the leaves of its trie, packed to the left, so item i is
+  found by following bits of i from the root down.  The root is shift bits
+  above the leaves, and when it's full, pushing grows a new root above it.
+ */
+
+lisp_pvector *lisp_pvector_from_array(lisp_runtime *rt, lisp_value **items,
+                                      int n)
+{
+  lisp_pvector *v = (lisp_pvector*)lisp_alloc(rt, &tp_pvector,
+                                               sizeof(lisp_pvector));
+  lisp_trie **level, *parent;
+  int count, width;
+
+  if (v == NULL) return NULL;
+  v->length = n;
+  v->shift = 0;
+  v->root = NULL;
+  if (n == 0) {
+    v->root = lisp_trie_create(rt, 0);
+    if (v->root == NULL) {
+      lisp_decref(rt, (lisp_value*)v);
+      return NULL;
+    }
+    return v;
+  }
+
+  // Build the trie from the leaves up, a full node at a time, rather than by
+  // copying paths for each push.
+  count = (n + TRIE_MASK) / TRIE_WIDTH;
+  level = smb_new(lisp_trie*, count);
+  for (int i = 0; i < count; i++) {
+    width = n - i * TRIE_WIDTH < TRIE_WIDTH ? n - i * TRIE_WIDTH : TRIE_WIDTH;
+    level[i] = lisp_trie_create(rt, width);
+    for (int j = 0; level[i] != NULL && j < width; j++) {
+      if (!lisp_trie_keep(rt, level[i], j, items[i * TRIE_WIDTH + j])) {
+        lisp_decref(rt, (lisp_value*)level[i]);
+        level[i] = NULL;
+      }
+    }
+    if (level[i] == NULL) {
+      count = i;
+      goto fail;
+    }
+  }
+  while (count > 1) {
+    n = count;
+    count = (n + TRIE_MASK) / TRIE_WIDTH;
+    for (int i = 0; i < count; i++) {
+      width = n - i * TRIE_WIDTH < TRIE_WIDTH ? n - i * TRIE_WIDTH : TRIE_WIDTH;
+      // The children were just allocated alongside their parent, so the
+      // parent takes their references.
+      parent = lisp_trie_create(rt, width);
+      if (parent == NULL) {
+        // Parents so far hold the nodes before them, and the rest are
+        // still on their own.
+        for (int j = i * TRIE_WIDTH; j < n; j++) {
+          lisp_decref(rt, (lisp_value*)level[j]);
+        }
+        count = i;
+        goto fail;
+      }
+      for (int j = 0; j < width; j++) {
+        parent->items[j] = (lisp_value*)level[i * TRIE_WIDTH + j];
+      }
+      level[i] = parent;
+    }
+    v->shift += TRIE_BITS;
+  }
+  v->root = level[0];
+  smb_free(level);
+  return v;
+
+fail:
+  for (int i = 0; i < count; i++) {
+    lisp_decref(rt, (lisp_value*)level[i]);
+  }
+  smb_free(level);
+  lisp_decref(rt, (lisp_value*)v);
+  return NULL;
+}
+
+lisp_value *lisp_pvector_ref(lisp_pvector *v, int index)
+{
+  lisp_trie *t = v->root;
+  for (int s = v->shift; s > 0; s -= TRIE_BITS) {
+    t = (lisp_trie*)t->items[(index >> s) & TRIE_MASK];
+  }
+  return t->items[index & TRIE_MASK];
+}
+
+static lisp_trie *pvector_set(lisp_runtime *rt, lisp_trie *t, int shift,
+                              int index, lisp_value *value)
+{
+  lisp_trie *child, *rv;
+  int slot = (index >> shift) & TRIE_MASK;
+
+  if (shift == 0) {
+    return lisp_trie_replace(rt, t, slot, value);
+  }
+  child = pvector_set(rt, (lisp_trie*)t->items[slot], shift - TRIE_BITS, index,
+                      value);
+  if (child == NULL) return NULL;
+  rv = lisp_trie_replace(rt, t, slot, (lisp_value*)child);
+  lisp_decref(rt, (lisp_value*)child);
+  return rv;
+}
+
+lisp_pvector *lisp_pvector_set(lisp_runtime *rt, lisp_pvector *v, int index,
+                               lisp_value *value)
+{
+  lisp_trie *root = pvector_set(rt, v->root, v->shift, index, value);
+  lisp_pvector *rv;
+
+  if (root == NULL) return NULL;
+  rv = (lisp_pvector*)lisp_alloc(rt, &tp_pvector, sizeof(lisp_pvector));
+  if (rv == NULL) {
+    lisp_decref(rt, (lisp_value*)root);
+    return NULL;
+  }
+  rv->length = v->length;
+  rv->shift = v->shift;
+  rv->root = root;
+  return rv;
+}
+
+/**
+   @brief Return a path of nodes down to a leaf holding just one item.
+ */
+static lisp_trie *pvector_path(lisp_runtime *rt, int shift, lisp_value *value)
+{
+  lisp_trie *t = lisp_trie_create(rt, 1);
+  if (t == NULL) return NULL;
+  if (shift == 0) {
+    t->items[0] = lisp_keep(rt, &t->lv, value);
+  } else {
+    t->items[0] = (lisp_value*)pvector_path(rt, shift - TRIE_BITS, value);
+  }
+  if (t->items[0] == NULL) {
+    lisp_decref(rt, (lisp_value*)t);
+    return NULL;
+  }
+  return t;
+}
+
+static lisp_trie *pvector_push(lisp_runtime *rt, lisp_trie *t, int shift,
+                               int index, lisp_value *value)
+{
+  lisp_trie *child, *rv;
+  int slot = (index >> shift) & TRIE_MASK;
+
+  if (shift == 0) {
+    return lisp_trie_replace(rt, t, slot, value);
+  } else if (slot < t->count) {
+    child = pvector_push(rt, (lisp_trie*)t->items[slot], shift - TRIE_BITS,
+                         index, value);
+  } else {
+    child = pvector_path(rt, shift - TRIE_BITS, value);
+  }
+  if (child == NULL) return NULL;
+  rv = lisp_trie_replace(rt, t, slot, (lisp_value*)child);
+  lisp_decref(rt, (lisp_value*)child);
+  return rv;
+}
+
+lisp_pvector *lisp_pvector_push(lisp_runtime *rt, lisp_pvector *v,
+                                lisp_value *value)
+{
+  lisp_pvector *rv = (lisp_pvector*)lisp_alloc(rt, &tp_pvector,
+                                                sizeof(lisp_pvector));
+  lisp_trie *path;
+
+  if (rv == NULL) return NULL;
+  rv->length = v->length + 1;
+  if (v->length == TRIE_WIDTH << v->shift) {
+    rv->shift = v->shift + TRIE_BITS;
+    path = pvector_path(rt, v->shift, value);
+    rv->root = path == NULL ? NULL : lisp_trie_create(rt, 2);
+    if (rv->root != NULL) {
+      rv->root->items[1] = (lisp_value*)path;
+      if (!lisp_trie_keep(rt, rv->root, 0, (lisp_value*)v->root)) {
+        lisp_decref(rt, (lisp_value*)rv->root);
+        rv->root = NULL;
+      }
+    } else {
+      lisp_decref(rt, (lisp_value*)path);
+    }
+  } else {
+    rv->shift = v->shift;
+    rv->root = pvector_push(rt, v->root, v->shift, v->length, value);
+  }
+  if (rv->root == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  return rv;
+}
+
+/**
+   @brief Copy the leaves under a node into an array, in order.
+ */
+static lisp_value **pvector_items(lisp_trie *t, int shift, lisp_value **dest)
+{
+  if (shift == 0) {
+    for (int i = 0; i < t->count; i++) {
+      *dest++ = t->items[i];
+    }
+    return dest;
+  }
+  for (int i = 0; i < t->count; i++) {
+    dest = pvector_items((lisp_trie*)t->items[i], shift - TRIE_BITS, dest);
+  }
+  return dest;
+}
+
+lisp_value *lisp_pvector_to_list(lisp_runtime *rt, lisp_pvector *v)
+{
+  lisp_value **items = smb_new(lisp_value*, v->length > 0 ? v->length : 1);
+  lisp_value *rv;
+
+  pvector_items(v->root, v->shift, items);
+  rv = lisp_list_from_array(rt, items, v->length);
+  smb_free(items);
+  return rv;
+}
+
+/*******************************************************************************
+                             Persistent hash maps
+*******************************************************************************/
+
+/*
+  A map's trie is a hash array mapped trie: each node has a bit set for each
+  of its 32 ways in use, and two slots for each bit set, in order.  The slots
+  hold either a key and its value, or NULL and the node below.  A key sits as
+  close to the root as the bits of its hash allow, so a lookup reads about
+  log32 n nodes, however the keys were added.  Keys whose hashes are all equal
+  end up together in a collision node, which just lists its pairs.
+
+  Keys are hashed by lisp_hash_key() and compared by lisp_eqv(), as in a
+  mutable hash map.
+ */
+
+/**
+   @brief Return which slot a way's pair is in, by counting bits below it.
+ */
+static int phash_slot(uint32_t bitmap, uint32_t bit)
+{
+  return 2 * __builtin_popcount(bitmap & (bit - 1));
+}
+
+lisp_value *lisp_phash_get(lisp_runtime *rt, lisp_phash *h, lisp_value *key)
+{
+  lisp_trie *t = h->root;
+  unsigned int hash;
+  uint32_t bit;
+  int slot;
+
+  if (!lisp_hash_key(rt, key, "phash-ref", &hash)) {
+    return NULL;
+  }
+  for (int shift = 0; shift < TRIE_HASH_BITS; shift += TRIE_BITS) {
+    bit = (uint32_t)1 << ((hash >> shift) & TRIE_MASK);
+    if (!(t->bitmap & bit)) {
+      return NULL;
+    }
+    slot = phash_slot(t->bitmap, bit);
+    if (t->items[slot] != NULL) {
+      return lisp_eqv(t->items[slot], key) ? t->items[slot + 1] : NULL;
+    }
+    t = (lisp_trie*)t->items[slot + 1];
+  }
+  for (int i = 0; i < t->count; i += 2) {
+    if (lisp_eqv(t->items[i], key)) {
+      return t->items[i + 1];
+    }
+  }
+  return NULL;
+}
+
+/**
+   @brief Return a node holding two pairs whose hashes agree up to some shift.
+ */
+static lisp_trie *phash_merge(lisp_runtime *rt, int shift,
+                              lisp_value *k1, lisp_value *v1, unsigned int h1,
+                              lisp_value *k2, lisp_value *v2, unsigned int h2)
+{
+  lisp_trie *t;
+  int i1, i2;
+
+  if (shift >= TRIE_HASH_BITS) {
+    t = lisp_trie_create(rt, 4);
+  } else {
+    i1 = (h1 >> shift) & TRIE_MASK;
+    i2 = (h2 >> shift) & TRIE_MASK;
+    if (i1 == i2) {
+      t = lisp_trie_create(rt, 2);
+      if (t == NULL) return NULL;
+      t->bitmap = (uint32_t)1 << i1;
+      t->items[1] = (lisp_value*)phash_merge(rt, shift + TRIE_BITS, k1, v1, h1,
+                                             k2, v2, h2);
+      if (t->items[1] == NULL) {
+        lisp_decref(rt, (lisp_value*)t);
+        return NULL;
+      }
+      return t;
+    }
+    if (i1 > i2) {
+      // Pairs go in the order of their ways.
+      return phash_merge(rt, shift, k2, v2, h2, k1, v1, h1);
+    }
+    t = lisp_trie_create(rt, 4);
+    if (t != NULL) {
+      t->bitmap = ((uint32_t)1 << i1) | ((uint32_t)1 << i2);
+    }
+  }
+  if (t == NULL) return NULL;
+  if (!lisp_trie_keep(rt, t, 0, k1) || !lisp_trie_keep(rt, t, 1, v1) ||
+      !lisp_trie_keep(rt, t, 2, k2) || !lisp_trie_keep(rt, t, 3, v2)) {
+    lisp_decref(rt, (lisp_value*)t);
+    return NULL;
+  }
+  return t;
+}
+
+static lisp_trie *phash_set(lisp_runtime *rt, lisp_trie *t, int shift,
+                            unsigned int hash, lisp_value *key,
+                            lisp_value *value, bool *added)
+{
+  lisp_trie *child, *rv;
+  unsigned int other;
+  uint32_t bit;
+  int slot;
+
+  if (shift >= TRIE_HASH_BITS) {
+    for (slot = 0; slot < t->count; slot += 2) {
+      if (lisp_eqv(t->items[slot], key)) {
+        return lisp_trie_replace(rt, t, slot + 1, value);
+      }
+    }
+    *added = true;
+    return lisp_trie_insert(rt, t, t->count, key, value);
+  }
+
+  bit = (uint32_t)1 << ((hash >> shift) & TRIE_MASK);
+  slot = phash_slot(t->bitmap, bit);
+  if (!(t->bitmap & bit)) {
+    *added = true;
+    rv = lisp_trie_insert(rt, t, slot, key, value);
+    if (rv != NULL) {
+      rv->bitmap |= bit;
+    }
+    return rv;
+  } else if (t->items[slot] == NULL) {
+    child = phash_set(rt, (lisp_trie*)t->items[slot + 1], shift + TRIE_BITS,
+                      hash, key, value, added);
+  } else if (lisp_eqv(t->items[slot], key)) {
+    return lisp_trie_replace(rt, t, slot + 1, value);
+  } else {
+    // Two keys want the same way, so they move down into a node of their own.
+    // Stored keys were hashed before, so hashing them again can't fail.
+    lisp_hash_key(rt, t->items[slot], "phash-set", &other);
+    *added = true;
+    child = phash_merge(rt, shift + TRIE_BITS, t->items[slot],
+                        t->items[slot + 1], other, key, value, hash);
+    rv = child == NULL ? NULL
+                       : lisp_trie_replace(rt, t, slot + 1, (lisp_value*)child);
+    if (rv != NULL) {
+      lisp_decref(rt, rv->items[slot]);
+      rv->items[slot] = NULL;
+    }
+    lisp_decref(rt, (lisp_value*)child);
+    return rv;
+  }
+  if (child == NULL) return NULL;
+  rv = lisp_trie_replace(rt, t, slot + 1, (lisp_value*)child);
+  lisp_decref(rt, (lisp_value*)child);
+  return rv;
+}
+
+lisp_phash *lisp_phash_set(lisp_runtime *rt, lisp_phash *h, lisp_value *key,
+                           lisp_value *value)
+{
+  lisp_phash *rv;
+  lisp_trie *root;
+  unsigned int hash;
+  bool added = false;
+
+  if (!lisp_hash_key(rt, key, "phash-set", &hash)) {
+    return NULL;
+  }
+  root = phash_set(rt, h->root, 0, hash, key, value, &added);
+  if (root == NULL) return NULL;
+  rv = (lisp_phash*)lisp_alloc(rt, &tp_phash, sizeof(lisp_phash));
+  if (rv == NULL) {
+    lisp_decref(rt, (lisp_value*)root);
+    return NULL;
+  }
+  rv->root = root;
+  rv->count = h->count + added;
+  return rv;
+}
+
+/**
+   @brief Return a node without a key, or NULL if the key isn't under it.
+
+   NULL is also returned, with an error raised, if a node couldn't be made.
+
+   A node left with a single pair (and no nodes below it) is returned as it is,
+   and the caller pulls the pair up into its own slots, so that every key stays
+   as close to the root as it can be.
+ */
+static lisp_trie *phash_remove(lisp_runtime *rt, lisp_trie *t, int shift,
+                               unsigned int hash, lisp_value *key)
+{
+  lisp_trie *child, *rv;
+  uint32_t bit;
+  int slot;
+
+  if (shift >= TRIE_HASH_BITS) {
+    for (slot = 0; slot < t->count; slot += 2) {
+      if (lisp_eqv(t->items[slot], key)) {
+        return lisp_trie_delete(rt, t, slot);
+      }
+    }
+    return NULL;
+  }
+
+  bit = (uint32_t)1 << ((hash >> shift) & TRIE_MASK);
+  if (!(t->bitmap & bit)) {
+    return NULL;
+  }
+  slot = phash_slot(t->bitmap, bit);
+  if (t->items[slot] != NULL) {
+    if (!lisp_eqv(t->items[slot], key)) {
+      return NULL;
+    }
+    rv = lisp_trie_delete(rt, t, slot);
+    if (rv != NULL) {
+      rv->bitmap &= ~bit;
+    }
+    return rv;
+  }
+
+  child = phash_remove(rt, (lisp_trie*)t->items[slot + 1], shift + TRIE_BITS,
+                       hash, key);
+  if (child == NULL) {
+    return NULL;
+  }
+  rv = lisp_trie_replace(rt, t, slot + 1, (lisp_value*)child);
+  if (rv != NULL && child->count == 2 && child->items[0] != NULL) {
+    lisp_decref(rt, rv->items[slot + 1]);
+    rv->items[slot + 1] = NULL;
+    if (!lisp_trie_keep(rt, rv, slot, child->items[0]) ||
+        !lisp_trie_keep(rt, rv, slot + 1, child->items[1])) {
+      lisp_decref(rt, (lisp_value*)rv);
+      rv = NULL;
+    }
+  }
+  lisp_decref(rt, (lisp_value*)child);
+  return rv;
+}
+
+lisp_phash *lisp_phash_remove(lisp_runtime *rt, lisp_phash *h, lisp_value *key)
+{
+  lisp_phash *rv;
+  lisp_trie *root;
+  unsigned int hash;
+
+  if (!lisp_hash_key(rt, key, "phash-remove", &hash)) {
+    return NULL;
+  }
+  root = phash_remove(rt, h->root, 0, hash, key);
+  if (root == NULL && rt->error) {
+    return NULL;
+  } else if (root == NULL) {
+    lisp_incref((lisp_value*)h);
+    return h;
+  }
+  rv = (lisp_phash*)lisp_alloc(rt, &tp_phash, sizeof(lisp_phash));
+  if (rv == NULL) {
+    lisp_decref(rt, (lisp_value*)root);
+    return NULL;
+  }
+  rv->root = root;
+  rv->count = h->count - 1;
+  return rv;
+}
+
+static int phash_items(lisp_trie *t, int shift, lisp_value **keys,
+                       lisp_value **values, int n)
+{
+  for (int i = 0; i < t->count; i += 2) {
+    if (t->items[i] == NULL) {
+      n = phash_items((lisp_trie*)t->items[i + 1], shift + TRIE_BITS, keys,
+                      values, n);
+    } else {
+      keys[n] = t->items[i];
+      values[n++] = t->items[i + 1];
+    }
+  }
+  return n;
+}
+
+void lisp_phash_items(lisp_phash *h, lisp_value **keys, lisp_value **values)
+{
+  phash_items(h->root, 0, keys, values, 0);
+}
+
+/*******************************************************************************
+                              tp_trie / lisp_trie
+*******************************************************************************/
+
+static lisp_value *lisp_trie_alloc(lisp_runtime *rt)
+{
+  return (lisp_value*)lisp_trie_create(rt, 0);
+}
+
+static void lisp_trie_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_trie *t = (lisp_trie*)value;
+  // Tries are at most seven levels deep, so recursing here is safe.
+  for (int i = 0; i < t->count; i++) {
+    lisp_decref(rt, t->items[i]);
+  }
+  lisp_free(rt, value, sizeof(lisp_trie) + t->count * sizeof(lisp_value*));
+}
+
+static void lisp_trie_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  (void)value; // unused
+  fprintf(f, "trie\n");
+}
+
+static lisp_value *lisp_trie_copy(lisp_runtime *rt, lisp_value *value,
+                                  lisp_value *(*child)(lisp_runtime *,
+                                                       lisp_value *))
+{
+  lisp_trie *t = (lisp_trie*)value;
+  lisp_trie *rv = lisp_trie_create(rt, t->count);
+  if (rv == NULL) return NULL;
+  rv->bitmap = t->bitmap;
+  for (int i = 0; i < t->count; i++) {
+    rv->items[i] = child(rt, t->items[i]);
+    if (rv->items[i] == NULL && t->items[i] != NULL) {
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+  }
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_trie = {
+  .tp_name = "trie",
+  .tp_index = TP_TRIE,
+  .tp_alloc = &lisp_trie_alloc,
+  .tp_dealloc = &lisp_trie_dealloc,
+  .tp_print = &lisp_trie_print,
+  .tp_copy = &lisp_trie_copy
+};
+
+/*******************************************************************************
+                           tp_pvector / lisp_pvector
+*******************************************************************************/
+
+static lisp_value *lisp_pvector_alloc(lisp_runtime *rt)
+{
+  return (lisp_value*)lisp_pvector_from_array(rt, NULL, 0);
+}
+
+static void lisp_pvector_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_decref(rt, (lisp_value*)((lisp_pvector*)value)->root);
+  lisp_free(rt, value, sizeof(lisp_pvector));
+}
+
+static void print_n_spaces(FILE *f, int nspaces)
+{
+  while (nspaces--) {
+    fputc(' ', f);
+  }
+}
+
+static void lisp_pvector_print(lisp_value *value, FILE *f, int indent)
+{
+  lisp_pvector *v = (lisp_pvector*)value;
+  lisp_value *item;
+
+  fprintf(f, "#pvector(\n");
+  for (int i = 0; i < v->length; i++) {
+    item = lisp_pvector_ref(v, i);
+    print_n_spaces(f, indent + 1);
+    lisp_type_of(item)->tp_print(item, f, indent + 1);
+  }
+  print_n_spaces(f, indent);
+  fprintf(f, ")\n");
+}
+
+static lisp_value *lisp_pvector_copy(lisp_runtime *rt, lisp_value *value,
+                                     lisp_value *(*child)(lisp_runtime *,
+                                                          lisp_value *))
+{
+  lisp_pvector *v = (lisp_pvector*)value;
+  lisp_pvector *rv = (lisp_pvector*)lisp_alloc(rt, &tp_pvector,
+                                                sizeof(lisp_pvector));
+  if (rv == NULL) return NULL;
+  rv->length = v->length;
+  rv->shift = v->shift;
+  rv->root = (lisp_trie*)child(rt, (lisp_value*)v->root);
+  if (rv->root == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_pvector = {
+  .tp_name = "pvector",
+  .tp_index = TP_PVECTOR,
+  .tp_alloc = &lisp_pvector_alloc,
+  .tp_dealloc = &lisp_pvector_dealloc,
+  .tp_print = &lisp_pvector_print,
+  .tp_copy = &lisp_pvector_copy
+};
+
+/*******************************************************************************
+                             tp_phash / lisp_phash
+*******************************************************************************/
+
+static lisp_value *lisp_phash_alloc(lisp_runtime *rt)
+{
+  lisp_phash *h = (lisp_phash*)lisp_alloc(rt, &tp_phash, sizeof(lisp_phash));
+  if (h == NULL) return NULL;
+  h->count = 0;
+  h->root = lisp_trie_create(rt, 0);
+  if (h->root == NULL) {
+    lisp_decref(rt, (lisp_value*)h);
+    return NULL;
+  }
+  return (lisp_value*)h;
+}
+
+static void lisp_phash_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_decref(rt, (lisp_value*)((lisp_phash*)value)->root);
+  lisp_free(rt, value, sizeof(lisp_phash));
+}
+
+static void lisp_phash_print(lisp_value *value, FILE *f, int indent)
+{
+  lisp_phash *h = (lisp_phash*)value;
+  lisp_value **keys = smb_new(lisp_value*, h->count > 0 ? 2 * h->count : 1);
+  lisp_value **values = keys + h->count;
+
+  lisp_phash_items(h, keys, values);
+  fprintf(f, "#phash(\n");
+  for (int i = 0; i < h->count; i++) {
+    print_n_spaces(f, indent + 1);
+    fprintf(f, "(\n");
+    print_n_spaces(f, indent + 2);
+    lisp_type_of(keys[i])->tp_print(keys[i], f, indent + 2);
+    print_n_spaces(f, indent + 2);
+    lisp_type_of(values[i])->tp_print(values[i], f, indent + 2);
+    print_n_spaces(f, indent + 1);
+    fprintf(f, ")\n");
+  }
+  print_n_spaces(f, indent);
+  fprintf(f, ")\n");
+  smb_free(keys);
+}
+
+static lisp_value *lisp_phash_copy(lisp_runtime *rt, lisp_value *value,
+                                   lisp_value *(*child)(lisp_runtime *,
+                                                        lisp_value *))
+{
+  lisp_phash *h = (lisp_phash*)value;
+  lisp_phash *rv = (lisp_phash*)lisp_alloc(rt, &tp_phash, sizeof(lisp_phash));
+  if (rv == NULL) return NULL;
+  // Copied keys hash the same as the originals, so the trie keeps its shape.
+  rv->count = h->count;
+  rv->root = (lisp_trie*)child(rt, (lisp_value*)h->root);
+  if (rv->root == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_phash = {
+  .tp_name = "phash",
+  .tp_index = TP_PHASH,
+  .tp_alloc = &lisp_phash_alloc,
+  .tp_dealloc = &lisp_phash_dealloc,
+  .tp_print = &lisp_phash_print,
+  .tp_copy = &lisp_phash_copy
+};
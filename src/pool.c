@@ -0,0 +1,259 @@
+/***************************************************************************//**
+
+  @file         pool.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        A work-stealing pool of worker threads.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Initial capacity of each worker's deque.
+ */
+#define DEQUE_MIN 16
+
+/**
+   @brief A worker thread, along with the tasks queued for it.
+
+   The worker takes tasks from the tail of its own deque, so that it works on
+   whatever it queued most recently.  Other workers steal from the head, where
+   the oldest (and usually largest remaining) tasks are.
+ */
+typedef struct {
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  lisp_task **tasks;
+  int capacity;
+  int head;
+  int count;
+
+  /**
+     @brief Each worker has its own runtime, since runtimes aren't shared.
+   */
+  lisp_runtime rt;
+  lisp_scope *globals;
+
+  lisp_pool *pool;
+  int index;
+
+} lisp_worker;
+
+struct lisp_pool {
+
+  int nworkers;
+  lisp_worker *workers;
+
+  /**
+     @brief Number of tasks queued and not yet taken by a worker.
+   */
+  int pending;
+
+  /**
+     @brief Protects started, shutdown, and sleeping on wake.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool started;
+  bool shutdown;
+
+  /**
+     @brief Worker the next submitted task is queued on.
+   */
+  unsigned int next;
+
+};
+
+static void lisp_worker_push(lisp_worker *w, lisp_task *task)
+{
+  lisp_task **tasks;
+
+  pthread_mutex_lock(&w->lock);
+  if (w->count == w->capacity) {
+    // Unroll the ring into a bigger buffer.
+    tasks = smb_new(lisp_task*, w->capacity * 2);
+    for (int i = 0; i < w->count; i++) {
+      tasks[i] = w->tasks[(w->head + i) % w->capacity];
+    }
+    smb_free(w->tasks);
+    w->tasks = tasks;
+    w->capacity *= 2;
+    w->head = 0;
+  }
+  w->tasks[(w->head + w->count) % w->capacity] = task;
+  w->count++;
+  pthread_mutex_unlock(&w->lock);
+}
+
+static lisp_task *lisp_worker_pop(lisp_worker *w, bool steal)
+{
+  lisp_task *task = NULL;
+
+  pthread_mutex_lock(&w->lock);
+  if (w->count > 0) {
+    if (steal) {
+      task = w->tasks[w->head];
+      w->head = (w->head + 1) % w->capacity;
+    } else {
+      task = w->tasks[(w->head + w->count - 1) % w->capacity];
+    }
+    w->count--;
+  }
+  pthread_mutex_unlock(&w->lock);
+  return task;
+}
+
+/**
+   @brief Take a task from a worker's own deque, or else steal one.
+ */
+static lisp_task *lisp_worker_take(lisp_worker *w)
+{
+  lisp_pool *pool = w->pool;
+  lisp_task *task = lisp_worker_pop(w, false);
+
+  for (int i = 1; task == NULL && i < pool->nworkers; i++) {
+    task = lisp_worker_pop(&pool->workers[(w->index + i) % pool->nworkers],
+                           true);
+  }
+  if (task != NULL) {
+    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+  }
+  return task;
+}
+
+static void *lisp_worker_main(void *arg)
+{
+  lisp_worker *w = arg;
+  lisp_pool *pool = w->pool;
+  lisp_task *task;
+
+  // The runtime was set up by whoever created the pool, on another stack.
+  lisp_runtime_set_stack(&w->rt);
+  w->globals = lisp_create_globals(&w->rt);
+
+  for (;;) {
+    task = lisp_worker_take(w);
+    if (task != NULL) {
+      task->run(&w->rt, w->globals, task);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0 &&
+           !pool->shutdown) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    if (pool->shutdown &&
+        __atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    // A task is pending, but another worker may beat us to it.
+    sched_yield();
+  }
+
+  lisp_scope_delete(&w->rt, w->globals);
+  lisp_runtime_destroy(&w->rt);
+  return NULL;
+}
+
+lisp_pool *lisp_pool_create(int nworkers)
+{
+  lisp_pool *pool = smb_new(lisp_pool, 1);
+  lisp_worker *w;
+
+  pool->nworkers = nworkers;
+  pool->workers = smb_new(lisp_worker, nworkers);
+  pool->pending = 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pool->started = false;
+  pool->shutdown = false;
+  pool->next = 0;
+
+  for (int i = 0; i < nworkers; i++) {
+    w = &pool->workers[i];
+    pthread_mutex_init(&w->lock, NULL);
+    w->tasks = smb_new(lisp_task*, DEQUE_MIN);
+    w->capacity = DEQUE_MIN;
+    w->head = 0;
+    w->count = 0;
+    // Worker runtimes have no pool, so nested parallel calls within a task
+    // run sequentially instead of waiting on other workers.
+    lisp_runtime_init(&w->rt);
+    w->globals = NULL;
+    w->pool = pool;
+    w->index = i;
+  }
+  return pool;
+}
+
+void lisp_pool_delete(lisp_pool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  // Every worker must be finished before any deque goes away, since they look
+  // at each other's deques for work to steal.
+  for (int i = 0; pool->started && i < pool->nworkers; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  for (int i = 0; i < pool->nworkers; i++) {
+    pthread_mutex_destroy(&pool->workers[i].lock);
+    smb_free(pool->workers[i].tasks);
+  }
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  smb_free(pool->workers);
+  smb_free(pool);
+}
+
+int lisp_pool_size(lisp_pool *pool)
+{
+  return pool->nworkers;
+}
+
+void lisp_pool_submit(lisp_pool *pool, lisp_task *task)
+{
+  lisp_worker *w;
+
+  pthread_mutex_lock(&pool->lock);
+  // Threads aren't started until there's something for them to do, so that
+  // programs which never use them don't pay for them.
+  if (!pool->started) {
+    for (int i = 0; i < pool->nworkers; i++) {
+      pthread_create(&pool->workers[i].thread, NULL, &lisp_worker_main,
+                     &pool->workers[i]);
+    }
+    pool->started = true;
+  }
+  w = &pool->workers[pool->next++ % pool->nworkers];
+  pthread_mutex_unlock(&pool->lock);
+
+  // Count the task before queueing it, so that pending never drops below 0.
+  __atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+  lisp_worker_push(w, task);
+
+  // Take the lock so that the signal can't slip in between a worker checking
+  // pending and going to sleep.
+  pthread_mutex_lock(&pool->lock);
+  pthread_cond_signal(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+}
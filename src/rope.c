@@ -0,0 +1,292 @@
+/***************************************************************************//**
+
+  @file         rope.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Ropes, for building up long strings a piece at a time.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#include <string.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/*
+  Ropes are kept balanced the way AVL trees are: the depths of a node's halves
+  differ by at most one.  Appending one short string at a time would otherwise
+  leave a rope with a leaf for each of them, so leaves shorter than this are
+  merged into a new leaf instead of being joined by a node.
+ */
+#define ROPE_LEAF 512
+
+/**
+   @brief Return a leaf holding a string, or NULL if the string is NULL.
+ */
+static lisp_rope *lisp_rope_leaf(lisp_runtime *rt, lisp_string *str)
+{
+  lisp_rope *r;
+
+  if (str == NULL) return NULL;
+  r = (lisp_rope*)lisp_alloc(rt, &tp_rope, sizeof(lisp_rope));
+  if (r == NULL) return NULL;
+  r->left = NULL;
+  r->right = NULL;
+  r->leaf = (lisp_string*)lisp_keep(rt, &r->lv, (lisp_value*)str);
+  if (r->leaf == NULL) {
+    lisp_decref(rt, (lisp_value*)r);
+    return NULL;
+  }
+  r->length = str->length;
+  r->depth = 0;
+  return r;
+}
+
+/**
+   @brief Return a node joining two ropes, without balancing it, or NULL if
+   either is NULL.
+ */
+static lisp_rope *lisp_rope_node(lisp_runtime *rt, lisp_rope *a, lisp_rope *b)
+{
+  lisp_rope *r;
+
+  if (a == NULL || b == NULL) return NULL;
+  r = (lisp_rope*)lisp_alloc(rt, &tp_rope, sizeof(lisp_rope));
+  if (r == NULL) return NULL;
+  r->leaf = NULL;
+  r->left = (lisp_rope*)lisp_keep(rt, &r->lv, (lisp_value*)a);
+  r->right = (lisp_rope*)lisp_keep(rt, &r->lv, (lisp_value*)b);
+  if (r->left == NULL || r->right == NULL) {
+    lisp_decref(rt, (lisp_value*)r);
+    return NULL;
+  }
+  r->length = a->length + b->length;
+  r->depth = (a->depth > b->depth ? a->depth : b->depth) + 1;
+  return r;
+}
+
+/**
+   @brief Return a leaf with the contents of two short leaves.
+ */
+static lisp_rope *lisp_rope_merge(lisp_runtime *rt, lisp_rope *a, lisp_rope *b)
+{
+  lisp_string *str = lisp_string_create(rt, a->length + b->length);
+  lisp_rope *r;
+
+  if (str == NULL) return NULL;
+  memcpy((char*)str->data, a->leaf->data, a->length);
+  memcpy((char*)str->data + a->length, b->leaf->data, b->length);
+  r = lisp_rope_leaf(rt, str);
+  lisp_decref(rt, (lisp_value*)str);
+  return r;
+}
+
+/**
+   @brief Return a node joining two ropes, rotating it if one is too deep.
+
+   The depths may differ by two at most, which is all that joining two
+   balanced ropes can leave behind.
+ */
+static lisp_rope *lisp_rope_balance(lisp_runtime *rt, lisp_rope *a,
+                                    lisp_rope *b)
+{
+  lisp_rope *x, *y, *r;
+
+  if (a->depth > b->depth + 1) {
+    if (a->left->depth >= a->right->depth) {
+      x = lisp_rope_node(rt, a->right, b);
+      r = lisp_rope_node(rt, a->left, x);
+      lisp_decref(rt, (lisp_value*)x);
+      return r;
+    }
+    x = lisp_rope_node(rt, a->left, a->right->left);
+    y = lisp_rope_node(rt, a->right->right, b);
+  } else if (b->depth > a->depth + 1) {
+    if (b->right->depth >= b->left->depth) {
+      x = lisp_rope_node(rt, a, b->left);
+      r = lisp_rope_node(rt, x, b->right);
+      lisp_decref(rt, (lisp_value*)x);
+      return r;
+    }
+    x = lisp_rope_node(rt, a, b->left->left);
+    y = lisp_rope_node(rt, b->left->right, b->right);
+  } else {
+    return lisp_rope_node(rt, a, b);
+  }
+  r = lisp_rope_node(rt, x, y);
+  lisp_decref(rt, (lisp_value*)x);
+  lisp_decref(rt, (lisp_value*)y);
+  return r;
+}
+
+lisp_rope *lisp_rope_from_string(lisp_runtime *rt, lisp_string *str)
+{
+  return lisp_rope_leaf(rt, str);
+}
+
+lisp_rope *lisp_rope_concat(lisp_runtime *rt, lisp_rope *a, lisp_rope *b)
+{
+  lisp_rope *x, *r;
+
+  if (a->length == 0 || b->length == 0) {
+    r = a->length == 0 ? b : a;
+    lisp_incref((lisp_value*)r);
+    return r;
+  }
+  if (a->depth == 0 && b->depth == 0 && a->length + b->length <= ROPE_LEAF) {
+    return lisp_rope_merge(rt, a, b);
+  }
+
+  // Join the shallower rope onto the edge of the deeper one, where it's about
+  // as deep, and rebalance on the way back up.  A short leaf goes all the way
+  // down, in case it can be merged into the leaf at the end.
+  if (a->depth > b->depth + 1 ||
+      (a->depth > 0 && b->depth == 0 && b->length < ROPE_LEAF)) {
+    x = lisp_rope_concat(rt, a->right, b);
+    r = x == NULL ? NULL : lisp_rope_balance(rt, a->left, x);
+  } else if (b->depth > a->depth + 1 ||
+             (b->depth > 0 && a->depth == 0 && a->length < ROPE_LEAF)) {
+    x = lisp_rope_concat(rt, a, b->left);
+    r = x == NULL ? NULL : lisp_rope_balance(rt, x, b->right);
+  } else {
+    return lisp_rope_node(rt, a, b);
+  }
+  lisp_decref(rt, (lisp_value*)x);
+  return r;
+}
+
+lisp_rope *lisp_rope_slice(lisp_runtime *rt, lisp_rope *r, size_t start,
+                           size_t end)
+{
+  lisp_rope *a, *b, *rv;
+  lisp_string *str;
+  size_t middle;
+
+  if (start == 0 && end == r->length) {
+    lisp_incref((lisp_value*)r);
+    return r;
+  }
+  if (r->depth == 0) {
+    str = lisp_string_substring(rt, r->leaf, start, end);
+    rv = lisp_rope_leaf(rt, str);
+    lisp_decref(rt, (lisp_value*)str);
+    return rv;
+  }
+
+  middle = r->left->length;
+  if (end <= middle) {
+    return lisp_rope_slice(rt, r->left, start, end);
+  } else if (start >= middle) {
+    return lisp_rope_slice(rt, r->right, start - middle, end - middle);
+  }
+  a = lisp_rope_slice(rt, r->left, start, middle);
+  b = lisp_rope_slice(rt, r->right, 0, end - middle);
+  rv = a == NULL || b == NULL ? NULL : lisp_rope_concat(rt, a, b);
+  lisp_decref(rt, (lisp_value*)a);
+  lisp_decref(rt, (lisp_value*)b);
+  return rv;
+}
+
+static char *lisp_rope_copy_out(lisp_rope *r, char *dest)
+{
+  if (r->depth == 0) {
+    memcpy(dest, r->leaf->data, r->length);
+    return dest + r->length;
+  }
+  dest = lisp_rope_copy_out(r->left, dest);
+  return lisp_rope_copy_out(r->right, dest);
+}
+
+lisp_string *lisp_rope_flatten(lisp_runtime *rt, lisp_rope *r)
+{
+  lisp_string *str;
+
+  if (r->depth == 0) {
+    lisp_incref((lisp_value*)r->leaf);
+    return r->leaf;
+  }
+  str = lisp_string_create(rt, r->length);
+  if (str == NULL) return NULL;
+  lisp_rope_copy_out(r, (char*)str->data);
+  return str;
+}
+
+bool lisp_rope_write(lisp_rope *r, FILE *f)
+{
+  if (r->depth == 0) {
+    return fwrite(r->leaf->data, 1, r->length, f) == r->length;
+  }
+  return lisp_rope_write(r->left, f) && lisp_rope_write(r->right, f);
+}
+
+/*******************************************************************************
+                              tp_rope / lisp_rope
+*******************************************************************************/
+
+static lisp_value *lisp_rope_alloc(lisp_runtime *rt)
+{
+  lisp_string *empty = lisp_string_create(rt, 0);
+  lisp_rope *r = lisp_rope_leaf(rt, empty);
+  lisp_decref(rt, (lisp_value*)empty);
+  return (lisp_value*)r;
+}
+
+static void lisp_rope_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_rope *r = (lisp_rope*)value;
+  // Ropes are balanced, so recursing only goes as deep as the rope does.
+  lisp_decref(rt, (lisp_value*)r->leaf);
+  lisp_decref(rt, (lisp_value*)r->left);
+  lisp_decref(rt, (lisp_value*)r->right);
+  lisp_free(rt, value, sizeof(lisp_rope));
+}
+
+static void lisp_rope_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  fputc('"', f);
+  lisp_rope_write((lisp_rope*)value, f);
+  fputs("\"\n", f);
+}
+
+static lisp_value *lisp_rope_copy(lisp_runtime *rt, lisp_value *value,
+                                  lisp_value *(*child)(lisp_runtime *,
+                                                       lisp_value *))
+{
+  lisp_rope *r = (lisp_rope*)value;
+  lisp_rope *rv = (lisp_rope*)lisp_alloc(rt, &tp_rope, sizeof(lisp_rope));
+
+  if (rv == NULL) return NULL;
+  rv->left = NULL;
+  rv->right = NULL;
+  // A leaf has a string, and a node has both halves.
+  rv->leaf = (lisp_string*)child(rt, (lisp_value*)r->leaf);
+  if (r->leaf == NULL) {
+    rv->left = (lisp_rope*)child(rt, (lisp_value*)r->left);
+    if (rv->left != NULL) {
+      rv->right = (lisp_rope*)child(rt, (lisp_value*)r->right);
+    }
+  }
+  if (rv->leaf == NULL && rv->right == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  rv->length = r->length;
+  rv->depth = r->depth;
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_rope = {
+  .tp_name = "rope",
+  .tp_index = TP_ROPE,
+  .tp_alloc = &lisp_rope_alloc,
+  .tp_dealloc = &lisp_rope_dealloc,
+  .tp_print = &lisp_rope_print,
+  .tp_copy = &lisp_rope_copy
+};
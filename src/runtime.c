@@ -0,0 +1,130 @@
+/***************************************************************************//**
+
+  @file         runtime.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Interpreter state and error reporting.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "libstephen/log.h"
+#include "lex.h"
+#include "lisp.h"
+
+/**
+   @brief Number of function calls between checks of the clock.
+ */
+#define DEADLINE_INTERVAL 1024
+
+void lisp_runtime_init(lisp_runtime *rt)
+{
+  memset(rt, 0, sizeof(lisp_runtime));
+  rt->log = (smb_logger) {
+    .format = SMB_DEFAULT_LOGFORMAT,
+    .num = 0,
+  };
+  lisp_runtime_set_stack(rt);
+}
+
+void lisp_runtime_set_stack(lisp_runtime *rt)
+{
+  pthread_attr_t attr;
+  void *addr;
+  size_t size;
+
+  // With no way to find the stack, calls simply aren't checked.
+  rt->stack_limit = 0;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+    return;
+  }
+  if (pthread_attr_getstack(&attr, &addr, &size) == 0 &&
+      size > 2 * LISP_STACK_RESERVE) {
+    rt->stack_limit = (uintptr_t)addr + LISP_STACK_RESERVE;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+void lisp_runtime_destroy(lisp_runtime *rt)
+{
+  // Arenas and scopes belong to whoever created them.  All that's left is to
+  // make sure nothing allocates into an arena that is about to go away.
+  rt->arena = NULL;
+  if (rt->lexer != NULL) {
+    lex_delete(rt->lexer, false);
+    rt->lexer = NULL;
+  }
+}
+
+lisp_value *lisp_error(lisp_runtime *rt, const char *format, ...)
+{
+  va_list va;
+
+  // The first error is the interesting one.  Anything after it is most likely
+  // fallout from unwinding.
+  if (rt->error) {
+    return NULL;
+  }
+
+  va_start(va, format);
+  vsnprintf(rt->message, LISP_ERROR_SIZE, format, va);
+  va_end(va);
+  rt->error = true;
+  return NULL;
+}
+
+void lisp_clear_error(lisp_runtime *rt)
+{
+  rt->error = false;
+  rt->message[0] = '\0';
+}
+
+static unsigned long long lisp_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void lisp_set_timeout(lisp_runtime *rt, unsigned long ms)
+{
+  rt->deadline = ms == 0 ? 0 : lisp_now() + ms * 1000000ULL;
+  rt->ticks = 0;
+}
+
+bool lisp_check_deadline(lisp_runtime *rt)
+{
+  if (rt->deadline == 0 || ++rt->ticks < DEADLINE_INTERVAL) {
+    return true;
+  }
+  rt->ticks = 0;
+  if (lisp_now() >= rt->deadline) {
+    lisp_error(rt, "evaluation timed out");
+    return false;
+  }
+  return true;
+}
+
+bool lisp_check_stack(lisp_runtime *rt)
+{
+  char here;
+
+  // Stacks grow down, so the address of a local is how far down this one is.
+  if ((uintptr_t)&here >= rt->stack_limit) {
+    return true;
+  }
+  lisp_error(rt, "recursion is too deep");
+  return false;
+}
@@ -42,18 +42,138 @@ lisp_scope *lisp_scope_create(void)
 {
   lisp_scope *scope = smb_new(lisp_scope, 1);
   scope->up = NULL;
-  ht_init(&scope->table, &wchar_hash, &data_compare_wstring);
+  scope->nsmall = 0;
+  scope->owned = NULL;
   return scope;
 }
 
-static void lisp_scope_values_decref(DATA d)
+/**
+   @brief Move a scope's bindings from its inline arrays into a hash table.
+ */
+static void lisp_scope_grow(lisp_scope *scope)
+{
+  ht_init(&scope->table, &wchar_hash, &data_compare_wstring);
+  for (int i = 0; i < scope->nsmall; i++) {
+    ht_insert(&scope->table, PTR(scope->names[i]), PTR(scope->values[i]));
+  }
+  scope->nsmall = -1;
+}
+
+void lisp_scope_bind(lisp_runtime *rt, lisp_scope *scope, wchar_t *name,
+                     lisp_value *value)
+{
+  smb_status st = SMB_SUCCESS;
+  lisp_value *old;
+
+  if (scope->nsmall >= 0) {
+    for (int i = 0; i < scope->nsmall; i++) {
+      if (wcscmp(scope->names[i], name) == 0) {
+        old = scope->values[i];
+        scope->values[i] = value;
+        lisp_decref(rt, old);
+        return;
+      }
+    }
+    if (scope->nsmall < LISP_SCOPE_SMALL) {
+      scope->names[scope->nsmall] = name;
+      scope->values[scope->nsmall] = value;
+      scope->nsmall++;
+      return;
+    }
+    lisp_scope_grow(scope);
+  }
+
+  old = ht_get(&scope->table, PTR(name), &st).data_ptr;
+  ht_insert(&scope->table, PTR(name), PTR(value));
+  if (st == SMB_SUCCESS) {
+    lisp_decref(rt, old);
+  }
+}
+
+lisp_value *lisp_scope_lookup(lisp_scope *scope, wchar_t *name)
+{
+  smb_status st;
+  lisp_value *rv;
+
+  while (scope) {
+    if (scope->nsmall >= 0) {
+      for (int i = 0; i < scope->nsmall; i++) {
+        if (wcscmp(scope->names[i], name) == 0) {
+          return scope->values[i];
+        }
+      }
+    } else {
+      st = SMB_SUCCESS;
+      rv = ht_get(&scope->table, PTR(name), &st).data_ptr;
+      if (st == SMB_SUCCESS) {
+        return rv;
+      }
+    }
+    scope = scope->up;
+  }
+  return NULL;
+}
+
+void lisp_scope_keep(lisp_scope *scope, lisp_value *value)
+{
+  if (scope->owned == NULL) {
+    scope->owned = ll_create();
+  }
+  ll_append(scope->owned, PTR(value));
+}
+
+void lisp_scope_immortalize(lisp_scope *scope)
 {
-  lisp_value *v = d.data_ptr;
-  lisp_decref(v);
+  smb_ht_bckt *bucket;
+  smb_status st = SMB_SUCCESS;
+  smb_iter it;
+
+  if (scope->nsmall >= 0) {
+    for (int i = 0; i < scope->nsmall; i++) {
+      lisp_immortalize(scope->values[i]);
+    }
+  } else {
+    for (int i = 0; i < scope->table.allocated; i++) {
+      for (bucket = scope->table.table[i]; bucket; bucket = bucket->next) {
+        lisp_immortalize(bucket->value.data_ptr);
+      }
+    }
+  }
+  if (scope->owned != NULL) {
+    it = ll_get_iter(scope->owned);
+    while (it.has_next(&it)) {
+      lisp_immortalize(it.next(&it, &st).data_ptr);
+    }
+  }
 }
 
-void lisp_scope_delete(lisp_scope *scope)
+void lisp_scope_delete(lisp_runtime *rt, lisp_scope *scope)
 {
-  ht_destroy_act(&scope->table, &lisp_scope_values_decref);
+  smb_ht_bckt *bucket;
+  smb_status st = SMB_SUCCESS;
+  smb_iter it;
+
+  if (scope->nsmall >= 0) {
+    for (int i = 0; i < scope->nsmall; i++) {
+      lisp_decref(rt, scope->values[i]);
+    }
+  } else {
+    // ht_destroy_act() has no way to pass the runtime along, so drop the values
+    // by walking the buckets first.
+    for (int i = 0; i < scope->table.allocated; i++) {
+      for (bucket = scope->table.table[i]; bucket; bucket = bucket->next) {
+        lisp_decref(rt, bucket->value.data_ptr);
+      }
+    }
+    ht_destroy(&scope->table);
+  }
+  // Only now that nothing refers to their names can these go.
+  if (scope->owned != NULL) {
+    it = ll_get_iter(scope->owned);
+    while (it.has_next(&it)) {
+      lisp_decref(rt, it.next(&it, &st).data_ptr);
+    }
+    ll_delete(scope->owned);
+  }
   smb_free(scope);
 }
@@ -0,0 +1,379 @@
+/***************************************************************************//**
+
+  @file         server.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Evaluating requests from a Unix domain socket.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/**
+   @brief Largest request accepted, in bytes.
+ */
+#define REQUEST_MAX (1024 * 1024)
+
+/**
+   @brief An interpreter, ready to take requests.
+ */
+typedef struct {
+
+  pthread_t thread;
+  lisp_server_config *config;
+  int listener;
+
+  lisp_runtime rt;
+  lisp_scope *globals;
+
+  /**
+     @brief Arena reused by each request, whose scope is set per request.
+   */
+  lisp_arena arena;
+
+} lisp_server_worker;
+
+/**
+   @brief Read until the client shuts down its side of the connection.
+   @returns The request, NUL terminated, or NULL on failure.
+ */
+static char *read_request(int fd)
+{
+  size_t capacity = 4096, length = 0;
+  char *text = smb_new(char, capacity);
+  ssize_t n;
+
+  for (;;) {
+    if (length + 1 == capacity) {
+      if (capacity >= REQUEST_MAX) {
+        smb_free(text);
+        return NULL;
+      }
+      capacity *= 2;
+      text = smb_renew(char, text, capacity);
+    }
+    n = read(fd, text + length, capacity - length - 1);
+    if (n == 0) {
+      break;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      // Including a receive timeout.
+      smb_free(text);
+      return NULL;
+    }
+    length += n;
+  }
+  text[length] = '\0';
+  return text;
+}
+
+/**
+   @brief Evaluate a request, and print the result to the client.
+ */
+static void handle_request(lisp_server_worker *w, const char *text, FILE *out)
+{
+  lisp_runtime *rt = &w->rt;
+  lisp_scope *scope;
+  lisp_value *rv;
+  wchar_t *wtext;
+  size_t length;
+
+  length = mbstowcs(NULL, text, 0);
+  if (length == (size_t)-1) {
+    fprintf(out, "error: invalid character in request\n");
+    return;
+  }
+  wtext = smb_new(wchar_t, length + 1);
+  mbstowcs(wtext, text, length + 1);
+
+  // Definitions go in the request's own scope, so that every request starts
+  // from the same globals.
+  scope = lisp_scope_create();
+  scope->up = w->globals;
+  w->arena.scope = scope;
+  lisp_arena_begin(rt, &w->arena);
+  lisp_set_timeout(rt, w->config->timeout);
+
+  rv = lisp_eval_string(rt, wtext, scope);
+  if (rv == NULL) {
+    fprintf(out, "error: %s\n", rt->message);
+    lisp_clear_error(rt);
+  } else {
+    lisp_type_of(rv)->tp_print(rv, out, 0);
+  }
+
+  lisp_set_timeout(rt, 0);
+  lisp_decref(rt, rv);
+  lisp_scope_delete(rt, scope);
+  lisp_arena_end(rt, &w->arena);
+  smb_free(wtext);
+}
+
+/**
+   @brief Read one request from a connection, answer it, and close it.
+ */
+static void serve_connection(lisp_server_worker *w, int fd)
+{
+  struct timeval tv;
+  char *text;
+  FILE *out;
+
+  // A client that stops sending (or reading) mustn't hold up the worker.
+  if (w->config->timeout != 0) {
+    tv.tv_sec = w->config->timeout / 1000;
+    tv.tv_usec = (w->config->timeout % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+  out = fdopen(fd, "w");
+  if (out == NULL) {
+    close(fd);
+    return;
+  }
+
+  text = read_request(fd);
+  if (text == NULL) {
+    fprintf(out, "error: unable to read request\n");
+  } else {
+    handle_request(w, text, out);
+    smb_free(text);
+  }
+  fclose(out);
+}
+
+/**
+   @brief Accept a connection, retrying on errors that don't matter.
+ */
+static int accept_connection(int listener)
+{
+  int fd;
+  for (;;) {
+    fd = accept(listener, NULL, NULL);
+    if (fd >= 0) {
+      return fd;
+    }
+    if (errno != EINTR && errno != ECONNABORTED) {
+      perror("accept");
+    }
+  }
+}
+
+static void *lisp_server_worker_main(void *arg)
+{
+  lisp_server_worker *w = arg;
+  // Files were loaded on the main thread, but requests run on this one.
+  lisp_runtime_set_stack(&w->rt);
+  for (;;) {
+    serve_connection(w, accept_connection(w->listener));
+  }
+  return NULL;
+}
+
+/**
+   @brief Set up an interpreter's runtime and globals, and load files into it.
+   @returns false if loading failed.
+ */
+static bool lisp_server_worker_init(lisp_server_worker *w,
+                                    lisp_server_config *config, int listener)
+{
+  w->config = config;
+  w->listener = listener;
+  lisp_runtime_init(&w->rt);
+  w->rt.heap_limit = config->heap_limit;
+  w->rt.pool = config->pool;
+  w->rt.image = config->image;
+  w->globals = lisp_create_globals(&w->rt);
+  lisp_arena_init(&w->arena, NULL);
+
+  for (int i = 0; i < config->nload; i++) {
+    if (!lisp_load_file(&w->rt, config->load[i], w->globals)) {
+      fprintf(stderr, "error: %s\n", w->rt.message);
+      return false;
+    }
+  }
+  // Requests mustn't be able to change what later requests see, so everything
+  // the globals refer to is frozen.  Storing into a global vector or hash map
+  // is an error, and (with --fork) children never write to the pages holding
+  // them.
+  lisp_scope_immortalize(w->globals);
+  return true;
+}
+
+/**
+   @brief Run a request in a child process, which exits once it's answered.
+   @returns Whether a child was started.
+
+   The child shares the parent's memory copy-on-write.  Since everything the
+   globals refer to is immortal, using them never writes to those pages, so
+   each child only pays for the memory its own request uses.
+ */
+static bool fork_connection(lisp_server_worker *w, int fd)
+{
+  pid_t pid = fork();
+
+  if (pid != 0) {
+    if (pid < 0) {
+      perror("fork");
+    }
+    close(fd);
+    return pid > 0;
+  }
+
+  close(w->listener);
+  // The pool's threads weren't forked along with the parent.
+  w->rt.pool = NULL;
+  // The deadline only works while lisp code is being called, so in case a
+  // builtin runs away, the child is killed a second or so after it.
+  if (w->config->timeout != 0) {
+    alarm(w->config->timeout / 1000 + 2);
+  }
+  serve_connection(w, fd);
+  // Tearing down the runtime would only dirty shared pages.
+  _exit(EXIT_SUCCESS);
+}
+
+/**
+   @brief Serve a request within the parent, before any children are forked.
+
+   The first allocations a process makes after loading files can make the
+   allocator tidy up after everything freed while loading, which writes to
+   much of the heap.  Were that left to the children, each would end up with a
+   private copy of those pages.  The request goes through a socket pair, so it
+   takes the same path as real ones, and it lexes, parses and calls a bit of
+   everything for the same reason.
+ */
+static void warm_up(lisp_server_worker *w)
+{
+  const char request[] = "(car (list \"b\" (+ 1 2)))";
+  char reply[64];
+  int fds[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    return;
+  }
+  if (write(fds[0], request, sizeof(request) - 1) == sizeof(request) - 1) {
+    shutdown(fds[0], SHUT_WR);
+    serve_connection(w, fds[1]);
+    while (read(fds[0], reply, sizeof(reply)) > 0) {}
+  } else {
+    close(fds[1]);
+  }
+  close(fds[0]);
+}
+
+/**
+   @brief Load the globals once, and fork a child for each request.
+ */
+static int lisp_fork_serve(lisp_server_config *config, int listener)
+{
+  lisp_server_worker w;
+  int children = 0, fd;
+
+  if (!lisp_server_worker_init(&w, config, listener)) {
+    return EXIT_FAILURE;
+  }
+  warm_up(&w);
+
+  for (;;) {
+    // Reap whatever has finished, and wait for a child to finish whenever
+    // there are already as many as there may be.
+    while (children > 0 && waitpid(-1, NULL, WNOHANG) > 0) {
+      children--;
+    }
+    while (children >= config->workers) {
+      if (waitpid(-1, NULL, 0) > 0) {
+        children--;
+      } else if (errno == ECHILD) {
+        children = 0;
+      }
+    }
+
+    fd = accept_connection(listener);
+    if (fork_connection(&w, fd)) {
+      children++;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+int lisp_serve(lisp_server_config *config)
+{
+  struct sockaddr_un addr;
+  lisp_server_worker *workers;
+  int listener;
+
+  if (strlen(config->path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path is too long: %s\n", config->path);
+    return EXIT_FAILURE;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, config->path);
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+  unlink(config->path);
+  if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    perror(config->path);
+    close(listener);
+    return EXIT_FAILURE;
+  }
+
+  // Clients that hang up early shouldn't take the server down with them.
+  signal(SIGPIPE, SIG_IGN);
+
+  if (config->fork) {
+    if (lisp_fork_serve(config, listener) != EXIT_SUCCESS) {
+      close(listener);
+      unlink(config->path);
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // Every interpreter is warmed up before any request is taken, so that load
+  // errors are reported right away, and requests never pay for them.
+  workers = smb_new(lisp_server_worker, config->workers);
+  for (int i = 0; i < config->workers; i++) {
+    if (!lisp_server_worker_init(&workers[i], config, listener)) {
+      close(listener);
+      unlink(config->path);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Workers take turns accepting connections on the same socket.
+  for (int i = 0; i < config->workers; i++) {
+    pthread_create(&workers[i].thread, NULL, &lisp_server_worker_main,
+                   &workers[i]);
+  }
+  for (int i = 0; i < config->workers; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  return EXIT_SUCCESS;
+}
@@ -13,6 +13,10 @@
 
 *******************************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
 #include "libstephen/base.h"
 #include "lisp.h"
 
@@ -22,16 +26,311 @@
 
 void lisp_incref(lisp_value *lv)
 {
-  if (lv == NULL) return;
-  lv->refcount += 1;
+  if (lv == NULL || lisp_is_float(lv) || (lv->flags & LISP_FLAG_IMMORTAL)) {
+    return;
+  }
+  if (lv->flags & LISP_FLAG_FROZEN) {
+    __atomic_add_fetch(&lv->refcount, 1, __ATOMIC_RELAXED);
+  } else {
+    lv->refcount += 1;
+  }
 }
 
-void lisp_decref(lisp_value *lv)
+void lisp_decref(lisp_runtime *rt, lisp_value *lv)
 {
-  if (lv == NULL) return;
+  if (lv == NULL || lisp_is_float(lv) || (lv->flags & LISP_FLAG_IMMORTAL)) {
+    return;
+  }
+  if (lv->flags & LISP_FLAG_FROZEN) {
+    // Whichever thread drops the last reference frees the value, so it must
+    // see every other thread's writes first.
+    if (__atomic_sub_fetch(&lv->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+      lv->type->tp_dealloc(rt, lv);
+    }
+    return;
+  }
   lv->refcount -= 1;
   if (lv->refcount == 0) {
-    lv->type->tp_dealloc(lv);
+    lv->type->tp_dealloc(rt, lv);
+  }
+}
+
+lisp_type_stats lisp_frozen_stats[TP_COUNT];
+
+lisp_value *lisp_freeze(lisp_runtime *rt, lisp_value *lv)
+{
+  lisp_arena *saved;
+  bool was_freezing;
+  lisp_value *rv;
+
+  if (lv == NULL) return NULL;
+  // Floats are immutable and belong to no runtime, so they're frozen already.
+  if (lisp_is_float(lv) || (lv->flags & LISP_FLAG_FROZEN)) {
+    lisp_incref(lv);
+    return lv;
+  }
+
+  // Frozen values may outlive this runtime, so they can't live in its arena.
+  saved = rt->arena;
+  was_freezing = rt->freezing;
+  rt->arena = NULL;
+  rt->freezing = true;
+  rv = lisp_copy(rt, lv, &lisp_freeze);
+  rt->arena = saved;
+  rt->freezing = was_freezing;
+  return rv;
+}
+
+unsigned int lisp_pointer_hash(DATA data)
+{
+  uintptr_t addr = (uintptr_t)data.data_ptr;
+  // Values are at least 16 byte aligned, so the low bits are all the same.
+  return (unsigned int)(addr >> 4) ^ (unsigned int)(addr >> 20);
+}
+
+int lisp_pointer_compare(DATA d1, DATA d2)
+{
+  uintptr_t a = (uintptr_t)d1.data_ptr, b = (uintptr_t)d2.data_ptr;
+  return (a > b) - (a < b);
+}
+
+lisp_value *lisp_copy(lisp_runtime *rt, lisp_value *lv,
+                      lisp_value *(*child)(lisp_runtime *, lisp_value *))
+{
+  lisp_value *(*copying)(lisp_runtime *, lisp_value *) = rt->copying;
+  smb_ht *copies = rt->copies;
+  smb_status status = SMB_SUCCESS;
+  bool shared = lv->refcount > 1;
+  lisp_value *rv;
+
+  if (copying != child) {
+    // This is the outermost copy, so the table of copies is its own.
+    rt->copying = child;
+    rt->copies = NULL;
+    rv = lv->type->tp_copy(rt, lv, child);
+    if (rt->copies != NULL) {
+      ht_delete(rt->copies);
+    }
+    rt->copying = copying;
+    rt->copies = copies;
+    return rv;
+  }
+
+  // A value with a single reference is only reachable through whatever is
+  // being copied now, so it can't have been copied already (or be again).
+  if (shared && copies != NULL) {
+    rv = ht_get(copies, PTR(lv), &status).data_ptr;
+    if (status == SMB_SUCCESS) {
+      lisp_incref(rv);
+      return rv;
+    }
+  }
+  rv = lv->type->tp_copy(rt, lv, child);
+  // The table holds no references.  Once a copy fails, every copy above it
+  // drops what it made and returns at once, so a freed copy is never looked up.
+  if (shared && rv != NULL) {
+    if (rt->copies == NULL) {
+      rt->copies = ht_create(&lisp_pointer_hash, &lisp_pointer_compare);
+    }
+    ht_insert(rt->copies, PTR(lv), PTR(rv));
+  }
+  return rv;
+}
+
+void lisp_immortalize(lisp_value *lv)
+{
+  lisp_chunk *chunk;
+
+  // Lists are followed along their tails rather than recursively, since they
+  // may be long.  Anything already immortal has been visited (or came from an
+  // image), so shared structure is only walked once.
+  while (lv != NULL && !lisp_is_float(lv) &&
+         !(lv->flags & LISP_FLAG_IMMORTAL)) {
+    // Coroutines, lazy sequences and files stay unfrozen, so that freezing
+    // one is still an error (and a lazy sequence may still be forced).
+    lv->flags |= LISP_FLAG_IMMORTAL;
+    if (lv->type != &tp_coroutine && lv->type != &tp_lazy &&
+        lv->type != &tp_file) {
+      lv->flags |= LISP_FLAG_FROZEN;
+    }
+
+    switch (lv->type->tp_index) {
+    case TP_LIST:
+      lisp_immortalize(((lisp_list*)lv)->value);
+      lv = (lisp_value*)((lisp_list*)lv)->next;
+      break;
+    case TP_FUNCTION:
+      lisp_immortalize((lisp_value*)((lisp_function*)lv)->arglist);
+      lv = ((lisp_function*)lv)->code;
+      break;
+    case TP_FUNCCALL:
+      lisp_immortalize(((lisp_funccall*)lv)->function);
+      lv = (lisp_value*)((lisp_funccall*)lv)->arguments;
+      break;
+    case TP_CHUNK:
+      chunk = (lisp_chunk*)lv;
+      for (int i = chunk->first; i < chunk->capacity; i++) {
+        lisp_immortalize(chunk->items[i]);
+      }
+      lv = chunk->tail;
+      break;
+    case TP_CLIST:
+      lv = (lisp_value*)((lisp_clist*)lv)->chunk;
+      break;
+    case TP_STRING:
+      lv = (lisp_value*)((lisp_string*)lv)->buf;
+      break;
+    case TP_VECTOR:
+      for (int i = 0; i < ((lisp_vector*)lv)->length; i++) {
+        lisp_immortalize(((lisp_vector*)lv)->items[i]);
+      }
+      lv = NULL;
+      break;
+    case TP_HASH:
+      for (int i = 0; i < ((lisp_hash*)lv)->capacity; i++) {
+        if (((lisp_hash*)lv)->entries[i].key != NULL) {
+          lisp_immortalize(((lisp_hash*)lv)->entries[i].key);
+          lisp_immortalize(((lisp_hash*)lv)->entries[i].value);
+        }
+      }
+      lv = NULL;
+      break;
+    case TP_ROPE:
+      lisp_immortalize((lisp_value*)((lisp_rope*)lv)->leaf);
+      lisp_immortalize((lisp_value*)((lisp_rope*)lv)->left);
+      lv = (lisp_value*)((lisp_rope*)lv)->right;
+      break;
+    case TP_TRIE:
+      for (int i = 0; i < ((lisp_trie*)lv)->count; i++) {
+        lisp_immortalize(((lisp_trie*)lv)->items[i]);
+      }
+      lv = NULL;
+      break;
+    case TP_PVECTOR:
+      lv = (lisp_value*)((lisp_pvector*)lv)->root;
+      break;
+    case TP_PHASH:
+      lv = (lisp_value*)((lisp_phash*)lv)->root;
+      break;
+    default:
+      // Everything else refers to no other values, or (like a future's
+      // promise) keeps what it refers to outside of any value.
+      lv = NULL;
+      break;
+    }
+  }
+}
+
+lisp_value *lisp_alloc(lisp_runtime *rt, lisp_type *type, size_t size)
+{
+  lisp_type_stats *stats = &rt->stats[type->tp_index];
+  lisp_value *lv;
+
+  if (rt->freezing) {
+    lv = (lisp_value*)smb_new(char, size);
+    lv->flags = LISP_FLAG_FROZEN;
+    lv->type = type;
+    lv->refcount = 1;
+    stats = &lisp_frozen_stats[type->tp_index];
+    __atomic_add_fetch(&stats->live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+    return lv;
+  }
+
+  if (rt->heap_limit != 0 && rt->heap_bytes + size > rt->heap_limit) {
+    lisp_error(rt, "heap limit of %lu bytes exceeded allocating %s",
+               rt->heap_limit, type->tp_name);
+    return NULL;
+  }
+
+  if (rt->arena != NULL) {
+    lv = lisp_arena_alloc(rt->arena, size);
+    lv->flags = LISP_FLAG_ARENA | rt->arena->epoch << LISP_EPOCH_SHIFT;
+  } else {
+    lv = (lisp_value*)smb_new(char, size);
+    lv->flags = 0;
+  }
+  lv->type = type;
+  lv->refcount = 1;
+
+  stats->live++;
+  stats->bytes += size;
+  stats->allocs++;
+  rt->heap_bytes += size;
+  return lv;
+}
+
+void lisp_free(lisp_runtime *rt, lisp_value *lv, size_t size)
+{
+  lisp_type_stats *stats = &rt->stats[lv->type->tp_index];
+
+  if (lv->flags & LISP_FLAG_FROZEN) {
+    stats = &lisp_frozen_stats[lv->type->tp_index];
+    __atomic_sub_fetch(&stats->live, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+    smb_free(lv);
+    return;
+  }
+
+  stats->live--;
+  stats->bytes -= size;
+  rt->heap_bytes -= size;
+
+  if (lv->flags & LISP_FLAG_ARENA) {
+    // Arena memory is reclaimed all at once by lisp_arena_end(), though small
+    // values may be reused before then.  A value left over from an earlier
+    // evaluation is in a retired block, which is kept until the arena is
+    // destroyed, so it's neither counted nor reused.
+    if (rt->arena != NULL && lisp_arena_owns(rt->arena, lv)) {
+      lisp_arena_release(rt->arena, lv, size);
+    }
+  } else {
+    smb_free(lv);
+  }
+}
+
+bool lisp_charge(lisp_runtime *rt, lisp_value *lv, long size)
+{
+  lisp_type_stats *stats = &rt->stats[lv->type->tp_index];
+
+  if (lv->flags & LISP_FLAG_FROZEN) {
+    stats = &lisp_frozen_stats[lv->type->tp_index];
+    __atomic_add_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  if (size > 0 && rt->heap_limit != 0 &&
+      rt->heap_bytes + size > rt->heap_limit) {
+    lisp_error(rt, "heap limit of %lu bytes exceeded allocating %s",
+               rt->heap_limit, lv->type->tp_name);
+    return false;
+  }
+  stats->bytes += size;
+  rt->heap_bytes += size;
+  return true;
+}
+
+void lisp_print_heap_stats(lisp_runtime *rt, FILE *f)
+{
+  lisp_type **tp;
+  lisp_type_stats *stats;
+  unsigned long frozen;
+  fprintf(f, "%-12s %10s %12s %12s\n", "type", "live", "bytes", "allocs");
+  for (tp = lisp_types; *tp != NULL; tp++) {
+    stats = &rt->stats[(*tp)->tp_index];
+    fprintf(f, "%-12s %10lu %12lu %12lu\n", (*tp)->tp_name, stats->live,
+            stats->bytes, stats->allocs);
+  }
+  fprintf(f, "%-12s %10s %12lu\n", "total", "", rt->heap_bytes);
+
+  frozen = 0;
+  for (tp = lisp_types; *tp != NULL; tp++) {
+    frozen += __atomic_load_n(&lisp_frozen_stats[(*tp)->tp_index].bytes,
+                              __ATOMIC_RELAXED);
+  }
+  if (frozen != 0) {
+    fprintf(f, "%-12s %10s %12lu\n", "frozen", "", frozen);
   }
 }
 
@@ -46,24 +345,30 @@ static void print_n_spaces(FILE *f, int nspaces)
   }
 }
 
-static void generic_dealloc(lisp_value *lv)
+static wchar_t *copy_wstring(const wchar_t *str)
 {
-  smb_free(lv);
+  wchar_t *rv = smb_new(wchar_t, wcslen(str) + 1);
+  wcscpy(rv, str);
+  return rv;
 }
 
 /*******************************************************************************
                                tp_int / lisp_int
 *******************************************************************************/
 
-static lisp_value *lisp_int_alloc(void)
+static lisp_value *lisp_int_alloc(lisp_runtime *rt)
 {
-  lisp_int *rv = smb_new(lisp_int, 1);
-  rv->lv.type = &tp_int;
-  rv->lv.refcount = 1;
+  lisp_int *rv = (lisp_int*)lisp_alloc(rt, &tp_int, sizeof(lisp_int));
+  if (rv == NULL) return NULL;
   rv->value = 0;
   return (lisp_value *)rv;
 }
 
+static void lisp_int_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_free(rt, value, sizeof(lisp_int));
+}
+
 static void lisp_int_print(lisp_value *value, FILE *f, int indent)
 {
   (void)indent; // unused
@@ -71,31 +376,101 @@ static void lisp_int_print(lisp_value *value, FILE *f, int indent)
   fprintf(f, "%ld\n", val->value);
 }
 
+static lisp_value *lisp_int_copy(lisp_runtime *rt, lisp_value *value,
+                                 lisp_value *(*child)(lisp_runtime *,
+                                                      lisp_value *))
+{
+  (void)child; // unused
+  lisp_int *rv = (lisp_int*)tp_int.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->value = ((lisp_int*)value)->value;
+  return (lisp_value*)rv;
+}
+
 lisp_type tp_int = {
   .tp_name = "int",
+  .tp_index = TP_INT,
   .tp_alloc = &lisp_int_alloc,
-  .tp_dealloc = &generic_dealloc,
-  .tp_print = &lisp_int_print
+  .tp_dealloc = &lisp_int_dealloc,
+  .tp_print = &lisp_int_print,
+  .tp_copy = &lisp_int_copy
+};
+
+/*******************************************************************************
+                                   tp_float
+*******************************************************************************/
+
+/*
+  Floats are stored in pointers with their top 16 bits set, which only works
+  where pointers are 64 bits wide.
+ */
+typedef char lisp_float_needs_64_bit_pointers[sizeof(void*) == 8 ? 1 : -1];
+
+static lisp_value *lisp_float_alloc(lisp_runtime *rt)
+{
+  (void)rt; // unused
+  return lisp_float(0.0);
+}
+
+static void lisp_float_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  (void)rt; // unused
+  (void)value; // unused
+}
+
+static void lisp_float_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  double d = lisp_float_value(value);
+  char text[32];
+
+  // Use the shortest of these that reads back as the same double, and make
+  // sure it doesn't look like an integer.
+  snprintf(text, sizeof(text), "%.15g", d);
+  if (strtod(text, NULL) != d) {
+    snprintf(text, sizeof(text), "%.17g", d);
+  }
+  if (strspn(text, "-0123456789") == strlen(text)) {
+    strcat(text, ".0");
+  }
+  fprintf(f, "%s\n", text);
+}
+
+static lisp_value *lisp_float_copy(lisp_runtime *rt, lisp_value *value,
+                                   lisp_value *(*child)(lisp_runtime *,
+                                                        lisp_value *))
+{
+  (void)rt; // unused
+  (void)child; // unused
+  return value;
+}
+
+lisp_type tp_float = {
+  .tp_name = "float",
+  .tp_index = TP_FLOAT,
+  .tp_alloc = &lisp_float_alloc,
+  .tp_dealloc = &lisp_float_dealloc,
+  .tp_print = &lisp_float_print,
+  .tp_copy = &lisp_float_copy
 };
 
 /*******************************************************************************
                               tp_atom / lisp_atom
 *******************************************************************************/
 
-static lisp_value *lisp_atom_alloc(void)
+static lisp_value *lisp_atom_alloc(lisp_runtime *rt)
 {
-  lisp_atom *rv = smb_new(lisp_atom, 1);
-  rv->lv.type = &tp_atom;
-  rv->lv.refcount = 1;
+  lisp_atom *rv = (lisp_atom*)lisp_alloc(rt, &tp_atom, sizeof(lisp_atom));
+  if (rv == NULL) return NULL;
   rv->value = NULL;
   return (lisp_value *)rv;
 }
 
-static void lisp_atom_dealloc(lisp_value *value)
+static void lisp_atom_dealloc(lisp_runtime *rt, lisp_value *value)
 {
   lisp_atom *id = (lisp_atom *) value;
   smb_free(id->value);
-  smb_free(id);
+  lisp_free(rt, value, sizeof(lisp_atom));
 }
 
 static void lisp_atom_print(lisp_value *value, FILE *f, int indent)
@@ -105,31 +480,43 @@ static void lisp_atom_print(lisp_value *value, FILE *f, int indent)
   fprintf(f, "'%ls\n", val->value);
 }
 
+static lisp_value *lisp_atom_copy(lisp_runtime *rt, lisp_value *value,
+                                  lisp_value *(*child)(lisp_runtime *,
+                                                       lisp_value *))
+{
+  (void)child; // unused
+  lisp_atom *rv = (lisp_atom*)tp_atom.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->value = copy_wstring(((lisp_atom*)value)->value);
+  return (lisp_value*)rv;
+}
+
 lisp_type tp_atom = {
   .tp_name = "atom",
+  .tp_index = TP_ATOM,
   .tp_alloc = &lisp_atom_alloc,
   .tp_dealloc = &lisp_atom_dealloc,
-  .tp_print = &lisp_atom_print
+  .tp_print = &lisp_atom_print,
+  .tp_copy = &lisp_atom_copy
 };
 
 /*******************************************************************************
                         tp_identifier / lisp_identifier
 *******************************************************************************/
 
-static lisp_value *lisp_identifier_alloc(void)
+static lisp_value *lisp_identifier_alloc(lisp_runtime *rt)
 {
-  lisp_identifier *rv = smb_new(lisp_identifier, 1);
-  rv->lv.type = &tp_identifier;
-  rv->lv.refcount = 1;
+  lisp_identifier *rv = (lisp_identifier*)lisp_alloc(rt, &tp_identifier, sizeof(lisp_identifier));
+  if (rv == NULL) return NULL;
   rv->value = NULL;
   return (lisp_value *)rv;
 }
 
-static void lisp_identifier_dealloc(lisp_value *value)
+static void lisp_identifier_dealloc(lisp_runtime *rt, lisp_value *value)
 {
   lisp_identifier *id = (lisp_identifier *) value;
   smb_free(id->value);
-  smb_free(id);
+  lisp_free(rt, value, sizeof(lisp_identifier));
 }
 
 static void lisp_identifier_print(lisp_value *value, FILE *f, int indent)
@@ -139,33 +526,268 @@ static void lisp_identifier_print(lisp_value *value, FILE *f, int indent)
   fprintf(f, "%ls\n", val->value);
 }
 
+static lisp_value *lisp_identifier_copy(lisp_runtime *rt, lisp_value *value,
+                                        lisp_value *(*child)(lisp_runtime *,
+                                                             lisp_value *))
+{
+  (void)child; // unused
+  lisp_identifier *rv = (lisp_identifier*)tp_identifier.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->value = copy_wstring(((lisp_identifier*)value)->value);
+  return (lisp_value*)rv;
+}
+
 lisp_type tp_identifier = {
   .tp_name = "identifier",
+  .tp_index = TP_IDENTIFIER,
   .tp_alloc = &lisp_identifier_alloc,
   .tp_dealloc = &lisp_identifier_dealloc,
-  .tp_print = &lisp_identifier_print
+  .tp_print = &lisp_identifier_print,
+  .tp_copy = &lisp_identifier_copy
+};
+
+/*******************************************************************************
+                            tp_strbuf / lisp_strbuf
+*******************************************************************************/
+
+static lisp_strbuf *lisp_strbuf_create(lisp_runtime *rt, size_t length)
+{
+  lisp_strbuf *rv = (lisp_strbuf*)lisp_alloc(
+    rt, &tp_strbuf, sizeof(lisp_strbuf) + length + 1);
+  if (rv == NULL) return NULL;
+  rv->length = length;
+  rv->data = rv->bytes;
+  rv->release = NULL;
+  rv->data[length] = '\0';
+  return rv;
+}
+
+static lisp_value *lisp_strbuf_alloc(lisp_runtime *rt)
+{
+  return (lisp_value*)lisp_strbuf_create(rt, 0);
+}
+
+static void lisp_strbuf_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_strbuf *buf = (lisp_strbuf *)value;
+  if (buf->release != NULL) {
+    buf->release(buf->data, buf->length);
+    lisp_free(rt, value, sizeof(lisp_strbuf));
+  } else {
+    lisp_free(rt, value, sizeof(lisp_strbuf) + buf->length + 1);
+  }
+}
+
+static void lisp_strbuf_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  (void)value; // unused
+  fprintf(f, "strbuf\n");
+}
+
+static lisp_value *lisp_strbuf_copy(lisp_runtime *rt, lisp_value *value,
+                                    lisp_value *(*child)(lisp_runtime *,
+                                                         lisp_value *))
+{
+  (void)child; // unused
+  lisp_strbuf *buf = (lisp_strbuf *)value;
+  lisp_strbuf *rv = lisp_strbuf_create(rt, buf->length);
+  if (rv == NULL) return NULL;
+  memcpy(rv->data, buf->data, buf->length);
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_strbuf = {
+  .tp_name = "strbuf",
+  .tp_index = TP_STRBUF,
+  .tp_alloc = &lisp_strbuf_alloc,
+  .tp_dealloc = &lisp_strbuf_dealloc,
+  .tp_print = &lisp_strbuf_print,
+  .tp_copy = &lisp_strbuf_copy
+};
+
+/*******************************************************************************
+                            tp_string / lisp_string
+*******************************************************************************/
+
+/**
+   @brief Allocate a string that refers to data elsewhere (or nothing yet).
+ */
+static lisp_string *lisp_string_alloc_shared(lisp_runtime *rt)
+{
+  lisp_string *rv = (lisp_string*)lisp_alloc(rt, &tp_string,
+                                             sizeof(lisp_string));
+  if (rv == NULL) return NULL;
+  rv->length = 0;
+  rv->data = NULL;
+  rv->buf = NULL;
+  return rv;
+}
+
+lisp_string *lisp_string_create(lisp_runtime *rt, size_t length)
+{
+  lisp_string *rv;
+
+  if (length > LISP_STRING_SMALL) {
+    rv = lisp_string_alloc_shared(rt);
+    if (rv == NULL) return NULL;
+    rv->buf = lisp_strbuf_create(rt, length);
+    if (rv->buf == NULL) {
+      lisp_free(rt, (lisp_value*)rv, sizeof(lisp_string));
+      return NULL;
+    }
+    rv->data = rv->buf->data;
+  } else {
+    rv = (lisp_string*)lisp_alloc(rt, &tp_string,
+                                  sizeof(lisp_string) + length + 1);
+    if (rv == NULL) return NULL;
+    rv->small[length] = '\0';
+    rv->data = rv->small;
+    rv->buf = NULL;
+  }
+  rv->length = length;
+  return rv;
+}
+
+lisp_string *lisp_string_new(lisp_runtime *rt, const char *data,
+                             size_t length)
+{
+  lisp_string *rv = lisp_string_create(rt, length);
+  if (rv == NULL) return NULL;
+  memcpy((char*)rv->data, data, length);
+  return rv;
+}
+
+lisp_string *lisp_string_substring(lisp_runtime *rt, lisp_string *str,
+                                   size_t start, size_t end)
+{
+  lisp_string *rv;
+
+  // Short substrings are cheaper to copy than to keep a buffer alive for.
+  if (str->buf == NULL || end - start <= LISP_STRING_SMALL) {
+    return lisp_string_new(rt, str->data + start, end - start);
+  }
+
+  rv = lisp_string_alloc_shared(rt);
+  if (rv == NULL) return NULL;
+  lisp_incref((lisp_value*)str->buf);
+  rv->buf = str->buf;
+  rv->data = str->data + start;
+  rv->length = end - start;
+  return rv;
+}
+
+int lisp_string_compare(lisp_string *a, lisp_string *b)
+{
+  size_t n = a->length < b->length ? a->length : b->length;
+  int rv = memcmp(a->data, b->data, n);
+  if (rv != 0 || a->length == b->length) {
+    return rv;
+  }
+  return a->length < b->length ? -1 : 1;
+}
+
+lisp_string *lisp_string_external(lisp_runtime *rt, char *data, size_t length,
+                                  void (*release)(char *data, size_t length))
+{
+  bool was_freezing = rt->freezing;
+  lisp_strbuf *buf;
+  lisp_string *rv;
+
+  // Nothing can change the bytes, so the buffer may as well be frozen, which
+  // lets every copy of the string share it.
+  rt->freezing = true;
+  buf = (lisp_strbuf*)lisp_alloc(rt, &tp_strbuf, sizeof(lisp_strbuf));
+  rt->freezing = was_freezing;
+  buf->length = length;
+  buf->data = data;
+  buf->release = release;
+
+  rv = lisp_string_alloc_shared(rt);
+  if (rv == NULL) {
+    lisp_decref(rt, (lisp_value*)buf);
+    return NULL;
+  }
+  rv->buf = buf;
+  rv->data = data;
+  rv->length = length;
+  return rv;
+}
+
+static lisp_value *lisp_string_alloc(lisp_runtime *rt)
+{
+  return (lisp_value*)lisp_string_create(rt, 0);
+}
+
+static void lisp_string_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_string *str = (lisp_string *)value;
+  if (str->buf != NULL) {
+    lisp_decref(rt, (lisp_value*)str->buf);
+    lisp_free(rt, value, sizeof(lisp_string));
+  } else {
+    lisp_free(rt, value, sizeof(lisp_string) + str->length + 1);
+  }
+}
+
+static void lisp_string_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  lisp_string *str = (lisp_string *) value;
+  fprintf(f, "\"%.*s\"\n", (int)str->length, str->data);
+}
+
+static lisp_value *lisp_string_copy(lisp_runtime *rt, lisp_value *value,
+                                    lisp_value *(*child)(lisp_runtime *,
+                                                         lisp_value *))
+{
+  lisp_string *str = (lisp_string *) value;
+  lisp_string *rv;
+
+  if (str->buf == NULL) {
+    return (lisp_value*)lisp_string_new(rt, str->data, str->length);
+  }
+
+  rv = lisp_string_alloc_shared(rt);
+  if (rv == NULL) return NULL;
+  rv->buf = (lisp_strbuf*)child(rt, (lisp_value*)str->buf);
+  if (rv->buf == NULL) {
+    lisp_free(rt, (lisp_value*)rv, sizeof(lisp_string));
+    return NULL;
+  }
+  rv->data = rv->buf->data + (str->data - str->buf->data);
+  rv->length = str->length;
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_string = {
+  .tp_name = "string",
+  .tp_index = TP_STRING,
+  .tp_alloc = &lisp_string_alloc,
+  .tp_dealloc = &lisp_string_dealloc,
+  .tp_print = &lisp_string_print,
+  .tp_copy = &lisp_string_copy
 };
 
 /*******************************************************************************
                           tp_funccall / lisp_funccall
 *******************************************************************************/
 
-static lisp_value *lisp_funccall_alloc(void)
+static lisp_value *lisp_funccall_alloc(lisp_runtime *rt)
 {
-  lisp_funccall *rv = smb_new(lisp_funccall, 1);
-  rv->lv.type = &tp_funccall;
-  rv->lv.refcount = 1;
+  lisp_funccall *rv = (lisp_funccall*)lisp_alloc(rt, &tp_funccall, sizeof(lisp_funccall));
+  if (rv == NULL) return NULL;
   rv->function = NULL;
   rv->arguments = NULL;
   return (lisp_value *)rv;
 }
 
-static void lisp_funccall_dealloc(lisp_value *value)
+static void lisp_funccall_dealloc(lisp_runtime *rt, lisp_value *value)
 {
   lisp_funccall *call = (lisp_funccall *)value;
-  lisp_decref(call->function);
-  lisp_decref((lisp_value*)call->arguments);
-  smb_free(value);
+  lisp_decref(rt, call->function);
+  lisp_decref(rt, (lisp_value*)call->arguments);
+  lisp_free(rt, value, sizeof(lisp_funccall));
 }
 
 static void lisp_funccall_print(lisp_value *value, FILE *f, int indent)
@@ -174,13 +796,13 @@ static void lisp_funccall_print(lisp_value *value, FILE *f, int indent)
   lisp_list *l;
 
   fprintf(f, "(");
-  call->function->type->tp_print(call->function, f, indent + 2);
+  lisp_type_of(call->function)->tp_print(call->function, f, indent + 2);
   fprintf(f, "\n");
 
   l = call->arguments;
   while (l->value != NULL) {
     print_n_spaces(f, indent + 1);
-    l->value->type->tp_print(l->value, f, indent + 1);
+    lisp_type_of(l->value)->tp_print(l->value, f, indent + 1);
     l = l->next;
   }
 
@@ -188,82 +810,416 @@ static void lisp_funccall_print(lisp_value *value, FILE *f, int indent)
   fprintf(f, ")\n");
 }
 
+static lisp_value *lisp_funccall_copy(lisp_runtime *rt, lisp_value *value,
+                                      lisp_value *(*child)(lisp_runtime *,
+                                                           lisp_value *))
+{
+  lisp_funccall *call = (lisp_funccall *) value;
+  lisp_funccall *rv = (lisp_funccall*)tp_funccall.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->function = child(rt, call->function);
+  if (rv->function == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  rv->arguments = (lisp_list*)child(rt, (lisp_value*)call->arguments);
+  if (rv->arguments == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  return (lisp_value*)rv;
+}
+
 lisp_type tp_funccall = {
   .tp_name = "funccall",
+  .tp_index = TP_FUNCCALL,
   .tp_alloc = &lisp_funccall_alloc,
   .tp_dealloc = &lisp_funccall_dealloc,
-  .tp_print = &lisp_funccall_print
+  .tp_print = &lisp_funccall_print,
+  .tp_copy = &lisp_funccall_copy
 };
 
 /*******************************************************************************
                               tp_list / lisp_list
 *******************************************************************************/
 
-static lisp_value *lisp_list_alloc(void)
+static lisp_value *lisp_list_alloc(lisp_runtime *rt)
 {
-  lisp_list *rv = smb_new(lisp_list, 1);
-  rv->lv.type = &tp_list;
-  rv->lv.refcount = 1;
+  lisp_list *rv = (lisp_list*)lisp_alloc(rt, &tp_list, sizeof(lisp_list));
+  if (rv == NULL) return NULL;
   rv->value = NULL;
   rv->next = NULL;
   return (lisp_value *)rv;
 }
 
-static void lisp_list_dealloc(lisp_value *value)
+static void lisp_list_dealloc(lisp_runtime *rt, lisp_value *value)
 {
   lisp_list *list = (lisp_list *)value;
-  lisp_decref(list->value);
-  lisp_decref((lisp_value*)list->next);
-  smb_free(list);
+  lisp_decref(rt, list->value);
+  lisp_decref(rt, (lisp_value*)list->next);
+  lisp_free(rt, value, sizeof(lisp_list));
 }
 
 static void lisp_list_print(lisp_value *value, FILE *f, int indent)
 {
-  lisp_list *l = (lisp_list *) value;
+  lisp_list_iter it;
+  lisp_value *item;
 
   fprintf(f, "(\n");
 
-  while (l->value != NULL) {
+  lisp_list_iter_init(&it, value);
+  while ((item = lisp_list_iter_next(&it)) != NULL) {
     print_n_spaces(f, indent + 1);
-    l->value->type->tp_print(l->value, f, indent + 1);
-    l = l->next;
+    lisp_type_of(item)->tp_print(item, f, indent + 1);
   }
 
   print_n_spaces(f, indent);
   fprintf(f, ")\n");
 }
 
+static lisp_value *lisp_list_copy(lisp_runtime *rt, lisp_value *value,
+                                  lisp_value *(*child)(lisp_runtime *,
+                                                       lisp_value *))
+{
+  lisp_list *list = (lisp_list *) value;
+  lisp_list *rv = (lisp_list*)tp_list.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->value = child(rt, list->value);
+  if (rv->value == NULL && list->value != NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  rv->next = (lisp_list*)child(rt, (lisp_value*)list->next);
+  if (rv->next == NULL && list->next != NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  return (lisp_value*)rv;
+}
+
 lisp_type tp_list = {
   .tp_name = "list",
+  .tp_index = TP_LIST,
   .tp_alloc = &lisp_list_alloc,
   .tp_dealloc = &lisp_list_dealloc,
-  .tp_print = &lisp_list_print
+  .tp_print = &lisp_list_print,
+  .tp_copy = &lisp_list_copy
+};
+
+/*******************************************************************************
+                             tp_chunk / lisp_chunk
+*******************************************************************************/
+
+/**
+   @brief Smallest number of items in a chunk created by consing.
+ */
+#define CHUNK_MIN 4
+/**
+   @brief Largest number of items in a chunk created by consing.
+ */
+#define CHUNK_MAX 256
+
+static lisp_chunk *lisp_chunk_create(lisp_runtime *rt, int capacity)
+{
+  lisp_chunk *rv = (lisp_chunk*)lisp_alloc(
+    rt, &tp_chunk, sizeof(lisp_chunk) + capacity * sizeof(lisp_value*));
+  if (rv == NULL) return NULL;
+  rv->capacity = capacity;
+  rv->first = capacity;
+  rv->tail = NULL;
+  return rv;
+}
+
+static lisp_value *lisp_chunk_alloc(lisp_runtime *rt)
+{
+  return (lisp_value*)lisp_chunk_create(rt, CHUNK_MIN);
+}
+
+static void lisp_chunk_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_chunk *chunk = (lisp_chunk *)value;
+  for (int i = chunk->first; i < chunk->capacity; i++) {
+    lisp_decref(rt, chunk->items[i]);
+  }
+  lisp_decref(rt, chunk->tail);
+  lisp_free(rt, value,
+            sizeof(lisp_chunk) + chunk->capacity * sizeof(lisp_value*));
+}
+
+static void lisp_chunk_print(lisp_value *value, FILE *f, int indent)
+{
+  (void)indent; // unused
+  (void)value; // unused
+  fprintf(f, "chunk\n");
+}
+
+static lisp_value *lisp_chunk_copy(lisp_runtime *rt, lisp_value *value,
+                                   lisp_value *(*child)(lisp_runtime *,
+                                                        lisp_value *))
+{
+  lisp_chunk *chunk = (lisp_chunk *)value;
+  lisp_chunk *rv = lisp_chunk_create(rt, chunk->capacity);
+  if (rv == NULL) return NULL;
+  // Items are filled from the back, so that a failed copy only drops the ones
+  // it has made.
+  for (int i = chunk->capacity - 1; i >= chunk->first; i--) {
+    rv->items[i] = child(rt, chunk->items[i]);
+    if (rv->items[i] == NULL) {
+      rv->first = i + 1;
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+    rv->first = i;
+  }
+  rv->tail = child(rt, chunk->tail);
+  if (rv->tail == NULL && chunk->tail != NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_chunk = {
+  .tp_name = "chunk",
+  .tp_index = TP_CHUNK,
+  .tp_alloc = &lisp_chunk_alloc,
+  .tp_dealloc = &lisp_chunk_dealloc,
+  .tp_print = &lisp_chunk_print,
+  .tp_copy = &lisp_chunk_copy
+};
+
+/*******************************************************************************
+                             tp_clist / lisp_clist
+*******************************************************************************/
+
+static lisp_value *lisp_clist_alloc(lisp_runtime *rt)
+{
+  lisp_clist *rv = (lisp_clist*)lisp_alloc(rt, &tp_clist, sizeof(lisp_clist));
+  if (rv == NULL) return NULL;
+  rv->chunk = NULL;
+  rv->index = 0;
+  return (lisp_value *)rv;
+}
+
+static void lisp_clist_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_clist *list = (lisp_clist *)value;
+  lisp_decref(rt, (lisp_value*)list->chunk);
+  lisp_free(rt, value, sizeof(lisp_clist));
+}
+
+static lisp_value *lisp_clist_copy(lisp_runtime *rt, lisp_value *value,
+                                   lisp_value *(*child)(lisp_runtime *,
+                                                        lisp_value *))
+{
+  lisp_clist *list = (lisp_clist *)value;
+  lisp_clist *rv = (lisp_clist*)tp_clist.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->chunk = (lisp_chunk*)child(rt, (lisp_value*)list->chunk);
+  if (rv->chunk == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  rv->index = list->index;
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_clist = {
+  .tp_name = "compact-list",
+  .tp_index = TP_CLIST,
+  .tp_alloc = &lisp_clist_alloc,
+  .tp_dealloc = &lisp_clist_dealloc,
+  .tp_print = &lisp_list_print,
+  .tp_copy = &lisp_clist_copy
 };
 
-int lisp_list_length(lisp_list *l)
+static lisp_clist *lisp_clist_view(lisp_runtime *rt, lisp_chunk *chunk,
+                                   int index)
+{
+  lisp_clist *rv = (lisp_clist*)tp_clist.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  lisp_incref((lisp_value*)chunk);
+  rv->chunk = chunk;
+  rv->index = index;
+  return rv;
+}
+
+/*******************************************************************************
+                               List Operations
+*******************************************************************************/
+
+bool lisp_is_list(lisp_value *lv)
+{
+  return lisp_type_of(lv) == &tp_list || lisp_type_of(lv) == &tp_clist;
+}
+
+void lisp_list_iter_init(lisp_list_iter *it, lisp_value *list)
+{
+  if (list->type == &tp_clist) {
+    it->chunk = ((lisp_clist*)list)->chunk;
+    it->index = ((lisp_clist*)list)->index;
+    it->cell = NULL;
+  } else {
+    it->chunk = NULL;
+    it->index = 0;
+    it->cell = (lisp_list*)list;
+  }
+}
+
+lisp_value *lisp_list_iter_next(lisp_list_iter *it)
+{
+  lisp_value *rv;
+
+  if (it->chunk != NULL) {
+    rv = it->chunk->items[it->index++];
+    if (it->index == it->chunk->capacity) {
+      // Continue on with whatever follows this chunk.
+      lisp_list_iter_init(it, it->chunk->tail);
+    }
+    return rv;
+  }
+
+  if (it->cell->value == NULL) {
+    return NULL;
+  }
+  rv = it->cell->value;
+  it->cell = it->cell->next;
+  return rv;
+}
+
+int lisp_list_length(lisp_value *l)
 {
+  lisp_list_iter it;
   int i = 0;
-  while (l->value != NULL) {
-    i++;
-    l = l->next;
+
+  lisp_list_iter_init(&it, l);
+  for (;;) {
+    if (it.chunk != NULL) {
+      // No need to visit each item of a chunk to count them.
+      i += it.chunk->capacity - it.index;
+      lisp_list_iter_init(&it, it.chunk->tail);
+    } else if (it.cell->value != NULL) {
+      i++;
+      it.cell = it.cell->next;
+    } else {
+      return i;
+    }
   }
-  return i;
+}
+
+lisp_value *lisp_list_first(lisp_value *l)
+{
+  lisp_clist *cl;
+  if (l->type == &tp_clist) {
+    cl = (lisp_clist*)l;
+    return cl->chunk->items[cl->index];
+  }
+  return ((lisp_list*)l)->value;
+}
+
+lisp_value *lisp_list_rest(lisp_runtime *rt, lisp_value *l)
+{
+  lisp_clist *cl;
+  if (l->type == &tp_clist) {
+    cl = (lisp_clist*)l;
+    if (cl->index + 1 < cl->chunk->capacity) {
+      return (lisp_value*)lisp_clist_view(rt, cl->chunk, cl->index + 1);
+    }
+    lisp_incref(cl->chunk->tail);
+    return cl->chunk->tail;
+  }
+  lisp_incref((lisp_value*)((lisp_list*)l)->next);
+  return (lisp_value*)((lisp_list*)l)->next;
+}
+
+lisp_value *lisp_list_cons(lisp_runtime *rt, lisp_value *value,
+                           lisp_value *list)
+{
+  lisp_clist *cl;
+  lisp_chunk *chunk;
+  int capacity = CHUNK_MIN;
+
+  if (list->type == &tp_clist) {
+    cl = (lisp_clist*)list;
+    chunk = cl->chunk;
+    // If nobody has claimed the slot in front of this list yet, take it.  A
+    // heap chunk can't be extended with values from the current arena, since
+    // they would be dropped out from under it, and a frozen chunk can't be
+    // extended at all, since other threads may be reading it.
+    if (cl->index == chunk->first && chunk->first > 0 &&
+        !(chunk->lv.flags & LISP_FLAG_FROZEN) &&
+        (rt->arena == NULL || (chunk->lv.flags & LISP_FLAG_ARENA))) {
+      lisp_incref(value);
+      chunk->items[--chunk->first] = value;
+      return (lisp_value*)lisp_clist_view(rt, chunk, chunk->first);
+    }
+    capacity = chunk->capacity * 2 > CHUNK_MAX ? CHUNK_MAX : chunk->capacity * 2;
+  }
+
+  chunk = lisp_chunk_create(rt, capacity);
+  if (chunk == NULL) return NULL;
+  lisp_incref(value);
+  chunk->items[--chunk->first] = value;
+  lisp_incref(list);
+  chunk->tail = list;
+  cl = lisp_clist_view(rt, chunk, chunk->first);
+  lisp_decref(rt, (lisp_value*)chunk); // the view owns the chunk now
+  return (lisp_value*)cl;
+}
+
+lisp_value *lisp_list_from_array(lisp_runtime *rt, lisp_value **items, int n)
+{
+  lisp_value *empty = tp_list.tp_alloc(rt);
+  lisp_value *rv;
+  if (empty == NULL) return NULL;
+  rv = lisp_list_prepend(rt, items, n, empty);
+  lisp_decref(rt, empty);
+  return rv;
+}
+
+lisp_value *lisp_list_prepend(lisp_runtime *rt, lisp_value **items, int n,
+                              lisp_value *tail)
+{
+  lisp_chunk *chunk;
+  lisp_clist *cl;
+
+  if (n == 0) {
+    lisp_incref(tail);
+    return tail;
+  }
+
+  chunk = lisp_chunk_create(rt, n);
+  if (chunk == NULL) return NULL;
+  for (int i = 0; i < n; i++) {
+    lisp_incref(items[i]);
+    chunk->items[i] = items[i];
+  }
+  chunk->first = 0;
+  lisp_incref(tail);
+  chunk->tail = tail;
+  cl = lisp_clist_view(rt, chunk, 0);
+  lisp_decref(rt, (lisp_value*)chunk);
+  return (lisp_value*)cl;
 }
 
 /*******************************************************************************
                            tp_builtin / lisp_builtin
 *******************************************************************************/
 
-static lisp_value *lisp_builtin_alloc(void)
+static lisp_value *lisp_builtin_alloc(lisp_runtime *rt)
 {
-  lisp_builtin *rv = smb_new(lisp_builtin, 1);
-  rv->lv.type = &tp_builtin;
-  rv->lv.refcount = 1;
+  lisp_builtin *rv = (lisp_builtin*)lisp_alloc(rt, &tp_builtin, sizeof(lisp_builtin));
+  if (rv == NULL) return NULL;
   rv->function = NULL;
   rv->eval = true;
   return (lisp_value *)rv;
 }
 
+static void lisp_builtin_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_free(rt, value, sizeof(lisp_builtin));
+}
+
 static void lisp_builtin_print(lisp_value *value, FILE *f, int indent)
 {
   (void)indent; // unused
@@ -271,33 +1227,47 @@ static void lisp_builtin_print(lisp_value *value, FILE *f, int indent)
   fprintf(f, "builtin-function\n");
 }
 
+static lisp_value *lisp_builtin_copy(lisp_runtime *rt, lisp_value *value,
+                                     lisp_value *(*child)(lisp_runtime *,
+                                                          lisp_value *))
+{
+  (void)child; // unused
+  lisp_builtin *bi = (lisp_builtin *) value;
+  lisp_builtin *rv = (lisp_builtin*)tp_builtin.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->function = bi->function;
+  rv->eval = bi->eval;
+  return (lisp_value*)rv;
+}
+
 lisp_type tp_builtin = {
   .tp_name = "builtin",
+  .tp_index = TP_BUILTIN,
   .tp_alloc = &lisp_builtin_alloc,
-  .tp_dealloc = &generic_dealloc,
-  .tp_print = &lisp_builtin_print
+  .tp_dealloc = &lisp_builtin_dealloc,
+  .tp_print = &lisp_builtin_print,
+  .tp_copy = &lisp_builtin_copy
 };
 
 /*******************************************************************************
                           tp_function / lisp_function
 *******************************************************************************/
 
-static lisp_value *lisp_function_alloc(void)
+static lisp_value *lisp_function_alloc(lisp_runtime *rt)
 {
-  lisp_function *rv = smb_new(lisp_function, 1);
-  rv->lv.type = &tp_function;
-  rv->lv.refcount = 1;
+  lisp_function *rv = (lisp_function*)lisp_alloc(rt, &tp_function, sizeof(lisp_function));
+  if (rv == NULL) return NULL;
   rv->arglist = NULL;
   rv->code = NULL;
   return (lisp_value *)rv;
 }
 
-static void lisp_function_dealloc(lisp_value *value)
+static void lisp_function_dealloc(lisp_runtime *rt, lisp_value *value)
 {
   lisp_function *func = (lisp_function*) value;
-  lisp_decref((lisp_value*)func->arglist);
-  lisp_decref(func->code);
-  smb_free(func);
+  lisp_decref(rt, (lisp_value*)func->arglist);
+  lisp_decref(rt, func->code);
+  lisp_free(rt, value, sizeof(lisp_function));
 }
 
 static void lisp_function_print(lisp_value *value, FILE *f, int indent)
@@ -307,14 +1277,581 @@ static void lisp_function_print(lisp_value *value, FILE *f, int indent)
   print_n_spaces(f, indent + 1);
   func->arglist->lv.type->tp_print((lisp_value*)func->arglist, f, indent + 1);
   print_n_spaces(f, indent + 1);
-  func->code->type->tp_print(func->code, f, indent + 1);
+  lisp_type_of(func->code)->tp_print(func->code, f, indent + 1);
   print_n_spaces(f, indent);
   fprintf(f, ")\n");
 }
 
+static lisp_value *lisp_function_copy(lisp_runtime *rt, lisp_value *value,
+                                      lisp_value *(*child)(lisp_runtime *,
+                                                           lisp_value *))
+{
+  lisp_function *func = (lisp_function*) value;
+  lisp_function *rv = (lisp_function*)tp_function.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  rv->arglist = (lisp_list*)child(rt, (lisp_value*)func->arglist);
+  if (rv->arglist == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  rv->code = child(rt, func->code);
+  if (rv->code == NULL) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  return (lisp_value*)rv;
+}
+
 lisp_type tp_function = {
   .tp_name = "function",
+  .tp_index = TP_FUNCTION,
   .tp_alloc = &lisp_function_alloc,
   .tp_dealloc = &lisp_function_dealloc,
-  .tp_print = &lisp_function_print
+  .tp_print = &lisp_function_print,
+  .tp_copy = &lisp_function_copy
+};
+
+lisp_list *lisp_list_cells(lisp_runtime *rt, lisp_value *list)
+{
+  lisp_list_iter it;
+  lisp_list *rv, *curr;
+  lisp_value *item;
+
+  if (list->type == &tp_list) {
+    lisp_incref(list);
+    return (lisp_list*)list;
+  }
+
+  rv = curr = (lisp_list*)tp_list.tp_alloc(rt);
+  if (rv == NULL) return NULL;
+  lisp_list_iter_init(&it, list);
+  while ((item = lisp_list_iter_next(&it)) != NULL) {
+    lisp_incref(item);
+    curr->value = item;
+    curr->next = (lisp_list*)tp_list.tp_alloc(rt);
+    if (curr->next == NULL) {
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+    curr = curr->next;
+  }
+  return rv;
+}
+
+/*******************************************************************************
+                            tp_vector / lisp_vector
+*******************************************************************************/
+
+/**
+   @brief Smallest capacity a vector grows to.
+ */
+#define VECTOR_MIN 8
+
+lisp_vector *lisp_vector_create(lisp_runtime *rt, int capacity)
+{
+  lisp_vector *vec = (lisp_vector*)tp_vector.tp_alloc(rt);
+  if (vec == NULL) return NULL;
+  if (capacity > 0) {
+    if (!lisp_charge(rt, &vec->lv, capacity * sizeof(lisp_value*))) {
+      lisp_decref(rt, (lisp_value*)vec);
+      return NULL;
+    }
+    vec->items = smb_new(lisp_value*, capacity);
+    vec->capacity = capacity;
+  }
+  return vec;
+}
+
+/*
+  As with extending a chunk in lisp_list_cons(), a heap container mustn't end up
+  pointing into the current arena, so such values are promoted.
+ */
+lisp_value *lisp_keep(lisp_runtime *rt, lisp_value *container,
+                      lisp_value *value)
+{
+  if (rt->arena != NULL && !(container->flags & LISP_FLAG_ARENA)) {
+    return lisp_promote(rt, value);
+  }
+  lisp_incref(value);
+  return value;
+}
+
+bool lisp_vector_set(lisp_runtime *rt, lisp_vector *vec, int index,
+                     lisp_value *value)
+{
+  if (vec->lv.flags & LISP_FLAG_FROZEN) {
+    lisp_error(rt, "vector-set!: vector is frozen");
+    return false;
+  }
+  if (index < 0 || index >= vec->length) {
+    lisp_error(rt, "vector-set!: index %d out of range for vector of length "
+               "%d", index, vec->length);
+    return false;
+  }
+  value = lisp_keep(rt, &vec->lv, value);
+  if (value == NULL) {
+    return false;
+  }
+  lisp_decref(rt, vec->items[index]);
+  vec->items[index] = value;
+  return true;
+}
+
+bool lisp_vector_push(lisp_runtime *rt, lisp_vector *vec, lisp_value *value)
+{
+  int capacity;
+
+  if (vec->lv.flags & LISP_FLAG_FROZEN) {
+    lisp_error(rt, "vector-push!: vector is frozen");
+    return false;
+  }
+  value = lisp_keep(rt, &vec->lv, value);
+  if (value == NULL) {
+    return false;
+  }
+  // Doubling keeps appending amortized constant time.
+  if (vec->length == vec->capacity) {
+    capacity = vec->capacity < VECTOR_MIN ? VECTOR_MIN : vec->capacity * 2;
+    if (!lisp_charge(rt, &vec->lv,
+                     (capacity - vec->capacity) * sizeof(lisp_value*))) {
+      lisp_decref(rt, value);
+      return false;
+    }
+    vec->capacity = capacity;
+    vec->items = smb_renew(lisp_value*, vec->items, vec->capacity);
+  }
+  vec->items[vec->length++] = value;
+  return true;
+}
+
+lisp_vector *lisp_vector_from_list(lisp_runtime *rt, lisp_value *list)
+{
+  lisp_vector *vec = lisp_vector_create(rt, lisp_list_length(list));
+  lisp_list_iter it;
+  lisp_value *item;
+
+  if (vec == NULL) return NULL;
+  lisp_list_iter_init(&it, list);
+  while ((item = lisp_list_iter_next(&it)) != NULL) {
+    lisp_incref(item);
+    vec->items[vec->length++] = item;
+  }
+  return vec;
+}
+
+static lisp_value *lisp_vector_alloc(lisp_runtime *rt)
+{
+  lisp_vector *rv = (lisp_vector*)lisp_alloc(rt, &tp_vector,
+                                             sizeof(lisp_vector));
+  if (rv == NULL) return NULL;
+  rv->length = 0;
+  rv->capacity = 0;
+  rv->items = NULL;
+  return (lisp_value*)rv;
+}
+
+static void lisp_vector_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_vector *vec = (lisp_vector*)value;
+  for (int i = 0; i < vec->length; i++) {
+    lisp_decref(rt, vec->items[i]);
+  }
+  smb_free(vec->items);
+  lisp_charge(rt, value, -(long)(vec->capacity * sizeof(lisp_value*)));
+  lisp_free(rt, value, sizeof(lisp_vector));
+}
+
+static void lisp_vector_print(lisp_value *value, FILE *f, int indent)
+{
+  lisp_vector *vec = (lisp_vector*)value;
+
+  fprintf(f, "#(\n");
+  for (int i = 0; i < vec->length; i++) {
+    print_n_spaces(f, indent + 1);
+    lisp_type_of(vec->items[i])->tp_print(vec->items[i], f, indent + 1);
+  }
+  print_n_spaces(f, indent);
+  fprintf(f, ")\n");
+}
+
+static lisp_value *lisp_vector_copy(lisp_runtime *rt, lisp_value *value,
+                                    lisp_value *(*child)(lisp_runtime *,
+                                                         lisp_value *))
+{
+  lisp_vector *vec = (lisp_vector*)value;
+  lisp_vector *rv = lisp_vector_create(rt, vec->length);
+  if (rv == NULL) return NULL;
+  for (int i = 0; i < vec->length; i++) {
+    rv->items[i] = child(rt, vec->items[i]);
+    if (rv->items[i] == NULL) {
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+    rv->length++;
+  }
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_vector = {
+  .tp_name = "vector",
+  .tp_index = TP_VECTOR,
+  .tp_alloc = &lisp_vector_alloc,
+  .tp_dealloc = &lisp_vector_dealloc,
+  .tp_print = &lisp_vector_print,
+  .tp_copy = &lisp_vector_copy
+};
+
+/*******************************************************************************
+                              tp_hash / lisp_hash
+*******************************************************************************/
+
+/**
+   @brief Smallest capacity a hash map grows to.  Capacities are powers of two.
+ */
+#define HASH_MIN 8
+
+/*
+  Keys are hashed by their contents, never their address, so that a hash map
+  restored from an image finds them again.
+ */
+bool lisp_hash_key(lisp_runtime *rt, lisp_value *key, const char *op,
+                   unsigned int *hash)
+{
+  unsigned long long x;
+  const wchar_t *w;
+  const char *c;
+  size_t length;
+
+  // FNV-1a for text, and a 64 bit finalizer (from MurmurHash3) for integers.
+  x = 14695981039346656037ULL;
+  if (lisp_type_of(key) == &tp_int) {
+    x = (unsigned long long)((lisp_int*)key)->value;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+  } else if (lisp_type_of(key) == &tp_bignum) {
+    x = (x ^ (unsigned long long)((lisp_bignum*)key)->sign) * 1099511628211ULL;
+    for (int i = 0; i < ((lisp_bignum*)key)->length; i++) {
+      x = (x ^ ((lisp_bignum*)key)->digits[i]) * 1099511628211ULL;
+    }
+  } else if (lisp_type_of(key) == &tp_atom) {
+    for (w = ((lisp_atom*)key)->value; *w != L'\0'; w++) {
+      x = (x ^ (unsigned long long)*w) * 1099511628211ULL;
+    }
+  } else if (lisp_type_of(key) == &tp_string) {
+    c = ((lisp_string*)key)->data;
+    length = ((lisp_string*)key)->length;
+    for (size_t i = 0; i < length; i++) {
+      x = (x ^ (unsigned char)c[i]) * 1099511628211ULL;
+    }
+  } else {
+    lisp_error(rt, "%s: can't use a value of type %s as a key", op,
+               lisp_type_of(key)->tp_name);
+    return false;
+  }
+  *hash = (unsigned int)(x ^ (x >> 32));
+  return true;
+}
+
+bool lisp_eqv(lisp_value *a, lisp_value *b)
+{
+  if (a == b) {
+    return true;
+  }
+  if (lisp_type_of(a) != lisp_type_of(b)) {
+    return false;
+  }
+  if (lisp_is_float(a)) {
+    return lisp_float_value(a) == lisp_float_value(b);
+  } else if (a->type == &tp_int) {
+    return ((lisp_int*)a)->value == ((lisp_int*)b)->value;
+  } else if (a->type == &tp_bignum) {
+    return lisp_integer_compare(a, b) == 0;
+  } else if (a->type == &tp_atom) {
+    return wcscmp(((lisp_atom*)a)->value, ((lisp_atom*)b)->value) == 0;
+  } else if (a->type == &tp_string) {
+    return lisp_string_compare((lisp_string*)a, (lisp_string*)b) == 0;
+  }
+  return false;
+}
+
+/**
+   @brief Find the entry for a key, or the empty entry where it would go.
+ */
+static lisp_hash_entry *lisp_hash_find(lisp_hash *h, lisp_value *key,
+                                       unsigned int hash)
+{
+  unsigned int mask = h->capacity - 1;
+  unsigned int i = hash & mask;
+  lisp_hash_entry *e;
+
+  // The table is never full, so this always finds an empty entry eventually.
+  for (;;) {
+    e = &h->entries[i];
+    if (e->key == NULL ||
+        (e->hash == hash && lisp_eqv(e->key, key))) {
+      return e;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+/**
+   @brief Move a hash map's entries into a new array of some capacity.
+   @returns false, leaving the map as it was, if the heap limit is reached.
+ */
+static bool lisp_hash_resize(lisp_runtime *rt, lisp_hash *h, int capacity)
+{
+  lisp_hash_entry *old = h->entries, *e;
+  int old_capacity = h->capacity;
+
+  if (!lisp_charge(rt, &h->lv, capacity * sizeof(lisp_hash_entry))) {
+    return false;
+  }
+  h->entries = smb_new(lisp_hash_entry, capacity);
+  memset(h->entries, 0, capacity * sizeof(lisp_hash_entry));
+  h->capacity = capacity;
+  for (int i = 0; i < old_capacity; i++) {
+    if (old[i].key != NULL) {
+      e = lisp_hash_find(h, old[i].key, old[i].hash);
+      *e = old[i];
+    }
+  }
+  smb_free(old);
+  lisp_charge(rt, &h->lv, -(long)(old_capacity * sizeof(lisp_hash_entry)));
+  return true;
+}
+
+lisp_hash *lisp_hash_create(lisp_runtime *rt, int count)
+{
+  lisp_hash *h = (lisp_hash*)tp_hash.tp_alloc(rt);
+  int capacity = HASH_MIN;
+  if (h == NULL) return NULL;
+  // Keep the table at most three quarters full, so that probes stay short.
+  while (capacity / 4 * 3 < count) {
+    capacity *= 2;
+  }
+  if (!lisp_hash_resize(rt, h, capacity)) {
+    lisp_decref(rt, (lisp_value*)h);
+    return NULL;
+  }
+  return h;
+}
+
+lisp_value *lisp_hash_get(lisp_runtime *rt, lisp_hash *h, lisp_value *key)
+{
+  unsigned int hash;
+  if (!lisp_hash_key(rt, key, "hash-ref", &hash)) {
+    return NULL;
+  }
+  return lisp_hash_find(h, key, hash)->value;
+}
+
+bool lisp_hash_set(lisp_runtime *rt, lisp_hash *h, lisp_value *key,
+                   lisp_value *value)
+{
+  lisp_hash_entry *e;
+  unsigned int hash;
+
+  if (h->lv.flags & LISP_FLAG_FROZEN) {
+    lisp_error(rt, "hash-set!: hash map is frozen");
+    return false;
+  }
+  if (!lisp_hash_key(rt, key, "hash-set!", &hash)) {
+    return false;
+  }
+
+  value = lisp_keep(rt, &h->lv, value);
+  if (value == NULL) {
+    return false;
+  }
+  e = lisp_hash_find(h, key, hash);
+  if (e->key != NULL) {
+    lisp_decref(rt, e->value);
+    e->value = value;
+    return true;
+  }
+  if ((h->count + 1) > h->capacity / 4 * 3) {
+    if (!lisp_hash_resize(rt, h, h->capacity * 2)) {
+      lisp_decref(rt, value);
+      return false;
+    }
+    e = lisp_hash_find(h, key, hash);
+  }
+  key = lisp_keep(rt, &h->lv, key);
+  if (key == NULL) {
+    lisp_decref(rt, value);
+    return false;
+  }
+  e->hash = hash;
+  e->key = key;
+  e->value = value;
+  h->count++;
+  return true;
+}
+
+bool lisp_hash_remove(lisp_runtime *rt, lisp_hash *h, lisp_value *key)
+{
+  unsigned int mask = h->capacity - 1, hash, home, i, j;
+  lisp_hash_entry *e;
+
+  if (h->lv.flags & LISP_FLAG_FROZEN) {
+    lisp_error(rt, "hash-remove!: hash map is frozen");
+    return false;
+  }
+  if (!lisp_hash_key(rt, key, "hash-remove!", &hash)) {
+    return false;
+  }
+  e = lisp_hash_find(h, key, hash);
+  if (e->key == NULL) {
+    return false;
+  }
+  lisp_decref(rt, e->key);
+  lisp_decref(rt, e->value);
+  h->count--;
+
+  // Rather than leaving a marker behind, shift back any entries after the hole
+  // that probing would no longer reach.  An entry may fill the hole if the
+  // hole lies between the entry's home and where it is now.
+  i = e - h->entries;
+  for (j = (i + 1) & mask; h->entries[j].key != NULL; j = (j + 1) & mask) {
+    home = h->entries[j].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      h->entries[i] = h->entries[j];
+      i = j;
+    }
+  }
+  h->entries[i].key = NULL;
+  h->entries[i].value = NULL;
+  return true;
+}
+
+static lisp_value *lisp_hash_alloc(lisp_runtime *rt)
+{
+  lisp_hash *rv = (lisp_hash*)lisp_alloc(rt, &tp_hash, sizeof(lisp_hash));
+  if (rv == NULL) return NULL;
+  rv->count = 0;
+  rv->capacity = 0;
+  rv->entries = NULL;
+  return (lisp_value*)rv;
+}
+
+static void lisp_hash_dealloc(lisp_runtime *rt, lisp_value *value)
+{
+  lisp_hash *h = (lisp_hash*)value;
+  for (int i = 0; i < h->capacity; i++) {
+    if (h->entries[i].key != NULL) {
+      lisp_decref(rt, h->entries[i].key);
+      lisp_decref(rt, h->entries[i].value);
+    }
+  }
+  smb_free(h->entries);
+  lisp_charge(rt, value, -(long)(h->capacity * sizeof(lisp_hash_entry)));
+  lisp_free(rt, value, sizeof(lisp_hash));
+}
+
+static void lisp_hash_print(lisp_value *value, FILE *f, int indent)
+{
+  lisp_hash *h = (lisp_hash*)value;
+  lisp_hash_entry *e;
+
+  fprintf(f, "#hash(\n");
+  for (int i = 0; i < h->capacity; i++) {
+    e = &h->entries[i];
+    if (e->key == NULL) {
+      continue;
+    }
+    print_n_spaces(f, indent + 1);
+    fprintf(f, "(\n");
+    print_n_spaces(f, indent + 2);
+    e->key->type->tp_print(e->key, f, indent + 2);
+    print_n_spaces(f, indent + 2);
+    lisp_type_of(e->value)->tp_print(e->value, f, indent + 2);
+    print_n_spaces(f, indent + 1);
+    fprintf(f, ")\n");
+  }
+  print_n_spaces(f, indent);
+  fprintf(f, ")\n");
+}
+
+static lisp_value *lisp_hash_copy(lisp_runtime *rt, lisp_value *value,
+                                  lisp_value *(*child)(lisp_runtime *,
+                                                       lisp_value *))
+{
+  lisp_hash *h = (lisp_hash*)value;
+  lisp_hash *rv = (lisp_hash*)tp_hash.tp_alloc(rt);
+  lisp_value *key, *item;
+
+  if (rv == NULL) {
+    return NULL;
+  } else if (!lisp_charge(rt, &rv->lv,
+                          h->capacity * sizeof(lisp_hash_entry))) {
+    lisp_decref(rt, (lisp_value*)rv);
+    return NULL;
+  }
+  // Copied keys are equal to the originals, so each entry can stay put.
+  rv->entries = smb_new(lisp_hash_entry, h->capacity);
+  memset(rv->entries, 0, h->capacity * sizeof(lisp_hash_entry));
+  rv->capacity = h->capacity;
+  for (int i = 0; i < h->capacity; i++) {
+    if (h->entries[i].key == NULL) {
+      continue;
+    }
+    key = child(rt, h->entries[i].key);
+    item = key == NULL ? NULL : child(rt, h->entries[i].value);
+    if (item == NULL) {
+      lisp_decref(rt, key);
+      lisp_decref(rt, (lisp_value*)rv);
+      return NULL;
+    }
+    rv->entries[i].hash = h->entries[i].hash;
+    rv->entries[i].key = key;
+    rv->entries[i].value = item;
+    rv->count++;
+  }
+  return (lisp_value*)rv;
+}
+
+lisp_type tp_hash = {
+  .tp_name = "hash",
+  .tp_index = TP_HASH,
+  .tp_alloc = &lisp_hash_alloc,
+  .tp_dealloc = &lisp_hash_dealloc,
+  .tp_print = &lisp_hash_print,
+  .tp_copy = &lisp_hash_copy
+};
+
+/*******************************************************************************
+                                 All Types
+*******************************************************************************/
+
+lisp_type *lisp_types[] = {
+  &tp_int,
+  &tp_atom,
+  &tp_list,
+  &tp_builtin,
+  &tp_function,
+  &tp_funccall,
+  &tp_identifier,
+  &tp_chunk,
+  &tp_clist,
+  &tp_strbuf,
+  &tp_string,
+  &tp_future,
+  &tp_coroutine,
+  &tp_channel,
+  &tp_vector,
+  &tp_hash,
+  &tp_array,
+  &tp_float,
+  &tp_bignum,
+  &tp_lazy,
+  &tp_rope,
+  &tp_file,
+  &tp_trie,
+  &tp_pvector,
+  &tp_phash,
+  NULL
 };
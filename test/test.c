@@ -0,0 +1,327 @@
+/***************************************************************************//**
+
+  @file         test.c
+
+  @author       Stephen Brennan
+
+  @date         Created Sunday, 18 October 2026
+
+  @brief        Regression tests for the interpreter.
+
+  @copyright    Copyright (c) 2015, Stephen Brennan.  Released under the Revised
+                BSD License.  See LICENSE.txt for details.
+
+*******************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "libstephen/base.h"
+#include "lisp.h"
+
+/*
+  A test is either a session of forms, evaluated one at a time as the REPL
+  would (each in its own arena), or a C function for things lisp can't reach.
+  Each test runs in a child process, so that a crash fails just that test.
+ */
+/**
+   @brief Most forms a session test may have.
+ */
+#define TEST_FORMS 12
+
+typedef struct {
+  const char *name;
+  /**
+     @brief Forms to evaluate in order, up to the first NULL.
+   */
+  const wchar_t *forms[TEST_FORMS];
+  /**
+     @brief What the last form prints, with each run of whitespace written as
+     a single space, or NULL if it should raise an error.
+   */
+  const char *expected;
+  /**
+     @brief Run the test instead of evaluating forms, if not NULL.
+     @returns false, with a message printed, if the test failed.
+   */
+  bool (*run)(void);
+} test_case;
+
+/**
+   @brief Print a value, with each run of whitespace made a single space.
+   @returns The text, to be freed by the caller.
+ */
+static char *test_print(lisp_value *value)
+{
+  char *text, *in, *out;
+  size_t size;
+  FILE *f = open_memstream(&text, &size);
+
+  lisp_type_of(value)->tp_print(value, f, 0);
+  fclose(f);
+  for (in = out = text; *in != '\0'; in++) {
+    if (strchr(" \t\n", *in) == NULL) {
+      *out++ = *in;
+    } else if (out != text && out[-1] != ' ') {
+      *out++ = ' ';
+    }
+  }
+  if (out != text && out[-1] == ' ') {
+    out--;
+  }
+  *out = '\0';
+  return text;
+}
+
+/**
+   @brief Fail the test, saying where, unless a condition holds.
+ */
+#define TEST_CHECK(cond)                                                \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      return false;                                                     \
+    }                                                                   \
+  } while (0)
+
+static bool test_session(const test_case *t)
+{
+  lisp_runtime rt;
+  lisp_scope *scope;
+  lisp_arena arena;
+  lisp_value *code, *rv = NULL;
+  smb_ll *tokens;
+  smb_iter it;
+  char *text = NULL;
+  bool ok, last = false;
+
+  lisp_runtime_init(&rt);
+  scope = lisp_create_globals(&rt);
+  lisp_arena_init(&arena, scope);
+  for (int i = 0; i < TEST_FORMS && t->forms[i] != NULL && !rt.error; i++) {
+    lisp_arena_begin(&rt, &arena);
+    tokens = lisp_lex(&rt, (wchar_t*)t->forms[i]);
+    it = ll_get_iter(tokens);
+    code = lisp_parse(&rt, &it);
+    ll_delete(tokens);
+    rv = code == NULL ? NULL : lisp_evaluate(&rt, code, scope);
+    last = i + 1 == TEST_FORMS || t->forms[i + 1] == NULL;
+    if (last && rv != NULL) {
+      text = test_print(rv);
+    }
+    lisp_decref(&rt, code);
+    lisp_decref(&rt, rv);
+    lisp_arena_end(&rt, &arena);
+  }
+
+  if (t->expected == NULL && rt.error && last) {
+    ok = true;
+  } else if (rt.error) {
+    printf("  error: %s\n", rt.message);
+    ok = false;
+  } else if (t->expected == NULL) {
+    printf("  expected an error, got: %s\n", text);
+    ok = false;
+  } else {
+    ok = text != NULL && strcmp(text, t->expected) == 0;
+    if (!ok) {
+      printf("  expected: %s\n  got:      %s\n", t->expected, text);
+    }
+  }
+  free(text);
+  lisp_scope_delete(&rt, scope);
+  lisp_arena_destroy(&rt, &arena);
+  lisp_runtime_destroy(&rt);
+  return ok;
+}
+
+/*******************************************************************************
+                                   The tests
+*******************************************************************************/
+
+/*
+  A string from one form outlives it, so its block is retired, and is freed
+  during the next form.  It mustn't count against the new form's values, or
+  have its memory handed out again.
+ */
+static bool test_arena_stale(void)
+{
+  lisp_runtime rt;
+  lisp_arena arena;
+  lisp_string *old, *new, *next;
+
+  lisp_runtime_init(&rt);
+  lisp_arena_init(&arena, NULL);
+  lisp_arena_begin(&rt, &arena);
+  old = lisp_string_new(&rt, "old", 3);
+  lisp_arena_end(&rt, &arena);
+
+  lisp_arena_begin(&rt, &arena);
+  new = lisp_string_new(&rt, "new", 3);
+  lisp_decref(&rt, (lisp_value*)old);
+  TEST_CHECK(arena.live == 1);
+  next = lisp_string_new(&rt, "next", 4);
+  TEST_CHECK(next != old);
+  lisp_decref(&rt, (lisp_value*)next);
+  lisp_decref(&rt, (lisp_value*)new);
+  TEST_CHECK(arena.live == 0);
+  lisp_arena_end(&rt, &arena);
+
+  lisp_arena_destroy(&rt, &arena);
+  lisp_runtime_destroy(&rt);
+  return true;
+}
+
+static const test_case test_cases[] = {
+  {
+    // The coroutine holds on to the list it's resumed with, past the end of
+    // the resuming form's arena.
+    "resume-keep",
+    {L"(define co (spawn (lambda (x)"
+     L"  ((lambda (kept) ((lambda (y) kept) (yield 0))) (yield x))) 0))",
+     L"(resume co)",
+     L"(resume co (list 1 2 3))",
+     L"(list 4 5 6 7 8 9)",
+     L"(resume co)"},
+    "( 1 2 3 )", NULL
+  },
+  {
+    // The coroutine stores each list it's resumed with somewhere global.  The
+    // sixth form drops the first list as it resumes with the second, so if
+    // either were left in its form's arena, the second would be overwritten
+    // by the next form.
+    "resume-store",
+    {L"(define box (make-vector 1 0))",
+     L"(define loop (lambda (n)"
+     L"  (loop (length (vector-set! box 0 (yield n))))))",
+     L"(define co (spawn loop 0))",
+     L"(resume co)",
+     L"(resume co (list 1 2 3))",
+     L"((lambda (old) (resume co (list 4 5 6))) (vector-ref box 0))",
+     L"(list 7 8 9 10 11 12)",
+     L"(vector-ref box 0)"},
+    "( 4 5 6 )", NULL
+  },
+  {"arena-stale", {NULL}, NULL, test_arena_stale},
+  {
+    // The same list passed more than once is still copied each time but the
+    // last.
+    "append-same",
+    {L"(define x (list 1 2))",
+     L"(append x x)"},
+    "( 1 2 1 2 )", NULL
+  },
+  {
+    "append-same-around",
+    {L"(define x (list 1 2))",
+     L"(append x '(3) x)"},
+    "( 1 2 3 1 2 )", NULL
+  },
+  {
+    // Every empty list is the same one.
+    "append-empty",
+    {L"(define x (list 1 2))",
+     L"(define e '())",
+     L"(append e x e x e)"},
+    "( 1 2 1 2 )", NULL
+  },
+  {
+    // 2^53 + 1 rounds to 2^53 as a double.
+    "compare-long-float",
+    {L"(list (= 9007199254740993 9007199254740992.0)"
+     L"      (< 9007199254740992.0 9007199254740993)"
+     L"      (> 9007199254740993 9007199254740992.0)"
+     L"      (= 9007199254740992 9007199254740992.0))"},
+    "( 0 1 1 1 )", NULL
+  },
+  {
+    "compare-bignum-float",
+    {L"(list (= 100000000000000000001 100000000000000000000.0)"
+     L"      (< 100000000000000000000.0 100000000000000000001)"
+     L"      (= 100000000000000000000 100000000000000000000.0)"
+     L"      (< 9223372036854775807 9223372036854775808.0))"},
+    "( 0 1 1 1 )", NULL
+  },
+  {
+    "compare-fraction",
+    {L"(list (< 1 1.5) (> 2 1.5) (= 1 1.0) (< (- 0 2) (- 0 1.5))"
+     L"      (> (- 0 1) (- 0 1.5)) (= 1 1.5))"},
+    "( 1 1 1 1 1 0 )", NULL
+  },
+  {
+    // Nine items, so that the SIMD kernels have a tail to finish off.
+    "array-float",
+    {L"(define f (array 1.5 2 3.25 4 5 6 7 8 (- 0 9.5)))",
+     L"(list (array-sum f) (array-dot f (make-array 9 2.0)) (array-min f)"
+     L"      (array-max f) (array-ref (array- f 0.5) 8)"
+     L"      (array-ref (array* f f) 2) (array-ref (array+ f 1) 0))"},
+    "( 27.25 54.5 -9.5 8.0 -10.0 10.5625 2.5 )", NULL
+  },
+  {
+    "array-mixed",
+    {L"(array+ (array 1 2) (array 1.0 2.0))"},
+    NULL, NULL
+  },
+};
+
+#define TEST_COUNT (sizeof(test_cases) / sizeof(test_cases[0]))
+
+/*******************************************************************************
+                                  The harness
+*******************************************************************************/
+
+/**
+   @brief Run a test in a child process.
+   @returns Whether it passed.
+ */
+static bool test_run(const test_case *t)
+{
+  int status;
+  pid_t pid;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    bool ok = t->run != NULL ? t->run() : test_session(t);
+    fflush(stdout);
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  } else if (pid < 0) {
+    printf("  unable to fork\n");
+    return false;
+  }
+  waitpid(pid, &status, 0);
+  if (WIFSIGNALED(status)) {
+    printf("  crashed (signal %d)\n", WTERMSIG(status));
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+  int failed = 0, run = 0;
+  bool selected;
+
+  for (size_t i = 0; i < TEST_COUNT; i++) {
+    selected = argc == 1;
+    for (int j = 1; j < argc; j++) {
+      selected = selected || strcmp(argv[j], test_cases[i].name) == 0;
+    }
+    if (!selected) {
+      continue;
+    }
+    printf("%s\n", test_cases[i].name);
+    run++;
+    if (!test_run(&test_cases[i])) {
+      printf("FAILED %s\n", test_cases[i].name);
+      failed++;
+    }
+  }
+  printf("%d of %d tests passed\n", run - failed, run);
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}